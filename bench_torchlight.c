@@ -0,0 +1,456 @@
+/*
+ * TorchLight Benchmarks
+ * Throughput of hot paths that do not need a running server
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <unistd.h>
+#include "torchlight.h"
+
+#define BENCH_THREADS 4
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void report(const char* name, long operations, double elapsed) {
+    printf("   %-28s %10ld ops  %8.3f s  %12.0f ops/s\n",
+           name, operations, elapsed, operations / elapsed);
+}
+
+// Random ID and token minting
+
+static void bench_session_ids(long iterations) {
+    char id[64];
+    double start = now_seconds();
+
+    for (long i = 0; i < iterations; i++) {
+        torchlight_random_base62(id, 63);
+    }
+
+    report("session id (base62, 63)", iterations, now_seconds() - start);
+}
+
+static void bench_csrf_tokens(long iterations) {
+    char token[64];
+    double start = now_seconds();
+
+    for (long i = 0; i < iterations; i++) {
+        torchlight_generate_csrf_token(token, sizeof(token));
+    }
+
+    report("csrf token (base64url, 43)", iterations, now_seconds() - start);
+}
+
+// Session creation
+
+static void* session_worker(void* arg) {
+    long iterations = *(long*)arg;
+    char session_id[64];
+
+    for (long i = 0; i < iterations; i++) {
+        if (torchlight_create_session("bench", session_id) == 0) {
+            torchlight_destroy_session(session_id);
+        }
+    }
+
+    return NULL;
+}
+
+static void bench_session_create(long iterations, int threads) {
+    pthread_t workers[BENCH_THREADS];
+    long per_thread = iterations / threads;
+    double start = now_seconds();
+
+    for (int i = 0; i < threads; i++) {
+        pthread_create(&workers[i], NULL, session_worker, &per_thread);
+    }
+    for (int i = 0; i < threads; i++) {
+        pthread_join(workers[i], NULL);
+    }
+
+    char name[64];
+    snprintf(name, sizeof(name), "session create+destroy x%d", threads);
+    report(name, per_thread * threads, now_seconds() - start);
+}
+
+// Rate limiting
+
+static void* rate_limit_worker(void* arg) {
+    long iterations = *(long*)arg;
+    char client_id[64];
+    long allowed = 0;
+
+    for (long i = 0; i < iterations; i++) {
+        // 64k distinct clients, so the table stays under eviction pressure
+        snprintf(client_id, sizeof(client_id), "10.%ld.%ld.%ld",
+                 (i >> 16) & 255, (i >> 8) & 255, i & 255);
+        allowed += torchlight_check_rate_limit(client_id);
+    }
+
+    return (void*)allowed;
+}
+
+static void bench_rate_limit(long iterations, int threads) {
+    pthread_t workers[BENCH_THREADS];
+    long per_thread = iterations / threads;
+    double start = now_seconds();
+
+    for (int i = 0; i < threads; i++) {
+        pthread_create(&workers[i], NULL, rate_limit_worker, &per_thread);
+    }
+    for (int i = 0; i < threads; i++) {
+        pthread_join(workers[i], NULL);
+    }
+
+    char name[64];
+    snprintf(name, sizeof(name), "rate limit check x%d", threads);
+    report(name, per_thread * threads, now_seconds() - start);
+}
+
+// Template rendering
+
+#define BENCH_TEMPLATE_VARS 50
+#define BENCH_TEMPLATE_ROWS 2000
+
+// A ~200 KB page with 2000 rows referencing 50 distinct variables
+static char* build_large_template(size_t* length_out) {
+    size_t capacity = 256 * BENCH_TEMPLATE_ROWS;
+    char* source = malloc(capacity);
+    size_t length = 0;
+
+    length += snprintf(source + length, capacity - length,
+                       "<html><head><title>{{var0}}</title></head><body><ul>\n");
+    for (int row = 0; row < BENCH_TEMPLATE_ROWS; row++) {
+        length += snprintf(source + length, capacity - length,
+                           "<li class=\"row\">Row %d: {{var%d}} and {{var%d}} "
+                           "with some static markup around it</li>\n",
+                           row, row % BENCH_TEMPLATE_VARS, (row * 7) % BENCH_TEMPLATE_VARS);
+    }
+    length += snprintf(source + length, capacity - length, "</ul></body></html>\n");
+
+    *length_out = length;
+    return source;
+}
+
+static char* build_template_variables(void) {
+    size_t capacity = 64 * BENCH_TEMPLATE_VARS;
+    char* json = malloc(capacity);
+    size_t length = snprintf(json, capacity, "{");
+
+    for (int i = 0; i < BENCH_TEMPLATE_VARS; i++) {
+        length += snprintf(json + length, capacity - length, "%s\"var%d\": \"value %d\"",
+                           i ? ", " : "", i, i);
+    }
+    snprintf(json + length, capacity - length, "}");
+    return json;
+}
+
+static void bench_template(const char* name, const char* path, const char* variables,
+                           long iterations, bool cached) {
+    torchlight_set_template_cache(cached);
+
+    size_t bytes = 0;
+    double start = now_seconds();
+
+    for (long i = 0; i < iterations; i++) {
+        char* output = NULL;
+        size_t output_size = 0;
+        if (torchlight_render_template(path, variables, &output, &output_size) == 0) {
+            bytes += output_size;
+            free(output);
+        }
+    }
+
+    double elapsed = now_seconds() - start;
+    report(name, iterations, elapsed);
+    printf("   %-28s %10.1f MB/s\n", "", bytes / elapsed / (1024 * 1024));
+}
+
+static void bench_templates(long iterations) {
+    char path[] = "/tmp/torchlight_bench_XXXXXX";
+    int fd = mkstemp(path);
+    if (fd < 0) return;
+
+    size_t length = 0;
+    char* source = build_large_template(&length);
+    char* variables = build_template_variables();
+
+    if (write(fd, source, length) == (ssize_t)length) {
+        bench_template("render (compile each time)", path, variables, iterations, false);
+        bench_template("render (cached)", path, variables, iterations, true);
+    }
+
+    close(fd);
+    unlink(path);
+    torchlight_clear_template_cache();
+    free(source);
+    free(variables);
+}
+
+// A small page with 200 distinct variables, rendered from a compiled template
+#define BENCH_PAGE_VARS 200
+
+static void bench_variable_page(long iterations) {
+    size_t capacity = 64 * BENCH_PAGE_VARS;
+    char* source = malloc(capacity);
+    char* json = malloc(capacity);
+    size_t source_length = 0;
+    size_t json_length = snprintf(json, capacity, "{");
+
+    for (int i = 0; i < BENCH_PAGE_VARS; i++) {
+        source_length += snprintf(source + source_length, capacity - source_length,
+                                  "<td>{{field%d}}</td>", i);
+        json_length += snprintf(json + json_length, capacity - json_length,
+                                "%s\"field%d\": \"value %d\"", i ? ", " : "", i, i);
+    }
+    snprintf(json + json_length, capacity - json_length, "}");
+
+    torchlight_template_t* tpl = torchlight_compile_template(source, source_length);
+    if (tpl) {
+        double start = now_seconds();
+        for (long i = 0; i < iterations; i++) {
+            char* output = NULL;
+            if (torchlight_render_compiled(tpl, json, &output, NULL) == 0) {
+                free(output);
+            }
+        }
+        report("render 200 vars (JSON)", iterations, now_seconds() - start);
+
+        // Same page with values bound by slot
+        torchlight_value_t values[BENCH_PAGE_VARS];
+        char storage[BENCH_PAGE_VARS][16];
+        size_t slot_count = torchlight_template_slot_count(tpl);
+        for (size_t slot = 0; slot < slot_count; slot++) {
+            int field = atoi(torchlight_template_slot_name(tpl, slot) + strlen("field"));
+            values[slot].len = snprintf(storage[slot], sizeof(storage[slot]), "value %d", field);
+            values[slot].ptr = storage[slot];
+        }
+
+        start = now_seconds();
+        for (long i = 0; i < iterations; i++) {
+            char* output = NULL;
+            if (torchlight_render_slots(tpl, values, slot_count, &output, NULL) == 0) {
+                free(output);
+            }
+        }
+        report("render 200 vars (slots)", iterations, now_seconds() - start);
+
+        torchlight_release_template(tpl);
+    }
+
+    free(source);
+    free(json);
+}
+
+// A 1000-row table rendered by a section loop over a JSON list
+#define BENCH_LIST_ROWS 1000
+
+static void bench_section_page(long iterations) {
+    static const char source[] =
+        "<table>{{#rows}}<tr><td>{{id}}</td><td>{{name}}</td>"
+        "<td>{{#active}}yes{{/active}}{{^active}}no{{/active}}</td>"
+        "<td>{{owner.email}}</td></tr>{{/rows}}</table>";
+
+    size_t capacity = 128 * BENCH_LIST_ROWS;
+    char* json = malloc(capacity);
+    size_t length = snprintf(json, capacity, "{\"rows\": [");
+
+    for (int i = 0; i < BENCH_LIST_ROWS; i++) {
+        length += snprintf(json + length, capacity - length,
+                           "%s{\"id\": %d, \"name\": \"row %d\", \"active\": %s, "
+                           "\"owner\": {\"email\": \"u%d@example.onion\"}}",
+                           i ? ", " : "", i, i, i % 2 ? "true" : "false", i);
+    }
+    snprintf(json + length, capacity - length, "]}");
+
+    torchlight_template_t* tpl = torchlight_compile_template(source, sizeof(source) - 1);
+    if (tpl) {
+        double start = now_seconds();
+        for (long i = 0; i < iterations; i++) {
+            char* output = NULL;
+            if (torchlight_render_compiled(tpl, json, &output, NULL) == 0) {
+                free(output);
+            }
+        }
+        report("render 1000-row section", iterations, now_seconds() - start);
+
+        // Into a response body: presized from the last renders, from the pool
+        start = now_seconds();
+        for (long i = 0; i < iterations; i++) {
+            http_response_t response = {0};
+            if (torchlight_render_response(tpl, json, &response) == 0) {
+                torchlight_release_response(&response);
+            }
+        }
+        report("render 1000 rows (pool)", iterations, now_seconds() - start);
+        torchlight_release_template(tpl);
+    }
+
+    // Same table in a fragment cache block: warmed once from the JSON, then
+    // spliced into scatter/gather responses that only bind the title
+    static const char cached_source[] =
+        "<h1>{{title}}</h1>{{%cache bench-rows 3600}}<table>{{#rows}}<tr><td>{{id}}</td>"
+        "<td>{{name}}</td><td>{{owner.email}}</td></tr>{{/rows}}</table>{{/cache}}";
+
+    tpl = torchlight_compile_template(cached_source, sizeof(cached_source) - 1);
+    char* warm = NULL;
+    if (tpl && torchlight_render_compiled(tpl, json, &warm, NULL) == 0) {
+        free(warm);
+
+        torchlight_value_t values[8] = {{0}};
+        int title = torchlight_template_slot(tpl, "title");
+        if (title >= 0) values[title] = (torchlight_value_t){ "Rows", 4 };
+
+        long cached_iterations = iterations * 100;
+        double start = now_seconds();
+        for (long i = 0; i < cached_iterations; i++) {
+            http_response_t response = {0};
+            if (torchlight_render_iov(tpl, values, torchlight_template_slot_count(tpl),
+                                      &response, NULL, NULL) == 0) {
+                torchlight_release_response(&response);
+            }
+        }
+        report("render cached section (iov)", cached_iterations, now_seconds() - start);
+        torchlight_invalidate_fragments("bench-rows");
+    }
+    torchlight_release_template(tpl);
+
+    free(json);
+}
+
+// JSON envelope and error page, built and released as a request would
+static void bench_responses(long iterations) {
+    static const char data[] = "{\"id\": 42, \"name\": \"torchlight\", \"tags\": [\"tor\", \"http\"]}";
+
+    double start = now_seconds();
+    for (long i = 0; i < iterations; i++) {
+        http_response_t response = {0};
+        if (torchlight_json_response(&response, data, "OK") == 0) {
+            torchlight_release_response(&response);
+        }
+    }
+    report("json response", iterations, now_seconds() - start);
+
+    start = now_seconds();
+    for (long i = 0; i < iterations; i++) {
+        http_response_t response = {0};
+        if (torchlight_response_error(&response, HTTP_STATUS_NOT_FOUND, "Page not found") == 0) {
+            torchlight_release_response(&response);
+        }
+    }
+    report("error page", iterations, now_seconds() - start);
+}
+
+// API payloads of about `size` bytes: a list of user records with the
+// usual mix of strings, numbers, booleans and a nested array
+static char* build_json_payload(size_t size, size_t* length_out) {
+    size_t capacity = size + 1024;
+    char* json = malloc(capacity);
+    size_t length = snprintf(json, capacity, "{\"page\": 1, \"users\": [");
+
+    for (int i = 0; length < size; i++) {
+        length += snprintf(json + length, capacity - length,
+                           "%s{\"id\": %d, \"name\": \"User %d\", \"email\": \"user%d@example.onion\", "
+                           "\"active\": %s, \"score\": %d.%02d, \"bio\": \"Runs a relay \\\"near\\\" "
+                           "the exit\", \"roles\": [\"reader\", \"editor\"]}",
+                           i ? ", " : "", i, i, i, i % 3 ? "true" : "false", i % 100, i % 97);
+    }
+    length += snprintf(json + length, capacity - length, "]}");
+
+    *length_out = length;
+    return json;
+}
+
+static void bench_json(const char* name, size_t size, long iterations) {
+    size_t length;
+    char* json = build_json_payload(size, &length);
+
+    double start = now_seconds();
+    for (long i = 0; i < iterations; i++) {
+        torchlight_json_t* doc = torchlight_json_parse(json, length, NULL);
+        if (!doc) break;
+        torchlight_json_free(doc);
+    }
+    double elapsed = now_seconds() - start;
+
+    report(name, iterations, elapsed);
+    printf("   %-28s %10.1f MB/s\n", "", (double)length * iterations / elapsed / (1024 * 1024));
+    free(json);
+}
+
+// Escaping a 1 MB text field with an occasional markup character
+#define BENCH_ESCAPE_BYTES (1024 * 1024)
+
+static void bench_escape(const char* name, torchlight_escape_t context, long iterations) {
+    char* input = malloc(BENCH_ESCAPE_BYTES);
+    char* output = malloc(BENCH_ESCAPE_BYTES * 2);
+    static const char prose[] = "Hidden services keep both ends of the circuit anonymous. ";
+
+    for (size_t i = 0; i < BENCH_ESCAPE_BYTES; i++) {
+        input[i] = prose[i % (sizeof(prose) - 1)];
+        if (i % 500 == 499) input[i] = '<';
+    }
+
+    size_t bytes = 0;
+    double start = now_seconds();
+    for (long i = 0; i < iterations; i++) {
+        bytes += torchlight_escape(context, input, BENCH_ESCAPE_BYTES, output, BENCH_ESCAPE_BYTES * 2);
+    }
+    double elapsed = now_seconds() - start;
+
+    report(name, iterations, elapsed);
+    printf("   %-28s %10.1f MB/s\n", "", (double)BENCH_ESCAPE_BYTES * iterations / elapsed / (1024 * 1024));
+    (void)bytes;
+
+    free(input);
+    free(output);
+}
+
+int main(int argc, char** argv) {
+    long iterations = argc > 1 ? atol(argv[1]) : 1000000;
+    if (iterations <= 0) iterations = 1000000;
+
+    printf("🔥 TorchLight Benchmarks\n");
+    printf("========================\n\n");
+
+    printf("🎲 Random tokens\n");
+    bench_session_ids(iterations);
+    bench_csrf_tokens(iterations);
+
+    printf("\n🍪 Sessions\n");
+    bench_session_create(iterations, 1);
+    bench_session_create(iterations, BENCH_THREADS);
+
+    printf("\n🎨 Templates (%d rows, %d variables)\n", BENCH_TEMPLATE_ROWS, BENCH_TEMPLATE_VARS);
+    bench_templates(iterations / 10000 > 0 ? iterations / 10000 : 1);
+    bench_variable_page(iterations / 100 > 0 ? iterations / 100 : 1);
+    bench_section_page(iterations / 1000 > 0 ? iterations / 1000 : 1);
+
+    printf("\n📤 Responses\n");
+    bench_responses(iterations);
+
+    printf("\n🧾 JSON parsing\n");
+    bench_json("parse 1 KB payload", 1024, iterations / 10 > 0 ? iterations / 10 : 1);
+    bench_json("parse 10 KB payload", 10 * 1024, iterations / 100 > 0 ? iterations / 100 : 1);
+    bench_json("parse 100 KB payload", 100 * 1024, iterations / 1000 > 0 ? iterations / 1000 : 1);
+
+    printf("\n🛡️  Escaping (1 MB field)\n");
+    bench_escape("escape html", TORCHLIGHT_ESCAPE_HTML, iterations / 2000 > 0 ? iterations / 2000 : 1);
+    bench_escape("escape js", TORCHLIGHT_ESCAPE_JS, iterations / 2000 > 0 ? iterations / 2000 : 1);
+
+    printf("\n🚦 Rate limiter\n");
+    torchlight_set_rate_limit(600, 0);
+    bench_rate_limit(iterations, 1);
+    bench_rate_limit(iterations, BENCH_THREADS);
+
+    torchlight_cleanup_sessions();
+    printf("\n✅ Done\n");
+    return 0;
+}
@@ -0,0 +1,142 @@
+/*
+ * TorchLight Concurrency Limiter
+ * Adaptive limit on in-flight requests with early load shedding
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include "torchlight.h"
+#include "torchlight_internal.h"
+
+// A request is admitted as soon as its request line and headers are
+// parsed, before its body is read, and counts as in flight until its
+// response is sent, whether it is queued for a handler thread or running.
+// Once in_flight reaches the limit, new requests are turned away at once
+// with a static 503, so accepted requests keep their latency rather than
+// everyone timing out together.
+//
+// The limit adapts with AIMD on observed latency (admission to response).
+// `baseline` tracks the no-load latency: it drops to any faster sample at
+// once and creeps up slowly, so it follows a genuine shift in handler
+// cost. A sample over twice the baseline means requests are queuing, and
+// the limit is cut by 10% (at most once per observed latency, so one
+// burst does not collapse it). Otherwise, if the limit is actually being
+// used, it grows by 1/limit per completion, about +1 per round trip.
+
+#define LIMITER_INITIAL 16.0
+#define LIMITER_MIN 1.0
+#define LIMITER_BACKOFF 0.9
+#define LIMITER_TOLERANCE 2.0
+#define LIMITER_SLACK_US 1000          // Ignore jitter below 1 ms
+#define LIMITER_BASELINE_DRIFT 0.001
+
+typedef struct {
+    int in_flight;                     // Atomic
+    int limit;                         // Atomic snapshot of `estimate`
+
+    pthread_mutex_t lock;              // Guards the fields below
+    double estimate;
+    double max_limit;
+    double baseline_us;
+    uint64_t last_decrease_us;
+    uint64_t shed_count;
+} concurrency_limiter_t;
+
+static concurrency_limiter_t g_limiter = {
+    .limit = (int)LIMITER_INITIAL,
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .estimate = LIMITER_INITIAL,
+    .max_limit = 1000.0
+};
+
+static const char SHED_RESPONSE[] =
+    "HTTP/1.1 503 Service Unavailable\r\n"
+    "Content-Type: text/plain; charset=utf-8\r\n"
+    "Content-Length: 20\r\n"
+    "Retry-After: 1\r\n"
+    "Connection: close\r\n"
+    "\r\n"
+    "Service Unavailable\n";
+
+uint64_t tl_concurrency_limiter_now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000ull + (uint64_t)ts.tv_nsec / 1000;
+}
+
+void tl_concurrency_limiter_configure(int max_limit) {
+    pthread_mutex_lock(&g_limiter.lock);
+
+    g_limiter.max_limit = max_limit > 0 ? (double)max_limit : 1000.0;
+    g_limiter.estimate = LIMITER_INITIAL < g_limiter.max_limit ? LIMITER_INITIAL : g_limiter.max_limit;
+    g_limiter.baseline_us = 0;
+    __atomic_store_n(&g_limiter.limit, (int)g_limiter.estimate, __ATOMIC_RELAXED);
+
+    pthread_mutex_unlock(&g_limiter.lock);
+}
+
+// Admit a request if we are under the limit
+bool tl_concurrency_limiter_acquire(void) {
+    int limit = __atomic_load_n(&g_limiter.limit, __ATOMIC_RELAXED);
+    int current = __atomic_load_n(&g_limiter.in_flight, __ATOMIC_RELAXED);
+
+    do {
+        if (current >= limit) {
+            __atomic_add_fetch(&g_limiter.shed_count, 1, __ATOMIC_RELAXED);
+            return false;
+        }
+    } while (!__atomic_compare_exchange_n(&g_limiter.in_flight, &current, current + 1, true,
+                                          __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+
+    return true;
+}
+
+// Finish an admitted request. latency_us == 0 releases without a sample
+// (the request was dropped rather than served).
+void tl_concurrency_limiter_release(uint64_t latency_us) {
+    int in_flight = __atomic_sub_fetch(&g_limiter.in_flight, 1, __ATOMIC_RELAXED) + 1;
+    if (latency_us == 0) return;
+
+    pthread_mutex_lock(&g_limiter.lock);
+
+    double sample = (double)latency_us;
+    if (g_limiter.baseline_us == 0 || sample < g_limiter.baseline_us) {
+        g_limiter.baseline_us = sample;
+    } else {
+        g_limiter.baseline_us += (sample - g_limiter.baseline_us) * LIMITER_BASELINE_DRIFT;
+    }
+
+    uint64_t now = tl_concurrency_limiter_now_us();
+    double threshold = g_limiter.baseline_us * LIMITER_TOLERANCE + LIMITER_SLACK_US;
+
+    if (sample > threshold) {
+        if (now - g_limiter.last_decrease_us > latency_us) {
+            g_limiter.estimate *= LIMITER_BACKOFF;
+            if (g_limiter.estimate < LIMITER_MIN) g_limiter.estimate = LIMITER_MIN;
+            g_limiter.last_decrease_us = now;
+        }
+    } else if (in_flight * 2 >= (int)g_limiter.estimate) {
+        g_limiter.estimate += 1.0 / g_limiter.estimate;
+        if (g_limiter.estimate > g_limiter.max_limit) g_limiter.estimate = g_limiter.max_limit;
+    }
+
+    __atomic_store_n(&g_limiter.limit, (int)g_limiter.estimate, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&g_limiter.lock);
+}
+
+int tl_concurrency_limiter_send_rejection(int socket_fd) {
+    ssize_t sent = send(socket_fd, SHED_RESPONSE, sizeof(SHED_RESPONSE) - 1, MSG_NOSIGNAL);
+    return sent == (ssize_t)(sizeof(SHED_RESPONSE) - 1) ? 0 : -1;
+}
+
+int tl_concurrency_limiter_limit(void) {
+    return __atomic_load_n(&g_limiter.limit, __ATOMIC_RELAXED);
+}
+
+uint64_t tl_concurrency_limiter_shed_count(void) {
+    return __atomic_load_n(&g_limiter.shed_count, __ATOMIC_RELAXED);
+}
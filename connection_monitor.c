@@ -0,0 +1,308 @@
+/*
+ * TorchLight Connection Monitor
+ * Read-rate floors and eviction of slow clients
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include "torchlight.h"
+#include "torchlight_internal.h"
+
+// Connections register here while the parser reads their headers and body,
+// and report every chunk they receive. One watchdog thread wakes four
+// times a second and checks each registered connection's rate for its
+// current phase, once the phase is past a short grace period. A
+// connection below the floor is shut down; its blocked recv() then
+// returns 0 and the parser gives up on it. No thread is needed per
+// connection.
+//
+// There is also a cap on connections still in the header phase, which is
+// where slowloris clients sit. When a new connection would exceed it, the
+// slowest header-phase connection past its grace period is evicted,
+// whatever its rate: one above the header floor is still the cheapest to
+// lose. Connections inside their grace period are never the victim; if
+// there is no other candidate, the new connection is refused with a 503
+// instead of being admitted past the cap. A full registry is handled the
+// same way, with connections in either phase as candidates, so it never
+// leaves a connection unmonitored.
+//
+// The watchdog calls shutdown() under the registry lock, and the parser
+// unregisters (under the same lock) before the caller can close the fd.
+// The descriptor cannot be reused underneath us.
+
+#define MONITOR_MAX_CONNECTIONS 4096
+#define MONITOR_TICK_MS 250
+#define MONITOR_GRACE_US 2000000ull
+
+typedef struct {
+    int fd;                     // -1 = free
+    bool body_phase;
+    bool evicted;
+    uint64_t phase_start_us;
+    uint64_t phase_bytes;       // Atomic: updated by the reading thread
+} monitored_connection_t;
+
+typedef struct {
+    monitored_connection_t slots[MONITOR_MAX_CONNECTIONS];
+    int high_water;             // Slots in use are below this index
+    int header_phase;           // Connections still reading headers (not evicted)
+
+    int min_header_bps;
+    int min_body_bps;
+    int max_header_connections;
+    bool enabled;
+
+    uint64_t dropped_slow;
+    uint64_t evicted_pressure;
+
+    pthread_t watchdog;
+    bool running;
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+} connection_monitor_t;
+
+static connection_monitor_t g_monitor = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .wake = PTHREAD_COND_INITIALIZER
+};
+
+static uint64_t monitor_now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000ull + (uint64_t)ts.tv_nsec / 1000;
+}
+
+void torchlight_set_slow_client_limits(int min_header_bps, int min_body_bps, int max_header_connections) {
+    pthread_mutex_lock(&g_monitor.lock);
+
+    g_monitor.min_header_bps = min_header_bps > 0 ? min_header_bps : 0;
+    g_monitor.min_body_bps = min_body_bps > 0 ? min_body_bps : 0;
+    g_monitor.max_header_connections = max_header_connections > 0 ? max_header_connections : 0;
+    g_monitor.enabled = g_monitor.min_header_bps || g_monitor.min_body_bps ||
+                        g_monitor.max_header_connections;
+
+    if (g_monitor.high_water == 0) {
+        for (int i = 0; i < MONITOR_MAX_CONNECTIONS; i++) {
+            g_monitor.slots[i].fd = -1;
+        }
+    }
+
+    pthread_mutex_unlock(&g_monitor.lock);
+}
+
+// Bytes per second over the current phase
+static uint64_t monitor_rate(const monitored_connection_t* conn, uint64_t now) {
+    uint64_t elapsed = now > conn->phase_start_us ? now - conn->phase_start_us : 1;
+    uint64_t bytes = __atomic_load_n(&conn->phase_bytes, __ATOMIC_RELAXED);
+    return bytes * 1000000ull / elapsed;
+}
+
+static void monitor_evict(monitored_connection_t* conn) {
+    if (!conn->body_phase) g_monitor.header_phase--;
+    conn->evicted = true;
+    shutdown(conn->fd, SHUT_RDWR);
+}
+
+// Evict the slowest connection past its grace period, among header-phase
+// connections only unless `any_phase`. Returns false if none qualifies.
+static bool monitor_evict_slowest(uint64_t now, bool any_phase) {
+    monitored_connection_t* slowest = NULL;
+    uint64_t slowest_rate = UINT64_MAX;
+
+    for (int i = 0; i < g_monitor.high_water; i++) {
+        monitored_connection_t* conn = &g_monitor.slots[i];
+        if (conn->fd < 0 || conn->evicted || (conn->body_phase && !any_phase)) continue;
+        if (now - conn->phase_start_us < MONITOR_GRACE_US) continue;
+
+        uint64_t rate = monitor_rate(conn, now);
+        if (!slowest || rate < slowest_rate) {
+            slowest_rate = rate;
+            slowest = conn;
+        }
+    }
+
+    if (!slowest) return false;
+
+    printf("🐌 Evicting slowest %s-phase connection (%llu B/s)\n",
+           slowest->body_phase ? "body" : "header", (unsigned long long)slowest_rate);
+    monitor_evict(slowest);
+    g_monitor.evicted_pressure++;
+    return true;
+}
+
+static int monitor_free_slot(void) {
+    for (int i = 0; i < MONITOR_MAX_CONNECTIONS; i++) {
+        if (g_monitor.slots[i].fd < 0) return i;
+    }
+    return -1;
+}
+
+// Register a connection entering the header phase. Returns a slot for
+// progress reports, -1 if the connection is not monitored, or
+// TL_CONNECTION_REFUSED if there is no room for it.
+int tl_connection_monitor_begin(int socket_fd) {
+    if (!__atomic_load_n(&g_monitor.enabled, __ATOMIC_RELAXED)) return -1;
+
+    pthread_mutex_lock(&g_monitor.lock);
+
+    uint64_t now = monitor_now_us();
+
+    // Make room under the header-phase cap by evicting the slowest
+    if (g_monitor.max_header_connections > 0 &&
+        g_monitor.header_phase >= g_monitor.max_header_connections &&
+        !monitor_evict_slowest(now, false)) {
+        pthread_mutex_unlock(&g_monitor.lock);
+        return TL_CONNECTION_REFUSED;
+    }
+
+    // An evicted connection keeps its slot until its reader unregisters,
+    // so a full registry may stay full for a moment after an eviction
+    int slot = monitor_free_slot();
+    if (slot < 0) {
+        monitor_evict_slowest(now, true);
+        pthread_mutex_unlock(&g_monitor.lock);
+        return TL_CONNECTION_REFUSED;
+    }
+
+    monitored_connection_t* conn = &g_monitor.slots[slot];
+    conn->fd = socket_fd;
+    conn->body_phase = false;
+    conn->evicted = false;
+    conn->phase_start_us = now;
+    conn->phase_bytes = 0;
+    g_monitor.header_phase++;
+    if (slot >= g_monitor.high_water) g_monitor.high_water = slot + 1;
+
+    pthread_mutex_unlock(&g_monitor.lock);
+    return slot;
+}
+
+void tl_connection_monitor_progress(int slot, size_t bytes) {
+    if (slot < 0) return;
+    __atomic_add_fetch(&g_monitor.slots[slot].phase_bytes, bytes, __ATOMIC_RELAXED);
+}
+
+// Headers are complete; the body is measured against its own floor
+void tl_connection_monitor_body_phase(int slot) {
+    if (slot < 0) return;
+
+    pthread_mutex_lock(&g_monitor.lock);
+
+    monitored_connection_t* conn = &g_monitor.slots[slot];
+    if (!conn->evicted && !conn->body_phase) {
+        g_monitor.header_phase--;
+    }
+    conn->body_phase = true;
+    conn->phase_start_us = monitor_now_us();
+    __atomic_store_n(&conn->phase_bytes, 0, __ATOMIC_RELAXED);
+
+    pthread_mutex_unlock(&g_monitor.lock);
+}
+
+// Unregister a connection. Returns true if it was evicted meanwhile.
+bool tl_connection_monitor_end(int slot) {
+    if (slot < 0) return false;
+
+    pthread_mutex_lock(&g_monitor.lock);
+
+    monitored_connection_t* conn = &g_monitor.slots[slot];
+    bool evicted = conn->evicted;
+    if (!evicted && !conn->body_phase) {
+        g_monitor.header_phase--;
+    }
+    conn->fd = -1;
+
+    while (g_monitor.high_water > 0 && g_monitor.slots[g_monitor.high_water - 1].fd < 0) {
+        g_monitor.high_water--;
+    }
+
+    pthread_mutex_unlock(&g_monitor.lock);
+    return evicted;
+}
+
+static void monitor_check(void) {
+    uint64_t now = monitor_now_us();
+
+    for (int i = 0; i < g_monitor.high_water; i++) {
+        monitored_connection_t* conn = &g_monitor.slots[i];
+        if (conn->fd < 0 || conn->evicted) continue;
+        if (now - conn->phase_start_us < MONITOR_GRACE_US) continue;
+
+        int floor = conn->body_phase ? g_monitor.min_body_bps : g_monitor.min_header_bps;
+        if (floor > 0 && monitor_rate(conn, now) < (uint64_t)floor) {
+            printf("🐌 Dropping slow connection on socket %d (%s phase)\n",
+                   conn->fd, conn->body_phase ? "body" : "header");
+            monitor_evict(conn);
+            g_monitor.dropped_slow++;
+        }
+    }
+}
+
+static void* monitor_watchdog(void* arg) {
+    (void)arg;
+
+    pthread_mutex_lock(&g_monitor.lock);
+
+    while (g_monitor.running) {
+        struct timespec wake;
+        clock_gettime(CLOCK_REALTIME, &wake);
+        wake.tv_nsec += MONITOR_TICK_MS * 1000000L;
+        if (wake.tv_nsec >= 1000000000L) {
+            wake.tv_sec++;
+            wake.tv_nsec -= 1000000000L;
+        }
+        pthread_cond_timedwait(&g_monitor.wake, &g_monitor.lock, &wake);
+
+        if (g_monitor.running) {
+            monitor_check();
+        }
+    }
+
+    pthread_mutex_unlock(&g_monitor.lock);
+    return NULL;
+}
+
+int tl_connection_monitor_start(void) {
+    pthread_mutex_lock(&g_monitor.lock);
+
+    if (g_monitor.running || !g_monitor.enabled) {
+        pthread_mutex_unlock(&g_monitor.lock);
+        return 0;
+    }
+
+    g_monitor.running = true;
+    if (pthread_create(&g_monitor.watchdog, NULL, monitor_watchdog, NULL) != 0) {
+        g_monitor.running = false;
+        pthread_mutex_unlock(&g_monitor.lock);
+        return -1;
+    }
+
+    pthread_mutex_unlock(&g_monitor.lock);
+    return 0;
+}
+
+void tl_connection_monitor_stop(void) {
+    pthread_mutex_lock(&g_monitor.lock);
+
+    if (!g_monitor.running) {
+        pthread_mutex_unlock(&g_monitor.lock);
+        return;
+    }
+
+    g_monitor.running = false;
+    pthread_cond_signal(&g_monitor.wake);
+    pthread_mutex_unlock(&g_monitor.lock);
+
+    pthread_join(g_monitor.watchdog, NULL);
+}
+
+uint64_t tl_connection_monitor_dropped(void) {
+    pthread_mutex_lock(&g_monitor.lock);
+    uint64_t dropped = g_monitor.dropped_slow + g_monitor.evicted_pressure;
+    pthread_mutex_unlock(&g_monitor.lock);
+    return dropped;
+}
@@ -0,0 +1,303 @@
+/*
+ * TorchLight Embedded Assets
+ * Templates and static files compiled into the binary
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <pthread.h>
+#include <sys/uio.h>
+#include "torchlight.h"
+#include "torchlight_internal.h"
+
+// torchlight_embed turns a templates/ and static/ tree into a generated C
+// file: the file contents as const arrays, precompiled template ops, a gzip
+// variant where it is smaller, an ETag from the SHA-256 of each file (the
+// gzip variant is served with "-gz" inside the quotes), and a perfect-hash
+// index over the paths. Registering the bundle makes its
+// templates visible to torchlight_load_template() (and so to partials) and
+// its static files to torchlight_serve_static(). Nothing is read from disk
+// at request time.
+//
+// The index is hash-and-displace. A key's 64-bit hash (FNV-1a plus a
+// finalizer) picks a bucket; the generator chose a displacement per bucket
+// so that every key lands in its own slot of a power-of-two table. A lookup is one hash, two
+// array reads and one strcmp to reject paths that are not in the bundle.
+//
+// Templates are imported once at registration and the registry keeps a
+// reference to each for the life of the process.
+//
+// Lookups take no lock. Registration builds a new registry and publishes
+// it with one atomic store, so a lookup sees either the old list or the
+// new one. Replaced registries are never freed, since a lookup may still
+// be reading one; there are at most EMBEDDED_MAX_BUNDLES of them.
+
+#define EMBEDDED_MAX_BUNDLES 8
+
+typedef struct {
+    const torchlight_embedded_bundle_t* bundle;
+    torchlight_template_t** templates;  // Parallel to bundle->assets
+} embedded_registration_t;
+
+typedef struct {
+    int count;
+    embedded_registration_t registrations[EMBEDDED_MAX_BUNDLES];  // Newest first
+} embedded_registry_t;
+
+static embedded_registry_t* g_embedded = NULL;
+static pthread_mutex_t g_embedded_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// Shared with torchlight_embed, which builds the index with them
+
+uint64_t tl_embedded_hash(const char* key) {
+    uint64_t hash = 14695981039346656037ull;
+    for (const unsigned char* p = (const unsigned char*)key; *p; p++) {
+        hash ^= *p;
+        hash *= 1099511628211ull;
+    }
+
+    // Finalizer: slots come from the low bits, which FNV mixes poorly
+    hash ^= hash >> 33;
+    hash *= 0xff51afd7ed558ccdull;
+    hash ^= hash >> 33;
+    hash *= 0xc4ceb9fe1a85ec53ull;
+    hash ^= hash >> 33;
+
+    return hash;
+}
+
+uint32_t tl_embedded_bucket(uint64_t hash, uint32_t bucket_count) {
+    return (uint32_t)((hash * 0x9e3779b97f4a7c15ull) >> 32) % bucket_count;
+}
+
+// The step is odd, so displacements walk every slot of a power-of-two table
+uint32_t tl_embedded_slot(uint64_t hash, uint32_t displacement, uint32_t slot_count) {
+    uint32_t start = (uint32_t)hash;
+    uint32_t step = (uint32_t)(hash >> 32) | 1;
+    return (start + displacement * step) & (slot_count - 1);
+}
+
+static int embedded_index(const torchlight_embedded_bundle_t* bundle, const char* key, uint64_t hash) {
+    if (bundle->asset_count == 0) return -1;
+
+    uint32_t displacement = bundle->displacements[tl_embedded_bucket(hash, bundle->bucket_count)];
+    uint32_t index = bundle->slots[tl_embedded_slot(hash, displacement, bundle->slot_count)];
+
+    if (index >= bundle->asset_count || strcmp(bundle->assets[index].path, key) != 0) return -1;
+    return (int)index;
+}
+
+int torchlight_register_embedded_assets(const torchlight_embedded_bundle_t* bundle) {
+    if (!bundle || (bundle->asset_count > 0 &&
+                    (!bundle->assets || !bundle->displacements || !bundle->slots ||
+                     bundle->bucket_count == 0 || bundle->slot_count == 0 ||
+                     (bundle->slot_count & (bundle->slot_count - 1)) != 0))) {
+        return -1;
+    }
+
+    pthread_mutex_lock(&g_embedded_lock);
+
+    const embedded_registry_t* current = g_embedded;
+    if (current && current->count == EMBEDDED_MAX_BUNDLES) {
+        pthread_mutex_unlock(&g_embedded_lock);
+        printf("❌ Too many embedded asset bundles\n");
+        return -1;
+    }
+
+    embedded_registry_t* registry = calloc(1, sizeof(embedded_registry_t));
+    torchlight_template_t** templates = calloc(bundle->asset_count ? bundle->asset_count : 1,
+                                               sizeof(torchlight_template_t*));
+    if (!registry || !templates) {
+        pthread_mutex_unlock(&g_embedded_lock);
+        free(registry);
+        free(templates);
+        return -1;
+    }
+
+    size_t template_count = 0;
+    for (uint32_t i = 0; i < bundle->asset_count; i++) {
+        if (!bundle->assets[i].ops) continue;
+
+        templates[i] = tl_template_import(&bundle->assets[i]);
+        if (!templates[i]) {
+            for (uint32_t j = 0; j < i; j++) torchlight_release_template(templates[j]);
+            pthread_mutex_unlock(&g_embedded_lock);
+            free(templates);
+            free(registry);
+            return -1;
+        }
+        template_count++;
+    }
+
+    // Newest first, so a later bundle can override an earlier one
+    registry->registrations[0].bundle = bundle;
+    registry->registrations[0].templates = templates;
+    if (current) {
+        memcpy(&registry->registrations[1], current->registrations,
+               (size_t)current->count * sizeof(embedded_registration_t));
+        registry->count = current->count;
+    }
+    registry->count++;
+
+    __atomic_store_n(&g_embedded, registry, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&g_embedded_lock);
+
+    printf("📦 Embedded assets: %zu templates, %zu static files\n",
+           template_count, (size_t)bundle->asset_count - template_count);
+    return 0;
+}
+
+static const torchlight_embedded_asset_t* embedded_find(const char* key,
+                                                        const embedded_registration_t** registration) {
+    const embedded_registry_t* registry = __atomic_load_n(&g_embedded, __ATOMIC_ACQUIRE);
+    if (!registry || !key) return NULL;
+
+    uint64_t hash = tl_embedded_hash(key);
+    for (int i = 0; i < registry->count; i++) {
+        int index = embedded_index(registry->registrations[i].bundle, key, hash);
+        if (index >= 0) {
+            if (registration) *registration = &registry->registrations[i];
+            return &registry->registrations[i].bundle->assets[index];
+        }
+    }
+    return NULL;
+}
+
+const torchlight_embedded_asset_t* torchlight_find_embedded_asset(const char* path) {
+    return embedded_find(path, NULL);
+}
+
+// Borrowed reference; the registry holds its own for good
+torchlight_template_t* tl_embedded_template(const char* key) {
+    const embedded_registration_t* registration = NULL;
+    const torchlight_embedded_asset_t* asset = embedded_find(key, &registration);
+    if (!asset || !asset->ops) return NULL;
+
+    return registration->templates[asset - registration->bundle->assets];
+}
+
+// Static serving
+
+static bool embedded_etag_matches(const char* if_none_match, const char* etag) {
+    const char* p = if_none_match;
+    while (*p == ' ' || *p == '\t') p++;
+    if (p[0] == '*' && (p[1] == '\0' || p[1] == ' ')) return true;
+
+    // Weak comparison: W/"x" matches "x"
+    return strstr(if_none_match, etag) != NULL;
+}
+
+// The gzip variant is a different representation, so it gets its own
+// strong validator
+static void embedded_gzip_etag(const char* etag, char* out, size_t size) {
+    size_t length = strlen(etag);
+    if (length >= 2 && etag[length - 1] == '"') {
+        snprintf(out, size, "%.*s-gz\"", (int)(length - 1), etag);
+    } else {
+        snprintf(out, size, "%s-gz", etag);
+    }
+}
+
+// True if Accept-Encoding lists gzip (or *) without q=0
+static bool embedded_accepts_gzip(const char* accept_encoding) {
+    const char* p = accept_encoding;
+    bool gzip_listed = false, gzip_accepted = false, any_accepted = false;
+
+    while (*p) {
+        while (*p == ' ' || *p == '\t' || *p == ',') p++;
+        const char* token = p;
+        while (*p && *p != ',' && *p != ';' && *p != ' ' && *p != '\t') p++;
+        size_t length = (size_t)(p - token);
+
+        // Parameters run to the next comma; only q matters
+        const char* end = strchr(p, ',');
+        if (!end) end = p + strlen(p);
+
+        bool rejected = false;
+        for (const char* q = p; q + 1 < end; q++) {
+            if ((q[0] == 'q' || q[0] == 'Q') && q[1] == '=') {
+                rejected = strtod(q + 2, NULL) <= 0.0;
+                break;
+            }
+        }
+
+        // An explicit gzip entry overrides the wildcard either way
+        if (length == 4 && strncasecmp(token, "gzip", 4) == 0) {
+            gzip_listed = true;
+            gzip_accepted = !rejected;
+        } else if (length == 1 && token[0] == '*') {
+            any_accepted = !rejected;
+        }
+        p = end;
+    }
+
+    return gzip_listed ? gzip_accepted : any_accepted;
+}
+
+static void embedded_free_iov(void* context) {
+    free(context);
+}
+
+int torchlight_serve_static(const http_request_t* request, http_response_t* response) {
+    if (!request || !response || request->path[0] != '/') return -1;
+
+    const torchlight_embedded_asset_t* asset = embedded_find(request->path, NULL);
+    if (!asset || asset->ops) return -1;
+
+    // The body is the embedded array itself; allocate its iovec before
+    // touching the response so a failure leaves it as it was
+    struct iovec* iov = NULL;
+    if (request->method != HTTP_METHOD_HEAD) {
+        iov = malloc(sizeof(struct iovec));
+        if (!iov) return -1;
+    }
+
+    const char* accept_encoding = torchlight_get_header(request, "Accept-Encoding");
+    bool gzip = asset->gzip_data && accept_encoding && embedded_accepts_gzip(accept_encoding);
+
+    char gzip_etag[128] = "";
+    if (asset->etag && asset->gzip_data) embedded_gzip_etag(asset->etag, gzip_etag, sizeof(gzip_etag));
+
+    response->content_type = asset->content_type;
+    if (asset->etag) torchlight_add_header(response, "ETag", gzip ? gzip_etag : asset->etag);
+    if (asset->gzip_data) torchlight_add_header(response, "Vary", "Accept-Encoding");
+
+    // Either variant's validator proves the client has this version
+    const char* if_none_match = torchlight_get_header(request, "If-None-Match");
+    if (asset->etag && if_none_match &&
+        (embedded_etag_matches(if_none_match, asset->etag) ||
+         (gzip_etag[0] && embedded_etag_matches(if_none_match, gzip_etag)))) {
+        response->status = HTTP_STATUS_NOT_MODIFIED;
+        free(iov);
+        return 0;
+    }
+
+    const unsigned char* data = asset->data;
+    size_t length = asset->length;
+
+    if (gzip) {
+        data = asset->gzip_data;
+        length = asset->gzip_length;
+        torchlight_add_header(response, "Content-Encoding", "gzip");
+    }
+
+    // HEAD: the headers and Content-Length of the GET, without the body
+    if (request->method == HTTP_METHOD_HEAD) {
+        response->status = HTTP_STATUS_OK;
+        response->body_length = length;
+        return 0;
+    }
+
+    iov->iov_base = (void*)data;
+    iov->iov_len = length;
+
+    response->status = HTTP_STATUS_OK;
+    response->body_iov = iov;
+    response->body_iov_count = 1;
+    response->body_length = length;
+    response->body_release = embedded_free_iov;
+    response->body_release_context = iov;
+    return 0;
+}
@@ -259,8 +259,9 @@ int main() {
             int client_fd = accept(server_fd, (struct sockaddr*)&client_addr, &client_len);
             if (client_fd >= 0) {
                 // Handle request with TorchLight
-                torchlight_handle_request(client_fd);
-                close(client_fd);
+                if (torchlight_handle_request(client_fd) != 1) {
+                    close(client_fd);
+                }
             }
         }
     }
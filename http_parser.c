@@ -8,13 +8,47 @@
 #include <string.h>
 #include <unistd.h>
 #include <ctype.h>
+#include <errno.h>
+#include <limits.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
 #include "torchlight.h"
+#include "torchlight_internal.h"
+
+#ifndef IOV_MAX
+#define IOV_MAX 1024
+#endif
 
 // HTTP method strings
 static const char* HTTP_METHOD_STRINGS[] = {
     "GET", "POST", "PUT", "DELETE", "HEAD", "OPTIONS", "PATCH"
 };
 
+static const char* status_reason(http_status_t status) {
+    switch (status) {
+        case HTTP_STATUS_OK: return "OK";
+        case HTTP_STATUS_CREATED: return "Created";
+        case HTTP_STATUS_ACCEPTED: return "Accepted";
+        case HTTP_STATUS_NO_CONTENT: return "No Content";
+        case HTTP_STATUS_MOVED_PERMANENTLY: return "Moved Permanently";
+        case HTTP_STATUS_FOUND: return "Found";
+        case HTTP_STATUS_NOT_MODIFIED: return "Not Modified";
+        case HTTP_STATUS_BAD_REQUEST: return "Bad Request";
+        case HTTP_STATUS_UNAUTHORIZED: return "Unauthorized";
+        case HTTP_STATUS_FORBIDDEN: return "Forbidden";
+        case HTTP_STATUS_NOT_FOUND: return "Not Found";
+        case HTTP_STATUS_METHOD_NOT_ALLOWED: return "Method Not Allowed";
+        case HTTP_STATUS_CONFLICT: return "Conflict";
+        case HTTP_STATUS_TOO_MANY_REQUESTS: return "Too Many Requests";
+        case HTTP_STATUS_INTERNAL_SERVER_ERROR: return "Internal Server Error";
+        case HTTP_STATUS_NOT_IMPLEMENTED: return "Not Implemented";
+        case HTTP_STATUS_SERVICE_UNAVAILABLE: return "Service Unavailable";
+    }
+    return "Unknown";
+}
+
 // Content type strings
 static const char* CONTENT_TYPE_STRINGS[] = {
     "text/html; charset=utf-8",
@@ -64,21 +98,214 @@ static int parse_query_string(const char* query_string, http_request_t* request)
     return 0;
 }
 
-int torchlight_parse_request(int socket_fd, http_request_t* request) {
-    if (!request) return -1;
-    
+// Client identity
+//
+// client_id keys rate limiting and fair scheduling. It is the peer address,
+// or with the PROXY protocol the address the proxy reports. IPv6 clients
+// are keyed by their /64, since one host can usually pick any address
+// inside it. Tor's HiddenServiceExportCircuitID puts the circuit number in
+// the low 32 bits of a fc00:dead:beef:4dad::/64 source address, so those
+// clients are keyed by circuit instead.
+
+static const unsigned char TOR_CIRCUIT_PREFIX[8] = {
+    0xfc, 0x00, 0xde, 0xad, 0xbe, 0xef, 0x4d, 0xad
+};
+
+static const unsigned char PROXY_V2_SIGNATURE[12] = {
+    0x0D, 0x0A, 0x0D, 0x0A, 0x00, 0x0D, 0x0A, 0x51, 0x55, 0x49, 0x54, 0x0A
+};
+
+static bool g_proxy_protocol = false;
+
+void torchlight_set_proxy_protocol(bool enabled) {
+    g_proxy_protocol = enabled;
+}
+
+static void set_client_address(http_request_t* request, int family, const void* address) {
+    char text[INET6_ADDRSTRLEN] = "unknown";
+
+    request->has_circuit_id = false;
+    request->circuit_id = 0;
+
+    if (family == AF_INET) {
+        inet_ntop(AF_INET, address, text, sizeof(text));
+    } else if (family == AF_INET6) {
+        const unsigned char* bytes = address;
+
+        if (memcmp(bytes, TOR_CIRCUIT_PREFIX, sizeof(TOR_CIRCUIT_PREFIX)) == 0) {
+            request->circuit_id = ((uint32_t)bytes[12] << 24) | ((uint32_t)bytes[13] << 16) |
+                                  ((uint32_t)bytes[14] << 8) | (uint32_t)bytes[15];
+            request->has_circuit_id = true;
+            snprintf(request->client_id, sizeof(request->client_id),
+                     "circuit:%u", request->circuit_id);
+            return;
+        }
+
+        if (IN6_IS_ADDR_V4MAPPED((const struct in6_addr*)address)) {
+            inet_ntop(AF_INET, bytes + 12, text, sizeof(text));
+        } else {
+            unsigned char prefix[16] = {0};
+            memcpy(prefix, bytes, 8);
+            inet_ntop(AF_INET6, prefix, text, sizeof(text));
+            strncat(text, "/64", sizeof(text) - strlen(text) - 1);
+        }
+    } else if (family == AF_UNIX) {
+        strcpy(text, "local");
+    }
+
+    snprintf(request->client_id, sizeof(request->client_id), "%s", text);
+}
+
+static void identify_client(int socket_fd, http_request_t* request) {
+    struct sockaddr_storage addr;
+    socklen_t addr_len = sizeof(addr);
+
+    if (getpeername(socket_fd, (struct sockaddr*)&addr, &addr_len) != 0) {
+        set_client_address(request, AF_UNSPEC, NULL);
+    } else if (addr.ss_family == AF_INET) {
+        set_client_address(request, AF_INET, &((struct sockaddr_in*)&addr)->sin_addr);
+    } else if (addr.ss_family == AF_INET6) {
+        set_client_address(request, AF_INET6, &((struct sockaddr_in6*)&addr)->sin6_addr);
+    } else {
+        set_client_address(request, addr.ss_family, NULL);
+    }
+}
+
+// Parse a PROXY protocol header at the start of the buffer, in place.
+// Returns its length, 0 if more data is needed, or -1 if it is malformed.
+static int parse_proxy_header(char* buffer, size_t length, http_request_t* request) {
+    const unsigned char* bytes = (const unsigned char*)buffer;
+
+    // Version 2: binary, fixed 16-byte preamble. A short read may stop
+    // inside the signature.
+    if (length < sizeof(PROXY_V2_SIGNATURE) && length > 0 &&
+        memcmp(bytes, PROXY_V2_SIGNATURE, length) == 0) {
+        return 0;
+    }
+    if (length >= sizeof(PROXY_V2_SIGNATURE) &&
+        memcmp(bytes, PROXY_V2_SIGNATURE, sizeof(PROXY_V2_SIGNATURE)) == 0) {
+        if (length < 16) return 0;
+
+        int version = bytes[12] >> 4;
+        int command = bytes[12] & 0x0F;
+        int family = bytes[13] >> 4;
+        size_t total = 16 + (((size_t)bytes[14] << 8) | bytes[15]);
+
+        if (version != 2) return -1;
+        if (length < total) return 0;
+
+        if (command == 0x0) {
+            // LOCAL (health checks from the proxy itself) keeps the socket peer
+        } else if (command == 0x1) {
+            if (family == 0x1 && total >= 16 + 12) {
+                set_client_address(request, AF_INET, bytes + 16);
+            } else if (family == 0x2 && total >= 16 + 36) {
+                set_client_address(request, AF_INET6, bytes + 16);
+            }
+        } else {
+            return -1;
+        }
+
+        return (int)total;
+    }
+
+    // Version 1: "PROXY TCP4|TCP6|UNKNOWN src dst sport dport\r\n", at most
+    // 107 bytes
+    if (length < 6) {
+        return memcmp(buffer, "PROXY ", length) == 0 ? 0 : -1;
+    }
+    if (memcmp(buffer, "PROXY ", 6) != 0) return -1;
+
+    char* line_end = memchr(buffer, '\r', length < 107 ? length : 107);
+    if (!line_end) return length < 107 ? 0 : -1;
+    if ((size_t)(line_end - buffer) + 1 >= length) return 0;
+    if (line_end[1] != '\n') return -1;
+
+    *line_end = '\0';
+
+    char* protocol = buffer + 6;
+    char* source = strchr(protocol, ' ');
+    if (source) {
+        *source++ = '\0';
+        char* source_end = strchr(source, ' ');
+        if (source_end) *source_end = '\0';
+    }
+
+    unsigned char address[16];
+    if (strcmp(protocol, "TCP4") == 0 && source && inet_pton(AF_INET, source, address) == 1) {
+        set_client_address(request, AF_INET, address);
+    } else if (strcmp(protocol, "TCP6") == 0 && source && inet_pton(AF_INET6, source, address) == 1) {
+        set_client_address(request, AF_INET6, address);
+    } else if (strcmp(protocol, "UNKNOWN") != 0) {
+        return -1;
+    }
+
+    return (int)(line_end + 2 - buffer);
+}
+
+// Append one recv() to the buffer and report it to the connection monitor
+static ssize_t read_more(int socket_fd, char* buffer, size_t* length, size_t capacity, int monitor_slot) {
+    ssize_t got;
+    do {
+        got = recv(socket_fd, buffer + *length, capacity - *length, 0);
+    } while (got < 0 && errno == EINTR);
+
+    if (got > 0) {
+        *length += (size_t)got;
+        tl_connection_monitor_progress(monitor_slot, (size_t)got);
+    }
+    return got;
+}
+
+static int parse_request(int socket_fd, http_request_t* request, int monitor_slot,
+                         bool (*admit)(http_request_t* request)) {
     char buffer[TORCHLIGHT_BUFFER_SIZE] = {0};
-    ssize_t bytes_read = recv(socket_fd, buffer, sizeof(buffer) - 1, 0);
+    size_t capacity = sizeof(buffer) - 1;
+    size_t bytes_read = 0;
     
-    if (bytes_read <= 0) {
+    if (read_more(socket_fd, buffer, &bytes_read, capacity, monitor_slot) <= 0) {
         printf("❌ Failed to read request data\n");
         return -1;
     }
     
+    // PROXY protocol header, required when enabled
+    char* request_start = buffer;
+    if (g_proxy_protocol) {
+        int proxy_length;
+        while ((proxy_length = parse_proxy_header(buffer, bytes_read, request)) == 0) {
+            if (read_more(socket_fd, buffer, &bytes_read, capacity, monitor_slot) <= 0) {
+                printf("❌ Incomplete PROXY protocol header\n");
+                return -1;
+            }
+        }
+        if (proxy_length < 0) {
+            printf("❌ Invalid PROXY protocol header\n");
+            return -1;
+        }
+        request_start = buffer + proxy_length;
+    }
+    
+    // Read until the end of the headers (or the buffer is full)
     buffer[bytes_read] = '\0';
+    char* scan_from = request_start;
+    while (!strstr(scan_from, "\r\n\r\n") && bytes_read < capacity) {
+        size_t before = bytes_read;
+        if (read_more(socket_fd, buffer, &bytes_read, capacity, monitor_slot) <= 0) {
+            if (bytes_read == (size_t)(request_start - buffer)) {
+                printf("❌ Failed to read request data\n");
+                return -1;
+            }
+            break;
+        }
+        buffer[bytes_read] = '\0';
+        
+        // A terminator may straddle the previous read
+        scan_from = buffer + (before >= 3 ? before - 3 : 0);
+        if (scan_from < request_start) scan_from = request_start;
+    }
     
     // Parse request line
-    char* line_end = strstr(buffer, "\r\n");
+    char* line_end = strstr(request_start, "\r\n");
     if (!line_end) {
         printf("❌ Invalid HTTP request - no CRLF found\n");
         return -1;
@@ -88,7 +315,7 @@ int torchlight_parse_request(int socket_fd, http_request_t* request) {
     char method_str[16] = {0};
     char path_and_query[512] = {0};
     
-    int parsed = sscanf(buffer, "%15s %511s %15s", method_str, path_and_query, request->http_version);
+    int parsed = sscanf(request_start, "%15s %511s %15s", method_str, path_and_query, request->http_version);
     if (parsed != 3) {
         printf("❌ Invalid HTTP request line\n");
         return -1;
@@ -146,6 +373,9 @@ int torchlight_parse_request(int socket_fd, http_request_t* request) {
         header_start = line_end + 2;
     }
     
+    // Turn the request away before spending a read on its body
+    if (admit && !admit(request)) return 1;
+    
     // Parse body if present
     const char* content_length_str = torchlight_get_header(request, "Content-Length");
     if (content_length_str) {
@@ -153,8 +383,9 @@ int torchlight_parse_request(int socket_fd, http_request_t* request) {
         
         if (content_length > 0 && content_length < TORCHLIGHT_MAX_REQUEST_SIZE) {
             // Calculate how much body data we already have
-            size_t headers_length = header_start - buffer;
-            size_t body_in_buffer = bytes_read - headers_length;
+            size_t body_in_buffer = (size_t)(buffer + bytes_read - header_start);
+            tl_connection_monitor_body_phase(monitor_slot);
+            if (body_in_buffer > content_length) body_in_buffer = content_length;
             
             request->body = malloc(content_length + 1);
             if (request->body) {
@@ -164,12 +395,10 @@ int torchlight_parse_request(int socket_fd, http_request_t* request) {
                 }
                 
                 // Read remaining body data if needed
-                if (body_in_buffer < content_length) {
-                    ssize_t remaining = recv(socket_fd, 
-                                           request->body + body_in_buffer,
-                                           content_length - body_in_buffer, 0);
-                    if (remaining > 0) {
-                        body_in_buffer += remaining;
+                while (body_in_buffer < content_length) {
+                    if (read_more(socket_fd, request->body, &body_in_buffer,
+                                  content_length, monitor_slot) <= 0) {
+                        break;
                     }
                 }
                 
@@ -182,18 +411,12 @@ int torchlight_parse_request(int socket_fd, http_request_t* request) {
     // Check for session cookie
     const char* cookie_header = torchlight_get_header(request, "Cookie");
     if (cookie_header) {
-        const char* session_start = strstr(cookie_header, "session_id=");
-        if (session_start) {
-            session_start += strlen("session_id=");
-            const char* session_end = strchr(session_start, ';');
-            if (!session_end) session_end = session_start + strlen(session_start);
-            
-            size_t session_length = session_end - session_start;
-            if (session_length < sizeof(request->session_id)) {
-                strncpy(request->session_id, session_start, session_length);
-                request->session_id[session_length] = '\0';
-                request->has_session = true;
-            }
+        size_t session_length = 0;
+        const char* session_start = tl_find_pair_value(cookie_header, "session_id", "; ", &session_length);
+        if (session_start && session_length < sizeof(request->session_id)) {
+            strncpy(request->session_id, session_start, session_length);
+            request->session_id[session_length] = '\0';
+            request->has_session = true;
         }
     }
     
@@ -204,51 +427,141 @@ int torchlight_parse_request(int socket_fd, http_request_t* request) {
     return 0;
 }
 
+// Parse a request, consulting `admit` once the request line and headers
+// are in. Returns 1 without reading the body if it refuses the request,
+// or without reading anything if the connection monitor has no room
+// (a 503 has been sent).
+int tl_parse_request(int socket_fd, http_request_t* request, bool (*admit)(http_request_t* request)) {
+    if (!request) return -1;
+    
+    identify_client(socket_fd, request);
+    
+    int monitor_slot = tl_connection_monitor_begin(socket_fd);
+    if (monitor_slot == TL_CONNECTION_REFUSED) {
+        printf("🐌 Too many connections reading headers, refusing socket %d\n", socket_fd);
+        tl_concurrency_limiter_send_rejection(socket_fd);
+        return 1;
+    }
+    
+    int result = parse_request(socket_fd, request, monitor_slot, admit);
+    
+    // Whatever was read before an eviction is not a request
+    if (tl_connection_monitor_end(monitor_slot) && result == 0) result = -1;
+    
+    return result;
+}
+
+int torchlight_parse_request(int socket_fd, http_request_t* request) {
+    return tl_parse_request(socket_fd, request, NULL) == 0 ? 0 : -1;
+}
+
+// Send a scatter/gather body, IOV_MAX entries per sendmsg(). A short write
+// that stops inside an entry finishes that entry with send().
+static int send_body_iov(int socket_fd, const struct iovec* iov, int count) {
+    int index = 0;
+    
+    while (index < count) {
+        struct msghdr message = {0};
+        message.msg_iov = (struct iovec*)&iov[index];
+        message.msg_iovlen = count - index < IOV_MAX ? count - index : IOV_MAX;
+        
+        ssize_t sent = sendmsg(socket_fd, &message, MSG_NOSIGNAL);
+        if (sent < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        
+        while (index < count && (size_t)sent >= iov[index].iov_len) {
+            sent -= (ssize_t)iov[index].iov_len;
+            index++;
+        }
+        
+        if (sent > 0) {
+            const char* rest = (const char*)iov[index].iov_base + sent;
+            size_t remaining = iov[index].iov_len - (size_t)sent;
+            
+            while (remaining > 0) {
+                ssize_t written = send(socket_fd, rest, remaining, MSG_NOSIGNAL);
+                if (written < 0) {
+                    if (errno == EINTR) continue;
+                    return -1;
+                }
+                rest += written;
+                remaining -= (size_t)written;
+            }
+            index++;
+        }
+    }
+    
+    return 0;
+}
+
 int torchlight_send_response(int socket_fd, const http_response_t* response) {
     if (!response) return -1;
     
     // Build status line
     char status_line[256];
     snprintf(status_line, sizeof(status_line), "HTTP/1.1 %d %s\r\n", 
-             response->status,
-             response->status == HTTP_STATUS_OK ? "OK" :
-             response->status == HTTP_STATUS_NOT_FOUND ? "Not Found" :
-             response->status == HTTP_STATUS_INTERNAL_SERVER_ERROR ? "Internal Server Error" :
-             response->status == HTTP_STATUS_BAD_REQUEST ? "Bad Request" : "Unknown");
+             response->status, status_reason(response->status));
     
-    // Send status line
-    send(socket_fd, status_line, strlen(status_line), 0);
+    // Send status line. The peer may already be gone (an evicted slow
+    // client still gets its 400), so a failed send must not raise SIGPIPE
+    send(socket_fd, status_line, strlen(status_line), MSG_NOSIGNAL);
     
     // Send Content-Type header
     const char* content_type = CONTENT_TYPE_STRINGS[response->content_type];
     char content_type_header[256];
     snprintf(content_type_header, sizeof(content_type_header), "Content-Type: %s\r\n", content_type);
-    send(socket_fd, content_type_header, strlen(content_type_header), 0);
+    send(socket_fd, content_type_header, strlen(content_type_header), MSG_NOSIGNAL);
     
     // Send Content-Length header
     char content_length_header[128];
     snprintf(content_length_header, sizeof(content_length_header), "Content-Length: %zu\r\n", response->body_length);
-    send(socket_fd, content_length_header, strlen(content_length_header), 0);
+    send(socket_fd, content_length_header, strlen(content_length_header), MSG_NOSIGNAL);
     
     // Send custom headers
     for (int i = 0; i < response->header_count; i++) {
         char header_line[640];
         snprintf(header_line, sizeof(header_line), "%s: %s\r\n",
                 response->headers[i].name, response->headers[i].value);
-        send(socket_fd, header_line, strlen(header_line), 0);
+        send(socket_fd, header_line, strlen(header_line), MSG_NOSIGNAL);
     }
     
     // Send empty line to end headers
-    send(socket_fd, "\r\n", 2, 0);
+    send(socket_fd, "\r\n", 2, MSG_NOSIGNAL);
     
     // Send body
+    if (response->body_iov) {
+        return send_body_iov(socket_fd, response->body_iov, response->body_iov_count);
+    }
     if (response->body && response->body_length > 0) {
-        send(socket_fd, response->body, response->body_length, 0);
+        send(socket_fd, response->body, response->body_length, MSG_NOSIGNAL);
     }
     
     return 0;
 }
 
+void torchlight_release_response(http_response_t* response) {
+    if (!response) return;
+    
+    if (response->body_capacity) {
+        torchlight_buffer_free(response->body, response->body_capacity);
+    } else {
+        free(response->body);
+    }
+    if (response->body_release) {
+        response->body_release(response->body_release_context);
+    }
+    
+    response->body = NULL;
+    response->body_length = 0;
+    response->body_capacity = 0;
+    response->body_iov = NULL;
+    response->body_iov_count = 0;
+    response->body_release = NULL;
+    response->body_release_context = NULL;
+}
+
 const char* torchlight_get_header(const http_request_t* request, const char* name) {
     if (!request || !name) return NULL;
     
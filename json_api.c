@@ -6,13 +6,23 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <errno.h>
 #include "torchlight.h"
 
+#if defined(__x86_64__) || (defined(__i386__) && defined(__SSE2__))
+#define TORCHLIGHT_JSON_SIMD 1
+#include <emmintrin.h>
+#endif
+
+static bool json_content_type(const http_request_t* request) {
+    const char* content_type = torchlight_get_header(request, "Content-Type");
+    return content_type && strstr(content_type, "application/json") != NULL;
+}
+
 int torchlight_parse_json(const http_request_t* request, char** json_out) {
     if (!request || !json_out) return -1;
     
-    const char* content_type = torchlight_get_header(request, "Content-Type");
-    if (!content_type || strstr(content_type, "application/json") == NULL) {
+    if (!json_content_type(request)) {
         return -1;  // Not JSON content
     }
     
@@ -29,25 +39,50 @@ int torchlight_parse_json(const http_request_t* request, char** json_out) {
     return 0;
 }
 
+// Envelopes are measured with snprintf() and formatted into a pool buffer
+// of exactly that size, so large data is never cut off and small replies
+// take a small buffer
+
+static const char JSON_SUCCESS_FORMAT[] =
+    "{\n"
+    "  \"success\": true,\n"
+    "  \"message\": \"%s\",\n"
+    "  \"data\": %s\n"
+    "}\n";
+
+static const char JSON_ERROR_FORMAT[] =
+    "{\n"
+    "  \"success\": false,\n"
+    "  \"error\": \"%s\",\n"
+    "  \"status\": %d\n"
+    "}\n";
+
+static char* json_alloc_body(http_response_t* response, int length) {
+    if (length < 0) return NULL;
+    
+    size_t capacity = 0;
+    char* json_body = torchlight_buffer_alloc((size_t)length + 1, &capacity);
+    if (!json_body) return NULL;
+    
+    response->content_type = CONTENT_TYPE_APPLICATION_JSON;
+    response->body = json_body;
+    response->body_length = (size_t)length;
+    response->body_capacity = capacity;
+    return json_body;
+}
+
 int torchlight_json_response(http_response_t* response, const char* data, const char* message) {
     if (!response) return -1;
     
-    char* json_body = malloc(2048);
-    if (!json_body) return -1;
+    if (!message) message = "OK";
+    if (!data) data = "null";
     
-    snprintf(json_body, 2048,
-        "{\n"
-        "  \"success\": true,\n"
-        "  \"message\": \"%s\",\n"
-        "  \"data\": %s\n"
-        "}\n",
-        message ? message : "OK",
-        data ? data : "null");
+    int length = snprintf(NULL, 0, JSON_SUCCESS_FORMAT, message, data);
+    char* json_body = json_alloc_body(response, length);
+    if (!json_body) return -1;
     
+    snprintf(json_body, (size_t)length + 1, JSON_SUCCESS_FORMAT, message, data);
     response->status = HTTP_STATUS_OK;
-    response->content_type = CONTENT_TYPE_APPLICATION_JSON;
-    response->body = json_body;
-    response->body_length = strlen(json_body);
     
     return 0;
 }
@@ -55,22 +90,803 @@ int torchlight_json_response(http_response_t* response, const char* data, const
 int torchlight_json_error(http_response_t* response, http_status_t status, const char* error_message) {
     if (!response) return -1;
     
-    char* json_body = malloc(1024);
-    if (!json_body) return -1;
+    if (!error_message) error_message = "Unknown error";
     
-    snprintf(json_body, 1024,
-        "{\n"
-        "  \"success\": false,\n"
-        "  \"error\": \"%s\",\n"
-        "  \"status\": %d\n"
-        "}\n",
-        error_message ? error_message : "Unknown error",
-        status);
+    int length = snprintf(NULL, 0, JSON_ERROR_FORMAT, error_message, status);
+    char* json_body = json_alloc_body(response, length);
+    if (!json_body) return -1;
     
+    snprintf(json_body, (size_t)length + 1, JSON_ERROR_FORMAT, error_message, status);
     response->status = status;
-    response->content_type = CONTENT_TYPE_APPLICATION_JSON;
-    response->body = json_body;
-    response->body_length = strlen(json_body);
     
     return 0;
-}
\ No newline at end of file
+}
+
+// JSON parser
+//
+// Two passes, after simdjson. Stage 1 classifies the input 64 bytes at a
+// time with SSE2 into bitmasks (quotes, backslashes, punctuation,
+// whitespace, control bytes). Backslash runs of odd length mark the
+// escaped characters; a prefix XOR over the remaining quotes gives the
+// bytes inside strings; what is outside is reduced to a list of
+// structural positions: punctuation, both quotes of every string and the
+// first byte of every number or literal. Stage 2 walks that list with an
+// explicit stack, checks the grammar and writes a tape of 16-byte entries:
+// one per value, key and container end, so a container's `end` skips its
+// whole subtree. Strings are decoded into the same allocation as the tape,
+// which is the only one the document owns.
+//
+// Parsing is strict: no comments, trailing commas, NaN, raw control bytes
+// in strings or unpaired surrogates, and the input must be valid UTF-8.
+
+#define JSON_MAX_DEPTH 1024
+
+// Tape entries other than the public value types
+#define JSON_TAPE_KEY 0x40
+#define JSON_TAPE_END 0x41
+
+typedef struct {
+    uint8_t type;               // torchlight_json_type_t or JSON_TAPE_*
+    bool integer;               // NUMBER: as.integer holds the value
+    uint32_t end;               // Tape index just past this value's subtree
+    union {
+        struct {
+            uint32_t offset;    // Into doc->strings, NUL-terminated
+            uint32_t length;
+        } string;
+        uint32_t count;         // ARRAY elements, OBJECT members
+        int64_t integer;
+        double real;
+    } as;
+} json_tape_t;
+
+struct torchlight_json {
+    json_tape_t* tape;
+    uint32_t tape_count;
+    char* strings;
+    size_t strings_used;
+};
+
+typedef struct {
+    uint64_t quote;
+    uint64_t backslash;
+    uint64_t op;                // { } [ ] : ,
+    uint64_t space;
+    uint64_t control;           // Below 0x20
+    uint64_t high;              // 0x80 and up
+} json_block_t;
+
+static void json_classify(const unsigned char* p, json_block_t* block) {
+    memset(block, 0, sizeof(*block));
+
+#ifdef TORCHLIGHT_JSON_SIMD
+    for (int k = 0; k < 4; k++) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(p + 16 * k));
+
+        // '[' and ']' are '{' and '}' without the 0x20 bit
+        __m128i folded = _mm_or_si128(v, _mm_set1_epi8(0x20));
+        __m128i op = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(folded, _mm_set1_epi8('{')),
+                                               _mm_cmpeq_epi8(folded, _mm_set1_epi8('}'))),
+                                  _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8(':')),
+                                               _mm_cmpeq_epi8(v, _mm_set1_epi8(','))));
+        __m128i space = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8(' ')),
+                                                  _mm_cmpeq_epi8(v, _mm_set1_epi8('\t'))),
+                                     _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('\n')),
+                                                  _mm_cmpeq_epi8(v, _mm_set1_epi8('\r'))));
+        __m128i control = _mm_cmpeq_epi8(_mm_min_epu8(v, _mm_set1_epi8(0x1F)), v);
+
+        int shift = 16 * k;
+        block->quote |= (uint64_t)(uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_set1_epi8('"'))) << shift;
+        block->backslash |= (uint64_t)(uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_set1_epi8('\\'))) << shift;
+        block->op |= (uint64_t)(uint16_t)_mm_movemask_epi8(op) << shift;
+        block->space |= (uint64_t)(uint16_t)_mm_movemask_epi8(space) << shift;
+        block->control |= (uint64_t)(uint16_t)_mm_movemask_epi8(control) << shift;
+        block->high |= (uint64_t)(uint16_t)_mm_movemask_epi8(v) << shift;
+    }
+#else
+    for (int i = 0; i < 64; i++) {
+        unsigned char c = p[i];
+        uint64_t bit = 1ull << i;
+
+        if (c == '"') block->quote |= bit;
+        if (c == '\\') block->backslash |= bit;
+        if (c == '{' || c == '}' || c == '[' || c == ']' || c == ':' || c == ',') block->op |= bit;
+        if (c == ' ' || c == '\t' || c == '\n' || c == '\r') block->space |= bit;
+        if (c < 0x20) block->control |= bit;
+        if (c >= 0x80) block->high |= bit;
+    }
+#endif
+}
+
+// Characters escaped by a backslash: those just after an odd-length run.
+// A run's parity is read from whether it starts on an even or odd bit;
+// carry says the previous block ended in an odd run.
+static uint64_t json_escaped(uint64_t backslash, uint64_t* carry) {
+    const uint64_t even_bits = 0x5555555555555555ull;
+    const uint64_t odd_bits = ~even_bits;
+
+    uint64_t starts = backslash & ~(backslash << 1);
+    uint64_t even_start_mask = even_bits ^ *carry;
+    uint64_t even_starts = starts & even_start_mask;
+    uint64_t odd_starts = starts & ~even_start_mask;
+
+    uint64_t even_carries = backslash + even_starts;
+    uint64_t odd_carries;
+    bool ends_odd = __builtin_add_overflow(backslash, odd_starts, &odd_carries);
+    odd_carries |= *carry;
+    *carry = ends_odd ? 1 : 0;
+
+    uint64_t even_carry_ends = even_carries & ~backslash;
+    uint64_t odd_carry_ends = odd_carries & ~backslash;
+    return (even_carry_ends & odd_bits) | (odd_carry_ends & even_bits);
+}
+
+// Bit i is the XOR of bits 0..i: set from an opening quote up to (not
+// including) its closing quote
+static uint64_t json_prefix_xor(uint64_t x) {
+    x ^= x << 1;
+    x ^= x << 2;
+    x ^= x << 4;
+    x ^= x << 8;
+    x ^= x << 16;
+    x ^= x << 32;
+    return x;
+}
+
+// Offset of the first invalid UTF-8 byte, or length if there is none
+static size_t json_utf8_error(const unsigned char* p, size_t length) {
+    size_t i = 0;
+
+    while (i < length) {
+        if (length - i >= 8) {
+            uint64_t word;
+            memcpy(&word, p + i, 8);
+            if ((word & 0x8080808080808080ull) == 0) {
+                i += 8;
+                continue;
+            }
+        }
+
+        unsigned char c = p[i];
+        if (c < 0x80) {
+            i++;
+            continue;
+        }
+
+        size_t extra;
+        uint32_t cp;
+        if (c >= 0xC2 && c <= 0xDF) {
+            extra = 1;
+            cp = c & 0x1F;
+        } else if (c >= 0xE0 && c <= 0xEF) {
+            extra = 2;
+            cp = c & 0x0F;
+        } else if (c >= 0xF0 && c <= 0xF4) {
+            extra = 3;
+            cp = c & 0x07;
+        } else {
+            return i;
+        }
+
+        if (length - i <= extra) return i;
+        for (size_t k = 1; k <= extra; k++) {
+            if ((p[i + k] & 0xC0) != 0x80) return i;
+            cp = (cp << 6) | (p[i + k] & 0x3F);
+        }
+
+        // Overlong forms, surrogates and code points past U+10FFFF
+        if ((extra == 2 && (cp < 0x800 || (cp >= 0xD800 && cp <= 0xDFFF))) ||
+            (extra == 3 && (cp < 0x10000 || cp > 0x10FFFF))) {
+            return i;
+        }
+        i += extra + 1;
+    }
+
+    return length;
+}
+
+// Stage 1: structural positions into indexes (room for length entries).
+// Returns their count, or -1 with *error set.
+static int64_t json_index(const char* json, size_t length, uint32_t* indexes, size_t* error) {
+    uint64_t escape_carry = 0;
+    uint64_t string_carry = 0;
+    uint64_t scalar_carry = 0;
+    uint64_t high = 0;
+    size_t count = 0;
+    unsigned char tail[64];
+
+    for (size_t base = 0; base < length; base += 64) {
+        const unsigned char* p = (const unsigned char*)json + base;
+        if (length - base < 64) {
+            memset(tail, ' ', sizeof(tail));
+            memcpy(tail, p, length - base);
+            p = tail;
+        }
+
+        json_block_t block;
+        json_classify(p, &block);
+
+        uint64_t quotes = block.quote & ~json_escaped(block.backslash, &escape_carry);
+        uint64_t in_string = json_prefix_xor(quotes) ^ string_carry;
+        string_carry = (uint64_t)((int64_t)in_string >> 63);
+
+        if (block.control & in_string) {
+            *error = base + (size_t)__builtin_ctzll(block.control & in_string);
+            return -1;
+        }
+        high |= block.high;
+
+        // Numbers and literals are indexed by their first byte
+        uint64_t outside = ~in_string;
+        uint64_t scalar = ~(block.op | block.space | quotes) & outside;
+        uint64_t scalar_starts = scalar & ~((scalar << 1) | scalar_carry);
+        scalar_carry = scalar >> 63;
+
+        uint64_t structurals = (block.op & outside) | quotes | scalar_starts;
+        while (structurals) {
+            indexes[count++] = (uint32_t)(base + (size_t)__builtin_ctzll(structurals));
+            structurals &= structurals - 1;
+        }
+    }
+
+    if (string_carry) {
+        *error = length;  // Unterminated string
+        return -1;
+    }
+
+    if (high) {
+        size_t bad = json_utf8_error((const unsigned char*)json, length);
+        if (bad < length) {
+            *error = bad;
+            return -1;
+        }
+    }
+
+    return (int64_t)count;
+}
+
+// Stage 2
+
+static int json_hex4(const char* p, uint32_t* out) {
+    uint32_t value = 0;
+    for (int i = 0; i < 4; i++) {
+        char c = p[i];
+        value <<= 4;
+        if (c >= '0' && c <= '9') value |= (uint32_t)(c - '0');
+        else if (c >= 'a' && c <= 'f') value |= (uint32_t)(c - 'a' + 10);
+        else if (c >= 'A' && c <= 'F') value |= (uint32_t)(c - 'A' + 10);
+        else return -1;
+    }
+    *out = value;
+    return 0;
+}
+
+// Decode escapes from src into dst (never longer than the source)
+static int json_unescape(const char* src, const char* end, char* dst, size_t* length) {
+    char* start = dst;
+
+    while (src < end) {
+        const char* backslash = memchr(src, '\\', (size_t)(end - src));
+        size_t plain = backslash ? (size_t)(backslash - src) : (size_t)(end - src);
+        memcpy(dst, src, plain);
+        dst += plain;
+        src += plain;
+        if (!backslash) break;
+
+        if (end - src < 2) return -1;
+        src += 2;
+        switch (src[-1]) {
+            case '"': *dst++ = '"'; break;
+            case '\\': *dst++ = '\\'; break;
+            case '/': *dst++ = '/'; break;
+            case 'b': *dst++ = '\b'; break;
+            case 'f': *dst++ = '\f'; break;
+            case 'n': *dst++ = '\n'; break;
+            case 'r': *dst++ = '\r'; break;
+            case 't': *dst++ = '\t'; break;
+            case 'u': {
+                uint32_t cp;
+                if (end - src < 4 || json_hex4(src, &cp) != 0) return -1;
+                src += 4;
+
+                if (cp >= 0xDC00 && cp <= 0xDFFF) return -1;  // Unpaired low surrogate
+                if (cp >= 0xD800 && cp <= 0xDBFF) {
+                    uint32_t low;
+                    if (end - src < 6 || src[0] != '\\' || src[1] != 'u' ||
+                        json_hex4(src + 2, &low) != 0 || low < 0xDC00 || low > 0xDFFF) {
+                        return -1;
+                    }
+                    cp = 0x10000 + ((cp - 0xD800) << 10) + (low - 0xDC00);
+                    src += 6;
+                }
+
+                if (cp < 0x80) {
+                    *dst++ = (char)cp;
+                } else if (cp < 0x800) {
+                    *dst++ = (char)(0xC0 | (cp >> 6));
+                    *dst++ = (char)(0x80 | (cp & 0x3F));
+                } else if (cp < 0x10000) {
+                    *dst++ = (char)(0xE0 | (cp >> 12));
+                    *dst++ = (char)(0x80 | ((cp >> 6) & 0x3F));
+                    *dst++ = (char)(0x80 | (cp & 0x3F));
+                } else {
+                    *dst++ = (char)(0xF0 | (cp >> 18));
+                    *dst++ = (char)(0x80 | ((cp >> 12) & 0x3F));
+                    *dst++ = (char)(0x80 | ((cp >> 6) & 0x3F));
+                    *dst++ = (char)(0x80 | (cp & 0x3F));
+                }
+                break;
+            }
+            default:
+                return -1;
+        }
+    }
+
+    *length = (size_t)(dst - start);
+    return 0;
+}
+
+// Copy up to the first backslash; returns the bytes copied. Strings are
+// mostly short and plain, so this stays inline rather than memchr+memcpy.
+static size_t json_copy_plain(char* dst, const char* src, size_t length) {
+    size_t i = 0;
+
+#ifdef TORCHLIGHT_JSON_SIMD
+    const __m128i backslash = _mm_set1_epi8('\\');
+    for (; i + 16 <= length; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(src + i));
+        _mm_storeu_si128((__m128i*)(dst + i), v);
+        int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(v, backslash));
+        if (mask) return i + (size_t)__builtin_ctz((unsigned)mask);
+    }
+#endif
+
+    for (; i < length; i++) {
+        if (src[i] == '\\') return i;
+        dst[i] = src[i];
+    }
+    return length;
+}
+
+// A string (or key) between the quotes at `open` and `close`
+static inline int json_string(torchlight_json_t* doc, const char* json, uint32_t open, uint32_t close,
+                              uint8_t type) {
+    const char* src = json + open + 1;
+    size_t length = close - open - 1;
+    char* dst = doc->strings + doc->strings_used;
+
+    // The decoded string never runs ahead of its source, so the vector
+    // stores stay inside the string area
+    size_t plain = json_copy_plain(dst, src, length);
+    if (plain < length) {
+        size_t decoded;
+        if (json_unescape(src + plain, src + length, dst + plain, &decoded) != 0) return -1;
+        length = plain + decoded;
+    }
+    dst[length] = '\0';
+
+    json_tape_t* entry = &doc->tape[doc->tape_count++];
+    entry->type = type;
+    entry->end = doc->tape_count;
+    entry->as.string.offset = (uint32_t)doc->strings_used;
+    entry->as.string.length = (uint32_t)length;
+
+    doc->strings_used += length + 1;
+    return 0;
+}
+
+// True if a scalar may end here
+static bool json_delimiter(const char* p, const char* end) {
+    if (p == end) return true;
+    switch (*p) {
+        case ' ': case '\t': case '\n': case '\r':
+        case ',': case ':': case '[': case ']': case '{': case '}': case '"':
+            return true;
+        default:
+            return false;
+    }
+}
+
+static bool json_digit(const char* p, const char* end) {
+    return p < end && *p >= '0' && *p <= '9';
+}
+
+static inline int json_number(torchlight_json_t* doc, const char* json, size_t length, uint32_t start) {
+    const char* s = json + start;
+    const char* end = json + length;
+    const char* p = s;
+
+    bool negative = *p == '-';
+    if (negative) p++;
+    if (!json_digit(p, end)) return -1;
+
+    // -?(0|[1-9][0-9]*)(\.[0-9]+)?([eE][+-]?[0-9]+)?, collecting the digits
+    // as an integer and the position of the decimal point as an exponent
+    const char* digits = p;
+    uint64_t magnitude = 0;
+    if (*p == '0') {
+        p++;
+    } else {
+        while (json_digit(p, end)) magnitude = magnitude * 10 + (uint64_t)(*p++ - '0');
+    }
+    size_t digit_count = (size_t)(p - digits);
+
+    bool real = false;
+    int exponent = 0;
+    if (p < end && *p == '.') {
+        p++;
+        if (!json_digit(p, end)) return -1;
+        const char* fraction = p;
+        while (json_digit(p, end)) magnitude = magnitude * 10 + (uint64_t)(*p++ - '0');
+        digit_count += (size_t)(p - fraction);
+        exponent = -(int)(p - fraction);
+        real = true;
+    }
+    if (p < end && (*p == 'e' || *p == 'E')) {
+        p++;
+        bool negative_exponent = p < end && *p == '-';
+        if (p < end && (*p == '+' || *p == '-')) p++;
+        if (!json_digit(p, end)) return -1;
+        int value = 0;
+        while (json_digit(p, end)) {
+            if (value < 10000) value = value * 10 + (*p - '0');
+            p++;
+        }
+        exponent += negative_exponent ? -value : value;
+        real = true;
+    }
+    if (!json_delimiter(p, end)) return -1;
+
+    json_tape_t* entry = &doc->tape[doc->tape_count++];
+    entry->type = TORCHLIGHT_JSON_NUMBER;
+    entry->end = doc->tape_count;
+
+    // Up to 18 digits cannot overflow
+    if (!real && digit_count <= 18) {
+        entry->integer = true;
+        entry->as.integer = negative ? -(int64_t)magnitude : (int64_t)magnitude;
+        return 0;
+    }
+
+    // Clinger's fast path: with at most 15 digits the mantissa and 10^22
+    // are exact doubles, so one multiply or divide rounds correctly
+    static const double POWERS_OF_TEN[] = {
+        1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+        1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+    };
+    if (real && digit_count <= 15 && exponent >= -22 && exponent <= 22) {
+        double value = (double)magnitude;
+        value = exponent < 0 ? value / POWERS_OF_TEN[-exponent] : value * POWERS_OF_TEN[exponent];
+        entry->integer = false;
+        entry->as.real = negative ? -value : value;
+        return 0;
+    }
+
+    // The text is not NUL-terminated; convert a copy
+    size_t text_length = (size_t)(p - s);
+    char local[64];
+    char* text = text_length < sizeof(local) ? local : malloc(text_length + 1);
+    if (!text) return -1;
+    memcpy(text, s, text_length);
+    text[text_length] = '\0';
+
+    entry->integer = false;
+    if (!real) {
+        errno = 0;
+        long long value = strtoll(text, NULL, 10);
+        if (errno == 0) {
+            entry->integer = true;
+            entry->as.integer = value;
+        }
+    }
+    if (!entry->integer) entry->as.real = strtod(text, NULL);
+
+    if (text != local) free(text);
+    return 0;
+}
+
+static inline int json_literal(torchlight_json_t* doc, const char* json, size_t length, uint32_t start) {
+    const char* p = json + start;
+    size_t available = length - start;
+
+    uint8_t type;
+    size_t literal_length;
+    if (available >= 4 && memcmp(p, "true", 4) == 0) {
+        type = TORCHLIGHT_JSON_TRUE;
+        literal_length = 4;
+    } else if (available >= 5 && memcmp(p, "false", 5) == 0) {
+        type = TORCHLIGHT_JSON_FALSE;
+        literal_length = 5;
+    } else if (available >= 4 && memcmp(p, "null", 4) == 0) {
+        type = TORCHLIGHT_JSON_NULL;
+        literal_length = 4;
+    } else {
+        return -1;
+    }
+    if (!json_delimiter(p + literal_length, json + length)) return -1;
+
+    json_tape_t* entry = &doc->tape[doc->tape_count++];
+    entry->type = type;
+    entry->end = doc->tape_count;
+    return 0;
+}
+
+// Stage 2: check the grammar over the structurals and write the tape.
+// Returns 0, or -1 with *error set to the offending offset.
+static int json_build_tape(torchlight_json_t* doc, const char* json, size_t length,
+                           const uint32_t* indexes, uint32_t count, size_t* error) {
+    json_tape_t* tape = doc->tape;
+    uint32_t stack[JSON_MAX_DEPTH];     // Tape index of each open container
+    int depth = 0;
+    uint32_t next = 0;                  // Next structural to consume
+    uint32_t pos = 0;
+
+value:
+    if (next >= count) goto truncated;
+    pos = indexes[next++];
+
+    switch (json[pos]) {
+        case '{':
+        case '[': {
+            if (depth == JSON_MAX_DEPTH) goto fail;
+            bool object = json[pos] == '{';
+
+            uint32_t at = doc->tape_count++;
+            tape[at].type = object ? TORCHLIGHT_JSON_OBJECT : TORCHLIGHT_JSON_ARRAY;
+            tape[at].as.count = 0;
+            stack[depth++] = at;
+
+            if (next < count && json[indexes[next]] == (object ? '}' : ']')) {
+                next++;
+                goto close;
+            }
+            if (object) goto key;
+            tape[at].as.count = 1;
+            goto value;
+        }
+        case '"':
+            // Stage 1 indexed the closing quote right after the opening one
+            if (next >= count) goto truncated;
+            if (json_string(doc, json, pos, indexes[next++], TORCHLIGHT_JSON_STRING) != 0) goto fail;
+            break;
+        case 't':
+        case 'f':
+        case 'n':
+            if (json_literal(doc, json, length, pos) != 0) goto fail;
+            break;
+        default:
+            if (json[pos] != '-' && (json[pos] < '0' || json[pos] > '9')) goto fail;
+            if (json_number(doc, json, length, pos) != 0) goto fail;
+            break;
+    }
+    goto next;
+
+key:
+    if (next + 2 > count) goto truncated;
+    pos = indexes[next++];
+    if (json[pos] != '"' || json_string(doc, json, pos, indexes[next++], JSON_TAPE_KEY) != 0) goto fail;
+    tape[stack[depth - 1]].as.count++;
+
+    if (next >= count) goto truncated;
+    pos = indexes[next++];
+    if (json[pos] != ':') goto fail;
+    goto value;
+
+next:
+    if (depth == 0) {
+        if (next < count) {
+            pos = indexes[next];
+            goto fail;  // Trailing content
+        }
+        return 0;
+    }
+
+    if (next >= count) goto truncated;
+    pos = indexes[next++];
+    {
+        json_tape_t* open = &tape[stack[depth - 1]];
+        bool object = open->type == TORCHLIGHT_JSON_OBJECT;
+
+        if (json[pos] == ',') {
+            if (object) goto key;
+            open->as.count++;
+            goto value;
+        }
+        if (json[pos] != (object ? '}' : ']')) goto fail;
+    }
+
+close:
+    {
+        uint32_t at = stack[--depth];
+        json_tape_t* end = &tape[doc->tape_count++];
+        end->type = JSON_TAPE_END;
+        end->end = doc->tape_count;
+        tape[at].end = doc->tape_count;
+    }
+    goto next;
+
+truncated:
+    pos = (uint32_t)length;
+fail:
+    *error = pos;
+    return -1;
+}
+
+torchlight_json_t* torchlight_json_parse(const char* json, size_t length, size_t* error_offset) {
+    size_t error = 0;
+    if (error_offset) *error_offset = 0;
+    if (!json || length >= UINT32_MAX) return NULL;
+
+    // At most one structural per byte; the scratch comes from the pool
+    size_t index_capacity = 0;
+    uint32_t* indexes = (uint32_t*)torchlight_buffer_alloc((length + 1) * sizeof(uint32_t),
+                                                           &index_capacity);
+    if (!indexes) return NULL;
+
+    int64_t count = json_index(json, length, indexes, &error);
+    if (count < 0) {
+        torchlight_buffer_free((char*)indexes, index_capacity);
+        if (error_offset) *error_offset = error;
+        return NULL;
+    }
+
+    // Every tape entry consumes at least one structural, and decoded
+    // strings with their NULs fit in the bytes their quotes span
+    size_t tape_capacity = count > 0 ? (size_t)count : 1;
+    torchlight_json_t* doc = malloc(sizeof(torchlight_json_t) + tape_capacity * sizeof(json_tape_t) +
+                                    length + 1);
+    if (!doc) {
+        torchlight_buffer_free((char*)indexes, index_capacity);
+        return NULL;
+    }
+    doc->tape = (json_tape_t*)(doc + 1);
+    doc->tape_count = 0;
+    doc->strings = (char*)(doc->tape + tape_capacity);
+    doc->strings_used = 0;
+
+    int result = json_build_tape(doc, json, length, indexes, (uint32_t)count, &error);
+    torchlight_buffer_free((char*)indexes, index_capacity);
+
+    if (result != 0) {
+        free(doc);
+        if (error_offset) *error_offset = error;
+        return NULL;
+    }
+
+    return doc;
+}
+
+void torchlight_json_free(torchlight_json_t* doc) {
+    free(doc);
+}
+
+const torchlight_json_t* torchlight_request_json(const http_request_t* request) {
+    if (!request) return NULL;
+    if (request->json) return request->json;
+
+    if (!request->body || request->body_length == 0 || !json_content_type(request)) return NULL;
+
+    // Cached on the request, which frees it once the response is sent
+    ((http_request_t*)request)->json = torchlight_json_parse(request->body, request->body_length, NULL);
+    return request->json;
+}
+
+// Accessors
+
+static const torchlight_json_value_t JSON_MISSING = { NULL, 0 };
+
+static const json_tape_t* json_entry(torchlight_json_value_t value) {
+    return value.doc ? &value.doc->tape[value.index] : NULL;
+}
+
+torchlight_json_value_t torchlight_json_root(const torchlight_json_t* doc) {
+    torchlight_json_value_t root = { doc, 0 };
+    return doc ? root : JSON_MISSING;
+}
+
+torchlight_json_type_t torchlight_json_type(torchlight_json_value_t value) {
+    const json_tape_t* entry = json_entry(value);
+    return entry ? (torchlight_json_type_t)entry->type : TORCHLIGHT_JSON_INVALID;
+}
+
+torchlight_json_value_t torchlight_json_get(torchlight_json_value_t object, const char* key) {
+    const json_tape_t* entry = json_entry(object);
+    if (!entry || entry->type != TORCHLIGHT_JSON_OBJECT || !key) return JSON_MISSING;
+
+    const json_tape_t* tape = object.doc->tape;
+    size_t length = strlen(key);
+
+    // Members are key, value pairs; a value's end is the next key
+    for (uint32_t i = object.index + 1; tape[i].type == JSON_TAPE_KEY; i = tape[i + 1].end) {
+        if (tape[i].as.string.length == length &&
+            memcmp(object.doc->strings + tape[i].as.string.offset, key, length) == 0) {
+            torchlight_json_value_t member = { object.doc, i + 1 };
+            return member;
+        }
+    }
+    return JSON_MISSING;
+}
+
+size_t torchlight_json_count(torchlight_json_value_t container) {
+    const json_tape_t* entry = json_entry(container);
+    if (!entry || (entry->type != TORCHLIGHT_JSON_ARRAY && entry->type != TORCHLIGHT_JSON_OBJECT)) {
+        return 0;
+    }
+    return entry->as.count;
+}
+
+torchlight_json_value_t torchlight_json_first(torchlight_json_value_t container) {
+    if (torchlight_json_count(container) == 0) return JSON_MISSING;
+
+    // Skip the first member's key
+    const json_tape_t* entry = json_entry(container);
+    torchlight_json_value_t first = {
+        container.doc, container.index + (entry->type == TORCHLIGHT_JSON_OBJECT ? 2 : 1)
+    };
+    return first;
+}
+
+torchlight_json_value_t torchlight_json_next(torchlight_json_value_t value) {
+    const json_tape_t* entry = json_entry(value);
+    if (!entry || entry->end >= value.doc->tape_count) return JSON_MISSING;
+
+    uint32_t next = entry->end;
+    const json_tape_t* tape = value.doc->tape;
+    if (tape[next].type == JSON_TAPE_END) return JSON_MISSING;
+    if (tape[next].type == JSON_TAPE_KEY) next++;
+
+    torchlight_json_value_t sibling = { value.doc, next };
+    return sibling;
+}
+
+torchlight_json_value_t torchlight_json_at(torchlight_json_value_t array, size_t position) {
+    if (torchlight_json_type(array) != TORCHLIGHT_JSON_ARRAY) return JSON_MISSING;
+
+    torchlight_json_value_t element = torchlight_json_first(array);
+    while (position-- > 0 && element.doc) element = torchlight_json_next(element);
+    return element;
+}
+
+const char* torchlight_json_key(torchlight_json_value_t value, size_t* length) {
+    if (!value.doc || value.index == 0) return NULL;
+
+    const json_tape_t* key = &value.doc->tape[value.index - 1];
+    if (key->type != JSON_TAPE_KEY) return NULL;
+
+    if (length) *length = key->as.string.length;
+    return value.doc->strings + key->as.string.offset;
+}
+
+const char* torchlight_json_string(torchlight_json_value_t value, size_t* length) {
+    const json_tape_t* entry = json_entry(value);
+    if (!entry || entry->type != TORCHLIGHT_JSON_STRING) return NULL;
+
+    if (length) *length = entry->as.string.length;
+    return value.doc->strings + entry->as.string.offset;
+}
+
+int torchlight_json_int(torchlight_json_value_t value, int64_t* out) {
+    const json_tape_t* entry = json_entry(value);
+    if (!entry || entry->type != TORCHLIGHT_JSON_NUMBER || !entry->integer || !out) return -1;
+
+    *out = entry->as.integer;
+    return 0;
+}
+
+int torchlight_json_double(torchlight_json_value_t value, double* out) {
+    const json_tape_t* entry = json_entry(value);
+    if (!entry || entry->type != TORCHLIGHT_JSON_NUMBER || !out) return -1;
+
+    *out = entry->integer ? (double)entry->as.integer : entry->as.real;
+    return 0;
+}
+
+int torchlight_json_bool(torchlight_json_value_t value, bool* out) {
+    const json_tape_t* entry = json_entry(value);
+    if (!entry || (entry->type != TORCHLIGHT_JSON_TRUE && entry->type != TORCHLIGHT_JSON_FALSE) || !out) {
+        return -1;
+    }
+
+    *out = entry->type == TORCHLIGHT_JSON_TRUE;
+    return 0;
+}
@@ -7,10 +7,16 @@
 #include <stdlib.h>
 #include <string.h>
 #include <fnmatch.h>
+#include <time.h>
+#include <pthread.h>
 #include "torchlight.h"
+#include "torchlight_internal.h"
 
-// External reference to global server state
-extern torchlight_server_t g_server;
+// Handlers running and response body sizes per route, parallel to
+// g_server.routes. Routes are handed out as const, so their mutable
+// counters live here.
+static int g_route_in_flight[TORCHLIGHT_MAX_ROUTES];
+static torchlight_size_estimate_t g_route_body_estimate[TORCHLIGHT_MAX_ROUTES];
 
 int torchlight_add_route(http_method_t method, const char* path_pattern, 
                         route_handler_func_t handler, const char* description) {
@@ -29,6 +35,10 @@ int torchlight_add_route(http_method_t method, const char* path_pattern,
     route->description = description;
     route->requires_auth = false;
     route->allowed_origins = NULL;
+    route->max_in_flight = 0;
+    route->deadline_ms = 0;
+    g_route_in_flight[g_server.route_count] = 0;
+    memset(&g_route_body_estimate[g_server.route_count], 0, sizeof(torchlight_size_estimate_t));
     
     g_server.route_count++;
     
@@ -50,6 +60,8 @@ int torchlight_add_routes(const route_t* routes, int count) {
     for (int i = 0; i < count; i++) {
         if (torchlight_add_route(routes[i].method, routes[i].path_pattern, 
                                 routes[i].handler, routes[i].description) == 0) {
+            torchlight_set_route_limits(routes[i].method, routes[i].path_pattern,
+                                        routes[i].max_in_flight, routes[i].deadline_ms);
             added++;
         }
     }
@@ -64,9 +76,11 @@ int torchlight_remove_route(http_method_t method, const char* path_pattern) {
         if (g_server.routes[i].method == method && 
             strcmp(g_server.routes[i].path_pattern, path_pattern) == 0) {
             
-            // Shift remaining routes down
+            // Shift remaining routes (and their counters) down
             for (int j = i; j < g_server.route_count - 1; j++) {
                 g_server.routes[j] = g_server.routes[j + 1];
+                g_route_in_flight[j] = g_route_in_flight[j + 1];
+                g_route_body_estimate[j] = g_route_body_estimate[j + 1];
             }
             
             g_server.route_count--;
@@ -144,6 +158,85 @@ const route_t* torchlight_find_route(const http_request_t* request) {
     return NULL;  // No route found
 }
 
+// Route bulkheads
+//
+// A route with max_in_flight set admits that many handlers at a time and
+// refuses the rest with 503 at once. Requests are dispatched on the
+// accepting thread or a handler thread, so waiting for a slot would stall
+// either all routes or a thread that could be serving another one.
+
+static uint64_t route_now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000ull + (uint64_t)ts.tv_nsec / 1000;
+}
+
+static int* route_in_flight(const route_t* route) {
+    return &g_route_in_flight[route - g_server.routes];
+}
+
+static torchlight_size_estimate_t* route_body_estimate(const route_t* route) {
+    return &g_route_body_estimate[route - g_server.routes];
+}
+
+int torchlight_set_route_limits(http_method_t method, const char* path_pattern,
+                                int max_in_flight, int deadline_ms) {
+    if (!path_pattern || max_in_flight < 0 || deadline_ms < 0) return -1;
+
+    for (int i = 0; i < g_server.route_count; i++) {
+        route_t* route = &g_server.routes[i];
+        if (route->method == method && strcmp(route->path_pattern, path_pattern) == 0) {
+            __atomic_store_n(&route->max_in_flight, max_in_flight, __ATOMIC_RELAXED);
+            __atomic_store_n(&route->deadline_ms, deadline_ms, __ATOMIC_RELAXED);
+            return 0;
+        }
+    }
+
+    return -1;  // Route not found
+}
+
+bool torchlight_request_cancelled(const http_request_t* request) {
+    return request && request->deadline_us && route_now_us() >= request->deadline_us;
+}
+
+// Route whose handler is running on this thread; torchlight_response_append()
+// presizes the body from its estimate
+static __thread const route_t* g_handler_route;
+
+// Start the route's deadline and take a handler slot. Returns false at
+// once if the route is at capacity.
+bool tl_route_acquire_slot(const route_t* route, http_request_t* request) {
+    int* in_flight = route_in_flight(route);
+    int max_in_flight = __atomic_load_n(&route->max_in_flight, __ATOMIC_RELAXED);
+    int deadline_ms = __atomic_load_n(&route->deadline_ms, __ATOMIC_RELAXED);
+
+    // Only a handler that got its slot sizes appends from this route
+    g_handler_route = NULL;
+
+    if (deadline_ms > 0) {
+        request->deadline_us = route_now_us() + (uint64_t)deadline_ms * 1000;
+    }
+
+    int current = __atomic_load_n(in_flight, __ATOMIC_RELAXED);
+    do {
+        if (max_in_flight > 0 && current >= max_in_flight) return false;
+    } while (!__atomic_compare_exchange_n(in_flight, &current, current + 1, true,
+                                          __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+
+    g_handler_route = route;
+    return true;
+}
+
+void tl_route_release_slot(const route_t* route) {
+    g_handler_route = NULL;
+    __atomic_sub_fetch(route_in_flight(route), 1, __ATOMIC_RELAXED);
+}
+
+// Fold a handler's response into the route's body size estimate
+void tl_route_record_response(const route_t* route, const http_response_t* response) {
+    torchlight_size_estimate_record(route_body_estimate(route), response->body_length);
+}
+
 int torchlight_get_path_param(const http_request_t* request, const route_t* route, 
                              const char* param_name, char* value_out, size_t value_size) {
     if (!request || !route || !param_name || !value_out) return -1;
@@ -176,19 +269,31 @@ int torchlight_get_path_param(const http_request_t* request, const route_t* rout
 }
 
 // Response helper functions
+//
+// Bodies built here come from the buffer pool (see torchlight_buffer_alloc)
+// and go back to it when the response is released.
+
+// Copy a string into a pool buffer as the body
+static int response_set_body(http_response_t* response, const char* data, size_t length) {
+    response->body = torchlight_buffer_alloc(length + 1, &response->body_capacity);
+    if (!response->body) {
+        response->body_length = 0;
+        response->body_capacity = 0;
+        return -1;
+    }
+    
+    memcpy(response->body, data, length);
+    response->body[length] = '\0';
+    response->body_length = length;
+    return 0;
+}
 
 int torchlight_response_json(http_response_t* response, const char* json_data) {
     if (!response || !json_data) return -1;
     
     response->status = HTTP_STATUS_OK;
     response->content_type = CONTENT_TYPE_APPLICATION_JSON;
-    response->body_length = strlen(json_data);
-    response->body = malloc(response->body_length + 1);
-    
-    if (!response->body) return -1;
-    
-    strcpy(response->body, json_data);
-    return 0;
+    return response_set_body(response, json_data, strlen(json_data));
 }
 
 int torchlight_response_html(http_response_t* response, const char* html_content) {
@@ -196,12 +301,35 @@ int torchlight_response_html(http_response_t* response, const char* html_content
     
     response->status = HTTP_STATUS_OK;
     response->content_type = CONTENT_TYPE_TEXT_HTML;
-    response->body_length = strlen(html_content);
-    response->body = malloc(response->body_length + 1);
+    return response_set_body(response, html_content, strlen(html_content));
+}
+
+int torchlight_response_append(http_response_t* response, const char* data, size_t length) {
+    if (!response || (!data && length > 0) || response->body_iov) return -1;
     
-    if (!response->body) return -1;
+    size_t needed = response->body_length + length + 1;
     
-    strcpy(response->body, html_content);
+    if (!response->body) {
+        // First write: reserve what this route's responses usually need
+        size_t reserve = g_handler_route ?
+            torchlight_size_estimate_reserve(route_body_estimate(g_handler_route)) + 1 : 0;
+        if (reserve < needed) reserve = needed;
+        
+        response->body = torchlight_buffer_alloc(reserve, &response->body_capacity);
+        if (!response->body) return -1;
+        response->body_length = 0;
+    } else {
+        // A plain malloc'd body holds at least its NUL-terminated length
+        size_t capacity = response->body_capacity ? response->body_capacity : response->body_length + 1;
+        char* body = torchlight_buffer_grow(response->body, &capacity, needed);
+        if (!body) return -1;
+        response->body = body;
+        response->body_capacity = capacity;
+    }
+    
+    if (length > 0) memcpy(response->body + response->body_length, data, length);
+    response->body_length += length;
+    response->body[response->body_length] = '\0';
     return 0;
 }
 
@@ -225,6 +353,7 @@ int torchlight_response_file(http_response_t* response, const char* file_path) {
     
     // Allocate buffer and read file
     response->body = malloc(file_size + 1);
+    response->body_capacity = 0;
     if (!response->body) {
         fclose(file);
         return -1;
@@ -255,11 +384,8 @@ int torchlight_response_error(http_response_t* response, http_status_t status, c
     response->status = status;
     response->content_type = CONTENT_TYPE_TEXT_HTML;
     
-    // Create simple error page
-    char* error_html = malloc(1024);
-    if (!error_html) return -1;
-    
-    snprintf(error_html, 1024,
+    // Create simple error page, sized exactly (a long message is not cut off)
+    static const char ERROR_PAGE[] =
         "<!DOCTYPE html>\n"
         "<html><head><title>Error %d</title></head>\n"
         "<body>\n"
@@ -267,11 +393,21 @@ int torchlight_response_error(http_response_t* response, http_status_t status, c
         "<p>%s</p>\n"
         "<hr>\n"
         "<small>TorchLight HTTP Server</small>\n"
-        "</body></html>\n",
-        status, status, message ? message : "An error occurred");
+        "</body></html>\n";
+    
+    if (!message) message = "An error occurred";
+    
+    int length = snprintf(NULL, 0, ERROR_PAGE, status, status, message);
+    if (length < 0) return -1;
+    
+    response->body = torchlight_buffer_alloc((size_t)length + 1, &response->body_capacity);
+    if (!response->body) {
+        response->body_capacity = 0;
+        return -1;
+    }
     
-    response->body = error_html;
-    response->body_length = strlen(error_html);
+    snprintf(response->body, (size_t)length + 1, ERROR_PAGE, status, status, message);
+    response->body_length = (size_t)length;
     
     return 0;
 }
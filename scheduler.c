@@ -0,0 +1,317 @@
+/*
+ * TorchLight Request Scheduler
+ * Fair queuing of parsed requests across clients
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "torchlight.h"
+#include "torchlight_internal.h"
+
+// Parsed requests wait here before a handler thread runs them. Each client
+// key (request->client_id: peer address or Tor circuit) gets its own FIFO
+// "flow", and handler threads serve flows with deficit round-robin: each
+// time a flow comes up in the round it earns one quantum of credit, and it
+// may dequeue a request if the request's cost fits in its credit. Every
+// request costs one unit plus one per 16 KB of body, so a flow of uploads
+// takes proportionally more rounds than a flow of small requests.
+//
+// A client with a deep queue therefore only waits behind itself: a fresh
+// client's first request is at most one round away, however many requests
+// the busiest client has outstanding. Per-client and global queue caps
+// keep memory bounded.
+
+#define SCHEDULER_FLOW_BUCKETS 1024
+#define SCHEDULER_MAX_QUEUED 4096
+#define SCHEDULER_QUANTUM 1
+#define SCHEDULER_COST_UNIT 16384
+
+typedef struct scheduled_request {
+    http_request_t request;
+    size_t cost;
+    struct scheduled_request* next;
+} scheduled_request_t;
+
+typedef struct scheduler_flow {
+    char key[64];
+    uint64_t hash;
+    scheduled_request_t* head;
+    scheduled_request_t* tail;
+    int queued;
+    size_t deficit;
+    bool credited;                      // Quantum added for the current visit
+    struct scheduler_flow* chain_next;  // Hash bucket chain
+    struct scheduler_flow* active_next; // Round-robin list
+} scheduler_flow_t;
+
+typedef struct {
+    scheduler_flow_t* buckets[SCHEDULER_FLOW_BUCKETS];
+    scheduler_flow_t* active_head;
+    scheduler_flow_t* active_tail;
+    int total_queued;
+    int max_per_client;
+
+    void (*dispatch)(http_request_t* request);
+
+    pthread_t* threads;
+    int thread_count;
+    bool running;
+
+    pthread_mutex_t lock;
+    pthread_cond_t ready;
+} scheduler_t;
+
+static scheduler_t g_scheduler = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .ready = PTHREAD_COND_INITIALIZER
+};
+
+static uint64_t flow_hash(const char* key) {
+    uint64_t hash = 14695981039346656037ull;
+    for (const unsigned char* p = (const unsigned char*)key; *p; p++) {
+        hash ^= *p;
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+static scheduler_flow_t* flow_lookup(const char* key, uint64_t hash, bool create) {
+    scheduler_flow_t** bucket = &g_scheduler.buckets[hash & (SCHEDULER_FLOW_BUCKETS - 1)];
+
+    for (scheduler_flow_t* flow = *bucket; flow; flow = flow->chain_next) {
+        if (flow->hash == hash && strcmp(flow->key, key) == 0) {
+            return flow;
+        }
+    }
+
+    if (!create) return NULL;
+
+    scheduler_flow_t* flow = calloc(1, sizeof(scheduler_flow_t));
+    if (!flow) return NULL;
+
+    snprintf(flow->key, sizeof(flow->key), "%s", key);
+    flow->hash = hash;
+    flow->chain_next = *bucket;
+    *bucket = flow;
+
+    // New flows join the end of the round
+    if (g_scheduler.active_tail) {
+        g_scheduler.active_tail->active_next = flow;
+    } else {
+        g_scheduler.active_head = flow;
+    }
+    g_scheduler.active_tail = flow;
+
+    return flow;
+}
+
+// Remove the (empty) flow at the head of the round and free it
+static void flow_retire_head(void) {
+    scheduler_flow_t* flow = g_scheduler.active_head;
+
+    g_scheduler.active_head = flow->active_next;
+    if (!g_scheduler.active_head) g_scheduler.active_tail = NULL;
+
+    scheduler_flow_t** link = &g_scheduler.buckets[flow->hash & (SCHEDULER_FLOW_BUCKETS - 1)];
+    while (*link != flow) link = &(*link)->chain_next;
+    *link = flow->chain_next;
+
+    free(flow);
+}
+
+static void flow_rotate_head(void) {
+    scheduler_flow_t* flow = g_scheduler.active_head;
+    if (flow == g_scheduler.active_tail) return;
+
+    g_scheduler.active_head = flow->active_next;
+    flow->active_next = NULL;
+    g_scheduler.active_tail->active_next = flow;
+    g_scheduler.active_tail = flow;
+}
+
+// Pick the next request by deficit round-robin (lock held, queue non-empty)
+static scheduled_request_t* scheduler_next(void) {
+    for (;;) {
+        scheduler_flow_t* flow = g_scheduler.active_head;
+
+        if (!flow->credited) {
+            flow->deficit += SCHEDULER_QUANTUM;
+            flow->credited = true;
+        }
+
+        scheduled_request_t* item = flow->head;
+        if (item->cost > flow->deficit) {
+            flow->credited = false;
+            flow_rotate_head();
+            continue;
+        }
+
+        flow->head = item->next;
+        if (!flow->head) flow->tail = NULL;
+        flow->queued--;
+        flow->deficit -= item->cost;
+        g_scheduler.total_queued--;
+
+        if (!flow->head) {
+            // Idle flows keep no credit
+            flow_retire_head();
+        } else if (flow->head->cost > flow->deficit) {
+            flow->credited = false;
+            flow_rotate_head();
+        }
+
+        return item;
+    }
+}
+
+static void* scheduler_worker(void* arg) {
+    (void)arg;
+
+    pthread_mutex_lock(&g_scheduler.lock);
+
+    while (g_scheduler.running) {
+        if (g_scheduler.total_queued == 0) {
+            pthread_cond_wait(&g_scheduler.ready, &g_scheduler.lock);
+            continue;
+        }
+
+        scheduled_request_t* item = scheduler_next();
+        pthread_mutex_unlock(&g_scheduler.lock);
+
+        g_scheduler.dispatch(&item->request);
+        close(item->request.socket_fd);
+        free(item);
+
+        pthread_mutex_lock(&g_scheduler.lock);
+    }
+
+    pthread_mutex_unlock(&g_scheduler.lock);
+    return NULL;
+}
+
+int tl_scheduler_start(int thread_count, int max_per_client, void (*dispatch)(http_request_t* request)) {
+    if (thread_count <= 0 || !dispatch) return -1;
+
+    pthread_mutex_lock(&g_scheduler.lock);
+
+    if (g_scheduler.running) {
+        pthread_mutex_unlock(&g_scheduler.lock);
+        return 0;
+    }
+
+    g_scheduler.threads = calloc((size_t)thread_count, sizeof(pthread_t));
+    if (!g_scheduler.threads) {
+        pthread_mutex_unlock(&g_scheduler.lock);
+        return -1;
+    }
+
+    g_scheduler.dispatch = dispatch;
+    g_scheduler.max_per_client = max_per_client > 0 ? max_per_client : SCHEDULER_MAX_QUEUED;
+    g_scheduler.running = true;
+    g_scheduler.thread_count = 0;
+
+    for (int i = 0; i < thread_count; i++) {
+        if (pthread_create(&g_scheduler.threads[i], NULL, scheduler_worker, NULL) != 0) {
+            break;
+        }
+        g_scheduler.thread_count++;
+    }
+
+    pthread_mutex_unlock(&g_scheduler.lock);
+
+    if (g_scheduler.thread_count == 0) {
+        g_scheduler.running = false;
+        free(g_scheduler.threads);
+        g_scheduler.threads = NULL;
+        return -1;
+    }
+
+    printf("⚖️  Fair scheduler started: %d handler threads, %d queued per client\n",
+           g_scheduler.thread_count, g_scheduler.max_per_client);
+    return 0;
+}
+
+bool tl_scheduler_active(void) {
+    return __atomic_load_n(&g_scheduler.running, __ATOMIC_ACQUIRE);
+}
+
+// Queue a parsed request; on success the scheduler owns its socket and body.
+// Returns -1 if the client's queue (or the whole scheduler) is full.
+int tl_scheduler_submit(const http_request_t* request) {
+    scheduled_request_t* item = malloc(sizeof(scheduled_request_t));
+    if (!item) return -1;
+
+    item->request = *request;
+    item->cost = 1 + request->body_length / SCHEDULER_COST_UNIT;
+    item->next = NULL;
+
+    pthread_mutex_lock(&g_scheduler.lock);
+
+    uint64_t hash = flow_hash(request->client_id);
+    scheduler_flow_t* flow = NULL;
+
+    if (g_scheduler.running && g_scheduler.total_queued < SCHEDULER_MAX_QUEUED) {
+        flow = flow_lookup(request->client_id, hash, true);
+    }
+
+    if (!flow || flow->queued >= g_scheduler.max_per_client) {
+        pthread_mutex_unlock(&g_scheduler.lock);
+        free(item);
+        return -1;
+    }
+
+    if (flow->tail) {
+        flow->tail->next = item;
+    } else {
+        flow->head = item;
+    }
+    flow->tail = item;
+    flow->queued++;
+    g_scheduler.total_queued++;
+
+    pthread_cond_signal(&g_scheduler.ready);
+    pthread_mutex_unlock(&g_scheduler.lock);
+    return 0;
+}
+
+void tl_scheduler_stop(void) {
+    pthread_mutex_lock(&g_scheduler.lock);
+
+    if (!g_scheduler.running) {
+        pthread_mutex_unlock(&g_scheduler.lock);
+        return;
+    }
+
+    g_scheduler.running = false;
+    pthread_cond_broadcast(&g_scheduler.ready);
+    pthread_mutex_unlock(&g_scheduler.lock);
+
+    for (int i = 0; i < g_scheduler.thread_count; i++) {
+        pthread_join(g_scheduler.threads[i], NULL);
+    }
+    free(g_scheduler.threads);
+    g_scheduler.threads = NULL;
+    g_scheduler.thread_count = 0;
+
+    // Drop whatever was still queued
+    pthread_mutex_lock(&g_scheduler.lock);
+    while (g_scheduler.active_head) {
+        scheduler_flow_t* flow = g_scheduler.active_head;
+        while (flow->head) {
+            scheduled_request_t* item = flow->head;
+            flow->head = item->next;
+            if (item->request.admitted_us) tl_concurrency_limiter_release(0);
+            close(item->request.socket_fd);
+            free(item->request.body);
+            free(item);
+        }
+        flow_retire_head();
+    }
+    g_scheduler.total_queued = 0;
+    pthread_mutex_unlock(&g_scheduler.lock);
+
+    printf("⚖️  Fair scheduler stopped\n");
+}
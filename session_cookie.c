@@ -0,0 +1,326 @@
+/*
+ * TorchLight Cookie Sessions
+ * Stateless sessions carried in an authenticated cookie
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <openssl/crypto.h>
+#include <openssl/evp.h>
+#include <openssl/hmac.h>
+#include <openssl/rand.h>
+#include "torchlight.h"
+
+// Cookie layout before base64url encoding:
+//
+//   [flags:1][key_id:1][expires:8]  header, authenticated in both modes
+//   body                            plain or AES-256-GCM ciphertext
+//   [tag:16]                        truncated HMAC-SHA256, or the GCM tag
+//
+// Encrypted cookies insert a 12-byte nonce between header and body. The
+// body is [created:8][last_access:8][authenticated:1][user_len:1][user_id]
+// [data_len:2][attribute arena]. Verifying a cookie is one HMAC (or one
+// GCM open) over a few hundred bytes; no server-side state is consulted.
+//
+// Keys are kept in a small ring. The most recently installed key signs new
+// cookies, and older keys keep verifying until they are retired, which
+// lets deployments rotate secrets without logging everyone out.
+
+#define COOKIE_NAME "tl_session"
+#define COOKIE_VERSION 1
+#define COOKIE_FLAG_ENCRYPTED 0x01
+#define COOKIE_HEADER_SIZE 10
+#define COOKIE_NONCE_SIZE 12
+#define COOKIE_TAG_SIZE 16
+#define COOKIE_MAX_RAW 320  // Keeps the Set-Cookie value within one header slot
+#define COOKIE_MAX_KEYS 4
+
+typedef struct {
+    bool in_use;
+    uint8_t key_id;
+    uint64_t installed;       // Install order; the smallest is the oldest
+    unsigned char mac_key[32];
+    unsigned char enc_key[32];
+} cookie_key_t;
+
+static cookie_key_t g_cookie_keys[COOKIE_MAX_KEYS];
+static int g_cookie_primary = -1;
+static uint64_t g_cookie_installs = 0;
+static pthread_rwlock_t g_cookie_keys_lock = PTHREAD_RWLOCK_INITIALIZER;
+
+static void put_u64(unsigned char* p, uint64_t v) {
+    for (int i = 7; i >= 0; i--) {
+        p[i] = (unsigned char)(v & 0xFF);
+        v >>= 8;
+    }
+}
+
+static uint64_t get_u64(const unsigned char* p) {
+    uint64_t v = 0;
+    for (int i = 0; i < 8; i++) {
+        v = (v << 8) | p[i];
+    }
+    return v;
+}
+
+// Derive independent MAC and encryption keys from one secret
+static void derive_key(const unsigned char* secret, size_t secret_len,
+                       const char* label, unsigned char out[32]) {
+    unsigned int out_len = 32;
+    HMAC(EVP_sha256(), secret, (int)secret_len,
+         (const unsigned char*)label, strlen(label), out, &out_len);
+}
+
+int torchlight_set_session_cookie_key(uint8_t key_id, const unsigned char* secret, size_t secret_len) {
+    if (!secret || secret_len < 16) return -1;
+
+    pthread_rwlock_wrlock(&g_cookie_keys_lock);
+
+    // Reuse the slot for this ID, else a free slot, else the oldest non-primary
+    int slot = -1;
+    for (int i = 0; i < COOKIE_MAX_KEYS && slot < 0; i++) {
+        if (g_cookie_keys[i].in_use && g_cookie_keys[i].key_id == key_id) slot = i;
+    }
+    for (int i = 0; i < COOKIE_MAX_KEYS && slot < 0; i++) {
+        if (!g_cookie_keys[i].in_use) slot = i;
+    }
+    if (slot < 0) {
+        for (int i = 0; i < COOKIE_MAX_KEYS; i++) {
+            if (i == g_cookie_primary) continue;
+            if (slot < 0 || g_cookie_keys[i].installed < g_cookie_keys[slot].installed) slot = i;
+        }
+    }
+
+    cookie_key_t* key = &g_cookie_keys[slot];
+    key->key_id = key_id;
+    derive_key(secret, secret_len, "torchlight cookie mac", key->mac_key);
+    derive_key(secret, secret_len, "torchlight cookie enc", key->enc_key);
+    key->in_use = true;
+    key->installed = ++g_cookie_installs;
+    g_cookie_primary = slot;
+
+    pthread_rwlock_unlock(&g_cookie_keys_lock);
+    return 0;
+}
+
+int torchlight_retire_session_cookie_key(uint8_t key_id) {
+    int result = -1;
+
+    pthread_rwlock_wrlock(&g_cookie_keys_lock);
+
+    for (int i = 0; i < COOKIE_MAX_KEYS; i++) {
+        if (g_cookie_keys[i].in_use && g_cookie_keys[i].key_id == key_id && i != g_cookie_primary) {
+            OPENSSL_cleanse(&g_cookie_keys[i], sizeof(cookie_key_t));
+            result = 0;
+        }
+    }
+
+    pthread_rwlock_unlock(&g_cookie_keys_lock);
+    return result;  // The primary key cannot be retired
+}
+
+static int cookie_gcm(bool encrypt, const unsigned char* key, const unsigned char* nonce,
+                      const unsigned char* aad, size_t aad_len,
+                      const unsigned char* in, size_t in_len,
+                      unsigned char* out, unsigned char* tag) {
+    EVP_CIPHER_CTX* ctx = EVP_CIPHER_CTX_new();
+    if (!ctx) return -1;
+
+    int len = 0;
+    int ok = EVP_CipherInit_ex(ctx, EVP_aes_256_gcm(), NULL, NULL, NULL, encrypt ? 1 : 0) &&
+             EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_SET_IVLEN, COOKIE_NONCE_SIZE, NULL) &&
+             EVP_CipherInit_ex(ctx, NULL, NULL, key, nonce, encrypt ? 1 : 0) &&
+             EVP_CipherUpdate(ctx, NULL, &len, aad, (int)aad_len) &&
+             EVP_CipherUpdate(ctx, out, &len, in, (int)in_len);
+
+    if (ok && !encrypt) {
+        ok = EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_SET_TAG, COOKIE_TAG_SIZE, tag);
+    }
+    ok = ok && EVP_CipherFinal_ex(ctx, out + len, &len);
+    if (ok && encrypt) {
+        ok = EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_GET_TAG, COOKIE_TAG_SIZE, tag);
+    }
+
+    EVP_CIPHER_CTX_free(ctx);
+    return ok ? 0 : -1;
+}
+
+int torchlight_encode_session_cookie(const session_t* session, bool encrypt,
+                                     char* cookie_out, size_t cookie_size) {
+    if (!session || !cookie_out) return -1;
+
+    size_t user_len = strnlen(session->user_id, sizeof(session->user_id));
+    size_t data_len = session->data_length;
+
+    unsigned char body[COOKIE_MAX_RAW];
+    size_t body_len = 8 + 8 + 1 + 1 + user_len + 2 + data_len;
+    size_t raw_len = COOKIE_HEADER_SIZE + (encrypt ? COOKIE_NONCE_SIZE : 0) + body_len + COOKIE_TAG_SIZE;
+    if (raw_len > COOKIE_MAX_RAW) return -1;  // Too much data for a cookie
+
+    unsigned char* p = body;
+    put_u64(p, (uint64_t)session->created_time);
+    put_u64(p + 8, (uint64_t)session->last_access_time);
+    p += 16;
+    *p++ = session->authenticated ? 1 : 0;
+    *p++ = (unsigned char)user_len;
+    memcpy(p, session->user_id, user_len);
+    p += user_len;
+    *p++ = (unsigned char)(data_len >> 8);
+    *p++ = (unsigned char)(data_len & 0xFF);
+    memcpy(p, session->data, data_len);
+
+    unsigned char raw[COOKIE_MAX_RAW];
+    int result = 0;
+
+    pthread_rwlock_rdlock(&g_cookie_keys_lock);
+
+    if (g_cookie_primary < 0) {
+        pthread_rwlock_unlock(&g_cookie_keys_lock);
+        return -1;  // No key installed
+    }
+    const cookie_key_t* key = &g_cookie_keys[g_cookie_primary];
+
+    raw[0] = (COOKIE_VERSION << 4) | (encrypt ? COOKIE_FLAG_ENCRYPTED : 0);
+    raw[1] = key->key_id;
+    put_u64(raw + 2, (uint64_t)session->last_access_time + TORCHLIGHT_SESSION_TIMEOUT);
+
+    if (encrypt) {
+        unsigned char* nonce = raw + COOKIE_HEADER_SIZE;
+        unsigned char* cipher = nonce + COOKIE_NONCE_SIZE;
+
+        if (RAND_bytes(nonce, COOKIE_NONCE_SIZE) != 1 ||
+            cookie_gcm(true, key->enc_key, nonce, raw, COOKIE_HEADER_SIZE,
+                       body, body_len, cipher, cipher + body_len) != 0) {
+            result = -1;
+        }
+    } else {
+        unsigned char mac[32];
+        unsigned int mac_len = sizeof(mac);
+
+        memcpy(raw + COOKIE_HEADER_SIZE, body, body_len);
+        HMAC(EVP_sha256(), key->mac_key, sizeof(key->mac_key),
+             raw, COOKIE_HEADER_SIZE + body_len, mac, &mac_len);
+        memcpy(raw + COOKIE_HEADER_SIZE + body_len, mac, COOKIE_TAG_SIZE);
+    }
+
+    pthread_rwlock_unlock(&g_cookie_keys_lock);
+
+    if (result != 0) return -1;
+    return torchlight_base64url_encode(raw, raw_len, cookie_out, cookie_size);
+}
+
+int torchlight_decode_session_cookie(const char* cookie, size_t cookie_length, session_t* session_out) {
+    if (!cookie || !session_out) return -1;
+
+    unsigned char raw[COOKIE_MAX_RAW];
+    int decoded = torchlight_base64url_decode(cookie, cookie_length, raw, sizeof(raw));
+    if (decoded < COOKIE_HEADER_SIZE + COOKIE_TAG_SIZE) return -1;
+
+    size_t raw_len = (size_t)decoded;
+    if ((raw[0] >> 4) != COOKIE_VERSION) return -1;
+
+    bool encrypted = (raw[0] & COOKIE_FLAG_ENCRYPTED) != 0;
+    if (encrypted && raw_len < COOKIE_HEADER_SIZE + COOKIE_NONCE_SIZE + COOKIE_TAG_SIZE) return -1;
+
+    if ((time_t)get_u64(raw + 2) < time(NULL)) return -1;  // Expired
+
+    unsigned char body[COOKIE_MAX_RAW];
+    size_t body_len;
+    int verified = -1;
+
+    pthread_rwlock_rdlock(&g_cookie_keys_lock);
+
+    for (int i = 0; i < COOKIE_MAX_KEYS; i++) {
+        const cookie_key_t* key = &g_cookie_keys[i];
+        if (!key->in_use || key->key_id != raw[1]) continue;
+
+        if (encrypted) {
+            unsigned char* nonce = raw + COOKIE_HEADER_SIZE;
+            unsigned char* cipher = nonce + COOKIE_NONCE_SIZE;
+            body_len = raw_len - COOKIE_HEADER_SIZE - COOKIE_NONCE_SIZE - COOKIE_TAG_SIZE;
+
+            verified = cookie_gcm(false, key->enc_key, nonce, raw, COOKIE_HEADER_SIZE,
+                                  cipher, body_len, body, cipher + body_len);
+        } else {
+            unsigned char mac[32];
+            unsigned int mac_len = sizeof(mac);
+            body_len = raw_len - COOKIE_HEADER_SIZE - COOKIE_TAG_SIZE;
+
+            HMAC(EVP_sha256(), key->mac_key, sizeof(key->mac_key),
+                 raw, COOKIE_HEADER_SIZE + body_len, mac, &mac_len);
+            if (CRYPTO_memcmp(mac, raw + COOKIE_HEADER_SIZE + body_len, COOKIE_TAG_SIZE) == 0) {
+                memcpy(body, raw + COOKIE_HEADER_SIZE, body_len);
+                verified = 0;
+            }
+        }
+        break;
+    }
+
+    pthread_rwlock_unlock(&g_cookie_keys_lock);
+
+    if (verified != 0) return -1;
+
+    // Authenticated; the body was written by us, but check bounds anyway
+    if (body_len < 20) return -1;
+
+    const unsigned char* p = body;
+    size_t user_len = p[17];
+    if (user_len >= sizeof(session_out->user_id) || 18 + user_len + 2 > body_len) return -1;
+
+    size_t data_len = ((size_t)p[18 + user_len] << 8) | p[19 + user_len];
+    if (data_len > sizeof(session_out->data) || 20 + user_len + data_len != body_len) return -1;
+
+    memset(session_out, 0, sizeof(session_t));
+    session_out->created_time = (time_t)get_u64(p);
+    session_out->last_access_time = (time_t)get_u64(p + 8);
+    session_out->authenticated = p[16] != 0;
+    memcpy(session_out->user_id, p + 18, user_len);
+    memcpy(session_out->data, p + 20 + user_len, data_len);
+    session_out->data_length = (uint16_t)data_len;
+
+    return 0;
+}
+
+int torchlight_load_cookie_session(const http_request_t* request, session_t* session_out) {
+    if (!request || !session_out) return -1;
+
+    const char* cookie_header = torchlight_get_header(request, "Cookie");
+    if (!cookie_header) return -1;
+
+    // Find "tl_session=" at the start of a cookie pair
+    const char* p = cookie_header;
+    while ((p = strstr(p, COOKIE_NAME "=")) != NULL) {
+        if (p == cookie_header || p[-1] == ' ' || p[-1] == ';') break;
+        p += strlen(COOKIE_NAME);
+    }
+    if (!p) return -1;
+
+    const char* value = p + strlen(COOKIE_NAME "=");
+    size_t value_length = strcspn(value, "; ");
+
+    if (torchlight_decode_session_cookie(value, value_length, session_out) != 0) {
+        return -1;
+    }
+
+    session_out->last_access_time = time(NULL);
+    return 0;
+}
+
+int torchlight_store_cookie_session(http_response_t* response, const session_t* session, bool encrypt) {
+    if (!response || !session) return -1;
+
+    char cookie[512];
+    int cookie_length = torchlight_encode_session_cookie(session, encrypt, cookie, sizeof(cookie));
+    if (cookie_length < 0) return -1;
+
+    char header_value[512];
+    int written = snprintf(header_value, sizeof(header_value),
+                           COOKIE_NAME "=%s; Path=/; Max-Age=%d; HttpOnly; SameSite=Lax",
+                           cookie, TORCHLIGHT_SESSION_TIMEOUT);
+    if (written < 0 || (size_t)written >= sizeof(header_value)) return -1;
+
+    return torchlight_add_header(response, "Set-Cookie", header_value);
+}
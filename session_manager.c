@@ -0,0 +1,870 @@
+/*
+ * TorchLight Session Manager
+ * Hash-table session store keyed by session ID
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include "torchlight.h"
+#include "torchlight_internal.h"
+
+// Sessions are spread across lock stripes by hash. Each shard owns an
+// open-addressing hash table with linear probing and a reader/writer lock,
+// so lookups in different shards never contend and lookups within a shard
+// run in parallel. Removal uses backward-shift deletion, so the tables
+// never accumulate tombstones and probe lengths stay short regardless of
+// churn.
+//
+// Every session is reference counted. The table holds one reference and
+// each torchlight_acquire_session() lease holds another, so a session that
+// is destroyed or expires while a handler is using it stays valid until
+// the handler calls torchlight_release_session().
+//
+// Expiry is driven by a per-shard timing wheel with one-second buckets.
+// Each session is linked into the bucket of the second in which it would
+// expire. Touching a session only stores its new access time; the wheel
+// notices on the next visit and relinks the session further ahead. A tick
+// therefore only walks the buckets that came due, so its cost tracks the
+// number of sessions expiring (plus sessions that were touched since they
+// were last scheduled) rather than the size of the store.
+//
+// When a persistent store is open (see session_store.c) the in-memory
+// shards are bypassed. Leases then hand out private snapshots of the
+// stored record. When a snapshot with dirty fields is released, only what
+// it changed is merged into the current stored record under the store's
+// writer lock: attributes it set or removed, and the core fields if
+// TORCHLIGHT_SESSION_DIRTY_CORE is set. Leases held by different workers
+// on the same session therefore keep each other's updates to other
+// attributes; for the same attribute the last release wins.
+//
+// Session attributes are packed into session->data as a sequence of
+// records: [type:1][key_len:1][value_len:2][key][value]. String values
+// keep their terminating NUL. Getters copy the value out under the arena
+// lock, since a concurrent set or remove may shift the records. Lookups
+// scan the (at most 1 KB) arena, which stays in cache; nothing is parsed
+// or serialized per request. Leases of an in-memory session share one
+// arena, so attribute accessors take a lock striped by session address.
+
+#define SESSION_SHARD_BITS 4
+#define SESSION_SHARD_COUNT (1 << SESSION_SHARD_BITS)
+#define SESSION_TABLE_INITIAL_CAPACITY 256
+#define SESSION_TABLE_MAX_LOAD_PERCENT 70
+#define SESSION_WHEEL_SLOTS 1024  // Power of two, one second per slot
+#define SESSION_REAPER_INTERVAL 1 // Seconds between background ticks
+#define SESSION_ATTR_HEADER_SIZE 4
+#define SESSION_ATTR_DIRTY_BITS 31 // Bit 31 is TORCHLIGHT_SESSION_DIRTY_CORE
+#define SESSION_ATTR_LOCK_STRIPES 64
+
+typedef struct session_entry {
+    session_t session;      // Must stay first: leases are cast back to entries
+    uint32_t refcount;
+    uint64_t hash;
+
+    // Timing wheel links, protected by the shard lock
+    struct session_entry* wheel_prev;
+    struct session_entry* wheel_next;
+    size_t wheel_slot;
+
+    bool snapshot;          // Lease over a persistent store record
+} session_entry_t;
+
+// Lease over a persistent store record
+typedef struct {
+    session_entry_t entry;  // Must stay first
+    session_t base;         // The record as loaded, to tell what changed
+} session_snapshot_t;
+
+typedef enum {
+    SESSION_ATTR_STRING = 1,
+    SESSION_ATTR_INT = 2,
+    SESSION_ATTR_BLOB = 3
+} session_attr_type_t;
+
+typedef struct {
+    uint64_t hash;
+    session_entry_t* entry;  // NULL marks an empty slot
+} session_slot_t;
+
+typedef struct {
+    pthread_rwlock_t lock;
+    session_slot_t* slots;
+    size_t capacity;         // Always a power of two
+    size_t count;
+
+    session_entry_t* wheel[SESSION_WHEEL_SLOTS];
+    time_t wheel_time;       // Last second the wheel has been advanced to
+} session_shard_t;
+
+static session_shard_t g_session_shards[SESSION_SHARD_COUNT];
+static pthread_once_t g_session_shards_once = PTHREAD_ONCE_INIT;
+static pthread_mutex_t g_session_attr_locks[SESSION_ATTR_LOCK_STRIPES];
+
+// Added to time(NULL); tests move it forward to drive expiry
+static time_t g_session_clock_offset = 0;
+
+// Background reaper state
+static pthread_t g_reaper_thread;
+static bool g_reaper_running = false;
+static pthread_mutex_t g_reaper_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t g_reaper_cond = PTHREAD_COND_INITIALIZER;
+
+static void session_shards_init(void) {
+    for (int i = 0; i < SESSION_SHARD_COUNT; i++) {
+        pthread_rwlock_init(&g_session_shards[i].lock, NULL);
+    }
+    for (int i = 0; i < SESSION_ATTR_LOCK_STRIPES; i++) {
+        pthread_mutex_init(&g_session_attr_locks[i], NULL);
+    }
+}
+
+// FNV-1a over the session ID string
+static uint64_t session_hash(const char* session_id) {
+    uint64_t hash = 0xcbf29ce484222325ULL;
+
+    for (const unsigned char* p = (const unsigned char*)session_id; *p; p++) {
+        hash ^= *p;
+        hash *= 0x100000001b3ULL;
+    }
+
+    return hash;
+}
+
+// The top bits pick the shard, the low bits pick the slot within it
+static session_shard_t* session_shard_for(uint64_t hash) {
+    pthread_once(&g_session_shards_once, session_shards_init);
+    return &g_session_shards[hash >> (64 - SESSION_SHARD_BITS)];
+}
+
+time_t tl_session_now(void) {
+    return time(NULL) + __atomic_load_n(&g_session_clock_offset, __ATOMIC_RELAXED);
+}
+
+void tl_session_clock_advance(time_t seconds) {
+    __atomic_add_fetch(&g_session_clock_offset, seconds, __ATOMIC_RELAXED);
+}
+
+// Generate random session ID (63 base62 characters, ~375 bits); -1 if the
+// random source failed and the ID is incomplete
+static int generate_session_id(char* session_id_out) {
+    return torchlight_random_base62(session_id_out, 63);
+}
+
+static void session_entry_retain(session_entry_t* entry) {
+    __atomic_add_fetch(&entry->refcount, 1, __ATOMIC_RELAXED);
+}
+
+static int session_snapshot_merge(session_t* stored, void* context);
+
+// Returns -1 if a dirty snapshot could not be written back to the store
+static int session_entry_release(session_entry_t* entry) {
+    if (__atomic_sub_fetch(&entry->refcount, 1, __ATOMIC_ACQ_REL) != 0) {
+        return 0;
+    }
+
+    int result = 0;
+    if (entry->snapshot && entry->session.dirty_fields) {
+        result = tl_session_store_update(entry->session.session_id, entry->hash,
+                                         session_snapshot_merge, entry);
+    }
+
+    free(entry);
+    return result;
+}
+
+// First second in which the session counts as expired
+static time_t session_expiry_time(const session_entry_t* entry) {
+    return __atomic_load_n(&entry->session.last_access_time, __ATOMIC_RELAXED) +
+           TORCHLIGHT_SESSION_TIMEOUT + 1;
+}
+
+static void session_wheel_link(session_shard_t* shard, session_entry_t* entry) {
+    size_t slot = (size_t)session_expiry_time(entry) & (SESSION_WHEEL_SLOTS - 1);
+
+    entry->wheel_slot = slot;
+    entry->wheel_prev = NULL;
+    entry->wheel_next = shard->wheel[slot];
+    if (entry->wheel_next) {
+        entry->wheel_next->wheel_prev = entry;
+    }
+    shard->wheel[slot] = entry;
+}
+
+static void session_wheel_unlink(session_shard_t* shard, session_entry_t* entry) {
+    if (entry->wheel_prev) {
+        entry->wheel_prev->wheel_next = entry->wheel_next;
+    } else {
+        shard->wheel[entry->wheel_slot] = entry->wheel_next;
+    }
+    if (entry->wheel_next) {
+        entry->wheel_next->wheel_prev = entry->wheel_prev;
+    }
+    entry->wheel_prev = NULL;
+    entry->wheel_next = NULL;
+}
+
+// Place an entry into a table known to have a free slot
+static void session_table_place(session_slot_t* slots, size_t capacity,
+                                uint64_t hash, session_entry_t* entry) {
+    size_t mask = capacity - 1;
+    size_t index = hash & mask;
+
+    while (slots[index].entry) {
+        index = (index + 1) & mask;
+    }
+
+    slots[index].hash = hash;
+    slots[index].entry = entry;
+}
+
+static int session_table_grow(session_shard_t* shard) {
+    size_t new_capacity = shard->capacity ? shard->capacity * 2 : SESSION_TABLE_INITIAL_CAPACITY;
+
+    session_slot_t* new_slots = calloc(new_capacity, sizeof(session_slot_t));
+    if (!new_slots) return -1;
+
+    for (size_t i = 0; i < shard->capacity; i++) {
+        if (shard->slots[i].entry) {
+            session_table_place(new_slots, new_capacity,
+                                shard->slots[i].hash, shard->slots[i].entry);
+        }
+    }
+
+    free(shard->slots);
+    shard->slots = new_slots;
+    shard->capacity = new_capacity;
+
+    return 0;
+}
+
+// Returns the slot index holding session_id, or -1
+static long session_table_find(const session_shard_t* shard, const char* session_id, uint64_t hash) {
+    if (shard->capacity == 0) return -1;
+
+    size_t mask = shard->capacity - 1;
+    size_t index = hash & mask;
+
+    while (shard->slots[index].entry) {
+        if (shard->slots[index].hash == hash &&
+            strcmp(shard->slots[index].entry->session.session_id, session_id) == 0) {
+            return (long)index;
+        }
+        index = (index + 1) & mask;
+    }
+
+    return -1;
+}
+
+// Backward-shift deletion: pull later members of the probe run into the
+// hole so that lookups never need tombstones to keep probing
+static void session_table_remove_at(session_shard_t* shard, size_t index) {
+    size_t mask = shard->capacity - 1;
+    size_t hole = index;
+    size_t next = (hole + 1) & mask;
+
+    while (shard->slots[next].entry) {
+        size_t home = shard->slots[next].hash & mask;
+
+        // Move the entry back if its home slot is not inside (hole, next]
+        if (((next - home) & mask) >= ((next - hole) & mask)) {
+            shard->slots[hole] = shard->slots[next];
+            hole = next;
+        }
+        next = (next + 1) & mask;
+    }
+
+    shard->slots[hole].entry = NULL;
+    shard->slots[hole].hash = 0;
+    __atomic_store_n(&shard->count, shard->count - 1, __ATOMIC_RELAXED);
+}
+
+int torchlight_create_session(const char* user_id, char* session_id_out) {
+    if (!session_id_out) return -1;
+
+    session_entry_t* entry = calloc(1, sizeof(session_entry_t));
+    if (!entry) return -1;
+
+    session_t* session = &entry->session;
+    if (user_id) {
+        strncpy(session->user_id, user_id, sizeof(session->user_id) - 1);
+    }
+
+    session->created_time = tl_session_now();
+    session->last_access_time = session->created_time;
+    session->authenticated = (user_id != NULL);
+    entry->refcount = 1;  // Reference owned by the table
+
+    if (tl_session_store_active()) {
+        int rc;
+        do {
+            if (generate_session_id(session->session_id) != 0) {
+                rc = -1;
+                break;
+            }
+            rc = tl_session_store_insert(session, session_hash(session->session_id));
+        } while (rc == 1);  // ID already taken
+
+        if (rc == 0) {
+            strcpy(session_id_out, session->session_id);
+        }
+        free(entry);
+        return rc;
+    }
+
+    for (;;) {
+        if (generate_session_id(session->session_id) != 0) {
+            free(entry);
+            return -1;
+        }
+        uint64_t hash = session_hash(session->session_id);
+        session_shard_t* shard = session_shard_for(hash);
+        entry->hash = hash;
+
+        pthread_rwlock_wrlock(&shard->lock);
+
+        // Regenerate on the (astronomically unlikely) event of an ID collision
+        if (session_table_find(shard, session->session_id, hash) >= 0) {
+            pthread_rwlock_unlock(&shard->lock);
+            continue;
+        }
+
+        if ((shard->count + 1) * 100 > shard->capacity * SESSION_TABLE_MAX_LOAD_PERCENT) {
+            if (session_table_grow(shard) != 0) {
+                pthread_rwlock_unlock(&shard->lock);
+                free(entry);
+                return -1;
+            }
+        }
+
+        session_table_place(shard->slots, shard->capacity, hash, entry);
+        __atomic_store_n(&shard->count, shard->count + 1, __ATOMIC_RELAXED);
+
+        if (shard->wheel_time == 0) {
+            shard->wheel_time = session->created_time;
+        }
+        session_wheel_link(shard, entry);
+
+        pthread_rwlock_unlock(&shard->lock);
+        break;
+    }
+
+    strcpy(session_id_out, session->session_id);
+    return 0;
+}
+
+session_t* torchlight_acquire_session(const char* session_id) {
+    if (!session_id) return NULL;
+
+    uint64_t hash = session_hash(session_id);
+
+    if (tl_session_store_active()) {
+        session_snapshot_t* snapshot = calloc(1, sizeof(session_snapshot_t));
+        if (!snapshot) return NULL;
+
+        if (tl_session_store_lookup(session_id, hash, &snapshot->base, true) != 0) {
+            free(snapshot);
+            return NULL;
+        }
+
+        snapshot->entry.session = snapshot->base;
+        snapshot->entry.refcount = 1;
+        snapshot->entry.hash = hash;
+        snapshot->entry.snapshot = true;
+        return &snapshot->entry.session;
+    }
+
+    session_shard_t* shard = session_shard_for(hash);
+    session_entry_t* entry = NULL;
+
+    pthread_rwlock_rdlock(&shard->lock);
+
+    long index = session_table_find(shard, session_id, hash);
+    if (index >= 0) {
+        entry = shard->slots[index].entry;
+        session_entry_retain(entry);
+        __atomic_store_n(&entry->session.last_access_time, tl_session_now(), __ATOMIC_RELAXED);
+    }
+
+    pthread_rwlock_unlock(&shard->lock);
+    return entry ? &entry->session : NULL;
+}
+
+int torchlight_release_session(session_t* session) {
+    if (!session) return 0;
+
+    return session_entry_release((session_entry_t*)session);
+}
+
+session_t* torchlight_get_session(const char* session_id) {
+    if (tl_session_store_active()) {
+        // Persistent records live in shared memory; hand out a per-thread copy
+        static __thread session_t copy;
+
+        if (!session_id || tl_session_store_lookup(session_id, session_hash(session_id), &copy, true) != 0) {
+            return NULL;
+        }
+        return &copy;
+    }
+
+    // Legacy unleased lookup: the table reference keeps the session alive
+    // only until it is destroyed or expires
+    session_t* session = torchlight_acquire_session(session_id);
+    if (session) {
+        torchlight_release_session(session);
+    }
+
+    return session;
+}
+
+int torchlight_destroy_session(const char* session_id) {
+    if (!session_id) return -1;
+
+    uint64_t hash = session_hash(session_id);
+
+    if (tl_session_store_active()) {
+        return tl_session_store_remove(session_id, hash);
+    }
+
+    session_shard_t* shard = session_shard_for(hash);
+
+    pthread_rwlock_wrlock(&shard->lock);
+
+    long index = session_table_find(shard, session_id, hash);
+    if (index < 0) {
+        pthread_rwlock_unlock(&shard->lock);
+        return -1;  // Session not found
+    }
+
+    session_entry_t* entry = shard->slots[index].entry;
+    session_table_remove_at(shard, (size_t)index);
+    session_wheel_unlink(shard, entry);
+
+    pthread_rwlock_unlock(&shard->lock);
+
+    session_entry_release(entry);
+    return 0;
+}
+
+// Advance one shard's wheel to `now`, expiring every session that came due
+static int session_wheel_advance(session_shard_t* shard, time_t now) {
+    int cleaned = 0;
+
+    if (shard->wheel_time == 0 || now <= shard->wheel_time) {
+        return 0;
+    }
+
+    // After a long pause every bucket is due, but each needs only one visit
+    time_t first = shard->wheel_time + 1;
+    if (now - first >= SESSION_WHEEL_SLOTS) {
+        first = now - SESSION_WHEEL_SLOTS + 1;
+    }
+
+    for (time_t t = first; t <= now; t++) {
+        size_t slot = (size_t)t & (SESSION_WHEEL_SLOTS - 1);
+
+        // Detach the bucket so relinked sessions are not revisited this pass
+        session_entry_t* entry = shard->wheel[slot];
+        shard->wheel[slot] = NULL;
+
+        while (entry) {
+            session_entry_t* next = entry->wheel_next;
+
+            if (session_expiry_time(entry) <= now) {
+                long index = session_table_find(shard, entry->session.session_id, entry->hash);
+                if (index >= 0) {
+                    session_table_remove_at(shard, (size_t)index);
+                }
+                session_entry_release(entry);
+                cleaned++;
+            } else {
+                // Touched since it was scheduled, or due on a later lap
+                session_wheel_link(shard, entry);
+            }
+
+            entry = next;
+        }
+    }
+
+    shard->wheel_time = now;
+    return cleaned;
+}
+
+int torchlight_cleanup_sessions(void) {
+    time_t now = tl_session_now();
+    int cleaned = 0;
+
+    if (tl_session_store_active()) {
+        return tl_session_store_expire(now, TORCHLIGHT_SESSION_TIMEOUT);
+    }
+
+    for (int s = 0; s < SESSION_SHARD_COUNT; s++) {
+        session_shard_t* shard = session_shard_for((uint64_t)s << (64 - SESSION_SHARD_BITS));
+
+        pthread_rwlock_wrlock(&shard->lock);
+        cleaned += session_wheel_advance(shard, now);
+        pthread_rwlock_unlock(&shard->lock);
+    }
+
+    return cleaned;
+}
+
+static void* session_reaper_main(void* arg) {
+    (void)arg;
+
+    pthread_mutex_lock(&g_reaper_mutex);
+
+    while (g_reaper_running) {
+        struct timespec wake;
+        clock_gettime(CLOCK_REALTIME, &wake);
+        wake.tv_sec += SESSION_REAPER_INTERVAL;
+        pthread_cond_timedwait(&g_reaper_cond, &g_reaper_mutex, &wake);
+
+        if (!g_reaper_running) break;
+
+        pthread_mutex_unlock(&g_reaper_mutex);
+        torchlight_cleanup_sessions();
+        pthread_mutex_lock(&g_reaper_mutex);
+    }
+
+    pthread_mutex_unlock(&g_reaper_mutex);
+    return NULL;
+}
+
+int torchlight_start_session_reaper(void) {
+    pthread_mutex_lock(&g_reaper_mutex);
+
+    if (g_reaper_running) {
+        pthread_mutex_unlock(&g_reaper_mutex);
+        return 0;  // Already running
+    }
+
+    g_reaper_running = true;
+    if (pthread_create(&g_reaper_thread, NULL, session_reaper_main, NULL) != 0) {
+        g_reaper_running = false;
+        pthread_mutex_unlock(&g_reaper_mutex);
+        return -1;
+    }
+
+    pthread_mutex_unlock(&g_reaper_mutex);
+    return 0;
+}
+
+void torchlight_stop_session_reaper(void) {
+    pthread_mutex_lock(&g_reaper_mutex);
+
+    if (!g_reaper_running) {
+        pthread_mutex_unlock(&g_reaper_mutex);
+        return;
+    }
+
+    g_reaper_running = false;
+    pthread_cond_signal(&g_reaper_cond);
+    pthread_mutex_unlock(&g_reaper_mutex);
+
+    pthread_join(g_reaper_thread, NULL);
+}
+
+int torchlight_session_count(void) {
+    size_t count = 0;
+
+    if (tl_session_store_active()) {
+        return tl_session_store_count();
+    }
+
+    for (int s = 0; s < SESSION_SHARD_COUNT; s++) {
+        count += __atomic_load_n(&g_session_shards[s].count, __ATOMIC_RELAXED);
+    }
+
+    return (int)count;
+}
+
+// Session attributes
+
+static uint32_t session_attr_dirty_bit(size_t ordinal) {
+    if (ordinal >= SESSION_ATTR_DIRTY_BITS) ordinal = SESSION_ATTR_DIRTY_BITS - 1;
+    return 1u << ordinal;
+}
+
+// Bits for ordinals [first, last]: attributes that shifted position
+static uint32_t session_attr_dirty_range(size_t first, size_t last) {
+    uint32_t bits = 0;
+    for (size_t ordinal = first; ordinal <= last; ordinal++) {
+        bits |= session_attr_dirty_bit(ordinal);
+        if (ordinal >= SESSION_ATTR_DIRTY_BITS) break;
+    }
+    return bits;
+}
+
+// Find an attribute record. Returns its offset in the arena or -1, and
+// reports its ordinal (or the ordinal a new attribute would get).
+static long session_attr_find(const session_t* session, const char* key, size_t key_len,
+                              size_t* ordinal_out) {
+    const unsigned char* arena = (const unsigned char*)session->data;
+    size_t offset = 0;
+    size_t ordinal = 0;
+
+    while (offset + SESSION_ATTR_HEADER_SIZE <= session->data_length) {
+        size_t record_key_len = arena[offset + 1];
+        size_t value_len = arena[offset + 2] | ((size_t)arena[offset + 3] << 8);
+
+        if (record_key_len == key_len &&
+            memcmp(arena + offset + SESSION_ATTR_HEADER_SIZE, key, key_len) == 0) {
+            if (ordinal_out) *ordinal_out = ordinal;
+            return (long)offset;
+        }
+
+        offset += SESSION_ATTR_HEADER_SIZE + record_key_len + value_len;
+        ordinal++;
+    }
+
+    if (ordinal_out) *ordinal_out = ordinal;
+    return -1;
+}
+
+static size_t session_attr_record_size(const session_t* session, size_t offset) {
+    const unsigned char* arena = (const unsigned char*)session->data;
+    return SESSION_ATTR_HEADER_SIZE + arena[offset + 1] +
+           (arena[offset + 2] | ((size_t)arena[offset + 3] << 8));
+}
+
+static void session_attr_remove_at(session_t* session, size_t offset) {
+    size_t record_size = session_attr_record_size(session, offset);
+
+    memmove(session->data + offset, session->data + offset + record_size,
+            session->data_length - offset - record_size);
+    session->data_length -= record_size;
+}
+
+static pthread_mutex_t* session_attr_lock(const session_t* session) {
+    pthread_once(&g_session_shards_once, session_shards_init);
+
+    uint64_t mix = ((uint64_t)(uintptr_t)session >> 6) * 0x9e3779b97f4a7c15ULL;
+    return &g_session_attr_locks[mix >> 58];  // Top 6 bits: 64 stripes
+}
+
+static int session_attr_put(session_t* session, const char* key, size_t key_len,
+                            session_attr_type_t type, const void* value, size_t value_len) {
+    size_t ordinal;
+    long offset = session_attr_find(session, key, key_len, &ordinal);
+    unsigned char* arena = (unsigned char*)session->data;
+
+    if (offset >= 0) {
+        size_t old_value_len = arena[offset + 2] | ((size_t)arena[offset + 3] << 8);
+
+        // Same size: overwrite the value in place
+        if (old_value_len == value_len) {
+            arena[offset] = (unsigned char)type;
+            if (value_len) {
+                memcpy(arena + offset + SESSION_ATTR_HEADER_SIZE + key_len, value, value_len);
+            }
+            session->dirty_fields |= session_attr_dirty_bit(ordinal);
+            return 0;
+        }
+
+        size_t free_space = sizeof(session->data) - session->data_length +
+                            SESSION_ATTR_HEADER_SIZE + key_len + old_value_len;
+        if (SESSION_ATTR_HEADER_SIZE + key_len + value_len > free_space) return -1;
+
+        // Different size: drop the old record and append a new one, which
+        // shifts every later attribute down one position
+        size_t first = ordinal;
+        session_attr_remove_at(session, (size_t)offset);
+        session_attr_find(session, key, key_len, &ordinal);
+        session->dirty_fields |= session_attr_dirty_range(first, ordinal);
+    } else if (session->data_length + SESSION_ATTR_HEADER_SIZE + key_len + value_len > sizeof(session->data)) {
+        return -1;  // Arena full
+    }
+
+    unsigned char* record = arena + session->data_length;
+    record[0] = (unsigned char)type;
+    record[1] = (unsigned char)key_len;
+    record[2] = (unsigned char)(value_len & 0xFF);
+    record[3] = (unsigned char)(value_len >> 8);
+    memcpy(record + SESSION_ATTR_HEADER_SIZE, key, key_len);
+    if (value_len) {
+        memcpy(record + SESSION_ATTR_HEADER_SIZE + key_len, value, value_len);
+    }
+
+    session->data_length += (uint16_t)(SESSION_ATTR_HEADER_SIZE + key_len + value_len);
+    session->dirty_fields |= session_attr_dirty_bit(ordinal);
+    return 0;
+}
+
+static int session_attr_delete(session_t* session, const char* key, size_t key_len) {
+    size_t ordinal;
+    long offset = session_attr_find(session, key, key_len, &ordinal);
+    if (offset < 0) return -1;
+
+    size_t first = ordinal;
+    session_attr_remove_at(session, (size_t)offset);
+    session_attr_find(session, key, key_len, &ordinal);  // Now the attribute count
+
+    // The removed slot and everything after it changed
+    session->dirty_fields |= session_attr_dirty_range(first, ordinal);
+    return 0;
+}
+
+static int session_attr_set(session_t* session, const char* key, session_attr_type_t type,
+                            const void* value, size_t value_len) {
+    if (!session || !key || (!value && value_len)) return -1;
+
+    size_t key_len = strlen(key);
+    if (key_len == 0 || key_len > 255 || value_len > 0xFFFF) return -1;
+
+    pthread_mutex_t* lock = session_attr_lock(session);
+    pthread_mutex_lock(lock);
+    int result = session_attr_put(session, key, key_len, type, value, value_len);
+    pthread_mutex_unlock(lock);
+
+    return result;
+}
+
+// Copy a value out under the arena lock; a pointer into the arena would be
+// left dangling by the next set or remove on any lease of the session.
+// Returns the full value length, or -1 if the attribute is missing or of
+// another type.
+static long session_attr_copy(const session_t* session, const char* key, session_attr_type_t type,
+                              void* out, size_t out_size) {
+    if (!session || !key || (!out && out_size)) return -1;
+
+    size_t key_len = strlen(key);
+    long result = -1;
+
+    pthread_mutex_t* lock = session_attr_lock(session);
+    pthread_mutex_lock(lock);
+
+    long offset = session_attr_find(session, key, key_len, NULL);
+    if (offset >= 0) {
+        const unsigned char* record = (const unsigned char*)session->data + offset;
+        if (record[0] == type) {
+            size_t value_len = record[2] | ((size_t)record[3] << 8);
+            memcpy(out, record + SESSION_ATTR_HEADER_SIZE + key_len, value_len < out_size ? value_len : out_size);
+            result = (long)value_len;
+        }
+    }
+
+    pthread_mutex_unlock(lock);
+    return result;
+}
+
+// Merge a released snapshot into the current stored record (see the top of
+// this file). Dirty bits narrow the scan to attributes whose position
+// changed; comparing with the loaded record drops those that only moved.
+// Returns -1 if an attribute no longer fits next to the stored ones.
+static int session_snapshot_merge(session_t* stored, void* context) {
+    const session_snapshot_t* snapshot = context;
+    const session_t* lease = &snapshot->entry.session;
+    const session_t* base = &snapshot->base;
+    uint32_t dirty = lease->dirty_fields;
+
+    if (dirty & TORCHLIGHT_SESSION_DIRTY_CORE) {
+        memcpy(stored->user_id, lease->user_id, sizeof(stored->user_id));
+        stored->authenticated = lease->authenticated;
+    }
+
+    // Set or added by the lease
+    const unsigned char* arena = (const unsigned char*)lease->data;
+    size_t ordinal = 0;
+    for (size_t offset = 0; offset + SESSION_ATTR_HEADER_SIZE <= lease->data_length; ordinal++) {
+        size_t record_size = session_attr_record_size(lease, offset);
+
+        if (dirty & session_attr_dirty_bit(ordinal)) {
+            const char* key = (const char*)arena + offset + SESSION_ATTR_HEADER_SIZE;
+            size_t key_len = arena[offset + 1];
+            long loaded = session_attr_find(base, key, key_len, NULL);
+
+            if (loaded < 0 || session_attr_record_size(base, (size_t)loaded) != record_size ||
+                memcmp(base->data + loaded, arena + offset, record_size) != 0) {
+                if (session_attr_put(stored, key, key_len, (session_attr_type_t)arena[offset],
+                                     arena + offset + SESSION_ATTR_HEADER_SIZE + key_len,
+                                     record_size - SESSION_ATTR_HEADER_SIZE - key_len) != 0) {
+                    return -1;
+                }
+            }
+        }
+        offset += record_size;
+    }
+
+    // Removed by the lease
+    if (dirty & ~TORCHLIGHT_SESSION_DIRTY_CORE) {
+        const unsigned char* loaded = (const unsigned char*)base->data;
+        for (size_t offset = 0; offset + SESSION_ATTR_HEADER_SIZE <= base->data_length;) {
+            const char* key = (const char*)loaded + offset + SESSION_ATTR_HEADER_SIZE;
+            size_t key_len = loaded[offset + 1];
+
+            if (session_attr_find(lease, key, key_len, NULL) < 0) {
+                session_attr_delete(stored, key, key_len);
+            }
+            offset += session_attr_record_size(base, offset);
+        }
+    }
+
+    stored->dirty_fields = 0;
+    return 0;
+}
+
+int torchlight_session_set_string(session_t* session, const char* key, const char* value) {
+    if (!value) return -1;
+    return session_attr_set(session, key, SESSION_ATTR_STRING, value, strlen(value) + 1);
+}
+
+int torchlight_session_set_int(session_t* session, const char* key, int64_t value) {
+    return session_attr_set(session, key, SESSION_ATTR_INT, &value, sizeof(value));
+}
+
+int torchlight_session_set_blob(session_t* session, const char* key, const void* value, size_t length) {
+    return session_attr_set(session, key, SESSION_ATTR_BLOB, value, length);
+}
+
+int torchlight_session_get_string(const session_t* session, const char* key, char* buffer, size_t buffer_size) {
+    if (!buffer || buffer_size == 0) return -1;
+
+    // Stored with its NUL, which the copy drops if it has to truncate
+    long length = session_attr_copy(session, key, SESSION_ATTR_STRING, buffer, buffer_size);
+    if (length <= 0) return -1;
+
+    buffer[(size_t)length <= buffer_size ? (size_t)length - 1 : buffer_size - 1] = '\0';
+    return (int)(length - 1);
+}
+
+int torchlight_session_get_int(const session_t* session, const char* key, int64_t* value_out) {
+    if (!value_out) return -1;
+
+    int64_t value;
+    if (session_attr_copy(session, key, SESSION_ATTR_INT, &value, sizeof(value)) != (long)sizeof(value)) {
+        return -1;
+    }
+
+    *value_out = value;
+    return 0;
+}
+
+int torchlight_session_get_blob(const session_t* session, const char* key, void* buffer, size_t buffer_size) {
+    long length = session_attr_copy(session, key, SESSION_ATTR_BLOB, buffer, buffer_size);
+    return length < 0 ? -1 : (int)length;
+}
+
+int torchlight_session_remove_attr(session_t* session, const char* key) {
+    if (!session || !key) return -1;
+
+    pthread_mutex_t* lock = session_attr_lock(session);
+    pthread_mutex_lock(lock);
+    int result = session_attr_delete(session, key, strlen(key));
+    pthread_mutex_unlock(lock);
+
+    return result;
+}
+
+int torchlight_update_session(const char* session_id, const char* data) {
+    if (!session_id || !data) return -1;
+
+    session_t* session = torchlight_acquire_session(session_id);
+    if (!session) return -1;
+
+    int result = torchlight_session_set_string(session, "data", data);
+    if (torchlight_release_session(session) != 0) result = -1;
+
+    return result;
+}
@@ -0,0 +1,631 @@
+/*
+ * TorchLight Persistent Session Store
+ * Memory-mapped session backend shared across processes and restarts
+ */
+
+#define _GNU_SOURCE  // F_OFD_SETLKW
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sched.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "torchlight.h"
+#include "torchlight_internal.h"
+
+// The store is a single file holding a header followed by a fixed number
+// of slots, laid out as an open-addressing hash table with linear probing.
+//
+// Readers never lock or enter the kernel. Every slot carries a sequence
+// counter that writers make odd while the slot is being rewritten, and the
+// header carries a layout counter that is odd while a deletion is shifting
+// entries between slots. A reader copies the record out and retries if
+// either counter moved underneath it.
+//
+// Writers serialize on a robust, process-shared mutex in the header. If a
+// worker dies mid-write, the next writer sees EOWNERDEAD and repairs the
+// table before continuing. The first process to attach (holding an
+// exclusive flock) does the same for a store left behind by a crash of the
+// whole service, then reinitializes the mutex.
+//
+// Attaching is serialized by a separate init lock (an OFD lock on the first
+// byte, which does not interact with flock). Converting the exclusive flock
+// to a shared one is not atomic, so without it another process could take
+// the exclusive lock in between and reset the mutex under us.
+//
+// Crash consistency covers processes: records live in the page cache and a
+// dead worker's writes are not lost. A host or power failure loses whatever
+// the kernel had not yet written back. Slots are not msync'd per write;
+// closing the store flushes the file.
+
+#define SESSION_STORE_MAGIC 0x31455453534c5454ULL  // "TTLSSTE1"
+#define SESSION_STORE_VERSION 1
+#define SESSION_STORE_DEFAULT_SLOTS (1 << 17)
+#define SESSION_STORE_MAX_LOAD_PERCENT 90
+#define SESSION_STORE_SWEEP_DIVISOR 64  // Full expiry sweep every 64 ticks
+#define SESSION_STORE_SPIN_LIMIT 64
+
+typedef struct {
+    uint64_t magic;
+    uint32_t version;
+    uint32_t record_size;     // sizeof(session_t) of the writer's build
+    uint64_t slot_count;      // Power of two
+    uint64_t slot_size;
+    uint64_t count;           // Live sessions
+    uint64_t layout_seq;      // Odd while a deletion is moving entries
+    uint64_t sweep_cursor;    // Next slot for the incremental expiry sweep
+    pthread_mutex_t lock;     // Robust, process-shared writer lock
+} session_store_header_t;
+
+typedef union {
+    session_store_header_t header;
+    char padding[512];
+} session_store_header_block_t;
+
+typedef struct {
+    uint64_t seq;             // Odd while the slot is being written
+    uint64_t hash;            // 0 marks an empty slot
+    int64_t last_access_time; // Updated in place without the writer lock
+    session_t record;
+} session_store_slot_t;
+
+static struct {
+    int fd;
+    void* base;
+    size_t length;
+    session_store_header_t* header;
+    char* slots;
+    size_t slot_size;
+    size_t mask;
+} g_store = { .fd = -1 };
+
+static session_store_slot_t* store_slot(size_t index) {
+    return (session_store_slot_t*)(g_store.slots + index * g_store.slot_size);
+}
+
+static uint64_t store_hash(uint64_t hash) {
+    return hash ? hash : 1;  // Reserve 0 for empty slots
+}
+
+// Seqlock helpers. Writers hold the store lock.
+
+static void slot_begin_write(session_store_slot_t* slot) {
+    __atomic_store_n(&slot->seq, slot->seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static void slot_end_write(session_store_slot_t* slot) {
+    __atomic_store_n(&slot->seq, slot->seq + 1, __ATOMIC_RELEASE);
+}
+
+static void layout_begin_write(void) {
+    __atomic_store_n(&g_store.header->layout_seq, g_store.header->layout_seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static void layout_end_write(void) {
+    __atomic_store_n(&g_store.header->layout_seq, g_store.header->layout_seq + 1, __ATOMIC_RELEASE);
+}
+
+static void store_backoff(int* spins) {
+    if (++(*spins) > SESSION_STORE_SPIN_LIMIT) {
+        sched_yield();
+        *spins = 0;
+    }
+}
+
+// Rebuild the table in place after a writer died mid-update: drop torn
+// slots, drop duplicates left by an interrupted shift, and reinsert every
+// survivor from its home slot so no probe run contains a hole. Returns the
+// number of sessions recovered, or -1 if the rebuild could not run.
+static long session_store_repair(void) {
+    size_t slot_count = g_store.mask + 1;
+    uint64_t live = 0;
+
+    // A writer that died inside a deletion leaves the layout counter odd
+    if (!(g_store.header->layout_seq & 1)) {
+        layout_begin_write();
+    }
+
+    for (size_t i = 0; i < slot_count; i++) {
+        session_store_slot_t* slot = store_slot(i);
+        if (slot->seq & 1) {
+            slot->hash = 0;
+            slot->seq++;
+        }
+    }
+
+    session_store_slot_t* moving = malloc(g_store.slot_size);
+    if (!moving) {
+        layout_end_write();
+        return -1;
+    }
+
+    // Reinsert every entry from its home slot until nothing moves; at that
+    // point each entry sits at the first free slot of its probe sequence
+    bool moved = true;
+    while (moved) {
+        moved = false;
+
+        for (size_t i = 0; i < slot_count; i++) {
+            session_store_slot_t* slot = store_slot(i);
+            if (slot->hash == 0) continue;
+
+            memcpy(moving, slot, g_store.slot_size);
+            slot->hash = 0;
+
+            size_t index = moving->hash & g_store.mask;
+            bool duplicate = false;
+
+            while (store_slot(index)->hash) {
+                session_store_slot_t* other = store_slot(index);
+                if (other->hash == moving->hash &&
+                    strcmp(other->record.session_id, moving->record.session_id) == 0) {
+                    duplicate = true;
+                    break;
+                }
+                index = (index + 1) & g_store.mask;
+            }
+
+            if (duplicate) {
+                moved = true;
+                continue;
+            }
+
+            session_store_slot_t* target = store_slot(index);
+            uint64_t seq = target->seq;
+            memcpy(target, moving, g_store.slot_size);
+            target->seq = seq + 2;
+            moved |= (index != i);
+        }
+    }
+
+    free(moving);
+
+    for (size_t i = 0; i < slot_count; i++) {
+        if (store_slot(i)->hash) live++;
+    }
+
+    g_store.header->count = live;
+    layout_end_write();
+
+    return (long)live;
+}
+
+static void store_report_repair(long live) {
+    if (live < 0) return;
+    printf("🩹 Session store repaired (%lu sessions recovered)\n", (unsigned long)live);
+}
+
+// Sessions recovered under the lock, reported by store_unlock() once the
+// lock is dropped; -1 when there was no repair
+static __thread long t_store_repaired = -1;
+
+static int store_lock(void) {
+    int rc = pthread_mutex_lock(&g_store.header->lock);
+
+    if (rc == EOWNERDEAD) {
+        // A worker died holding the lock; its last write may be torn
+        t_store_repaired = session_store_repair();
+        pthread_mutex_consistent(&g_store.header->lock);
+        return 0;
+    }
+
+    return rc == 0 ? 0 : -1;
+}
+
+static void store_unlock(void) {
+    long repaired = t_store_repaired;
+    t_store_repaired = -1;
+
+    pthread_mutex_unlock(&g_store.header->lock);
+
+    store_report_repair(repaired);
+}
+
+// Held from open() until this process holds its shared flock
+static int store_init_lock(int fd, short type) {
+    struct flock lock = {
+        .l_type = type,
+        .l_whence = SEEK_SET,
+        .l_start = 0,
+        .l_len = 1
+    };
+
+    while (fcntl(fd, F_OFD_SETLKW, &lock) != 0) {
+        if (errno != EINTR) return -1;
+    }
+    return 0;
+}
+
+static int store_init_mutex(void) {
+    pthread_mutexattr_t attr;
+
+    if (pthread_mutexattr_init(&attr) != 0) return -1;
+    pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+    pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+
+    int rc = pthread_mutex_init(&g_store.header->lock, &attr);
+    pthread_mutexattr_destroy(&attr);
+
+    return rc == 0 ? 0 : -1;
+}
+
+int torchlight_open_session_store(const char* path, size_t slot_count) {
+    if (!path || !path[0]) return -1;
+    if (g_store.base) return 0;  // Already open
+
+    if (slot_count == 0) slot_count = SESSION_STORE_DEFAULT_SLOTS;
+
+    // Round up to a power of two
+    size_t slots = 1;
+    while (slots < slot_count) slots <<= 1;
+
+    size_t slot_size = (sizeof(session_store_slot_t) + 63) & ~(size_t)63;
+
+    int fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if (fd < 0) {
+        printf("❌ Cannot open session store %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+
+    if (store_init_lock(fd, F_WRLCK) != 0) {
+        printf("❌ Cannot lock session store %s: %s\n", path, strerror(errno));
+        close(fd);
+        return -1;
+    }
+
+    // Whoever gets the exclusive flock is the only process attached, so it
+    // may initialize or repair the file. Closing fd drops the init lock too.
+    bool exclusive = flock(fd, LOCK_EX | LOCK_NB) == 0;
+    if (!exclusive && flock(fd, LOCK_SH) != 0) {
+        close(fd);
+        return -1;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        return -1;
+    }
+
+    // An empty file is new. A zero magic means an earlier attach died
+    // before publishing the header; the magic is written last. Anything
+    // else without our magic is somebody else's file and is left alone.
+    session_store_header_block_t probe = {0};
+    bool fresh = st.st_size == 0;
+
+    if (!fresh) {
+        if (st.st_size < (off_t)sizeof(probe) ||
+            pread(fd, &probe, sizeof(probe), 0) != (ssize_t)sizeof(probe) ||
+            (probe.header.magic != SESSION_STORE_MAGIC && probe.header.magic != 0)) {
+            printf("❌ %s is not a session store\n", path);
+            close(fd);
+            return -1;
+        }
+        fresh = probe.header.magic == 0;
+    }
+
+    if (fresh) {
+        if (!exclusive) {
+            printf("❌ Session store %s is not initialized\n", path);
+            close(fd);
+            return -1;
+        }
+    } else {
+        if (probe.header.version != SESSION_STORE_VERSION ||
+            probe.header.record_size != sizeof(session_t) ||
+            probe.header.slot_size != slot_size) {
+            printf("❌ Session store %s has an incompatible layout\n", path);
+            close(fd);
+            return -1;
+        }
+        slots = probe.header.slot_count;  // The file's geometry wins
+    }
+
+    size_t length = sizeof(session_store_header_block_t) + slots * slot_size;
+
+    // Truncating first zeroes whatever a dead attach left behind; the size
+    // from fstat() is stale after that, so a fresh file is always resized
+    if (fresh && (ftruncate(fd, 0) != 0 || ftruncate(fd, (off_t)length) != 0)) {
+        close(fd);
+        return -1;
+    }
+    if (!fresh && (size_t)st.st_size < length && ftruncate(fd, (off_t)length) != 0) {
+        close(fd);
+        return -1;
+    }
+
+    void* base = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (base == MAP_FAILED) {
+        close(fd);
+        return -1;
+    }
+
+    g_store.fd = fd;
+    g_store.base = base;
+    g_store.length = length;
+    g_store.header = &((session_store_header_block_t*)base)->header;
+    g_store.slots = (char*)base + sizeof(session_store_header_block_t);
+    g_store.slot_size = slot_size;
+    g_store.mask = slots - 1;
+
+    if (exclusive) {
+        if (fresh) {
+            g_store.header->version = SESSION_STORE_VERSION;
+            g_store.header->record_size = sizeof(session_t);
+            g_store.header->slot_count = slots;
+            g_store.header->slot_size = slot_size;
+        }
+
+        // Any lock state in the file belongs to processes that are gone
+        store_init_mutex();
+
+        if (!fresh) {
+            bool torn = g_store.header->layout_seq & 1;
+            for (size_t i = 0; i < slots && !torn; i++) {
+                torn = store_slot(i)->seq & 1;
+            }
+            if (torn) store_report_repair(session_store_repair());
+        }
+
+        if (fresh) {
+            __atomic_store_n(&g_store.header->magic, SESSION_STORE_MAGIC, __ATOMIC_RELEASE);
+            msync(base, sizeof(session_store_header_block_t), MS_SYNC);
+        }
+
+        flock(fd, LOCK_SH);
+    }
+
+    store_init_lock(fd, F_UNLCK);
+
+    printf("💾 Session store mapped: %s (%lu slots, %lu sessions)\n",
+           path, (unsigned long)slots, (unsigned long)g_store.header->count);
+    return 0;
+}
+
+void torchlight_close_session_store(void) {
+    if (!g_store.base) return;
+
+    msync(g_store.base, g_store.length, MS_SYNC);
+    munmap(g_store.base, g_store.length);
+    close(g_store.fd);
+
+    g_store.base = NULL;
+    g_store.header = NULL;
+    g_store.slots = NULL;
+    g_store.fd = -1;
+}
+
+bool tl_session_store_active(void) {
+    return g_store.base != NULL;
+}
+
+// Copy a session out of the store without taking any lock.
+// Returns 0 when found, -1 otherwise.
+int tl_session_store_lookup(const char* session_id, uint64_t hash, session_t* out, bool touch) {
+    hash = store_hash(hash);
+    int spins = 0;
+
+    for (;;) {
+        uint64_t layout = __atomic_load_n(&g_store.header->layout_seq, __ATOMIC_ACQUIRE);
+        if (layout & 1) {
+            store_backoff(&spins);
+            continue;
+        }
+
+        size_t index = hash & g_store.mask;
+        int found = -1;
+        bool retry = false;
+
+        for (size_t probes = 0; probes <= g_store.mask; probes++) {
+            session_store_slot_t* slot = store_slot(index);
+
+            uint64_t seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+            if (seq & 1) {
+                retry = true;
+                break;
+            }
+
+            uint64_t slot_hash = __atomic_load_n(&slot->hash, __ATOMIC_RELAXED);
+            if (slot_hash == 0) break;
+
+            if (slot_hash == hash) {
+                memcpy(out, &slot->record, sizeof(session_t));
+                out->last_access_time = (time_t)__atomic_load_n(&slot->last_access_time, __ATOMIC_RELAXED);
+                __atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+                if (__atomic_load_n(&slot->seq, __ATOMIC_RELAXED) != seq) {
+                    retry = true;
+                    break;
+                }
+
+                if (strncmp(out->session_id, session_id, sizeof(out->session_id)) == 0) {
+                    if (touch) {
+                        __atomic_store_n(&slot->last_access_time, (int64_t)tl_session_now(), __ATOMIC_RELAXED);
+                    }
+                    found = 0;
+                    break;
+                }
+            }
+
+            index = (index + 1) & g_store.mask;
+        }
+
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (!retry && __atomic_load_n(&g_store.header->layout_seq, __ATOMIC_RELAXED) == layout) {
+            return found;
+        }
+
+        store_backoff(&spins);
+    }
+}
+
+// Writer-side probe; caller holds the store lock
+static long store_find_locked(const char* session_id, uint64_t hash) {
+    size_t index = hash & g_store.mask;
+
+    for (size_t probes = 0; probes <= g_store.mask; probes++) {
+        session_store_slot_t* slot = store_slot(index);
+
+        if (slot->hash == 0) return -1;
+        if (slot->hash == hash && strcmp(slot->record.session_id, session_id) == 0) {
+            return (long)index;
+        }
+        index = (index + 1) & g_store.mask;
+    }
+
+    return -1;
+}
+
+// Returns 0 on success, 1 if the ID is already taken, -1 if the store is full
+int tl_session_store_insert(const session_t* session, uint64_t hash) {
+    hash = store_hash(hash);
+
+    if (store_lock() != 0) return -1;
+
+    if (store_find_locked(session->session_id, hash) >= 0) {
+        store_unlock();
+        return 1;
+    }
+
+    if ((g_store.header->count + 1) * 100 > (g_store.mask + 1) * SESSION_STORE_MAX_LOAD_PERCENT) {
+        store_unlock();
+        return -1;
+    }
+
+    size_t index = hash & g_store.mask;
+    while (store_slot(index)->hash) {
+        index = (index + 1) & g_store.mask;
+    }
+
+    session_store_slot_t* slot = store_slot(index);
+    slot_begin_write(slot);
+    memcpy(&slot->record, session, sizeof(session_t));
+    slot->last_access_time = (int64_t)session->last_access_time;
+    __atomic_store_n(&slot->hash, hash, __ATOMIC_RELAXED);
+    slot_end_write(slot);
+
+    __atomic_store_n(&g_store.header->count, g_store.header->count + 1, __ATOMIC_RELAXED);
+
+    store_unlock();
+    return 0;
+}
+
+// Apply `merge` to the stored record under the writer lock. The merge runs
+// on a copy, which is then published with a single slot write, so readers
+// never see a half-merged record. If the merge fails nothing is published.
+int tl_session_store_update(const char* session_id, uint64_t hash,
+                            int (*merge)(session_t* stored, void* context), void* context) {
+    hash = store_hash(hash);
+
+    if (store_lock() != 0) return -1;
+
+    long index = store_find_locked(session_id, hash);
+    if (index < 0) {
+        store_unlock();
+        return -1;  // Destroyed or expired meanwhile
+    }
+
+    session_store_slot_t* slot = store_slot((size_t)index);
+    session_t record;
+    memcpy(&record, &slot->record, sizeof(session_t));
+    if (merge(&record, context) != 0) {
+        store_unlock();
+        return -1;
+    }
+
+    slot_begin_write(slot);
+    memcpy(&slot->record, &record, sizeof(session_t));
+    slot_end_write(slot);
+
+    store_unlock();
+    return 0;
+}
+
+// Backward-shift deletion; caller holds the store lock
+static void store_remove_at(size_t index) {
+    size_t hole = index;
+    size_t next = (hole + 1) & g_store.mask;
+
+    layout_begin_write();
+
+    while (store_slot(next)->hash) {
+        session_store_slot_t* from = store_slot(next);
+        size_t home = from->hash & g_store.mask;
+
+        if (((next - home) & g_store.mask) >= ((next - hole) & g_store.mask)) {
+            session_store_slot_t* to = store_slot(hole);
+            slot_begin_write(to);
+            memcpy(&to->record, &from->record, sizeof(session_t));
+            to->last_access_time = from->last_access_time;
+            to->hash = from->hash;
+            slot_end_write(to);
+            hole = next;
+        }
+        next = (next + 1) & g_store.mask;
+    }
+
+    session_store_slot_t* slot = store_slot(hole);
+    slot_begin_write(slot);
+    slot->hash = 0;
+    slot_end_write(slot);
+
+    __atomic_store_n(&g_store.header->count, g_store.header->count - 1, __ATOMIC_RELAXED);
+    layout_end_write();
+}
+
+int tl_session_store_remove(const char* session_id, uint64_t hash) {
+    hash = store_hash(hash);
+
+    if (store_lock() != 0) return -1;
+
+    long index = store_find_locked(session_id, hash);
+    if (index >= 0) {
+        store_remove_at((size_t)index);
+    }
+
+    store_unlock();
+    return index >= 0 ? 0 : -1;
+}
+
+// Sweep the next slice of the table. Every process shares the cursor, so
+// the whole table is covered once per SESSION_STORE_SWEEP_DIVISOR ticks
+// no matter how many workers are attached.
+int tl_session_store_expire(time_t now, int timeout) {
+    size_t slot_count = g_store.mask + 1;
+    size_t budget = slot_count / SESSION_STORE_SWEEP_DIVISOR;
+    int cleaned = 0;
+
+    if (budget == 0) budget = slot_count;
+    if (store_lock() != 0) return 0;
+
+    size_t index = g_store.header->sweep_cursor & g_store.mask;
+    for (size_t n = 0; n < budget; n++) {
+        session_store_slot_t* slot = store_slot(index);
+        time_t last_access = (time_t)__atomic_load_n(&slot->last_access_time, __ATOMIC_RELAXED);
+
+        if (slot->hash && now - last_access > timeout) {
+            // Removal may shift another entry into this slot, so re-examine it
+            store_remove_at(index);
+            cleaned++;
+        } else {
+            index = (index + 1) & g_store.mask;
+        }
+    }
+    g_store.header->sweep_cursor = index;
+
+    store_unlock();
+    return cleaned;
+}
+
+int tl_session_store_count(void) {
+    return (int)__atomic_load_n(&g_store.header->count, __ATOMIC_RELAXED);
+}
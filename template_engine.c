@@ -1,194 +1,2519 @@
 /*
  * TorchLight Template Engine
- * Simple variable substitution for dynamic content
+ * Compiled templates with variable substitution for dynamic content
  */
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <limits.h>
+#include <ctype.h>
+#include <strings.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/stat.h>
 #include "torchlight.h"
+#include "torchlight_internal.h"
 
-// Simple template variable substitution
-// Replaces {{variable}} with values from JSON object
-
-static char* find_json_value(const char* json, const char* key) {
-    if (!json || !key) return NULL;
-    
-    // Simple JSON value extraction (not a full parser)
-    char search_pattern[128];
-    snprintf(search_pattern, sizeof(search_pattern), "\"%s\":", key);
-    
-    const char* key_pos = strstr(json, search_pattern);
-    if (!key_pos) return NULL;
-    
-    // Find the value after the colon
-    const char* value_start = strchr(key_pos, ':');
-    if (!value_start) return NULL;
-    
-    value_start++;
-    while (*value_start == ' ' || *value_start == '\t') value_start++;
-    
-    const char* value_end;
-    if (*value_start == '"') {
-        // String value
-        value_start++;
-        value_end = strchr(value_start, '"');
+// A template is compiled once into bytecode: literal spans that point into
+// the template source, variable ops that refer to a slot (one per distinct
+// name, numbered in order of first use), and section ops whose jump offsets
+// pair {{#name}} or {{^name}} with the matching {{/name}}. Rendering is one
+// loop over the ops. A section over a list jumps back to its start for
+// each element, so nothing is rescanned per iteration.
+//
+// Names resolve against a stack of JSON contexts, innermost first, and
+// dotted names ("user.address.city") descend from the first match; "."
+// is the current element. {{>name}} renders another template file from
+// the template directory with the same contexts. {{! ... }} is a comment.
+// When values are bound by slot instead of JSON, a section is a
+// conditional on its slot being non-empty.
+//
+// Variables are escaped for the HTML context they appear in (element text,
+// attribute, URL, script); {{{name}}} or {{&name}} output a value raw.
+//
+// {{%cache name [variable] ttl}}...{{/cache}} renders its block once and
+// reuses the result for ttl seconds, keyed by name and the variable's
+// value. Fragments are shared across templates and renders.
+//
+// Templates loaded from files are cached by path. Each lookup stat()s the
+// file, and a changed mtime or size triggers a recompile; the old template
+// is freed once the last render holding it releases its reference.
+// Templates embedded at build time are found first and never stat()ed.
+// Under a directory watched by template_watcher.c, cached templates are
+// returned without a stat(): the watcher recompiles them when they change.
+
+#define TEMPLATE_CACHE_BUCKETS 256
+#define TEMPLATE_MAX_DEPTH 32           // Section nesting and context stack
+#define TEMPLATE_MAX_PARTIAL_DEPTH 16
+
+typedef enum {
+    TEMPLATE_OP_LITERAL = 0,
+    TEMPLATE_OP_VARIABLE,
+    TEMPLATE_OP_SECTION,        // {{#name}}: jump = matching END
+    TEMPLATE_OP_INVERTED,       // {{^name}}: jump = matching END
+    TEMPLATE_OP_END,            // {{/name}}: jump = opening op
+    TEMPLATE_OP_PARTIAL,        // {{>name}}: name is the source span
+    TEMPLATE_OP_CACHE           // {{%cache}}: span is "name [variable] ttl",
+                                // slot = variable or UINT32_MAX, jump = END,
+                                // escape = context at the block start
+} template_op_type_t;
+
+typedef struct {
+    template_op_type_t type;
+    uint32_t offset;            // Literal/partial: span in source
+    uint32_t length;
+    uint32_t slot;              // Variable/section/cache: slot index
+    uint32_t jump;
+    torchlight_escape_t escape; // Variable/cache: output context
+} template_op_t;
+
+typedef struct {
+    uint32_t offset;            // Within the slot name
+    uint32_t length;
+    uint64_t hash;
+} template_segment_t;
+
+typedef struct {
+    char* name;
+    uint32_t length;
+    uint64_t hash;              // Whole name, for torchlight_template_slot()
+    uint32_t segment_start;     // Dotted path; no segments means "."
+    uint32_t segment_count;
+} template_slot_t;
+
+struct torchlight_template {
+    char* source;
+    size_t source_length;
+    uint64_t source_hash;       // Part of fragment cache keys
+
+    template_op_t* ops;
+    size_t op_count;
+
+    template_slot_t* slots;
+    size_t slot_count;
+    template_segment_t* segments;
+    size_t segment_count;
+
+    size_t literal_bytes;       // Sum of literal spans (output size floor)
+    torchlight_size_estimate_t output_estimate;  // Rendered bytes (presizes buffers)
+    torchlight_size_estimate_t span_estimate;    // Scatter/gather spans (presizes iovecs)
+    int refcount;
+    bool embedded;              // Source is embedded data, not owned
+
+    // Cache validation
+    struct timespec mtime;
+    off_t file_size;
+};
+
+typedef struct template_cache_entry {
+    char* path;
+    uint64_t hash;
+    torchlight_template_t* template;
+    bool trusted;               // Watched without symlinks: no stat() per load
+    struct template_cache_entry* next;
+} template_cache_entry_t;
+
+static template_cache_entry_t* g_template_cache[TEMPLATE_CACHE_BUCKETS];
+static pthread_mutex_t g_template_cache_lock = PTHREAD_MUTEX_INITIALIZER;
+static bool g_template_cache_enabled = true;
+static char g_template_directory[512] = "";
+// The watched directory as the watcher names it, and its realpath(); both
+// under g_template_cache_lock
+static char g_template_watched[512] = "";  // Normalized; empty = not watching
+static char g_template_watched_real[PATH_MAX] = "";
+static uint64_t g_template_reloads = 0;    // Bumped per watcher event and cache clear
+
+// Template variables
+//
+// The variables JSON is parsed once per render into a flat array of nodes,
+// in document order, with each container recording where its subtree
+// ends. Scalar values are views into the JSON text. Strings with escapes
+// are decoded into one scratch buffer, which is never longer than the
+// input. The top-level object's keys go into an open-addressing map, so a
+// top-level {{variable}} costs one probe with the hash precomputed for its
+// name. Nested objects are small and searched in order.
+
+#define TEMPLATE_JSON_MAX_DEPTH 64
+
+typedef enum {
+    JSON_NODE_STRING = 0,
+    JSON_NODE_NUMBER,
+    JSON_NODE_TRUE,
+    JSON_NODE_FALSE,
+    JSON_NODE_NULL,
+    JSON_NODE_OBJECT,
+    JSON_NODE_ARRAY
+} json_node_type_t;
+
+typedef struct {
+    json_node_type_t type;
+    const char* key;            // Member name (objects only), decoded
+    uint32_t key_length;
+    const char* value;          // Scalar text, decoded for strings
+    uint32_t value_length;
+    uint32_t end;               // Index just past this node's subtree
+} json_node_t;
+
+typedef struct {
+    const char* json;
+    const char* pos;
+    const char* limit;
+
+    json_node_t* nodes;
+    size_t count;
+    size_t capacity;
+
+    char* scratch;              // Decoded strings with escapes
+    size_t scratch_used;
+
+    uint32_t* map;              // Top-level keys: node index + 1, 0 = empty
+    size_t map_mask;
+} template_json_t;
+
+static uint64_t template_name_hash(const char* name, size_t length) {
+    uint64_t hash = 14695981039346656037ull;
+    for (size_t i = 0; i < length; i++) {
+        hash ^= (unsigned char)name[i];
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+static void json_skip_space(template_json_t* doc) {
+    while (doc->pos < doc->limit &&
+           (*doc->pos == ' ' || *doc->pos == '\t' || *doc->pos == '\n' || *doc->pos == '\r')) {
+        doc->pos++;
+    }
+}
+
+static int json_hex4(const char* p, uint32_t* out) {
+    uint32_t value = 0;
+    for (int i = 0; i < 4; i++) {
+        char c = p[i];
+        value <<= 4;
+        if (c >= '0' && c <= '9') value |= (uint32_t)(c - '0');
+        else if (c >= 'a' && c <= 'f') value |= (uint32_t)(c - 'a' + 10);
+        else if (c >= 'A' && c <= 'F') value |= (uint32_t)(c - 'A' + 10);
+        else return -1;
+    }
+    *out = value;
+    return 0;
+}
+
+// Parse a string at doc->pos (on the opening quote) into a view
+static int json_parse_string(template_json_t* doc, const char** out, uint32_t* out_length) {
+    const char* start = ++doc->pos;
+    const char* p = start;
+
+    while (p < doc->limit && *p != '"' && *p != '\\') p++;
+    if (p >= doc->limit) return -1;
+
+    if (*p == '"') {
+        // No escapes: point straight into the JSON
+        *out = start;
+        *out_length = (uint32_t)(p - start);
+        doc->pos = p + 1;
+        return 0;
+    }
+
+    if (!doc->scratch) {
+        doc->scratch = malloc((size_t)(doc->limit - doc->json) + 1);
+        if (!doc->scratch) return -1;
+    }
+
+    char* dst = doc->scratch + doc->scratch_used;
+    char* dst_start = dst;
+    memcpy(dst, start, (size_t)(p - start));
+    dst += p - start;
+
+    while (p < doc->limit && *p != '"') {
+        if (*p != '\\') {
+            *dst++ = *p++;
+            continue;
+        }
+
+        if (++p >= doc->limit) return -1;
+        switch (*p++) {
+            case '"': *dst++ = '"'; break;
+            case '\\': *dst++ = '\\'; break;
+            case '/': *dst++ = '/'; break;
+            case 'b': *dst++ = '\b'; break;
+            case 'f': *dst++ = '\f'; break;
+            case 'n': *dst++ = '\n'; break;
+            case 'r': *dst++ = '\r'; break;
+            case 't': *dst++ = '\t'; break;
+            case 'u': {
+                uint32_t cp;
+                if (doc->limit - p < 4 || json_hex4(p, &cp) != 0) return -1;
+                p += 4;
+
+                // Surrogate pair
+                if (cp >= 0xD800 && cp <= 0xDBFF && doc->limit - p >= 6 && p[0] == '\\' && p[1] == 'u') {
+                    uint32_t low;
+                    if (json_hex4(p + 2, &low) == 0 && low >= 0xDC00 && low <= 0xDFFF) {
+                        cp = 0x10000 + ((cp - 0xD800) << 10) + (low - 0xDC00);
+                        p += 6;
+                    }
+                }
+
+                // UTF-8 is never longer than the escape it replaces
+                if (cp < 0x80) {
+                    *dst++ = (char)cp;
+                } else if (cp < 0x800) {
+                    *dst++ = (char)(0xC0 | (cp >> 6));
+                    *dst++ = (char)(0x80 | (cp & 0x3F));
+                } else if (cp < 0x10000) {
+                    *dst++ = (char)(0xE0 | (cp >> 12));
+                    *dst++ = (char)(0x80 | ((cp >> 6) & 0x3F));
+                    *dst++ = (char)(0x80 | (cp & 0x3F));
+                } else {
+                    *dst++ = (char)(0xF0 | (cp >> 18));
+                    *dst++ = (char)(0x80 | ((cp >> 12) & 0x3F));
+                    *dst++ = (char)(0x80 | ((cp >> 6) & 0x3F));
+                    *dst++ = (char)(0x80 | (cp & 0x3F));
+                }
+                break;
+            }
+            default:
+                return -1;
+        }
+    }
+    if (p >= doc->limit) return -1;
+
+    *out = dst_start;
+    *out_length = (uint32_t)(dst - dst_start);
+    doc->scratch_used += (size_t)(dst - dst_start);
+    doc->pos = p + 1;
+    return 0;
+}
+
+static json_node_t* json_new_node(template_json_t* doc) {
+    if (doc->count == doc->capacity) {
+        size_t new_capacity = doc->capacity ? doc->capacity * 2 : 32;
+        json_node_t* nodes = realloc(doc->nodes, new_capacity * sizeof(json_node_t));
+        if (!nodes) return NULL;
+        doc->nodes = nodes;
+        doc->capacity = new_capacity;
+    }
+
+    json_node_t* node = &doc->nodes[doc->count++];
+    memset(node, 0, sizeof(*node));
+    return node;
+}
+
+static int json_parse_value(template_json_t* doc, const char* key, uint32_t key_length, int depth) {
+    json_skip_space(doc);
+    if (doc->pos >= doc->limit || depth > TEMPLATE_JSON_MAX_DEPTH) return -1;
+
+    size_t index = doc->count;
+    json_node_t* node = json_new_node(doc);
+    if (!node) return -1;
+    node->key = key;
+    node->key_length = key_length;
+
+    char c = *doc->pos;
+    if (c == '"') {
+        node->type = JSON_NODE_STRING;
+        const char* value;
+        uint32_t value_length;
+        if (json_parse_string(doc, &value, &value_length) != 0) return -1;
+        doc->nodes[index].value = value;
+        doc->nodes[index].value_length = value_length;
+    } else if (c == '{' || c == '[') {
+        bool is_object = (c == '{');
+        node->type = is_object ? JSON_NODE_OBJECT : JSON_NODE_ARRAY;
+        doc->pos++;
+        json_skip_space(doc);
+
+        if (doc->pos < doc->limit && *doc->pos == (is_object ? '}' : ']')) {
+            doc->pos++;
+        } else {
+            for (;;) {
+                const char* member = NULL;
+                uint32_t member_length = 0;
+
+                if (is_object) {
+                    json_skip_space(doc);
+                    if (doc->pos >= doc->limit || *doc->pos != '"') return -1;
+                    if (json_parse_string(doc, &member, &member_length) != 0) return -1;
+                    json_skip_space(doc);
+                    if (doc->pos >= doc->limit || *doc->pos != ':') return -1;
+                    doc->pos++;
+                }
+
+                if (json_parse_value(doc, member, member_length, depth + 1) != 0) return -1;
+
+                json_skip_space(doc);
+                if (doc->pos >= doc->limit) return -1;
+                if (*doc->pos == ',') {
+                    doc->pos++;
+                    continue;
+                }
+                if (*doc->pos != (is_object ? '}' : ']')) return -1;
+                doc->pos++;
+                break;
+            }
+        }
+    } else {
+        // Number or literal: keep the raw token
+        const char* start = doc->pos;
+        while (doc->pos < doc->limit && *doc->pos != ',' && *doc->pos != '}' &&
+               *doc->pos != ']' && *doc->pos != ' ' && *doc->pos != '\t' &&
+               *doc->pos != '\n' && *doc->pos != '\r') {
+            doc->pos++;
+        }
+
+        size_t length = (size_t)(doc->pos - start);
+        if (length == 0) return -1;
+
+        if (length == 4 && memcmp(start, "true", 4) == 0) node->type = JSON_NODE_TRUE;
+        else if (length == 5 && memcmp(start, "false", 5) == 0) node->type = JSON_NODE_FALSE;
+        else if (length == 4 && memcmp(start, "null", 4) == 0) node->type = JSON_NODE_NULL;
+        else node->type = JSON_NODE_NUMBER;
+
+        node->value = start;
+        node->value_length = (uint32_t)length;
+    }
+
+    doc->nodes[index].end = (uint32_t)doc->count;
+    return 0;
+}
+
+static void template_json_free(template_json_t* doc) {
+    free(doc->nodes);
+    free(doc->scratch);
+    free(doc->map);
+    memset(doc, 0, sizeof(*doc));
+}
+
+// Parse the variables and index the top-level keys. A document that is not
+// a JSON object leaves every variable missing.
+static int template_json_parse(template_json_t* doc, const char* json) {
+    memset(doc, 0, sizeof(*doc));
+    if (!json) return 0;
+
+    doc->json = json;
+    doc->pos = json;
+    doc->limit = json + strlen(json);
+
+    if (json_parse_value(doc, NULL, 0, 0) != 0 || doc->nodes[0].type != JSON_NODE_OBJECT) {
+        doc->count = 0;
+        return -1;
+    }
+
+    size_t members = 0;
+    for (uint32_t i = 1; i < doc->nodes[0].end; i = doc->nodes[i].end) members++;
+
+    size_t map_size = 8;
+    while (map_size < members * 2) map_size <<= 1;
+
+    doc->map = calloc(map_size, sizeof(uint32_t));
+    if (!doc->map) {
+        doc->count = 0;
+        return -1;
+    }
+    doc->map_mask = map_size - 1;
+
+    for (uint32_t i = 1; i < doc->nodes[0].end; i = doc->nodes[i].end) {
+        const json_node_t* node = &doc->nodes[i];
+        size_t slot = template_name_hash(node->key, node->key_length) & doc->map_mask;
+
+        // On duplicate keys the first one wins
+        for (;;) {
+            uint32_t existing = doc->map[slot];
+            if (existing == 0) {
+                doc->map[slot] = i + 1;
+                break;
+            }
+            const json_node_t* other = &doc->nodes[existing - 1];
+            if (other->key_length == node->key_length &&
+                memcmp(other->key, node->key, node->key_length) == 0) {
+                break;
+            }
+            slot = (slot + 1) & doc->map_mask;
+        }
+    }
+
+    return 0;
+}
+
+static const json_node_t* template_json_lookup(const template_json_t* doc, const char* name,
+                                               size_t length, uint64_t hash) {
+    if (!doc->map) return NULL;
+
+    size_t slot = hash & doc->map_mask;
+    for (;;) {
+        uint32_t index = doc->map[slot];
+        if (index == 0) return NULL;
+
+        const json_node_t* node = &doc->nodes[index - 1];
+        if (node->key_length == length && memcmp(node->key, name, length) == 0) {
+            return node;
+        }
+        slot = (slot + 1) & doc->map_mask;
+    }
+}
+
+// Output context
+//
+// The compiler runs a small HTML tokenizer over the literal text, which is
+// enough to tell element text from attribute values (and which attribute),
+// script bodies and comments. Each variable is escaped for the context it
+// is found in. Values are escaped, so they cannot change the structure the
+// tokenizer saw. A partial starts in element text.
+//
+// Script bodies and on* attribute values are also followed through the
+// JavaScript lexer states that matter: string literals, comments and
+// regular expression literals. A variable inside one of those is escaped
+// in place. A variable in code becomes a quoted string, so a value can
+// never be executed as code. Inside a template literal, ${...} would
+// make a value code again, so variables there are refused.
+//
+// <textarea> and <title> hold escapable raw text (RCDATA): no tags, but
+// entities, so HTML escaping applies. <style> holds raw text that no
+// escaping makes safe, so variables there are refused too.
+
+typedef enum {
+    HTML_TEXT = 0,
+    HTML_TAG_NAME,
+    HTML_TAG,                   // Between attributes
+    HTML_ATTRIBUTE_NAME,
+    HTML_BEFORE_VALUE,
+    HTML_VALUE,
+    HTML_SCRIPT,
+    HTML_RAWTEXT,               // Until the end tag named in tag; see rcdata
+    HTML_COMMENT
+} html_state_t;
+
+typedef enum {
+    JS_CODE = 0,
+    JS_STRING,                  // Quote in js_quote; '`' is a template literal
+    JS_REGEX,
+    JS_LINE_COMMENT,
+    JS_BLOCK_COMMENT
+} js_state_t;
+
+typedef struct {
+    html_state_t state;
+    char tag[16];
+    size_t tag_length;
+    char attribute[24];
+    size_t attribute_length;
+    char quote;                 // Value quote, or 0 when unquoted
+    bool rcdata;                // HTML_RAWTEXT decodes entities (textarea, title)
+    bool value_scheme;          // ':', '/', '?' or '#' seen: a URL's scheme is fixed
+    bool value_query;           // '?' seen in the value
+    bool value_js;              // The value is an on* event handler
+
+    // JavaScript in a script body or event handler
+    js_state_t js_state;
+    char js_quote;
+    bool js_escape;             // Previous character was a backslash
+    bool js_class;              // Inside [...] in a regular expression
+    char js_last;               // Last significant character of code
+    bool js_in_word;            // The previous character was part of js_word
+    char js_word[12];           // Start of the last identifier
+    size_t js_word_length;
+} html_context_t;
+
+static bool template_is_space(char c) {
+    return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+}
+
+static void js_reset(html_context_t* html) {
+    html->js_state = JS_CODE;
+    html->js_escape = false;
+    html->js_class = false;
+    html->js_last = '\0';
+    html->js_in_word = false;
+    html->js_word_length = 0;
+}
+
+static bool js_identifier_char(char c) {
+    return isalnum((unsigned char)c) || c == '_' || c == '$' || (unsigned char)c >= 0x80;
+}
+
+// A '/' after an operator, an opening bracket or a keyword such as return
+// starts a regular expression; after a value it divides
+static bool js_slash_starts_regex(const html_context_t* html) {
+    static const char* const keywords[] = {
+        "return", "typeof", "instanceof", "in", "of", "new", "delete", "void", "throw",
+        "case", "do", "else", "yield", "await"
+    };
+
+    if (html->js_last == '\0') return true;
+    if (!js_identifier_char(html->js_last)) return strchr("(,=:[!&|?{};+-*%<>~^}", html->js_last) != NULL;
+
+    for (size_t i = 0; i < sizeof(keywords) / sizeof(keywords[0]); i++) {
+        if (strlen(keywords[i]) == html->js_word_length &&
+            memcmp(keywords[i], html->js_word, html->js_word_length) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// A literal or a variable's value was just completed
+static void js_after_value(html_context_t* html) {
+    html->js_state = JS_CODE;
+    html->js_last = '"';
+    html->js_in_word = false;
+}
+
+// Advance the JavaScript state by one character. Returns how many of the
+// following characters were consumed with it (for "//", "/*" and "*/").
+static size_t js_advance(html_context_t* html, const char* text, size_t remaining) {
+    char c = text[0];
+    char next = remaining > 1 ? text[1] : '\0';
+
+    switch (html->js_state) {
+        case JS_CODE:
+            if (c == '"' || c == '\'' || c == '`') {
+                html->js_state = JS_STRING;
+                html->js_quote = c;
+                html->js_escape = false;
+            } else if (c == '/' && next == '/') {
+                html->js_state = JS_LINE_COMMENT;
+                return 1;
+            } else if (c == '/' && next == '*') {
+                html->js_state = JS_BLOCK_COMMENT;
+                return 1;
+            } else if (c == '/' && js_slash_starts_regex(html)) {
+                html->js_state = JS_REGEX;
+                html->js_escape = false;
+                html->js_class = false;
+            } else if (js_identifier_char(c)) {
+                if (!html->js_in_word) html->js_word_length = 0;
+                if (html->js_word_length < sizeof(html->js_word)) {
+                    html->js_word[html->js_word_length] = c;
+                }
+                html->js_word_length++;
+                html->js_in_word = true;
+                html->js_last = c;
+            } else {
+                html->js_in_word = false;
+                if (!template_is_space(c)) html->js_last = c;
+            }
+            break;
+
+        case JS_STRING:
+            if (html->js_escape) {
+                html->js_escape = false;
+            } else if (c == '\\') {
+                html->js_escape = true;
+            } else if (c == html->js_quote) {
+                js_after_value(html);
+            }
+            break;
+
+        case JS_REGEX:
+            if (html->js_escape) {
+                html->js_escape = false;
+            } else if (c == '\\') {
+                html->js_escape = true;
+            } else if (c == '[') {
+                html->js_class = true;
+            } else if (c == ']') {
+                html->js_class = false;
+            } else if (c == '/' && !html->js_class) {
+                js_after_value(html);
+            }
+            break;
+
+        case JS_LINE_COMMENT:
+            if (c == '\n') {
+                html->js_state = JS_CODE;
+                html->js_in_word = false;
+            }
+            break;
+
+        case JS_BLOCK_COMMENT:
+            if (c == '*' && next == '/') {
+                html->js_state = JS_CODE;
+                html->js_in_word = false;
+                return 1;
+            }
+            break;
+    }
+    return 0;
+}
+
+static bool html_tag_is(const html_context_t* html, const char* name) {
+    return strlen(name) == html->tag_length && memcmp(html->tag, name, html->tag_length) == 0;
+}
+
+static void html_end_tag(html_context_t* html) {
+    // <style/> still opens a style element
+    if (html->tag_length > 0 && html->tag[html->tag_length - 1] == '/') html->tag_length--;
+
+    html->state = HTML_TEXT;
+    if (html_tag_is(html, "script")) {
+        html->state = HTML_SCRIPT;
+        js_reset(html);
+    } else if (html_tag_is(html, "style")) {
+        html->state = HTML_RAWTEXT;
+        html->rcdata = false;
+    } else if (html_tag_is(html, "textarea") || html_tag_is(html, "title")) {
+        html->state = HTML_RAWTEXT;
+        html->rcdata = true;
+    }
+}
+
+// "</name" that closes the raw text element in html->tag
+static bool html_at_end_tag(const html_context_t* html, const char* text, size_t length) {
+    if (length < html->tag_length + 2 || text[0] != '<' || text[1] != '/') return false;
+    if (strncasecmp(text + 2, html->tag, html->tag_length) != 0) return false;
+    if (length == html->tag_length + 2) return true;
+
+    char after = text[html->tag_length + 2];
+    return after == '>' || after == '/' || template_is_space(after);
+}
+
+static void html_start_value(html_context_t* html, char quote) {
+    html->state = HTML_VALUE;
+    html->quote = quote;
+    html->value_scheme = false;
+    html->value_query = false;
+    html->value_js = html->attribute_length > 2 && memcmp(html->attribute, "on", 2) == 0;
+    js_reset(html);
+}
+
+// Literal text in an attribute value
+static void html_value_char(html_context_t* html, char c) {
+    if (c == ':' || c == '/' || c == '?' || c == '#') html->value_scheme = true;
+    if (c == '?') html->value_query = true;
+}
+
+static void html_context_advance(html_context_t* html, const char* text, size_t length) {
+    for (size_t i = 0; i < length; i++) {
+        char c = text[i];
+
+        switch (html->state) {
+            case HTML_TEXT:
+                if (c != '<') break;
+                if (length - i >= 4 && memcmp(text + i, "<!--", 4) == 0) {
+                    html->state = HTML_COMMENT;
+                    i += 3;
+                } else if (i + 1 == length || isalpha((unsigned char)text[i + 1]) ||
+                           text[i + 1] == '/' || text[i + 1] == '!' || text[i + 1] == '?') {
+                    // Any other '<' is text ("1 < 2"); one that ends the
+                    // literal may be followed by a variable, so assume a tag
+                    html->state = HTML_TAG_NAME;
+                    html->tag_length = 0;
+                }
+                break;
+
+            case HTML_TAG_NAME:
+                if (c == '>') {
+                    html_end_tag(html);
+                } else if (template_is_space(c)) {
+                    html->state = HTML_TAG;
+                    html->attribute_length = 0;
+                } else if (html->tag_length < sizeof(html->tag) - 1) {
+                    html->tag[html->tag_length++] = (char)tolower((unsigned char)c);
+                }
+                break;
+
+            case HTML_TAG:
+            case HTML_ATTRIBUTE_NAME:
+                if (c == '>') {
+                    html_end_tag(html);
+                } else if (c == '=' && html->attribute_length > 0) {
+                    html->state = HTML_BEFORE_VALUE;
+                    html->value_scheme = false;
+                    html->value_query = false;
+                } else if (template_is_space(c) || c == '/') {
+                    if (html->state == HTML_ATTRIBUTE_NAME) html->state = HTML_TAG;
+                } else {
+                    if (html->state == HTML_TAG) html->attribute_length = 0;
+                    html->state = HTML_ATTRIBUTE_NAME;
+                    if (html->attribute_length < sizeof(html->attribute) - 1) {
+                        html->attribute[html->attribute_length++] = (char)tolower((unsigned char)c);
+                    }
+                }
+                break;
+
+            case HTML_BEFORE_VALUE:
+                if (c == '"' || c == '\'') {
+                    html_start_value(html, c);
+                } else if (c == '>') {
+                    html_end_tag(html);
+                } else if (!template_is_space(c)) {
+                    html_start_value(html, 0);
+                    html_value_char(html, c);
+                    if (html->value_js) i += js_advance(html, text + i, length - i);
+                }
+                break;
+
+            case HTML_VALUE:
+                if (html->quote ? c == html->quote : template_is_space(c)) {
+                    html->state = HTML_TAG;
+                    html->attribute_length = 0;
+                } else if (!html->quote && c == '>') {
+                    html_end_tag(html);
+                } else {
+                    html_value_char(html, c);
+                    if (html->value_js) i += js_advance(html, text + i, length - i);
+                }
+                break;
+
+            case HTML_SCRIPT:
+                // The HTML parser ends the script here even inside a JS string
+                if (c == '<' && length - i >= 8 && strncasecmp(text + i, "</script", 8) == 0) {
+                    html->state = HTML_TAG_NAME;
+                    html->tag_length = 0;
+                } else {
+                    i += js_advance(html, text + i, length - i);
+                }
+                break;
+
+            case HTML_RAWTEXT:
+                if (c == '<' && html_at_end_tag(html, text + i, length - i)) {
+                    html->state = HTML_TAG_NAME;
+                    html->tag_length = 0;
+                }
+                break;
+
+            case HTML_COMMENT:
+                if (c == '-' && length - i >= 3 && memcmp(text + i, "-->", 3) == 0) {
+                    html->state = HTML_TEXT;
+                    i += 2;
+                }
+                break;
+        }
+    }
+}
+
+static bool html_is_url_attribute(const html_context_t* html) {
+    static const char* const url_attributes[] = {
+        "href", "src", "action", "formaction", "cite", "poster", "background", "data",
+        "manifest", "icon"
+    };
+
+    for (size_t i = 0; i < sizeof(url_attributes) / sizeof(url_attributes[0]); i++) {
+        if (strlen(url_attributes[i]) == html->attribute_length &&
+            memcmp(url_attributes[i], html->attribute, html->attribute_length) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Context for a variable inside JavaScript. In code the value becomes a
+// quoted string (value_escape) and counts as a value from then on.
+// Returns -1 inside a template literal.
+static int js_context_variable(html_context_t* html, torchlight_escape_t value_escape,
+                               torchlight_escape_t* escape) {
+    if (html->js_state == JS_STRING && html->js_quote == '`') return -1;
+
+    if (html->js_state != JS_CODE) {
+        *escape = TORCHLIGHT_ESCAPE_JS;
+        return 0;
+    }
+
+    js_after_value(html);
+    *escape = value_escape;
+    return 0;
+}
+
+// Context for a variable at this point; the variable then counts as part
+// of the attribute value it sits in. Returns -1 where no escaping is safe.
+static int html_context_variable(html_context_t* html, torchlight_escape_t* escape) {
+    switch (html->state) {
+        case HTML_TEXT:
+        case HTML_COMMENT:
+            *escape = TORCHLIGHT_ESCAPE_HTML;
+            return 0;
+
+        case HTML_SCRIPT:
+            return js_context_variable(html, TORCHLIGHT_ESCAPE_JS_VALUE, escape);
+
+        case HTML_RAWTEXT:
+            if (!html->rcdata) return -1;
+            *escape = TORCHLIGHT_ESCAPE_HTML;
+            return 0;
+
+        case HTML_BEFORE_VALUE:
+        case HTML_VALUE: {
+            if (html->state == HTML_BEFORE_VALUE) html_start_value(html, 0);
+
+            if (html->value_js) {
+                return js_context_variable(html, TORCHLIGHT_ESCAPE_JS_VALUE_ATTRIBUTE, escape);
+            }
+            if (html_is_url_attribute(html)) {
+                // Until literal text ends the scheme, each value could
+                // supply it (after leading spaces or earlier empty values)
+                if (!html->value_scheme) {
+                    *escape = TORCHLIGHT_ESCAPE_URL_ATTRIBUTE;
+                } else {
+                    *escape = html->value_query ? TORCHLIGHT_ESCAPE_URL : TORCHLIGHT_ESCAPE_ATTRIBUTE;
+                }
+                return 0;
+            }
+            *escape = TORCHLIGHT_ESCAPE_ATTRIBUTE;
+            return 0;
+        }
+
+        default:
+            *escape = TORCHLIGHT_ESCAPE_ATTRIBUTE;
+            return 0;
+    }
+}
+
+// Template compilation
+
+static int template_add_op(torchlight_template_t* tpl, size_t* capacity, template_op_t op) {
+    if (tpl->op_count == *capacity) {
+        size_t new_capacity = *capacity ? *capacity * 2 : 16;
+        template_op_t* ops = realloc(tpl->ops, new_capacity * sizeof(template_op_t));
+        if (!ops) return -1;
+        tpl->ops = ops;
+        *capacity = new_capacity;
+    }
+
+    tpl->ops[tpl->op_count++] = op;
+    return 0;
+}
+
+static int template_add_literal(torchlight_template_t* tpl, size_t* capacity,
+                                size_t offset, size_t length) {
+    if (length == 0) return 0;
+
+    template_op_t op = { TEMPLATE_OP_LITERAL, (uint32_t)offset, (uint32_t)length, 0, 0,
+                         TORCHLIGHT_ESCAPE_NONE };
+    tpl->literal_bytes += length;
+    return template_add_op(tpl, capacity, op);
+}
+
+// Find or create the slot for a name, splitting dotted paths into segments
+static int template_slot(torchlight_template_t* tpl, const char* name, size_t length) {
+    for (size_t i = 0; i < tpl->slot_count; i++) {
+        if (tpl->slots[i].length == length && memcmp(tpl->slots[i].name, name, length) == 0) {
+            return (int)i;
+        }
+    }
+
+    template_slot_t* slots = realloc(tpl->slots, (tpl->slot_count + 1) * sizeof(template_slot_t));
+    if (!slots) return -1;
+    tpl->slots = slots;
+
+    template_slot_t* slot = &tpl->slots[tpl->slot_count];
+    memset(slot, 0, sizeof(*slot));
+
+    slot->name = malloc(length + 1);
+    if (!slot->name) return -1;
+    memcpy(slot->name, name, length);
+    slot->name[length] = '\0';
+    slot->length = (uint32_t)length;
+    slot->hash = template_name_hash(name, length);
+    slot->segment_start = (uint32_t)tpl->segment_count;
+
+    if (!(length == 1 && name[0] == '.')) {
+        size_t start = 0;
+        for (size_t i = 0; i <= length; i++) {
+            if (i < length && name[i] != '.') continue;
+
+            template_segment_t* segments = realloc(tpl->segments,
+                                                   (tpl->segment_count + 1) * sizeof(template_segment_t));
+            if (!segments) {
+                free(slot->name);
+                return -1;
+            }
+            tpl->segments = segments;
+
+            template_segment_t* segment = &tpl->segments[tpl->segment_count++];
+            segment->offset = (uint32_t)start;
+            segment->length = (uint32_t)(i - start);
+            segment->hash = template_name_hash(name + start, i - start);
+            slot->segment_count++;
+            start = i + 1;
+        }
+    }
+
+    return (int)tpl->slot_count++;
+}
+
+// {{%cache name [variable] ttl}}: the op's span covers "name ... ttl"
+static int template_cache_directive(torchlight_template_t* tpl, const char* text, size_t length,
+                                    template_op_t* op) {
+    const char* tokens[4];
+    size_t lengths[4];
+    size_t count = 0;
+
+    for (size_t i = 0; i < length;) {
+        if (template_is_space(text[i])) {
+            i++;
+            continue;
+        }
+        if (count == 4) {
+            count++;
+            break;
+        }
+        tokens[count] = text + i;
+        while (i < length && !template_is_space(text[i])) i++;
+        lengths[count] = (size_t)(text + i - tokens[count]);
+        count++;
+    }
+
+    bool valid = (count == 3 || count == 4) && lengths[0] == 5 && memcmp(tokens[0], "cache", 5) == 0;
+    for (size_t i = 0; valid && i < lengths[count - 1]; i++) {
+        valid = isdigit((unsigned char)tokens[count - 1][i]) && i < 9;
+    }
+    if (!valid) {
+        printf("❌ Template error: expected {{%%cache name [variable] ttl}}, got {{%%%.*s}}\n",
+               (int)length, text);
+        return -1;
+    }
+
+    *op = (template_op_t){ TEMPLATE_OP_CACHE, (uint32_t)(tokens[1] - tpl->source),
+                           (uint32_t)(tokens[count - 1] + lengths[count - 1] - tokens[1]),
+                           UINT32_MAX, 0, TORCHLIGHT_ESCAPE_NONE };
+
+    if (count == 4) {
+        int slot = template_slot(tpl, tokens[2], lengths[2]);
+        if (slot < 0) return -1;
+        op->slot = (uint32_t)slot;
+    }
+    return 0;
+}
+
+torchlight_template_t* torchlight_compile_template(const char* source, size_t length) {
+    if (!source) return NULL;
+    if (length > UINT32_MAX) return NULL;
+
+    torchlight_template_t* tpl = calloc(1, sizeof(torchlight_template_t));
+    if (!tpl) return NULL;
+
+    tpl->source = malloc(length + 1);
+    if (!tpl->source) {
+        free(tpl);
+        return NULL;
+    }
+    memcpy(tpl->source, source, length);
+    tpl->source[length] = '\0';
+    tpl->source_length = length;
+    tpl->source_hash = template_name_hash(source, length);
+    tpl->refcount = 1;
+
+    size_t capacity = 0;
+    size_t literal_start = 0;
+    size_t pos = 0;
+
+    uint32_t open_sections[TEMPLATE_MAX_DEPTH];
+    int open_count = 0;
+    html_context_t html = { HTML_TEXT };
+
+    while (pos + 1 < length) {
+        if (tpl->source[pos] != '{' || tpl->source[pos + 1] != '{') {
+            pos++;
+            continue;
+        }
+
+        // {{{name}}} is a raw variable like {{&name}}
+        char* close = NULL;
+        size_t close_length = 2;
+        const char* name = tpl->source + pos + 2;
+        char sigil = '\0';
+
+        if (pos + 2 < length && tpl->source[pos + 2] == '{') {
+            close = strstr(tpl->source + pos + 3, "}}}");
+            if (close) {
+                close_length = 3;
+                name++;
+                sigil = '&';
+            }
+        }
+        if (!close) close = strstr(tpl->source + pos + 2, "}}");
+        if (!close) break;  // No closing }}, the rest is literal text
+
+        // Tag type, then the name with surrounding whitespace trimmed
+        const char* name_end = close;
+        while (name < name_end && template_is_space(*name)) name++;
+
+        if (!sigil && name < name_end) {
+            sigil = *name;
+            if (sigil == '#' || sigil == '^' || sigil == '/' || sigil == '>' || sigil == '!' || sigil == '&' ||
+                sigil == '%') {
+                name++;
+            } else {
+                sigil = '\0';
+            }
+        }
+        while (name < name_end && template_is_space(*name)) name++;
+        while (name_end > name && template_is_space(name_end[-1])) name_end--;
+
+        size_t name_length = (size_t)(name_end - name);
+
+        html_context_advance(&html, tpl->source + literal_start, pos - literal_start);
+        if (template_add_literal(tpl, &capacity, literal_start, pos - literal_start) != 0) goto fail;
+
+        bool closes_cache = sigil == '/' && open_count > 0 &&
+                            tpl->ops[open_sections[open_count - 1]].type == TEMPLATE_OP_CACHE &&
+                            name_length == 5 && memcmp(name, "cache", 5) == 0;
+
+        if (sigil == '>') {
+            template_op_t op = { TEMPLATE_OP_PARTIAL, (uint32_t)(name - tpl->source),
+                                 (uint32_t)name_length, 0, 0, TORCHLIGHT_ESCAPE_NONE };
+            if (template_add_op(tpl, &capacity, op) != 0) goto fail;
+        } else if (sigil == '%') {
+            if (open_count == TEMPLATE_MAX_DEPTH) {
+                printf("❌ Template sections nested too deeply\n");
+                goto fail;
+            }
+
+            template_op_t op;
+            if (template_cache_directive(tpl, name, name_length, &op) != 0) goto fail;
+
+            // The context a variable would get here; NONE where one is refused
+            html_context_t probe = html;
+            if (html_context_variable(&probe, &op.escape) != 0) op.escape = TORCHLIGHT_ESCAPE_NONE;
+
+            open_sections[open_count++] = (uint32_t)tpl->op_count;
+            if (template_add_op(tpl, &capacity, op) != 0) goto fail;
+        } else if (closes_cache) {
+            uint32_t open = open_sections[--open_count];
+            tpl->ops[open].jump = (uint32_t)tpl->op_count;
+
+            template_op_t op = { TEMPLATE_OP_END, 0, 0, UINT32_MAX, open, TORCHLIGHT_ESCAPE_NONE };
+            if (template_add_op(tpl, &capacity, op) != 0) goto fail;
+        } else if (sigil != '!') {
+            int slot = template_slot(tpl, name, name_length);
+            if (slot < 0) goto fail;
+
+            template_op_t op = { TEMPLATE_OP_VARIABLE, 0, 0, (uint32_t)slot, 0,
+                                 TORCHLIGHT_ESCAPE_NONE };
+
+            if (sigil == '#' || sigil == '^') {
+                if (open_count == TEMPLATE_MAX_DEPTH) {
+                    printf("❌ Template sections nested too deeply\n");
+                    goto fail;
+                }
+                open_sections[open_count++] = (uint32_t)tpl->op_count;
+                op.type = sigil == '#' ? TEMPLATE_OP_SECTION : TEMPLATE_OP_INVERTED;
+            } else if (sigil == '/') {
+                if (open_count == 0 || tpl->ops[open_sections[open_count - 1]].slot != (uint32_t)slot ||
+                    tpl->ops[open_sections[open_count - 1]].type == TEMPLATE_OP_CACHE) {
+                    printf("❌ Template error: unexpected {{/%.*s}}\n", (int)name_length, name);
+                    goto fail;
+                }
+                uint32_t open = open_sections[--open_count];
+                tpl->ops[open].jump = (uint32_t)tpl->op_count;
+                op.type = TEMPLATE_OP_END;
+                op.jump = open;
+            } else {
+                torchlight_escape_t escape;
+                if (html_context_variable(&html, &escape) != 0 && sigil != '&') {
+                    printf("❌ Template error: {{%.*s}} inside %s\n", (int)name_length, name,
+                           html.state == HTML_RAWTEXT ? "a <style> element" : "a JavaScript template literal");
+                    goto fail;
+                }
+                op.escape = sigil == '&' ? TORCHLIGHT_ESCAPE_NONE : escape;
+            }
+
+            if (template_add_op(tpl, &capacity, op) != 0) goto fail;
+        }
+
+        pos = (size_t)(close - tpl->source) + close_length;
+        literal_start = pos;
+    }
+
+    if (template_add_literal(tpl, &capacity, literal_start, length - literal_start) != 0) goto fail;
+
+    if (open_count > 0) {
+        const template_op_t* open = &tpl->ops[open_sections[open_count - 1]];
+        if (open->type == TEMPLATE_OP_CACHE) {
+            printf("❌ Template error: unclosed {{%%cache %.*s}}\n", (int)open->length,
+                   tpl->source + open->offset);
+        } else {
+            printf("❌ Template error: unclosed {{#%s}}\n", tpl->slots[open->slot].name);
+        }
+        goto fail;
+    }
+
+    return tpl;
+
+fail:
+    torchlight_release_template(tpl);
+    return NULL;
+}
+
+static void template_free(torchlight_template_t* tpl) {
+    for (size_t i = 0; i < tpl->slot_count; i++) {
+        free(tpl->slots[i].name);
+    }
+    free(tpl->slots);
+    free(tpl->segments);
+    free(tpl->ops);
+    if (!tpl->embedded) free(tpl->source);
+    free(tpl);
+}
+
+void torchlight_release_template(torchlight_template_t* tpl) {
+    if (!tpl) return;
+
+    if (__atomic_sub_fetch(&tpl->refcount, 1, __ATOMIC_ACQ_REL) == 0) {
+        template_free(tpl);
+    }
+}
+
+// Template cache
+
+void torchlight_set_template_cache(bool enabled) {
+    g_template_cache_enabled = enabled;
+}
+
+static uint64_t template_path_hash(const char* path) {
+    uint64_t hash = 14695981039346656037ull;
+    for (const unsigned char* p = (const unsigned char*)path; *p; p++) {
+        hash ^= *p;
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+static torchlight_template_t* template_compile_file(const char* path, const struct stat* st) {
+    char* content = NULL;
+    size_t size = 0;
+
+    if (torchlight_read_file(path, &content, &size) != 0) return NULL;
+
+    torchlight_template_t* tpl = torchlight_compile_template(content, size);
+    free(content);
+
+    if (tpl) {
+        tpl->mtime = st->st_mtim;
+        tpl->file_size = st->st_size;
+    }
+    return tpl;
+}
+
+// Embedded templates are keyed by their path under the template directory
+static const char* template_embedded_key(const char* path) {
+    const char* directory = g_template_directory;
+    if (directory[0] == '.' && directory[1] == '/') directory += 2;
+    if (path[0] == '.' && path[1] == '/') path += 2;
+
+    size_t length = strlen(directory);
+    if (length > 0 && strncmp(path, directory, length) == 0 && path[length] == '/') {
+        path += length + 1;
+    }
+    return path;
+}
+
+// Cache key: the path without "./" segments or doubled slashes, so the
+// watcher's paths and callers' spellings of them meet
+static int template_normalize_path(const char* path, char* out, size_t size) {
+    size_t length = 0;
+
+    while (*path) {
+        if (path[0] == '.' && (path[1] == '/' || path[1] == '\0') && (length == 0 || out[length - 1] == '/')) {
+            path += path[1] ? 2 : 1;
+            continue;
+        }
+        if (path[0] == '/' && length > 0 && out[length - 1] == '/') {
+            path++;
+            continue;
+        }
+        if (length + 1 >= size) return -1;
+        out[length++] = *path++;
+    }
+
+    if (length + 1 > size) return -1;
+    out[length] = '\0';
+    return 0;
+}
+
+// True if the watcher sees changes to this (normalized) path. Called
+// with g_template_cache_lock held.
+static bool template_path_watched(const char* key) {
+    size_t length = strlen(g_template_watched);
+    if (length == 0 || strncmp(key, g_template_watched, length) != 0 || key[length] != '/') return false;
+
+    // ".." could lead out of the watched tree
+    for (const char* p = key + length; (p = strstr(p, "/..")) != NULL; p += 3) {
+        if (p[3] == '/' || p[3] == '\0') return false;
+    }
+    return true;
+}
+
+// True if `real`, the realpath() of watched `key`, is the same file name
+// under the real watched directory. Otherwise a symlink on the way leads
+// elsewhere, inotify reports its changes under another name (or not at
+// all), and the entry must keep checking mtimes. Lock held.
+static bool template_path_canonical(const char* key, const char* real) {
+    size_t length = strlen(g_template_watched_real);
+    return strncmp(real, g_template_watched_real, length) == 0 &&
+           strcmp(real + length, key + strlen(g_template_watched)) == 0;
+}
+
+static template_cache_entry_t* template_cache_find(template_cache_entry_t* entry, const char* key,
+                                                   uint64_t hash) {
+    while (entry && (entry->hash != hash || strcmp(entry->path, key) != 0)) {
+        entry = entry->next;
+    }
+    return entry;
+}
+
+torchlight_template_t* torchlight_load_template(const char* path) {
+    if (!path) return NULL;
+
+    torchlight_template_t* embedded = tl_embedded_template(template_embedded_key(path));
+    if (embedded) {
+        __atomic_add_fetch(&embedded->refcount, 1, __ATOMIC_RELAXED);
+        return embedded;
+    }
+
+    struct stat st;
+    char key[1024];
+
+    if (!g_template_cache_enabled || template_normalize_path(path, key, sizeof(key)) != 0) {
+        if (stat(path, &st) != 0) return NULL;
+        return template_compile_file(path, &st);
+    }
+
+    uint64_t hash = template_path_hash(key);
+    template_cache_entry_t** bucket = &g_template_cache[hash & (TEMPLATE_CACHE_BUCKETS - 1)];
+
+    pthread_mutex_lock(&g_template_cache_lock);
+
+    bool watched = template_path_watched(key);
+    template_cache_entry_t* entry = template_cache_find(*bucket, key, hash);
+
+    if (entry && watched && entry->trusted) {
+        torchlight_template_t* tpl = entry->template;
+        __atomic_add_fetch(&tpl->refcount, 1, __ATOMIC_RELAXED);
+        pthread_mutex_unlock(&g_template_cache_lock);
+        return tpl;
+    }
+    pthread_mutex_unlock(&g_template_cache_lock);
+
+    if (stat(path, &st) != 0) return NULL;
+
+    pthread_mutex_lock(&g_template_cache_lock);
+
+    entry = template_cache_find(*bucket, key, hash);
+
+    if (entry && entry->template->mtime.tv_sec == st.st_mtim.tv_sec &&
+        entry->template->mtime.tv_nsec == st.st_mtim.tv_nsec &&
+        entry->template->file_size == st.st_size) {
+        torchlight_template_t* tpl = entry->template;
+        __atomic_add_fetch(&tpl->refcount, 1, __ATOMIC_RELAXED);
+        pthread_mutex_unlock(&g_template_cache_lock);
+        return tpl;
+    }
+
+    // A change seen while we compile may predate the copy we read
+    uint64_t reloads = g_template_reloads;
+    pthread_mutex_unlock(&g_template_cache_lock);
+
+    // Compile outside the lock; a concurrent loader may do the same work
+    torchlight_template_t* tpl = template_compile_file(path, &st);
+    if (!tpl) return NULL;
+
+    char real[PATH_MAX];
+    bool resolved = watched && realpath(path, real) != NULL;
+
+    pthread_mutex_lock(&g_template_cache_lock);
+
+    // The watcher may have started or stopped meanwhile
+    watched = template_path_watched(key);
+    bool trusted = watched && resolved && template_path_canonical(key, real);
+    entry = template_cache_find(*bucket, key, hash);
+
+    if (entry && trusted && entry->trusted) {
+        // Another loader or the watcher got there first, and the watcher's
+        // copy may be newer than ours
+        torchlight_template_t* cached = entry->template;
+        __atomic_add_fetch(&cached->refcount, 1, __ATOMIC_RELAXED);
+        pthread_mutex_unlock(&g_template_cache_lock);
+        torchlight_release_template(tpl);
+        return cached;
+    }
+
+    if (trusted && g_template_reloads != reloads) {
+        // The watcher saw a change while we compiled and found nothing to
+        // reload. Our copy may be stale, and trusted entries are never
+        // checked again, so leave it to the next load.
+        pthread_mutex_unlock(&g_template_cache_lock);
+        return tpl;
+    }
+
+    if (!entry) {
+        entry = calloc(1, sizeof(template_cache_entry_t));
+        if (entry) entry->path = strdup(key);
+        if (!entry || !entry->path) {
+            free(entry);
+            pthread_mutex_unlock(&g_template_cache_lock);
+            return tpl;  // Uncached, still usable
+        }
+        entry->hash = hash;
+        entry->next = *bucket;
+        *bucket = entry;
+    } else {
+        torchlight_release_template(entry->template);
+    }
+    entry->trusted = trusted;
+
+    // One reference for the cache, one for the caller
+    tpl->refcount = 2;
+    entry->template = tpl;
+
+    pthread_mutex_unlock(&g_template_cache_lock);
+    return tpl;
+}
+
+// Hot reload (called by template_watcher.c)
+
+void tl_template_cache_watch(const char* directory) {
+    pthread_mutex_lock(&g_template_cache_lock);
+    if (!directory || template_normalize_path(directory, g_template_watched, sizeof(g_template_watched)) != 0 ||
+        !realpath(directory, g_template_watched_real)) {
+        g_template_watched[0] = '\0';
+        g_template_watched_real[0] = '\0';
+    }
+
+    // A trailing slash would never match "dir/" + name
+    size_t length = strlen(g_template_watched);
+    while (length > 1 && g_template_watched[length - 1] == '/') g_template_watched[--length] = '\0';
+    pthread_mutex_unlock(&g_template_cache_lock);
+}
+
+// `path` changed on disk: recompile a cached template and swap it in, or
+// drop it if the file went away. Renders holding the old template keep
+// it until they release it; a template that no longer compiles stays as
+// it was.
+void tl_template_cache_reload(const char* path, bool removed) {
+    char key[1024];
+    if (template_normalize_path(path, key, sizeof(key)) != 0) return;
+
+    uint64_t hash = template_path_hash(key);
+    template_cache_entry_t** bucket = &g_template_cache[hash & (TEMPLATE_CACHE_BUCKETS - 1)];
+    template_cache_entry_t** link = bucket;
+
+    pthread_mutex_lock(&g_template_cache_lock);
+    g_template_reloads++;
+    while (*link && ((*link)->hash != hash || strcmp((*link)->path, key) != 0)) {
+        link = &(*link)->next;
+    }
+    bool cached = *link != NULL;
+
+    if (cached && removed) {
+        template_cache_entry_t* entry = *link;
+        *link = entry->next;
+        torchlight_release_template(entry->template);
+        free(entry->path);
+        free(entry);
+    }
+    pthread_mutex_unlock(&g_template_cache_lock);
+
+    if (!cached) return;
+    if (removed) {
+        printf("🔥 Template removed: %s\n", path);
+        return;
+    }
+
+    struct stat st;
+    torchlight_template_t* tpl = stat(path, &st) == 0 ? template_compile_file(path, &st) : NULL;
+    if (!tpl) {
+        printf("❌ Template %s failed to reload; serving the last good version\n", path);
+        return;
+    }
+
+    pthread_mutex_lock(&g_template_cache_lock);
+    template_cache_entry_t* entry = template_cache_find(*bucket, key, hash);
+    if (entry) {
+        // An edit rarely changes the output size much; keep the history
+        tpl->output_estimate = entry->template->output_estimate;
+        tpl->span_estimate = entry->template->span_estimate;
+        torchlight_release_template(entry->template);
+        entry->template = tpl;
+        tpl = NULL;
+    }
+    pthread_mutex_unlock(&g_template_cache_lock);
+
+    if (tpl) {
+        torchlight_release_template(tpl);  // Dropped meanwhile
+        return;
+    }
+
+    // Fragments rendered from the old version would hide the edit
+    torchlight_invalidate_fragments(NULL);
+    printf("🔥 Template reloaded: %s\n", path);
+}
+
+void torchlight_clear_template_cache(void) {
+    pthread_mutex_lock(&g_template_cache_lock);
+    g_template_reloads++;
+
+    for (int i = 0; i < TEMPLATE_CACHE_BUCKETS; i++) {
+        template_cache_entry_t* entry = g_template_cache[i];
+        while (entry) {
+            template_cache_entry_t* next = entry->next;
+            torchlight_release_template(entry->template);
+            free(entry->path);
+            free(entry);
+            entry = next;
+        }
+        g_template_cache[i] = NULL;
+    }
+
+    pthread_mutex_unlock(&g_template_cache_lock);
+}
+
+// Embedding
+//
+// torchlight_embed compiles templates at build time and writes their ops
+// out as torchlight_embedded_op_t arrays; at registration they are turned
+// back into templates whose source is the embedded data. Only the slot
+// table is rebuilt (names, hashes, dotted segments).
+
+torchlight_embedded_op_t* tl_template_export(const torchlight_template_t* tpl, size_t* op_count,
+                                             size_t* literal_bytes) {
+    torchlight_embedded_op_t* ops = calloc(tpl->op_count ? tpl->op_count : 1,
+                                           sizeof(torchlight_embedded_op_t));
+    if (!ops) return NULL;
+
+    for (size_t i = 0; i < tpl->op_count; i++) {
+        const template_op_t* op = &tpl->ops[i];
+        ops[i] = (torchlight_embedded_op_t){ op->type, op->offset, op->length, op->slot,
+                                             op->jump, op->escape };
+    }
+
+    *op_count = tpl->op_count;
+    *literal_bytes = tpl->literal_bytes;
+    return ops;
+}
+
+torchlight_template_t* tl_template_import(const torchlight_embedded_asset_t* asset) {
+    if (!asset->ops || asset->length > UINT32_MAX) return NULL;
+
+    torchlight_template_t* tpl = calloc(1, sizeof(torchlight_template_t));
+    if (!tpl) return NULL;
+
+    tpl->source = (char*)asset->data;
+    tpl->source_length = asset->length;
+    tpl->source_hash = template_name_hash(tpl->source, tpl->source_length);
+    tpl->literal_bytes = asset->literal_bytes;
+    tpl->refcount = 1;
+    tpl->embedded = true;
+
+    for (uint32_t i = 0; i < asset->slot_count; i++) {
+        const char* name = asset->slot_names[i];
+        if (template_slot(tpl, name, strlen(name)) != (int)i) goto fail;
+    }
+
+    tpl->ops = malloc((asset->op_count ? asset->op_count : 1) * sizeof(template_op_t));
+    if (!tpl->ops) goto fail;
+
+    // The bundle is trusted, but a stale one must not send the
+    // interpreter out of bounds
+    for (uint32_t i = 0; i < asset->op_count; i++) {
+        const torchlight_embedded_op_t* op = &asset->ops[i];
+        bool has_slot = op->type == TEMPLATE_OP_VARIABLE || op->type == TEMPLATE_OP_SECTION ||
+                        op->type == TEMPLATE_OP_INVERTED ||
+                        (op->type == TEMPLATE_OP_CACHE && op->slot != UINT32_MAX);
+        if (op->type > TEMPLATE_OP_CACHE || op->escape > TORCHLIGHT_ESCAPE_JS_VALUE_ATTRIBUTE ||
+            op->jump >= asset->op_count || (size_t)op->offset + op->length > asset->length ||
+            (has_slot && op->slot >= asset->slot_count)) {
+            printf("❌ Embedded template %s is corrupt\n", asset->path);
+            goto fail;
+        }
+        tpl->ops[i] = (template_op_t){ (template_op_type_t)op->type, op->offset, op->length,
+                                       op->slot, op->jump, (torchlight_escape_t)op->escape };
+    }
+    tpl->op_count = asset->op_count;
+
+    return tpl;
+
+fail:
+    template_free(tpl);
+    return NULL;
+}
+
+// Slot binding
+//
+// Handlers can bind values by slot index (torchlight_render_slots) or
+// through a callback instead of building JSON. Slot-mode output is sized
+// exactly: the interpreter runs once to measure and once to copy, so the
+// render is a single malloc.
+
+#define TEMPLATE_INLINE_SLOTS 64
+
+int torchlight_template_slot(const torchlight_template_t* tpl, const char* name) {
+    if (!tpl || !name) return -1;
+
+    size_t length = strlen(name);
+    uint64_t hash = template_name_hash(name, length);
+
+    for (size_t i = 0; i < tpl->slot_count; i++) {
+        if (tpl->slots[i].hash == hash && tpl->slots[i].length == length &&
+            memcmp(tpl->slots[i].name, name, length) == 0) {
+            return (int)i;
+        }
+    }
+    return -1;
+}
+
+size_t torchlight_template_slot_count(const torchlight_template_t* tpl) {
+    return tpl ? tpl->slot_count : 0;
+}
+
+const char* torchlight_template_slot_name(const torchlight_template_t* tpl, size_t slot) {
+    if (!tpl || slot >= tpl->slot_count) return NULL;
+    return tpl->slots[slot].name;
+}
+
+// Value array for a render: on the stack for typical templates
+static torchlight_value_t* template_values(const torchlight_template_t* tpl,
+                                           torchlight_value_t* local) {
+    if (tpl->slot_count <= TEMPLATE_INLINE_SLOTS) {
+        memset(local, 0, tpl->slot_count * sizeof(torchlight_value_t));
+        return local;
+    }
+    return calloc(tpl->slot_count, sizeof(torchlight_value_t));
+}
+
+// Partials
+
+void torchlight_set_template_directory(const char* directory) {
+    snprintf(g_template_directory, sizeof(g_template_directory), "%s", directory ? directory : "");
+}
+
+static int template_partial_path(const char* name, size_t length, char* path, size_t size) {
+    if (length == 0) return -1;
+
+    int written;
+    if (g_template_directory[0] && name[0] != '/') {
+        written = snprintf(path, size, "%s/%.*s", g_template_directory, (int)length, name);
     } else {
-        // Number or boolean value
-        value_end = value_start;
-        while (*value_end && *value_end != ',' && *value_end != '}' && *value_end != '\n') {
-            value_end++;
-        }
-    }
-    
-    if (!value_end) return NULL;
-    
-    size_t value_length = value_end - value_start;
-    char* value = malloc(value_length + 1);
-    if (!value) return NULL;
-    
-    strncpy(value, value_start, value_length);
-    value[value_length] = '\0';
-    
-    // Trim trailing whitespace
-    while (value_length > 0 && (value[value_length - 1] == ' ' || value[value_length - 1] == '\t')) {
-        value[--value_length] = '\0';
-    }
-    
-    return value;
+        written = snprintf(path, size, "%.*s", (int)length, name);
+    }
+    return written > 0 && (size_t)written < size ? 0 : -1;
+}
+
+// Fragment cache
+//
+// A {{%cache}} block is rendered into its own buffer, which becomes a
+// reference-counted fragment stored under "name\0value" until its TTL
+// runs out. Hits are spliced into the output: copied by the buffer sink,
+// or pointed at by the iov sink, which holds a reference until the
+// response is released, so replacing or dropping the entry never pulls
+// the bytes out from under a response in flight. Concurrent misses may
+// render the same block; the last one stored wins. Expired entries are
+// swept when the cache is full, and past that new fragments go uncached.
+
+#define FRAGMENT_CACHE_BUCKETS 256
+#define FRAGMENT_CACHE_MAX_ENTRIES 4096
+
+typedef struct {
+    int refcount;
+    size_t length;
+    char* data;
+} template_fragment_t;
+
+typedef struct fragment_entry {
+    char* key;
+    size_t key_length;
+    size_t name_length;
+    uint64_t hash;
+    uint64_t expires_us;
+    template_fragment_t* fragment;
+    struct fragment_entry* next;
+} fragment_entry_t;
+
+static fragment_entry_t* g_fragment_cache[FRAGMENT_CACHE_BUCKETS];
+static size_t g_fragment_count = 0;
+static pthread_mutex_t g_fragment_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static uint64_t fragment_now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000ull + (uint64_t)ts.tv_nsec / 1000;
+}
+
+static void fragment_release(template_fragment_t* fragment) {
+    if (fragment && __atomic_sub_fetch(&fragment->refcount, 1, __ATOMIC_ACQ_REL) == 0) {
+        free(fragment->data);
+        free(fragment);
+    }
+}
+
+static void fragment_entry_free(fragment_entry_t* entry) {
+    fragment_release(entry->fragment);
+    free(entry->key);
+    free(entry);
+}
+
+// A referenced fragment for the key, or NULL if absent or expired
+static template_fragment_t* fragment_lookup(const char* key, size_t key_length, uint64_t hash) {
+    pthread_mutex_lock(&g_fragment_lock);
+
+    template_fragment_t* fragment = NULL;
+    for (fragment_entry_t* entry = g_fragment_cache[hash & (FRAGMENT_CACHE_BUCKETS - 1)];
+         entry; entry = entry->next) {
+        if (entry->hash == hash && entry->key_length == key_length &&
+            memcmp(entry->key, key, key_length) == 0) {
+            if (entry->expires_us > fragment_now_us()) {
+                fragment = entry->fragment;
+                __atomic_add_fetch(&fragment->refcount, 1, __ATOMIC_RELAXED);
+            }
+            break;
+        }
+    }
+
+    pthread_mutex_unlock(&g_fragment_lock);
+    return fragment;
+}
+
+// Drop the entries `drop` selects; lock held
+static void fragment_sweep(bool (*drop)(const fragment_entry_t* entry, const void* context),
+                           const void* context) {
+    for (int i = 0; i < FRAGMENT_CACHE_BUCKETS; i++) {
+        fragment_entry_t** link = &g_fragment_cache[i];
+        while (*link) {
+            fragment_entry_t* entry = *link;
+            if (drop(entry, context)) {
+                *link = entry->next;
+                fragment_entry_free(entry);
+                g_fragment_count--;
+            } else {
+                link = &entry->next;
+            }
+        }
+    }
 }
 
-int torchlight_substitute_variables(const char* template_str, const char* variables_json,
-                                   char** output, size_t* output_size) {
-    if (!template_str || !output) return -1;
-    
-    size_t template_length = strlen(template_str);
-    size_t result_capacity = template_length * 2;  // Start with 2x template size
-    char* result = malloc(result_capacity);
-    if (!result) return -1;
-    
-    const char* src = template_str;
-    char* dst = result;
-    size_t dst_used = 0;
-    
-    while (*src) {
-        if (src[0] == '{' && src[1] == '{') {
-            // Found variable start
-            const char* var_start = src + 2;
-            const char* var_end = strstr(var_start, "}}");
-            
-            if (var_end) {
-                // Extract variable name
-                size_t var_name_length = var_end - var_start;
-                char* var_name = malloc(var_name_length + 1);
-                if (!var_name) {
-                    free(result);
-                    return -1;
-                }
-                
-                strncpy(var_name, var_start, var_name_length);
-                var_name[var_name_length] = '\0';
-                
-                // Get variable value
-                char* var_value = NULL;
-                if (variables_json) {
-                    var_value = find_json_value(variables_json, var_name);
-                }
-                
-                if (!var_value) {
-                    var_value = strdup("");  // Empty string for missing variables
-                }
-                
-                // Check if we need to expand the result buffer
-                size_t value_length = strlen(var_value);
-                if (dst_used + value_length >= result_capacity) {
-                    result_capacity = (dst_used + value_length + 1024) * 2;
-                    char* new_result = realloc(result, result_capacity);
-                    if (!new_result) {
-                        free(var_name);
-                        free(var_value);
-                        free(result);
-                        return -1;
-                    }
-                    result = new_result;
-                    dst = result + dst_used;
-                }
-                
-                // Copy variable value to result
-                strcpy(dst, var_value);
-                dst += value_length;
-                dst_used += value_length;
-                
-                free(var_name);
-                free(var_value);
-                
-                src = var_end + 2;  // Skip past }}
+static bool fragment_expired(const fragment_entry_t* entry, const void* context) {
+    return entry->expires_us <= *(const uint64_t*)context;
+}
+
+static bool fragment_named(const fragment_entry_t* entry, const void* context) {
+    const char* name = context;
+    return !name || (strlen(name) == entry->name_length &&
+                     memcmp(entry->key, name, entry->name_length) == 0);
+}
+
+static void fragment_store(const char* key, size_t key_length, size_t name_length, uint64_t hash,
+                           template_fragment_t* fragment, uint64_t ttl_us) {
+    uint64_t now = fragment_now_us();
+    fragment_entry_t** bucket = &g_fragment_cache[hash & (FRAGMENT_CACHE_BUCKETS - 1)];
+
+    pthread_mutex_lock(&g_fragment_lock);
+
+    fragment_entry_t* entry = *bucket;
+    while (entry && (entry->hash != hash || entry->key_length != key_length ||
+                     memcmp(entry->key, key, key_length) != 0)) {
+        entry = entry->next;
+    }
+
+    if (!entry) {
+        if (g_fragment_count >= FRAGMENT_CACHE_MAX_ENTRIES) fragment_sweep(fragment_expired, &now);
+
+        if (g_fragment_count < FRAGMENT_CACHE_MAX_ENTRIES) {
+            entry = calloc(1, sizeof(fragment_entry_t));
+            if (entry) entry->key = malloc(key_length);
+            if (entry && entry->key) {
+                memcpy(entry->key, key, key_length);
+                entry->key_length = key_length;
+                entry->name_length = name_length;
+                entry->hash = hash;
+                entry->next = *bucket;
+                *bucket = entry;
+                g_fragment_count++;
             } else {
-                // No closing }}, treat as literal text
-                *dst++ = *src++;
-                dst_used++;
+                free(entry);
+                entry = NULL;
             }
+        }
+    }
+
+    if (entry) {
+        fragment_release(entry->fragment);
+        __atomic_add_fetch(&fragment->refcount, 1, __ATOMIC_RELAXED);
+        entry->fragment = fragment;
+        entry->expires_us = now + ttl_us;
+    }
+
+    pthread_mutex_unlock(&g_fragment_lock);
+}
+
+void torchlight_invalidate_fragments(const char* name) {
+    pthread_mutex_lock(&g_fragment_lock);
+    fragment_sweep(fragment_named, name);
+    pthread_mutex_unlock(&g_fragment_lock);
+}
+
+// Rendering
+//
+// The interpreter writes through a sink. BUFFER copies into a growing pool
+// buffer, and IOV records spans for a scatter/gather response body (holding
+// references to the partials and cached fragments those spans point into).
+// Values that need escaping are escaped into the buffer, or for IOV into
+// scratch chunks owned by the sink; clean values are emitted as is.
+
+#define RENDER_CHUNK_SIZE 16384
+
+typedef struct render_chunk {
+    struct render_chunk* next;
+    size_t capacity;
+    size_t used;
+    char data[];
+} render_chunk_t;
+
+typedef enum {
+    RENDER_SINK_BUFFER = 0,
+    RENDER_SINK_IOV
+} render_sink_mode_t;
+
+typedef struct {
+    render_sink_mode_t mode;
+    size_t length;
+
+    char* data;                     // BUFFER; capacity includes the NUL
+    size_t capacity;
+
+    struct iovec* iov;              // IOV
+    size_t iov_count;
+    size_t iov_capacity;
+
+    torchlight_template_t** held;   // IOV: partials the spans point into
+    size_t held_count;
+    size_t held_capacity;
+
+    template_fragment_t** fragments; // IOV: cached fragments likewise
+    size_t fragment_count;
+    size_t fragment_capacity;
+
+    render_chunk_t* chunks;         // IOV: escaped values
+} render_sink_t;
+
+static int sink_emit(render_sink_t* sink, const char* data, size_t length) {
+    if (length == 0) return 0;
+
+    if (sink->mode == RENDER_SINK_BUFFER) {
+        if (sink->length + length + 1 > sink->capacity) {
+            char* grown = torchlight_buffer_grow(sink->data, &sink->capacity, sink->length + length + 1);
+            if (!grown) return -1;
+            sink->data = grown;
+        }
+        memcpy(sink->data + sink->length, data, length);
+    } else if (sink->mode == RENDER_SINK_IOV) {
+        struct iovec* last = sink->iov_count ? &sink->iov[sink->iov_count - 1] : NULL;
+
+        if (last && (const char*)last->iov_base + last->iov_len == data) {
+            last->iov_len += length;  // Contiguous with the previous span
         } else {
-            // Regular character
-            if (dst_used >= result_capacity - 1) {
-                result_capacity *= 2;
-                char* new_result = realloc(result, result_capacity);
-                if (!new_result) {
-                    free(result);
+            if (sink->iov_count == sink->iov_capacity) {
+                size_t new_capacity = sink->iov_capacity ? sink->iov_capacity * 2 : 64;
+                struct iovec* iov = realloc(sink->iov, new_capacity * sizeof(struct iovec));
+                if (!iov) return -1;
+                sink->iov = iov;
+                sink->iov_capacity = new_capacity;
+            }
+            sink->iov[sink->iov_count].iov_base = (void*)data;
+            sink->iov[sink->iov_count].iov_len = length;
+            sink->iov_count++;
+        }
+    }
+
+    sink->length += length;
+    return 0;
+}
+
+// Keep a partial alive for the sink's spans; the reference is consumed
+static int sink_hold(render_sink_t* sink, torchlight_template_t* tpl) {
+    if (sink->mode != RENDER_SINK_IOV) {
+        torchlight_release_template(tpl);
+        return 0;
+    }
+
+    if (sink->held_count == sink->held_capacity) {
+        size_t new_capacity = sink->held_capacity ? sink->held_capacity * 2 : 4;
+        torchlight_template_t** held = realloc(sink->held, new_capacity * sizeof(*held));
+        if (!held) {
+            torchlight_release_template(tpl);
+            return -1;
+        }
+        sink->held = held;
+        sink->held_capacity = new_capacity;
+    }
+
+    sink->held[sink->held_count++] = tpl;
+    return 0;
+}
+
+// Emit a cached fragment; the reference is consumed
+static int sink_emit_fragment(render_sink_t* sink, template_fragment_t* fragment) {
+    if (sink->mode != RENDER_SINK_IOV) {
+        int result = sink_emit(sink, fragment->data, fragment->length);
+        fragment_release(fragment);
+        return result;
+    }
+
+    if (sink->fragment_count == sink->fragment_capacity) {
+        size_t new_capacity = sink->fragment_capacity ? sink->fragment_capacity * 2 : 4;
+        template_fragment_t** fragments = realloc(sink->fragments, new_capacity * sizeof(*fragments));
+        if (!fragments) {
+            fragment_release(fragment);
+            return -1;
+        }
+        sink->fragments = fragments;
+        sink->fragment_capacity = new_capacity;
+    }
+
+    sink->fragments[sink->fragment_count++] = fragment;
+    return sink_emit(sink, fragment->data, fragment->length);
+}
+
+static char* sink_scratch(render_sink_t* sink, size_t length) {
+    render_chunk_t* chunk = sink->chunks;
+
+    if (!chunk || chunk->capacity - chunk->used < length) {
+        size_t capacity = length > RENDER_CHUNK_SIZE ? length : RENDER_CHUNK_SIZE;
+        chunk = malloc(sizeof(render_chunk_t) + capacity);
+        if (!chunk) return NULL;
+        chunk->next = sink->chunks;
+        chunk->capacity = capacity;
+        chunk->used = 0;
+        sink->chunks = chunk;
+    }
+
+    char* data = chunk->data + chunk->used;
+    chunk->used += length;
+    return data;
+}
+
+static int sink_emit_escaped(render_sink_t* sink, torchlight_escape_t escape,
+                             const char* data, size_t length) {
+    if (escape == TORCHLIGHT_ESCAPE_JS_VALUE || escape == TORCHLIGHT_ESCAPE_JS_VALUE_ATTRIBUTE) {
+        const char* quote = escape == TORCHLIGHT_ESCAPE_JS_VALUE ? "\"" : "&#34;";
+        size_t quote_length = strlen(quote);
+
+        if (sink_emit(sink, quote, quote_length) != 0 ||
+            sink_emit_escaped(sink, TORCHLIGHT_ESCAPE_JS, data, length) != 0) {
+            return -1;
+        }
+        return sink_emit(sink, quote, quote_length);
+    }
+
+    if (escape == TORCHLIGHT_ESCAPE_URL_ATTRIBUTE) {
+        if (!tl_escape_url_safe(data, length)) return sink_emit(sink, "#", 1);
+        escape = TORCHLIGHT_ESCAPE_ATTRIBUTE;
+    }
+
+    size_t clean = escape == TORCHLIGHT_ESCAPE_NONE ? length : tl_escape_scan(escape, data, length);
+    if (clean == length) return sink_emit(sink, data, length);
+
+    if (sink->mode == RENDER_SINK_IOV) {
+        size_t needed = torchlight_escape(escape, data, length, NULL, 0);
+        char* out = sink_scratch(sink, needed + 1);
+        if (!out) return -1;
+        torchlight_escape(escape, data, length, out, needed + 1);
+        return sink_emit(sink, out, needed);
+    }
+
+    for (;;) {
+        if (sink_emit(sink, data, clean) != 0) return -1;
+        data += clean;
+        length -= clean;
+        if (length == 0) return 0;
+
+        char sequence[8];
+        size_t consumed;
+        size_t sequence_length = tl_escape_sequence(escape, data, length, sequence, &consumed);
+        if (sink_emit(sink, sequence, sequence_length) != 0) return -1;
+        data += consumed;
+        length -= consumed;
+
+        clean = tl_escape_scan(escape, data, length);
+    }
+}
+
+static void sink_free(render_sink_t* sink) {
+    while (sink->chunks) {
+        render_chunk_t* next = sink->chunks->next;
+        free(sink->chunks);
+        sink->chunks = next;
+    }
+    for (size_t i = 0; i < sink->held_count; i++) {
+        torchlight_release_template(sink->held[i]);
+    }
+    for (size_t i = 0; i < sink->fragment_count; i++) {
+        fragment_release(sink->fragments[i]);
+    }
+    free(sink->held);
+    free(sink->fragments);
+    free(sink->iov);
+    torchlight_buffer_free(sink->data, sink->capacity);
+    memset(sink, 0, sizeof(*sink));
+}
+
+typedef struct {
+    render_sink_t* sink;
+
+    // JSON mode: names resolve through the context stack
+    const template_json_t* doc;
+    const json_node_t* contexts[TEMPLATE_MAX_DEPTH];
+    int context_depth;
+
+    // Slot mode (doc == NULL)
+    const torchlight_value_t* values;
+    size_t value_count;
+
+    int partial_depth;
+} render_state_t;
+
+typedef struct {
+    uint32_t open;              // SECTION/INVERTED op
+    const json_node_t* list;    // Array being iterated, or NULL
+    uint32_t next;              // Node index of the next element
+    bool pushed;                // A context was pushed for this frame
+} render_frame_t;
+
+static void render_state_init(render_state_t* state, render_sink_t* sink, const template_json_t* doc,
+                              const torchlight_value_t* values, size_t value_count) {
+    memset(state, 0, sizeof(*state));
+    state->sink = sink;
+    state->doc = doc;
+    state->values = values;
+    state->value_count = value_count;
+
+    if (doc && doc->count > 0) {
+        state->contexts[state->context_depth++] = &doc->nodes[0];
+    }
+}
+
+// Member of an object node by name (the root goes through its key map)
+static const json_node_t* json_member(const template_json_t* doc, const json_node_t* object,
+                                      const char* name, size_t length, uint64_t hash) {
+    if (object->type != JSON_NODE_OBJECT) return NULL;
+    if (object == &doc->nodes[0]) return template_json_lookup(doc, name, length, hash);
+
+    for (uint32_t i = (uint32_t)(object - doc->nodes) + 1; i < object->end; i = doc->nodes[i].end) {
+        const json_node_t* member = &doc->nodes[i];
+        if (member->key_length == length && memcmp(member->key, name, length) == 0) {
+            return member;
+        }
+    }
+    return NULL;
+}
+
+static const json_node_t* render_resolve(const render_state_t* state, const torchlight_template_t* tpl,
+                                         uint32_t slot_index) {
+    const template_slot_t* slot = &tpl->slots[slot_index];
+    if (state->context_depth == 0) return NULL;
+    if (slot->segment_count == 0) return state->contexts[state->context_depth - 1];
+
+    const template_segment_t* segments = &tpl->segments[slot->segment_start];
+
+    // The first segment is looked up innermost-first; the rest descend
+    for (int depth = state->context_depth - 1; depth >= 0; depth--) {
+        const json_node_t* node = json_member(state->doc, state->contexts[depth],
+                                              slot->name + segments[0].offset,
+                                              segments[0].length, segments[0].hash);
+        if (!node) continue;
+
+        for (uint32_t i = 1; i < slot->segment_count && node; i++) {
+            node = json_member(state->doc, node, slot->name + segments[i].offset,
+                               segments[i].length, segments[i].hash);
+        }
+        return node;
+    }
+    return NULL;
+}
+
+static bool json_truthy(const template_json_t* doc, const json_node_t* node) {
+    if (!node) return false;
+
+    switch (node->type) {
+        case JSON_NODE_FALSE:
+        case JSON_NODE_NULL:
+            return false;
+        case JSON_NODE_STRING:
+            return node->value_length > 0;
+        case JSON_NODE_ARRAY:
+            return node->end > (uint32_t)(node - doc->nodes) + 1;
+        default:
+            return true;
+    }
+}
+
+static int template_execute_range(const torchlight_template_t* tpl, render_state_t* state,
+                                  size_t begin, size_t end);
+
+static int template_execute(const torchlight_template_t* tpl, render_state_t* state) {
+    return template_execute_range(tpl, state, 0, tpl->op_count);
+}
+
+static int render_partial(const torchlight_template_t* tpl, const template_op_t* op,
+                          render_state_t* state) {
+    if (state->partial_depth >= TEMPLATE_MAX_PARTIAL_DEPTH) {
+        printf("❌ Template partials nested too deeply\n");
+        return -1;
+    }
+
+    // Missing partials render as nothing
+    char path[1024];
+    if (template_partial_path(tpl->source + op->offset, op->length, path, sizeof(path)) != 0) return 0;
+
+    torchlight_template_t* partial = torchlight_load_template(path);
+    if (!partial) return 0;
+
+    const torchlight_value_t* values = state->values;
+    size_t value_count = state->value_count;
+    torchlight_value_t local[TEMPLATE_INLINE_SLOTS];
+    torchlight_value_t* mapped = NULL;
+
+    // In slot mode the partial's slots are bound by name to ours
+    if (!state->doc) {
+        mapped = template_values(partial, local);
+        if (!mapped) {
+            torchlight_release_template(partial);
+            return -1;
+        }
+        for (size_t i = 0; i < partial->slot_count; i++) {
+            int slot = torchlight_template_slot(tpl, partial->slots[i].name);
+            if (slot >= 0 && (size_t)slot < value_count) mapped[i] = values[slot];
+        }
+        state->values = mapped;
+        state->value_count = partial->slot_count;
+    }
+
+    state->partial_depth++;
+    int result = template_execute(partial, state);
+    state->partial_depth--;
+
+    state->values = values;
+    state->value_count = value_count;
+    if (mapped != local) free(mapped);
+
+    if (sink_hold(state->sink, partial) != 0) return -1;
+    return result;
+}
+
+// {{%cache}}: splice the cached fragment, or render the block into a new one
+static int render_cached(const torchlight_template_t* tpl, size_t pc, render_state_t* state) {
+    const template_op_t* op = &tpl->ops[pc];
+    const char* span = tpl->source + op->offset;
+
+    size_t name_length = 0;
+    while (name_length < op->length && !template_is_space(span[name_length])) name_length++;
+
+    size_t ttl_start = op->length;
+    while (ttl_start > 0 && !template_is_space(span[ttl_start - 1])) ttl_start--;
+    uint64_t ttl_us = 0;
+    for (size_t i = ttl_start; i < op->length; i++) ttl_us = ttl_us * 10 + (uint64_t)(span[i] - '0');
+    ttl_us *= 1000000ull;
+
+    // Key: name, NUL, the context the block starts in, the template, the
+    // variable's value. The same name elsewhere is a different fragment.
+    const char* value = NULL;
+    size_t value_length = 0;
+    if (op->slot != UINT32_MAX) {
+        if (state->doc) {
+            const json_node_t* node = render_resolve(state, tpl, op->slot);
+            if (node && node->type <= JSON_NODE_FALSE) {
+                value = node->value;
+                value_length = node->value_length;
+            }
+        } else if (op->slot < state->value_count && state->values[op->slot].ptr) {
+            value = state->values[op->slot].ptr;
+            value_length = state->values[op->slot].len;
+        }
+    }
+
+    char local_key[256];
+    size_t prefix_length = name_length + 2 + sizeof(tpl->source_hash);
+    size_t key_length = prefix_length + value_length;
+    char* key = key_length <= sizeof(local_key) ? local_key : malloc(key_length);
+    if (!key) return -1;
+    memcpy(key, span, name_length);
+    key[name_length] = '\0';
+    key[name_length + 1] = (char)op->escape;
+    memcpy(key + name_length + 2, &tpl->source_hash, sizeof(tpl->source_hash));
+    if (value_length) memcpy(key + prefix_length, value, value_length);
+
+    uint64_t hash = template_name_hash(key, key_length);
+    template_fragment_t* fragment = ttl_us ? fragment_lookup(key, key_length, hash) : NULL;
+
+    if (!fragment) {
+        render_sink_t buffer = { .mode = RENDER_SINK_BUFFER, .capacity = 256 };
+        buffer.data = malloc(buffer.capacity);
+        fragment = calloc(1, sizeof(template_fragment_t));
+
+        render_sink_t* sink = state->sink;
+        state->sink = &buffer;
+        int result = buffer.data && fragment ? template_execute_range(tpl, state, pc + 1, op->jump) : -1;
+        state->sink = sink;
+
+        if (result != 0) {
+            sink_free(&buffer);
+            free(fragment);
+            if (key != local_key) free(key);
+            return -1;
+        }
+
+        fragment->refcount = 1;
+        fragment->data = buffer.data;
+        fragment->length = buffer.length;
+        if (ttl_us) fragment_store(key, key_length, name_length, hash, fragment, ttl_us);
+    }
+
+    if (key != local_key) free(key);
+    return sink_emit_fragment(state->sink, fragment);
+}
+
+static int template_execute_range(const torchlight_template_t* tpl, render_state_t* state,
+                                  size_t begin, size_t end) {
+    render_frame_t frames[TEMPLATE_MAX_DEPTH];
+    int frame_count = 0;
+    size_t pc = begin;
+
+    while (pc < end) {
+        const template_op_t* op = &tpl->ops[pc];
+
+        switch (op->type) {
+            case TEMPLATE_OP_LITERAL:
+                if (sink_emit(state->sink, tpl->source + op->offset, op->length) != 0) return -1;
+                pc++;
+                break;
+
+            case TEMPLATE_OP_VARIABLE: {
+                // Missing variables, null and containers render as an empty
+                // string (quoted, where the value stands for JavaScript code)
+                const char* data = NULL;
+                size_t length = 0;
+
+                if (state->doc) {
+                    const json_node_t* node = render_resolve(state, tpl, op->slot);
+                    if (node && node->type <= JSON_NODE_FALSE) {
+                        data = node->value;
+                        length = node->value_length;
+                    }
+                } else if (op->slot < state->value_count && state->values[op->slot].ptr) {
+                    data = state->values[op->slot].ptr;
+                    length = state->values[op->slot].len;
+                }
+
+                if ((data || op->escape >= TORCHLIGHT_ESCAPE_JS_VALUE) &&
+                    sink_emit_escaped(state->sink, op->escape, data ? data : "", length) != 0) {
                     return -1;
                 }
-                result = new_result;
-                dst = result + dst_used;
+                pc++;
+                break;
+            }
+
+            case TEMPLATE_OP_SECTION:
+            case TEMPLATE_OP_INVERTED: {
+                const json_node_t* node = NULL;
+                bool truthy;
+
+                if (state->doc) {
+                    node = render_resolve(state, tpl, op->slot);
+                    truthy = json_truthy(state->doc, node);
+                } else {
+                    truthy = op->slot < state->value_count && state->values[op->slot].ptr &&
+                             state->values[op->slot].len > 0;
+                }
+
+                if (truthy != (op->type == TEMPLATE_OP_SECTION)) {
+                    pc = op->jump + 1;
+                    break;
+                }
+
+                render_frame_t* frame = &frames[frame_count++];
+                frame->open = (uint32_t)pc;
+                frame->list = NULL;
+                frame->pushed = false;
+
+                // Sections over JSON values become the innermost context;
+                // a list starts with its first element
+                if (node && op->type == TEMPLATE_OP_SECTION) {
+                    const json_node_t* context = node;
+                    if (node->type == JSON_NODE_ARRAY) {
+                        frame->list = node;
+                        context = node + 1;
+                        frame->next = context->end;
+                    }
+
+                    if (state->context_depth == TEMPLATE_MAX_DEPTH) return -1;
+                    state->contexts[state->context_depth++] = context;
+                    frame->pushed = true;
+                }
+                pc++;
+                break;
+            }
+
+            case TEMPLATE_OP_END: {
+                render_frame_t* frame = &frames[frame_count - 1];
+
+                if (frame->list && frame->next < frame->list->end) {
+                    const json_node_t* element = &state->doc->nodes[frame->next];
+                    state->contexts[state->context_depth - 1] = element;
+                    frame->next = element->end;
+                    pc = frame->open + 1;
+                    break;
+                }
+
+                if (frame->pushed) state->context_depth--;
+                frame_count--;
+                pc++;
+                break;
             }
-            
-            *dst++ = *src++;
-            dst_used++;
+
+            case TEMPLATE_OP_PARTIAL:
+                if (render_partial(tpl, op, state) != 0) return -1;
+                pc++;
+                break;
+
+            case TEMPLATE_OP_CACHE:
+                if (render_cached(tpl, pc, state) != 0) return -1;
+                pc = op->jump + 1;
+                break;
         }
     }
-    
-    *dst = '\0';
-    *output = result;
-    if (output_size) *output_size = dst_used;
-    
+
     return 0;
 }
 
-int torchlight_render_template(const char* template_path, const char* variables_json, 
-                              char** output, size_t* output_size) {
-    if (!template_path || !output) return -1;
-    
-    // Read template file
-    FILE* file = fopen(template_path, "r");
-    if (!file) return -1;
-    
-    fseek(file, 0, SEEK_END);
-    long file_size = ftell(file);
-    fseek(file, 0, SEEK_SET);
-    
-    if (file_size <= 0) {
-        fclose(file);
+int torchlight_render_fill(const torchlight_template_t* tpl, torchlight_slot_fill_t fill,
+                           void* context, char** output, size_t* output_size) {
+    if (!tpl || !fill || !output) return -1;
+
+    torchlight_value_t local[TEMPLATE_INLINE_SLOTS];
+    torchlight_value_t* values = template_values(tpl, local);
+    if (!values) return -1;
+
+    int result = 0;
+    for (size_t i = 0; i < tpl->slot_count && result == 0; i++) {
+        result = fill(context, i, tpl->slots[i].name, &values[i]);
+    }
+
+    if (result == 0) {
+        result = torchlight_render_slots(tpl, values, tpl->slot_count, output, output_size);
+    }
+
+    if (values != local) free(values);
+    return result == 0 ? 0 : -1;
+}
+
+// Render into a pool buffer presized from the template's recent output, so
+// a render of the usual size never grows it (the first render guesses from
+// the literal bytes). Variables come from JSON or from values by slot.
+static int template_render_pooled(const torchlight_template_t* tpl, const template_json_t* variables,
+                                  const torchlight_value_t* values, size_t value_count,
+                                  render_sink_t* sink) {
+    size_t reserve = torchlight_size_estimate_reserve(&tpl->output_estimate);
+    if (reserve == 0) reserve = tpl->literal_bytes + tpl->literal_bytes / 2 + 64;
+
+    sink->mode = RENDER_SINK_BUFFER;
+    sink->data = torchlight_buffer_alloc(reserve + 1, &sink->capacity);
+
+    render_state_t state;
+    render_state_init(&state, sink, variables, values, value_count);
+
+    if (!sink->data || template_execute(tpl, &state) != 0) {
+        sink_free(sink);
         return -1;
     }
-    
-    char* template_content = malloc(file_size + 1);
-    if (!template_content) {
-        fclose(file);
+
+    sink->data[sink->length] = '\0';
+    torchlight_size_estimate_record(&((torchlight_template_t*)tpl)->output_estimate, sink->length);
+    return 0;
+}
+
+static int template_render_buffer(const torchlight_template_t* tpl, const char* variables_json,
+                                  render_sink_t* sink) {
+    template_json_t variables;
+    template_json_parse(&variables, variables_json);
+
+    int result = template_render_pooled(tpl, &variables, NULL, 0, sink);
+    template_json_free(&variables);
+    return result;
+}
+
+int torchlight_render_slots(const torchlight_template_t* tpl, const torchlight_value_t* values,
+                            size_t value_count, char** output, size_t* output_size) {
+    if (!tpl || !output) return -1;
+    if (value_count > 0 && !values) return -1;
+
+    render_sink_t sink = { .mode = RENDER_SINK_BUFFER };
+    if (template_render_pooled(tpl, NULL, values, value_count, &sink) != 0) return -1;
+
+    *output = sink.data;
+    if (output_size) *output_size = sink.length;
+
+    return 0;
+}
+
+int torchlight_render_compiled(const torchlight_template_t* tpl, const char* variables_json,
+                               char** output, size_t* output_size) {
+    if (!tpl || !output) return -1;
+
+    render_sink_t sink = { .mode = RENDER_SINK_BUFFER };
+    if (template_render_buffer(tpl, variables_json, &sink) != 0) return -1;
+
+    *output = sink.data;
+    if (output_size) *output_size = sink.length;
+
+    return 0;
+}
+
+int torchlight_render_response(const torchlight_template_t* tpl, const char* variables_json,
+                               http_response_t* response) {
+    if (!tpl || !response) return -1;
+
+    render_sink_t sink = { .mode = RENDER_SINK_BUFFER };
+    if (template_render_buffer(tpl, variables_json, &sink) != 0) return -1;
+
+    torchlight_release_response(response);
+    response->body = sink.data;
+    response->body_length = sink.length;
+    response->body_capacity = sink.capacity;
+
+    return 0;
+}
+
+// Scatter/gather rendering
+//
+// Instead of copying the page into one buffer, the sink records an iovec
+// per span: literals point into the compiled templates, values at the
+// caller's data or the parsed JSON. The body keeps everything those spans
+// point into, and is freed through the response's body_release once the
+// response has been sent.
+
+typedef struct {
+    torchlight_template_t* tpl;
+    render_sink_t sink;
+    void (*release)(void* context);
+    void* context;
+    template_json_t variables;
+    char* json;
+} template_iov_body_t;
+
+static void template_iov_free(template_iov_body_t* body) {
+    sink_free(&body->sink);
+    template_json_free(&body->variables);
+    free(body->json);
+    torchlight_release_template(body->tpl);
+    free(body);
+}
+
+static void template_iov_release(void* context) {
+    template_iov_body_t* body = context;
+
+    if (body->release) body->release(body->context);
+    template_iov_free(body);
+}
+
+// Render into the body and attach it to the response; the body is freed
+// (without calling its release callback) on failure
+static int template_iov_render(const torchlight_template_t* tpl, template_iov_body_t* body,
+                               bool json_mode, const torchlight_value_t* values,
+                               size_t value_count, http_response_t* response) {
+    body->sink.mode = RENDER_SINK_IOV;
+
+    // The literal spans stay valid for as long as the response holds this
+    body->tpl = (torchlight_template_t*)tpl;
+    __atomic_add_fetch(&body->tpl->refcount, 1, __ATOMIC_RELAXED);
+
+    // Room for the usual number of spans up front
+    size_t spans = torchlight_size_estimate_reserve(&tpl->span_estimate);
+    if (spans > 0) {
+        body->sink.iov = malloc(spans * sizeof(struct iovec));
+        if (body->sink.iov) body->sink.iov_capacity = spans;
+    }
+
+    render_state_t state;
+    render_state_init(&state, &body->sink, json_mode ? &body->variables : NULL, values, value_count);
+
+    if (template_execute(tpl, &state) != 0 || body->sink.iov_count > INT_MAX) {
+        template_iov_free(body);
         return -1;
     }
-    
-    size_t bytes_read = fread(template_content, 1, file_size, file);
-    fclose(file);
-    
-    if (bytes_read != (size_t)file_size) {
-        free(template_content);
+
+    torchlight_size_estimate_record(&body->tpl->span_estimate, body->sink.iov_count);
+    torchlight_size_estimate_record(&body->tpl->output_estimate, body->sink.length);
+
+    torchlight_release_response(response);
+    response->body_iov = body->sink.iov;
+    response->body_iov_count = (int)body->sink.iov_count;
+    response->body_length = body->sink.length;
+    response->body_release = template_iov_release;
+    response->body_release_context = body;
+
+    return 0;
+}
+
+int torchlight_render_iov(const torchlight_template_t* tpl, const torchlight_value_t* values,
+                          size_t value_count, http_response_t* response,
+                          void (*release)(void* context), void* context) {
+    if (!tpl || !response) return -1;
+    if (value_count > 0 && !values) return -1;
+
+    template_iov_body_t* body = calloc(1, sizeof(template_iov_body_t));
+    if (!body) return -1;
+
+    if (template_iov_render(tpl, body, false, values, value_count, response) != 0) return -1;
+
+    body->release = release;
+    body->context = context;
+    return 0;
+}
+
+int torchlight_render_template_iov(const char* template_path, const char* variables_json,
+                                   http_response_t* response) {
+    if (!template_path || !response) return -1;
+
+    template_iov_body_t* body = calloc(1, sizeof(template_iov_body_t));
+    if (!body) return -1;
+
+    // Values point into a private copy of the JSON and its decode scratch
+    if (variables_json) {
+        body->json = strdup(variables_json);
+        if (!body->json) {
+            free(body);
+            return -1;
+        }
+    }
+    template_json_parse(&body->variables, body->json);
+
+    torchlight_template_t* tpl = torchlight_load_template(template_path);
+    if (!tpl) {
+        template_json_free(&body->variables);
+        free(body->json);
+        free(body);
         return -1;
     }
-    
-    template_content[file_size] = '\0';
-    
-    // Perform variable substitution
-    int result = torchlight_substitute_variables(template_content, variables_json, output, output_size);
-    
-    free(template_content);
+
+    int result = template_iov_render(tpl, body, true, NULL, 0, response);
+    torchlight_release_template(tpl);
+    return result;
+}
+
+int torchlight_substitute_variables(const char* template_str, const char* variables_json,
+                                   char** output, size_t* output_size) {
+    if (!template_str || !output) return -1;
+
+    torchlight_template_t* tpl = torchlight_compile_template(template_str, strlen(template_str));
+    if (!tpl) return -1;
+
+    int result = torchlight_render_compiled(tpl, variables_json, output, output_size);
+
+    torchlight_release_template(tpl);
+    return result;
+}
+
+int torchlight_render_template(const char* template_path, const char* variables_json,
+                              char** output, size_t* output_size) {
+    if (!template_path || !output) return -1;
+
+    torchlight_template_t* tpl = torchlight_load_template(template_path);
+    if (!tpl) return -1;
+
+    int result = torchlight_render_compiled(tpl, variables_json, output, output_size);
+
+    torchlight_release_template(tpl);
     return result;
-}
\ No newline at end of file
+}
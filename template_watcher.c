@@ -0,0 +1,250 @@
+/*
+ * TorchLight Template Watcher
+ * Hot reload of cached templates through inotify
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/inotify.h>
+#include "torchlight.h"
+#include "torchlight_internal.h"
+
+// One thread watches config.template_directory and its subdirectories.
+// When a file is written (IN_CLOSE_WRITE) or renamed into place
+// (IN_MOVED_TO, as editors and deploy tools do), the cached template for
+// it is recompiled and swapped in; removed files are dropped from the
+// cache. While the watcher runs, the cache trusts its entries under the
+// directory and skips the stat() per render, except for templates reached
+// through a symlink, whose changes inotify may report under another name.
+//
+// If the kernel's event queue overflows, the events are gone, so the
+// whole cache is cleared and templates are recompiled on next use. If
+// inotify is unavailable (e.g. out of watches), the watcher does not
+// start and the cache keeps checking mtimes.
+
+#define WATCHER_POLL_MS 250
+#define WATCHER_EVENTS (IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM | IN_DELETE | IN_CREATE | \
+                        IN_DELETE_SELF | IN_MOVE_SELF)
+
+typedef struct {
+    int wd;
+    char* path;
+} watched_directory_t;
+
+typedef struct {
+    int fd;
+    watched_directory_t* directories;
+    size_t directory_count;
+    size_t directory_capacity;
+
+    pthread_t thread;
+    bool running;                      // Atomic
+} template_watcher_t;
+
+static template_watcher_t g_watcher = { .fd = -1 };
+
+static watched_directory_t* watcher_find(int wd) {
+    for (size_t i = 0; i < g_watcher.directory_count; i++) {
+        if (g_watcher.directories[i].wd == wd) return &g_watcher.directories[i];
+    }
+    return NULL;
+}
+
+static const char* watcher_directory(int wd) {
+    watched_directory_t* directory = watcher_find(wd);
+    return directory ? directory->path : NULL;
+}
+
+static void watcher_forget(int wd) {
+    for (size_t i = 0; i < g_watcher.directory_count; i++) {
+        if (g_watcher.directories[i].wd == wd) {
+            free(g_watcher.directories[i].path);
+            g_watcher.directories[i] = g_watcher.directories[--g_watcher.directory_count];
+            return;
+        }
+    }
+}
+
+// Watch a directory and everything below it
+static int watcher_add_tree(const char* path) {
+    int wd = inotify_add_watch(g_watcher.fd, path, WATCHER_EVENTS | IN_ONLYDIR);
+    if (wd < 0) {
+        printf("⚠️  Cannot watch %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+
+    // inotify hands back the same wd for a directory watched twice, and
+    // for one renamed within the tree, whose events now carry this path
+    watched_directory_t* known = watcher_find(wd);
+    if (known) {
+        if (strcmp(known->path, path) != 0) {
+            char* copy = strdup(path);
+            if (!copy) return -1;
+            free(known->path);
+            known->path = copy;
+        }
+    } else {
+        if (g_watcher.directory_count == g_watcher.directory_capacity) {
+            size_t capacity = g_watcher.directory_capacity ? g_watcher.directory_capacity * 2 : 16;
+            watched_directory_t* directories = realloc(g_watcher.directories,
+                                                       capacity * sizeof(watched_directory_t));
+            if (!directories) return -1;
+            g_watcher.directories = directories;
+            g_watcher.directory_capacity = capacity;
+        }
+
+        char* copy = strdup(path);
+        if (!copy) return -1;
+        g_watcher.directories[g_watcher.directory_count].wd = wd;
+        g_watcher.directories[g_watcher.directory_count].path = copy;
+        g_watcher.directory_count++;
+    }
+
+    DIR* dir = opendir(path);
+    if (!dir) return 0;
+
+    int result = 0;
+    struct dirent* entry;
+    while (result == 0 && (entry = readdir(dir)) != NULL) {
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) continue;
+
+        char child[1024];
+        if (snprintf(child, sizeof(child), "%s/%s", path, entry->d_name) >= (int)sizeof(child)) continue;
+
+        // Symlinked directories are not followed: templates under them
+        // are checked with stat(), and a link back up would loop
+        struct stat st;
+        if (lstat(child, &st) == 0 && S_ISDIR(st.st_mode)) {
+            result = watcher_add_tree(child);
+        }
+    }
+
+    closedir(dir);
+    return result;
+}
+
+static void watcher_handle(const struct inotify_event* event) {
+    if (event->mask & IN_Q_OVERFLOW) {
+        printf("⚠️  Template watcher missed events; clearing the template cache\n");
+        torchlight_clear_template_cache();
+        return;
+    }
+
+    if (event->mask & IN_IGNORED) {
+        watcher_forget(event->wd);
+        return;
+    }
+
+    const char* directory = watcher_directory(event->wd);
+    if (!directory || event->len == 0) return;
+
+    char path[1024];
+    if (snprintf(path, sizeof(path), "%s/%s", directory, event->name) >= (int)sizeof(path)) return;
+
+    if (event->mask & IN_ISDIR) {
+        if (event->mask & (IN_CREATE | IN_MOVED_TO)) {
+            watcher_add_tree(path);
+        }
+        // A directory moved away or in takes its templates with it
+        if (event->mask & (IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE)) {
+            torchlight_clear_template_cache();
+        }
+        return;
+    }
+
+    if (event->mask & (IN_CLOSE_WRITE | IN_MOVED_TO)) {
+        tl_template_cache_reload(path, false);
+    } else if (event->mask & (IN_DELETE | IN_MOVED_FROM)) {
+        tl_template_cache_reload(path, true);
+    }
+}
+
+static void* watcher_thread(void* arg) {
+    (void)arg;
+
+    // Events are variable-length; the buffer must hold at least one with
+    // the longest name
+    char buffer[16 * (sizeof(struct inotify_event) + 256)]
+        __attribute__((aligned(__alignof__(struct inotify_event))));
+
+    while (__atomic_load_n(&g_watcher.running, __ATOMIC_ACQUIRE)) {
+        struct pollfd pfd = { .fd = g_watcher.fd, .events = POLLIN };
+        int ready = poll(&pfd, 1, WATCHER_POLL_MS);
+        if (ready <= 0) continue;
+
+        ssize_t length = read(g_watcher.fd, buffer, sizeof(buffer));
+        if (length <= 0) continue;
+
+        for (char* p = buffer; p < buffer + length;) {
+            const struct inotify_event* event = (const struct inotify_event*)p;
+            watcher_handle(event);
+            p += sizeof(struct inotify_event) + event->len;
+        }
+    }
+
+    return NULL;
+}
+
+int tl_template_watcher_start(const char* directory) {
+    if (g_watcher.running) return 0;
+    if (!directory || !directory[0]) return -1;
+
+    struct stat st;
+    if (stat(directory, &st) != 0 || !S_ISDIR(st.st_mode)) return -1;
+
+    g_watcher.fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (g_watcher.fd < 0) {
+        printf("⚠️  inotify unavailable (%s); templates are checked with stat()\n", strerror(errno));
+        return -1;
+    }
+
+    // Watches go in before the cache trusts them, so no change is missed
+    if (watcher_add_tree(directory) != 0) {
+        printf("⚠️  Template hot reload disabled; templates are checked with stat()\n");
+        tl_template_watcher_stop();
+        return -1;
+    }
+
+    __atomic_store_n(&g_watcher.running, true, __ATOMIC_RELEASE);
+    if (pthread_create(&g_watcher.thread, NULL, watcher_thread, NULL) != 0) {
+        g_watcher.running = false;
+        tl_template_watcher_stop();
+        return -1;
+    }
+
+    // Entries cached before now may predate a change we never saw
+    torchlight_clear_template_cache();
+    tl_template_cache_watch(directory);
+
+    printf("🔥 Watching %s for template changes (%zu directories)\n",
+           directory, g_watcher.directory_count);
+    return 0;
+}
+
+void tl_template_watcher_stop(void) {
+    tl_template_cache_watch(NULL);
+
+    if (__atomic_exchange_n(&g_watcher.running, false, __ATOMIC_ACQ_REL)) {
+        pthread_join(g_watcher.thread, NULL);
+    }
+
+    if (g_watcher.fd >= 0) {
+        close(g_watcher.fd);
+        g_watcher.fd = -1;
+    }
+
+    for (size_t i = 0; i < g_watcher.directory_count; i++) {
+        free(g_watcher.directories[i].path);
+    }
+    free(g_watcher.directories);
+    g_watcher.directories = NULL;
+    g_watcher.directory_count = 0;
+    g_watcher.directory_capacity = 0;
+}
@@ -1 +1,2213 @@
-/*\n * TorchLight Dynamic HTTP Server Test Suite\n * Comprehensive testing of all TorchLight features\n * \n * Compile: gcc -I. test_torchlight.c src/modules/torchlight/*.c -lpthread -o test_torchlight\n * Run: ./test_torchlight\n */\n\n#include <stdio.h>\n#include <stdlib.h>\n#include <string.h>\n#include <unistd.h>\n#include <assert.h>\n#include \"src/modules/torchlight/torchlight.h\"\n\n// Test configuration\nstatic int tests_run = 0;\nstatic int tests_passed = 0;\n\n#define TEST_ASSERT(condition, message) do { \\\n    tests_run++; \\\n    if (condition) { \\\n        printf(\"\u2705 %s\\n\", message); \\\n        tests_passed++; \\\n    } else { \\\n        printf(\"\u274c %s\\n\", message); \\\n    } \\\n} while(0)\n\n// Test route handlers\nstatic int test_hello_handler(const http_request_t* request, http_response_t* response) {\n    (void)request;  // Unused\n    return torchlight_response_html(response, \"<h1>Hello from TorchLight!</h1>\");\n}\n\nstatic int test_api_handler(const http_request_t* request, http_response_t* response) {\n    (void)request;  // Unused\n    const char* data = \"{\\\"test\\\": true, \\\"value\\\": 42}\";\n    return torchlight_json_response(response, data, \"Test API response\");\n}\n\nstatic int test_param_handler(const http_request_t* request, http_response_t* response) {\n    const route_t* route = torchlight_find_route(request);\n    char param_value[64] = \"unknown\";\n    \n    if (route) {\n        torchlight_get_path_param(request, route, \"id\", param_value, sizeof(param_value));\n    }\n    \n    char html[256];\n    snprintf(html, sizeof(html), \"<h1>Parameter: %s</h1>\", param_value);\n    return torchlight_response_html(response, html);\n}\n\nstatic int test_error_handler(const http_request_t* request, http_response_t* response) {\n    (void)request;  // Unused\n    return torchlight_response_error(response, HTTP_STATUS_INTERNAL_SERVER_ERROR, \"Test error\");\n}\n\n// Test TorchLight initialization\nstatic void test_initialization(void) {\n    printf(\"\\n\ud83d\udd25 Testing TorchLight Initialization...\\n\");\n    \n    // Test with default config\n    TEST_ASSERT(torchlight_init(NULL) == 0, \"TorchLight initialization with default config\");\n    \n    // Test double initialization\n    TEST_ASSERT(torchlight_init(NULL) == 0, \"TorchLight double initialization handled\");\n    \n    // Test start\n    TEST_ASSERT(torchlight_start() == 0, \"TorchLight server start\");\n    \n    torchlight_server_t stats;\n    torchlight_get_stats(&stats);\n    TEST_ASSERT(stats.initialized == true, \"TorchLight properly initialized\");\n}\n\n// Test route management\nstatic void test_routing(void) {\n    printf(\"\\n\ud83d\udded Testing Route Management...\\n\");\n    \n    // Add basic routes\n    TEST_ASSERT(torchlight_add_route(HTTP_METHOD_GET, \"/\", test_hello_handler, \"Home page\") == 0, \n                \"Add home route\");\n    TEST_ASSERT(torchlight_add_route(HTTP_METHOD_GET, \"/api/test\", test_api_handler, \"Test API\") == 0,\n                \"Add API route\");\n    TEST_ASSERT(torchlight_add_route(HTTP_METHOD_GET, \"/users/{id}\", test_param_handler, \"User profile\") == 0,\n                \"Add parameterized route\");\n    TEST_ASSERT(torchlight_add_route(HTTP_METHOD_GET, \"/error\", test_error_handler, \"Error test\") == 0,\n                \"Add error route\");\n    \n    // Test invalid route\n    TEST_ASSERT(torchlight_add_route(HTTP_METHOD_GET, NULL, test_hello_handler, \"Invalid\") != 0,\n                \"Reject NULL path pattern\");\n    TEST_ASSERT(torchlight_add_route(HTTP_METHOD_GET, \"/test\", NULL, \"Invalid\") != 0,\n                \"Reject NULL handler\");\n    \n    // Test route removal\n    TEST_ASSERT(torchlight_remove_route(HTTP_METHOD_GET, \"/nonexistent\") != 0,\n                \"Remove nonexistent route fails\");\n    \n    printf(\"   Routes registered successfully\\n\");\n}\n\n// Test request parsing\nstatic void test_request_parsing(void) {\n    printf(\"\\n\ud83d\udccb Testing HTTP Request Parsing...\\n\");\n    \n    // Create mock request data\n    const char* mock_request = \n        \"GET /api/test?param1=value1&param2=value2 HTTP/1.1\\r\\n\"\n        \"Host: localhost\\r\\n\"\n        \"User-Agent: TorchLight-Test\\r\\n\"\n        \"Content-Type: application/json\\r\\n\"\n        \"Content-Length: 13\\r\\n\"\n        \"\\r\\n\"\n        \"{\\\"test\\\": true}\";\n    \n    // Note: In a real test, we'd need to set up sockets or mock the recv() function\n    // For now, we test the parsing components\n    \n    // Test query parameter extraction\n    http_request_t test_request = {0};\n    strcpy(test_request.query_string, \"param1=value1&param2=value2\");\n    \n    // Simulate parsed query params\n    strcpy(test_request.query_params[0][0], \"param1\");\n    strcpy(test_request.query_params[0][1], \"value1\");\n    strcpy(test_request.query_params[1][0], \"param2\");\n    strcpy(test_request.query_params[1][1], \"value2\");\n    test_request.query_param_count = 2;\n    \n    const char* param1 = torchlight_get_query_param(&test_request, \"param1\");\n    TEST_ASSERT(param1 && strcmp(param1, \"value1\") == 0, \"Query parameter extraction\");\n    \n    const char* missing_param = torchlight_get_query_param(&test_request, \"missing\");\n    TEST_ASSERT(missing_param == NULL, \"Missing query parameter returns NULL\");\n    \n    printf(\"   Request parsing components working\\n\");\n}\n\n// Test response generation\nstatic void test_response_generation(void) {\n    printf(\"\\n\ud83d\udce4 Testing HTTP Response Generation...\\n\");\n    \n    // Test HTML response\n    http_response_t html_response = {0};\n    TEST_ASSERT(torchlight_response_html(&html_response, \"<h1>Test</h1>\") == 0,\n                \"HTML response generation\");\n    TEST_ASSERT(html_response.status == HTTP_STATUS_OK, \"HTML response status OK\");\n    TEST_ASSERT(html_response.content_type == CONTENT_TYPE_TEXT_HTML, \"HTML content type\");\n    TEST_ASSERT(html_response.body != NULL, \"HTML response has body\");\n    if (html_response.body) free(html_response.body);\n    \n    // Test JSON response\n    http_response_t json_response = {0};\n    TEST_ASSERT(torchlight_response_json(&json_response, \"{\\\"test\\\": true}\") == 0,\n                \"JSON response generation\");\n    TEST_ASSERT(json_response.content_type == CONTENT_TYPE_APPLICATION_JSON, \"JSON content type\");\n    if (json_response.body) free(json_response.body);\n    \n    // Test error response\n    http_response_t error_response = {0};\n    TEST_ASSERT(torchlight_response_error(&error_response, HTTP_STATUS_NOT_FOUND, \"Not found\") == 0,\n                \"Error response generation\");\n    TEST_ASSERT(error_response.status == HTTP_STATUS_NOT_FOUND, \"Error response status\");\n    if (error_response.body) free(error_response.body);\n    \n    // Test header addition\n    http_response_t header_response = {0};\n    TEST_ASSERT(torchlight_add_header(&header_response, \"X-Test\", \"test-value\") == 0,\n                \"Header addition\");\n    TEST_ASSERT(header_response.header_count == 1, \"Header count updated\");\n    \n    printf(\"   Response generation working correctly\\n\");\n}\n\n// Test JSON API helpers\nstatic void test_json_api(void) {\n    printf(\"\\n\ud83d\udcca Testing JSON API Helpers...\\n\");\n    \n    // Test JSON API response\n    http_response_t api_response = {0};\n    TEST_ASSERT(torchlight_json_response(&api_response, \"{\\\"data\\\": 123}\", \"Success\") == 0,\n                \"JSON API response creation\");\n    TEST_ASSERT(api_response.body != NULL, \"JSON API response has body\");\n    if (api_response.body) {\n        TEST_ASSERT(strstr(api_response.body, \"success\") != NULL, \"JSON API response contains success\");\n        free(api_response.body);\n    }\n    \n    // Test JSON error response\n    http_response_t error_response = {0};\n    TEST_ASSERT(torchlight_json_error(&error_response, HTTP_STATUS_BAD_REQUEST, \"Bad input\") == 0,\n                \"JSON error response creation\");\n    TEST_ASSERT(error_response.status == HTTP_STATUS_BAD_REQUEST, \"JSON error response status\");\n    if (error_response.body) {\n        TEST_ASSERT(strstr(error_response.body, \"success\\\": false\") != NULL, \"JSON error response format\");\n        free(error_response.body);\n    }\n    \n    printf(\"   JSON API helpers working correctly\\n\");\n}\n\n// Test template engine\nstatic void test_template_engine(void) {\n    printf(\"\\n\ud83c\udfa8 Testing Template Engine...\\n\");\n    \n    // Test variable substitution\n    const char* template_str = \"Hello {{name}}, you have {{count}} messages!\";\n    const char* variables = \"{\\\"name\\\": \\\"Alice\\\", \\\"count\\\": \\\"5\\\"}\";\n    \n    char* output = NULL;\n    size_t output_size = 0;\n    \n    TEST_ASSERT(torchlight_substitute_variables(template_str, variables, &output, &output_size) == 0,\n                \"Template variable substitution\");\n    \n    if (output) {\n        TEST_ASSERT(strstr(output, \"Alice\") != NULL, \"Template variable 'name' substituted\");\n        TEST_ASSERT(strstr(output, \"5\") != NULL, \"Template variable 'count' substituted\");\n        TEST_ASSERT(strstr(output, \"{{\") == NULL, \"No template markers remain\");\n        free(output);\n    }\n    \n    // Test missing variables\n    const char* incomplete_template = \"Hello {{name}}, {{missing}} variable!\";\n    char* incomplete_output = NULL;\n    \n    TEST_ASSERT(torchlight_substitute_variables(incomplete_template, variables, &incomplete_output, NULL) == 0,\n                \"Template with missing variables\");\n    \n    if (incomplete_output) {\n        TEST_ASSERT(strstr(incomplete_output, \"Alice\") != NULL, \"Existing variable substituted\");\n        // Missing variables should be replaced with empty string\n        free(incomplete_output);\n    }\n    \n    printf(\"   Template engine working correctly\\n\");\n}\n\n// Test utility functions\nstatic void test_utilities(void) {\n    printf(\"\\n\ud83d\udd27 Testing Utility Functions...\\n\");\n    \n    // Test content type detection\n    TEST_ASSERT(torchlight_detect_content_type(\"test.html\") == CONTENT_TYPE_TEXT_HTML,\n                \"HTML content type detection\");\n    TEST_ASSERT(torchlight_detect_content_type(\"api.json\") == CONTENT_TYPE_APPLICATION_JSON,\n                \"JSON content type detection\");\n    TEST_ASSERT(torchlight_detect_content_type(\"style.css\") == CONTENT_TYPE_TEXT_CSS,\n                \"CSS content type detection\");\n    TEST_ASSERT(torchlight_detect_content_type(\"image.png\") == CONTENT_TYPE_IMAGE_PNG,\n                \"PNG content type detection\");\n    TEST_ASSERT(torchlight_detect_content_type(\"unknown.xyz\") == CONTENT_TYPE_APPLICATION_OCTET_STREAM,\n                \"Unknown file type detection\");\n    \n    // Test string utilities (if implemented)\n    TEST_ASSERT(torchlight_string_starts_with(\"hello world\", \"hello\") == true,\n                \"String starts with check\");\n    TEST_ASSERT(torchlight_string_starts_with(\"hello world\", \"world\") == false,\n                \"String starts with negative check\");\n    \n    printf(\"   Utility functions working correctly\\n\");\n}\n\n// Test route finding\nstatic void test_route_finding(void) {\n    printf(\"\\n\ud83d\udd0d Testing Route Finding...\\n\");\n    \n    // Create test requests\n    http_request_t home_request = {0};\n    home_request.method = HTTP_METHOD_GET;\n    strcpy(home_request.path, \"/\");\n    \n    const route_t* home_route = torchlight_find_route(&home_request);\n    TEST_ASSERT(home_route != NULL, \"Find home route\");\n    TEST_ASSERT(home_route && home_route->handler == test_hello_handler, \"Home route handler correct\");\n    \n    // Test API route\n    http_request_t api_request = {0};\n    api_request.method = HTTP_METHOD_GET;\n    strcpy(api_request.path, \"/api/test\");\n    \n    const route_t* api_route = torchlight_find_route(&api_request);\n    TEST_ASSERT(api_route != NULL, \"Find API route\");\n    TEST_ASSERT(api_route && api_route->handler == test_api_handler, \"API route handler correct\");\n    \n    // Test parameterized route\n    http_request_t param_request = {0};\n    param_request.method = HTTP_METHOD_GET;\n    strcpy(param_request.path, \"/users/123\");\n    \n    const route_t* param_route = torchlight_find_route(&param_request);\n    TEST_ASSERT(param_route != NULL, \"Find parameterized route\");\n    TEST_ASSERT(param_route && param_route->handler == test_param_handler, \"Parameterized route handler correct\");\n    \n    // Test nonexistent route\n    http_request_t missing_request = {0};\n    missing_request.method = HTTP_METHOD_GET;\n    strcpy(missing_request.path, \"/nonexistent\");\n    \n    const route_t* missing_route = torchlight_find_route(&missing_request);\n    TEST_ASSERT(missing_route == NULL, \"Nonexistent route returns NULL\");\n    \n    printf(\"   Route finding working correctly\\n\");\n}\n\n// Test default routes\nstatic void test_default_routes(void) {\n    printf(\"\\n\ud83c\udfe0 Testing Default Routes...\\n\");\n    \n    TEST_ASSERT(torchlight_register_default_routes() == 0, \"Register default routes\");\n    \n    // Test status route\n    http_request_t status_request = {0};\n    status_request.method = HTTP_METHOD_GET;\n    strcpy(status_request.path, \"/api/status\");\n    \n    const route_t* status_route = torchlight_find_route(&status_request);\n    TEST_ASSERT(status_route != NULL, \"Default status route registered\");\n    \n    // Test stats route\n    http_request_t stats_request = {0};\n    stats_request.method = HTTP_METHOD_GET;\n    strcpy(stats_request.path, \"/api/stats\");\n    \n    const route_t* stats_route = torchlight_find_route(&stats_request);\n    TEST_ASSERT(stats_route != NULL, \"Default stats route registered\");\n    \n    printf(\"   Default routes working correctly\\n\");\n}\n\nint main() {\n    printf(\"\ud83d\ude80 TorchLight Dynamic HTTP Server Test Suite\\n\");\n    printf(\"================================================\\n\");\n    \n    // Run all tests\n    test_initialization();\n    test_routing();\n    test_request_parsing();\n    test_response_generation();\n    test_json_api();\n    test_template_engine();\n    test_utilities();\n    test_route_finding();\n    test_default_routes();\n    \n    // Final cleanup\n    printf(\"\\n\ud83e\uddf9 Cleaning up...\\n\");\n    torchlight_shutdown();\n    printf(\"\u2705 TorchLight shutdown complete\\n\");\n    \n    // Summary\n    printf(\"\\n\ud83d\udcca Test Results Summary:\\n\");\n    printf(\"   Tests Run: %d\\n\", tests_run);\n    printf(\"   Tests Passed: %d\\n\", tests_passed);\n    printf(\"   Success Rate: %.1f%%\\n\", (float)tests_passed / tests_run * 100);\n    \n    if (tests_passed == tests_run) {\n        printf(\"\\n\ud83c\udf89 All TorchLight tests passed!\\n\");\n        printf(\"\u2705 TorchLight is ready for production use\\n\");\n    } else {\n        printf(\"\\n\u26a0\ufe0f  Some tests failed - check implementation\\n\");\n    }\n    \n    printf(\"\\n\ud83d\udca1 TorchLight Features Verified:\\n\");\n    printf(\"   \ud83d\udd25 HTTP/1.1 server initialization\\n\");\n    printf(\"   \ud83d\udded Flexible routing system\\n\");\n    printf(\"   \ud83d\udccb Request parsing and validation\\n\");\n    printf(\"   \ud83d\udce4 Response generation (HTML, JSON, errors)\\n\");\n    printf(\"   \ud83d\udcca JSON API framework\\n\");\n    printf(\"   \ud83c\udfa8 Template engine with variable substitution\\n\");\n    printf(\"   \ud83d\udd27 Utility functions and content type detection\\n\");\n    printf(\"   \ud83d\udd0d Route finding and parameter extraction\\n\");\n    printf(\"   \ud83c\udfe0 Default API endpoints (status, stats)\\n\");\n    \n    printf(\"\\n\ud83d\ude80 Ready to illuminate the web through Tor!\\n\");\n    \n    return (tests_passed == tests_run) ? 0 : 1;\n}"
\ No newline at end of file
+/*
+ * TorchLight Dynamic HTTP Server Test Suite
+ * Comprehensive testing of all TorchLight features
+ * 
+ * Compile: gcc -I. test_torchlight.c *.c -lpthread -lssl -lcrypto -o test_torchlight
+ * Run: ./test_torchlight
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <assert.h>
+#include <time.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <sys/time.h>
+#include "torchlight.h"
+#include "torchlight_internal.h"
+
+// Test configuration
+static int tests_run = 0;
+static int tests_passed = 0;
+
+#define TEST_ASSERT(condition, message) do { \
+    tests_run++; \
+    if (condition) { \
+        printf("✅ %s\n", message); \
+        tests_passed++; \
+    } else { \
+        printf("❌ %s\n", message); \
+    } \
+} while(0)
+
+// Test route handlers
+static int test_hello_handler(const http_request_t* request, http_response_t* response) {
+    (void)request;  // Unused
+    return torchlight_response_html(response, "<h1>Hello from TorchLight!</h1>");
+}
+
+static int test_api_handler(const http_request_t* request, http_response_t* response) {
+    (void)request;  // Unused
+    const char* data = "{\"test\": true, \"value\": 42}";
+    return torchlight_json_response(response, data, "Test API response");
+}
+
+static int test_param_handler(const http_request_t* request, http_response_t* response) {
+    const route_t* route = torchlight_find_route(request);
+    char param_value[64] = "unknown";
+    
+    if (route) {
+        torchlight_get_path_param(request, route, "id", param_value, sizeof(param_value));
+    }
+    
+    char html[256];
+    snprintf(html, sizeof(html), "<h1>Parameter: %s</h1>", param_value);
+    return torchlight_response_html(response, html);
+}
+
+static int test_error_handler(const http_request_t* request, http_response_t* response) {
+    (void)request;  // Unused
+    return torchlight_response_error(response, HTTP_STATUS_INTERNAL_SERVER_ERROR, "Test error");
+}
+
+// Test TorchLight initialization
+static void test_initialization(void) {
+    printf("\n🔥 Testing TorchLight Initialization...\n");
+    
+    // Test with default config
+    TEST_ASSERT(torchlight_init(NULL) == 0, "TorchLight initialization with default config");
+    
+    // Test double initialization
+    TEST_ASSERT(torchlight_init(NULL) == 0, "TorchLight double initialization handled");
+    
+    // Test start
+    TEST_ASSERT(torchlight_start() == 0, "TorchLight server start");
+    
+    torchlight_server_t stats;
+    torchlight_get_stats(&stats);
+    TEST_ASSERT(stats.initialized == true, "TorchLight properly initialized");
+}
+
+// Test route management
+static void test_routing(void) {
+    printf("\n🗭 Testing Route Management...\n");
+    
+    // Add basic routes
+    TEST_ASSERT(torchlight_add_route(HTTP_METHOD_GET, "/", test_hello_handler, "Home page") == 0, 
+                "Add home route");
+    TEST_ASSERT(torchlight_add_route(HTTP_METHOD_GET, "/api/test", test_api_handler, "Test API") == 0,
+                "Add API route");
+    TEST_ASSERT(torchlight_add_route(HTTP_METHOD_GET, "/users/{id}", test_param_handler, "User profile") == 0,
+                "Add parameterized route");
+    TEST_ASSERT(torchlight_add_route(HTTP_METHOD_GET, "/error", test_error_handler, "Error test") == 0,
+                "Add error route");
+    
+    // Test invalid route
+    TEST_ASSERT(torchlight_add_route(HTTP_METHOD_GET, NULL, test_hello_handler, "Invalid") != 0,
+                "Reject NULL path pattern");
+    TEST_ASSERT(torchlight_add_route(HTTP_METHOD_GET, "/test", NULL, "Invalid") != 0,
+                "Reject NULL handler");
+    
+    // Test route removal
+    TEST_ASSERT(torchlight_remove_route(HTTP_METHOD_GET, "/nonexistent") != 0,
+                "Remove nonexistent route fails");
+    
+    printf("   Routes registered successfully\n");
+}
+
+// Write a request in two parts so the server sees a short first read
+typedef struct {
+    int fd;
+    const char* data;
+    size_t length;
+    size_t first;
+} split_write_t;
+
+static void* split_writer(void* arg) {
+    split_write_t* write_job = arg;
+    if (write(write_job->fd, write_job->data, write_job->first) < 0) return NULL;
+    usleep(20000);
+    if (write(write_job->fd, write_job->data + write_job->first, write_job->length - write_job->first) < 0) {
+        return NULL;
+    }
+    return NULL;
+}
+
+static int parse_split(const char* data, size_t length, size_t first, http_request_t* request) {
+    int fds[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0) return -1;
+    
+    split_write_t write_job = { fds[1], data, length, first ? first : length };
+    pthread_t writer;
+    pthread_create(&writer, NULL, split_writer, &write_job);
+    
+    memset(request, 0, sizeof(*request));
+    int result = torchlight_parse_request(fds[0], request);
+    
+    pthread_join(writer, NULL);
+    close(fds[0]);
+    close(fds[1]);
+    return result;
+}
+
+// Test request parsing
+static void test_request_parsing(void) {
+    printf("\n📋 Testing HTTP Request Parsing...\n");
+    
+    // Create mock request data
+    const char* mock_request = 
+        "GET /api/test?param1=value1&param2=value2 HTTP/1.1\r\n"
+        "Host: localhost\r\n"
+        "User-Agent: TorchLight-Test\r\n"
+        "Content-Type: application/json\r\n"
+        "Content-Length: 14\r\n"
+        "\r\n"
+        "{\"test\": true}";
+    
+    http_request_t parsed;
+    TEST_ASSERT(parse_split(mock_request, strlen(mock_request), 20, &parsed) == 0, "Parse request from socket");
+    TEST_ASSERT(parsed.method == HTTP_METHOD_GET && strcmp(parsed.path, "/api/test") == 0,
+                "Request line parsed");
+    const char* user_agent = torchlight_get_header(&parsed, "user-agent");
+    TEST_ASSERT(user_agent && strcmp(user_agent, "TorchLight-Test") == 0, "Header lookup ignores case");
+    TEST_ASSERT(parsed.body_length == 14 && parsed.body && memcmp(parsed.body, "{\"test\": true}", 14) == 0,
+                "Body read to Content-Length");
+    const char* parsed_param = torchlight_get_query_param(&parsed, "param2");
+    TEST_ASSERT(parsed_param && strcmp(parsed_param, "value2") == 0, "Query string parsed");
+    free(parsed.body);
+    torchlight_json_free(parsed.json);
+    
+    // The session cookie name must match a whole cookie name
+    const char* cookie_request = "GET / HTTP/1.1\r\nCookie: xsession_id=forged; session_id=real\r\n\r\n";
+    TEST_ASSERT(parse_split(cookie_request, strlen(cookie_request), 0, &parsed) == 0 &&
+                parsed.has_session && strcmp(parsed.session_id, "real") == 0, "Session cookie matched by name");
+    free(parsed.body);
+    torchlight_json_free(parsed.json);
+    cookie_request = "GET / HTTP/1.1\r\nCookie: xsession_id=forged\r\n\r\n";
+    TEST_ASSERT(parse_split(cookie_request, strlen(cookie_request), 0, &parsed) == 0 && !parsed.has_session,
+                "Cookie ending in session_id ignored");
+    free(parsed.body);
+    torchlight_json_free(parsed.json);
+    
+    // Test query parameter extraction
+    http_request_t test_request = {0};
+    strcpy(test_request.query_string, "param1=value1&param2=value2");
+    
+    // Simulate parsed query params
+    strcpy(test_request.query_params[0][0], "param1");
+    strcpy(test_request.query_params[0][1], "value1");
+    strcpy(test_request.query_params[1][0], "param2");
+    strcpy(test_request.query_params[1][1], "value2");
+    test_request.query_param_count = 2;
+    
+    const char* param1 = torchlight_get_query_param(&test_request, "param1");
+    TEST_ASSERT(param1 && strcmp(param1, "value1") == 0, "Query parameter extraction");
+    
+    const char* missing_param = torchlight_get_query_param(&test_request, "missing");
+    TEST_ASSERT(missing_param == NULL, "Missing query parameter returns NULL");
+    
+    printf("   Request parsing components working\n");
+}
+
+// Test response generation
+static void test_response_generation(void) {
+    printf("\n📤 Testing HTTP Response Generation...\n");
+    
+    // Test HTML response
+    http_response_t html_response = {0};
+    TEST_ASSERT(torchlight_response_html(&html_response, "<h1>Test</h1>") == 0,
+                "HTML response generation");
+    TEST_ASSERT(html_response.status == HTTP_STATUS_OK, "HTML response status OK");
+    TEST_ASSERT(html_response.content_type == CONTENT_TYPE_TEXT_HTML, "HTML content type");
+    TEST_ASSERT(html_response.body != NULL, "HTML response has body");
+    if (html_response.body) free(html_response.body);
+    
+    // Test JSON response
+    http_response_t json_response = {0};
+    TEST_ASSERT(torchlight_response_json(&json_response, "{\"test\": true}") == 0,
+                "JSON response generation");
+    TEST_ASSERT(json_response.content_type == CONTENT_TYPE_APPLICATION_JSON, "JSON content type");
+    if (json_response.body) free(json_response.body);
+    
+    // Test error response
+    http_response_t error_response = {0};
+    TEST_ASSERT(torchlight_response_error(&error_response, HTTP_STATUS_NOT_FOUND, "Not found") == 0,
+                "Error response generation");
+    TEST_ASSERT(error_response.status == HTTP_STATUS_NOT_FOUND, "Error response status");
+    if (error_response.body) free(error_response.body);
+    
+    // Test header addition
+    http_response_t header_response = {0};
+    TEST_ASSERT(torchlight_add_header(&header_response, "X-Test", "test-value") == 0,
+                "Header addition");
+    TEST_ASSERT(header_response.header_count == 1, "Header count updated");
+    
+    printf("   Response generation working correctly\n");
+}
+
+// Test JSON API helpers
+static void test_json_api(void) {
+    printf("\n📊 Testing JSON API Helpers...\n");
+    
+    // Test JSON API response
+    http_response_t api_response = {0};
+    TEST_ASSERT(torchlight_json_response(&api_response, "{\"data\": 123}", "Success") == 0,
+                "JSON API response creation");
+    TEST_ASSERT(api_response.body != NULL, "JSON API response has body");
+    if (api_response.body) {
+        TEST_ASSERT(strstr(api_response.body, "success") != NULL, "JSON API response contains success");
+        free(api_response.body);
+    }
+    
+    // Test JSON error response
+    http_response_t error_response = {0};
+    TEST_ASSERT(torchlight_json_error(&error_response, HTTP_STATUS_BAD_REQUEST, "Bad input") == 0,
+                "JSON error response creation");
+    TEST_ASSERT(error_response.status == HTTP_STATUS_BAD_REQUEST, "JSON error response status");
+    if (error_response.body) {
+        TEST_ASSERT(strstr(error_response.body, "success\": false") != NULL, "JSON error response format");
+        free(error_response.body);
+    }
+    
+    printf("   JSON API helpers working correctly\n");
+}
+
+// Test template engine
+static void test_template_engine(void) {
+    printf("\n🎨 Testing Template Engine...\n");
+    
+    // Test variable substitution
+    const char* template_str = "Hello {{name}}, you have {{count}} messages!";
+    const char* variables = "{\"name\": \"Alice\", \"count\": \"5\"}";
+    
+    char* output = NULL;
+    size_t output_size = 0;
+    
+    TEST_ASSERT(torchlight_substitute_variables(template_str, variables, &output, &output_size) == 0,
+                "Template variable substitution");
+    
+    if (output) {
+        TEST_ASSERT(strstr(output, "Alice") != NULL, "Template variable 'name' substituted");
+        TEST_ASSERT(strstr(output, "5") != NULL, "Template variable 'count' substituted");
+        TEST_ASSERT(strstr(output, "{{") == NULL, "No template markers remain");
+        free(output);
+    }
+    
+    // Test missing variables
+    const char* incomplete_template = "Hello {{name}}, {{missing}} variable!";
+    char* incomplete_output = NULL;
+    
+    TEST_ASSERT(torchlight_substitute_variables(incomplete_template, variables, &incomplete_output, NULL) == 0,
+                "Template with missing variables");
+    
+    if (incomplete_output) {
+        TEST_ASSERT(strstr(incomplete_output, "Alice") != NULL, "Existing variable substituted");
+        // Missing variables should be replaced with empty string
+        free(incomplete_output);
+    }
+    
+    printf("   Template engine working correctly\n");
+}
+
+// Test utility functions
+static void test_utilities(void) {
+    printf("\n🔧 Testing Utility Functions...\n");
+    
+    // Test content type detection
+    TEST_ASSERT(torchlight_detect_content_type("test.html") == CONTENT_TYPE_TEXT_HTML,
+                "HTML content type detection");
+    TEST_ASSERT(torchlight_detect_content_type("api.json") == CONTENT_TYPE_APPLICATION_JSON,
+                "JSON content type detection");
+    TEST_ASSERT(torchlight_detect_content_type("style.css") == CONTENT_TYPE_TEXT_CSS,
+                "CSS content type detection");
+    TEST_ASSERT(torchlight_detect_content_type("image.png") == CONTENT_TYPE_IMAGE_PNG,
+                "PNG content type detection");
+    TEST_ASSERT(torchlight_detect_content_type("unknown.xyz") == CONTENT_TYPE_APPLICATION_OCTET_STREAM,
+                "Unknown file type detection");
+    
+    // Test string utilities (if implemented)
+    TEST_ASSERT(torchlight_string_starts_with("hello world", "hello") == true,
+                "String starts with check");
+    TEST_ASSERT(torchlight_string_starts_with("hello world", "world") == false,
+                "String starts with negative check");
+    
+    printf("   Utility functions working correctly\n");
+}
+
+// Test route finding
+static void test_route_finding(void) {
+    printf("\n🔍 Testing Route Finding...\n");
+    
+    // Create test requests
+    http_request_t home_request = {0};
+    home_request.method = HTTP_METHOD_GET;
+    strcpy(home_request.path, "/");
+    
+    const route_t* home_route = torchlight_find_route(&home_request);
+    TEST_ASSERT(home_route != NULL, "Find home route");
+    TEST_ASSERT(home_route && home_route->handler == test_hello_handler, "Home route handler correct");
+    
+    // Test API route
+    http_request_t api_request = {0};
+    api_request.method = HTTP_METHOD_GET;
+    strcpy(api_request.path, "/api/test");
+    
+    const route_t* api_route = torchlight_find_route(&api_request);
+    TEST_ASSERT(api_route != NULL, "Find API route");
+    TEST_ASSERT(api_route && api_route->handler == test_api_handler, "API route handler correct");
+    
+    // Test parameterized route
+    http_request_t param_request = {0};
+    param_request.method = HTTP_METHOD_GET;
+    strcpy(param_request.path, "/users/123");
+    
+    const route_t* param_route = torchlight_find_route(&param_request);
+    TEST_ASSERT(param_route != NULL, "Find parameterized route");
+    TEST_ASSERT(param_route && param_route->handler == test_param_handler, "Parameterized route handler correct");
+    
+    // Test nonexistent route
+    http_request_t missing_request = {0};
+    missing_request.method = HTTP_METHOD_GET;
+    strcpy(missing_request.path, "/nonexistent");
+    
+    const route_t* missing_route = torchlight_find_route(&missing_request);
+    TEST_ASSERT(missing_route == NULL, "Nonexistent route returns NULL");
+    
+    printf("   Route finding working correctly\n");
+}
+
+// Test default routes
+static void test_default_routes(void) {
+    printf("\n🏠 Testing Default Routes...\n");
+    
+    TEST_ASSERT(torchlight_register_default_routes() == 0, "Register default routes");
+    
+    // Test status route
+    http_request_t status_request = {0};
+    status_request.method = HTTP_METHOD_GET;
+    strcpy(status_request.path, "/api/status");
+    
+    const route_t* status_route = torchlight_find_route(&status_request);
+    TEST_ASSERT(status_route != NULL, "Default status route registered");
+    
+    // Test stats route
+    http_request_t stats_request = {0};
+    stats_request.method = HTTP_METHOD_GET;
+    strcpy(stats_request.path, "/api/stats");
+    
+    const route_t* stats_route = torchlight_find_route(&stats_request);
+    TEST_ASSERT(stats_route != NULL, "Default stats route registered");
+    
+    printf("   Default routes working correctly\n");
+}
+
+// Test the strict JSON parser
+static bool json_rejects(const char* json, size_t expected_offset) {
+    size_t offset = 0;
+    torchlight_json_t* doc = torchlight_json_parse(json, strlen(json), &offset);
+    if (doc) {
+        torchlight_json_free(doc);
+        return false;
+    }
+    return expected_offset == (size_t)-1 || offset == expected_offset;
+}
+
+static bool json_accepts(const char* json) {
+    torchlight_json_t* doc = torchlight_json_parse(json, strlen(json), NULL);
+    torchlight_json_free(doc);
+    return doc != NULL;
+}
+
+static void test_json_parser(void) {
+    printf("\n🧾 Testing JSON Parser...\n");
+    
+    const char* text = "{\"name\": \"Alice\", \"age\": 30, \"score\": -1.5e2, \"admin\": false,"
+                       " \"tags\": [\"a\", \"b\", \"c\"], \"none\": null}";
+    torchlight_json_t* doc = torchlight_json_parse(text, strlen(text), NULL);
+    TEST_ASSERT(doc != NULL, "Parse object");
+    
+    torchlight_json_value_t root = torchlight_json_root(doc);
+    size_t length = 0;
+    const char* name = torchlight_json_string(torchlight_json_get(root, "name"), &length);
+    TEST_ASSERT(name && length == 5 && strcmp(name, "Alice") == 0, "Get string member");
+    
+    int64_t age = 0;
+    TEST_ASSERT(torchlight_json_int(torchlight_json_get(root, "age"), &age) == 0 && age == 30,
+                "Get integer member");
+    
+    double score = 0;
+    TEST_ASSERT(torchlight_json_double(torchlight_json_get(root, "score"), &score) == 0 && score == -150.0,
+                "Get number with exponent");
+    TEST_ASSERT(torchlight_json_int(torchlight_json_get(root, "score"), &age) != 0,
+                "Non-integer rejected as int");
+    
+    bool admin = true;
+    TEST_ASSERT(torchlight_json_bool(torchlight_json_get(root, "admin"), &admin) == 0 && !admin,
+                "Get boolean member");
+    TEST_ASSERT(torchlight_json_type(torchlight_json_get(root, "none")) == TORCHLIGHT_JSON_NULL,
+                "Null member type");
+    
+    torchlight_json_value_t tags = torchlight_json_get(root, "tags");
+    TEST_ASSERT(torchlight_json_count(tags) == 3, "Array count");
+    const char* second = torchlight_json_string(torchlight_json_at(tags, 1), NULL);
+    TEST_ASSERT(second && strcmp(second, "b") == 0, "Array element by position");
+    TEST_ASSERT(torchlight_json_type(torchlight_json_at(tags, 3)) == TORCHLIGHT_JSON_INVALID,
+                "Array position past the end is missing");
+    
+    char joined[8] = "";
+    for (torchlight_json_value_t tag = torchlight_json_first(tags);
+         torchlight_json_type(tag) != TORCHLIGHT_JSON_INVALID; tag = torchlight_json_next(tag)) {
+        strncat(joined, torchlight_json_string(tag, NULL), sizeof(joined) - strlen(joined) - 1);
+    }
+    TEST_ASSERT(strcmp(joined, "abc") == 0, "Iterate array with first/next");
+    
+    size_t members = 0;
+    const char* last_key = NULL;
+    for (torchlight_json_value_t member = torchlight_json_first(root);
+         torchlight_json_type(member) != TORCHLIGHT_JSON_INVALID; member = torchlight_json_next(member)) {
+        last_key = torchlight_json_key(member, NULL);
+        members++;
+    }
+    TEST_ASSERT(members == 6 && last_key && strcmp(last_key, "none") == 0, "Iterate object members");
+    
+    torchlight_json_value_t missing = torchlight_json_get(torchlight_json_get(root, "nope"), "deeper");
+    TEST_ASSERT(torchlight_json_type(missing) == TORCHLIGHT_JSON_INVALID, "Missing value propagates");
+    TEST_ASSERT(torchlight_json_string(torchlight_json_get(root, "age"), NULL) == NULL,
+                "Wrong type returns NULL");
+    torchlight_json_free(doc);
+    
+    // Escapes and surrogate pairs
+    const char* escaped = "[\"a\\\"b\\\\c\\/d\\b\\f\\n\\r\\t\", \"\\u00e9\\u20ac\", \"\\ud83d\\ude00\"]";
+    doc = torchlight_json_parse(escaped, strlen(escaped), NULL);
+    TEST_ASSERT(doc != NULL, "Parse string escapes");
+    root = torchlight_json_root(doc);
+    const char* decoded = torchlight_json_string(torchlight_json_at(root, 0), &length);
+    TEST_ASSERT(decoded && length == 12 && memcmp(decoded, "a\"b\\c/d\b\f\n\r\t", 12) == 0,
+                "Simple escapes decoded");
+    decoded = torchlight_json_string(torchlight_json_at(root, 1), NULL);
+    TEST_ASSERT(decoded && strcmp(decoded, "\xc3\xa9\xe2\x82\xac") == 0, "\\u escapes decoded to UTF-8");
+    decoded = torchlight_json_string(torchlight_json_at(root, 2), NULL);
+    TEST_ASSERT(decoded && strcmp(decoded, "\xf0\x9f\x98\x80") == 0, "Surrogate pair decoded");
+    torchlight_json_free(doc);
+    
+    TEST_ASSERT(json_rejects("[\"\\ud83d\"]", (size_t)-1), "Lone high surrogate rejected");
+    TEST_ASSERT(json_rejects("[\"\\ude00\"]", (size_t)-1), "Lone low surrogate rejected");
+    TEST_ASSERT(json_rejects("[\"\\ud83d\\u0041\"]", (size_t)-1), "High surrogate without low rejected");
+    TEST_ASSERT(json_rejects("[\"\\x41\"]", (size_t)-1), "Unknown escape rejected");
+    TEST_ASSERT(json_rejects("[\"a\tb\"]", (size_t)-1), "Raw control character rejected");
+    
+    // UTF-8 validation
+    TEST_ASSERT(json_accepts("[\"\xc3\xa9\xe2\x82\xac\xf0\x9f\x98\x80\"]"), "Valid UTF-8 accepted");
+    TEST_ASSERT(json_rejects("[\"\xc0\x80\"]", (size_t)-1), "Overlong UTF-8 rejected");
+    TEST_ASSERT(json_rejects("[\"\xed\xa0\x80\"]", (size_t)-1), "UTF-8 encoded surrogate rejected");
+    TEST_ASSERT(json_rejects("[\"\xf4\x90\x80\x80\"]", (size_t)-1), "UTF-8 above U+10FFFF rejected");
+    TEST_ASSERT(json_rejects("[\"\xff\"]", (size_t)-1), "Invalid UTF-8 byte rejected");
+    TEST_ASSERT(json_rejects("[\"\xe2\x82\"]", (size_t)-1), "Truncated UTF-8 rejected");
+    
+    // Numbers
+    TEST_ASSERT(json_accepts("[0, -0, 1.5, 1e10, 1E+2, 2.5e-3]"), "Valid numbers accepted");
+    TEST_ASSERT(json_rejects("[01]", (size_t)-1), "Leading zero rejected");
+    TEST_ASSERT(json_rejects("[1.]", (size_t)-1), "Missing fraction digits rejected");
+    TEST_ASSERT(json_rejects("[.5]", (size_t)-1), "Missing integer part rejected");
+    TEST_ASSERT(json_rejects("[+1]", (size_t)-1), "Leading plus rejected");
+    TEST_ASSERT(json_rejects("[1e]", (size_t)-1), "Missing exponent digits rejected");
+    TEST_ASSERT(json_rejects("[-]", (size_t)-1), "Lone minus rejected");
+    
+    const char* limits = "[9223372036854775807, -9223372036854775808, 9223372036854775808]";
+    doc = torchlight_json_parse(limits, strlen(limits), NULL);
+    root = torchlight_json_root(doc);
+    int64_t value = 0;
+    TEST_ASSERT(torchlight_json_int(torchlight_json_at(root, 0), &value) == 0 && value == INT64_MAX,
+                "INT64_MAX parsed as int");
+    TEST_ASSERT(torchlight_json_int(torchlight_json_at(root, 1), &value) == 0 && value == INT64_MIN,
+                "INT64_MIN parsed as int");
+    TEST_ASSERT(torchlight_json_int(torchlight_json_at(root, 2), &value) != 0,
+                "Integer overflow rejected as int");
+    TEST_ASSERT(torchlight_json_double(torchlight_json_at(root, 2), &score) == 0 && score == 9223372036854775808.0,
+                "Integer overflow still readable as double");
+    torchlight_json_free(doc);
+    
+    // Structure and error offsets
+    TEST_ASSERT(json_rejects("[1, 2,]", 6), "Trailing comma reported at its offset");
+    TEST_ASSERT(json_rejects("{\"a\": tru}", 6), "Bad literal reported at its offset");
+    TEST_ASSERT(json_rejects("[\"ab", 4), "Unterminated string reported at end");
+    TEST_ASSERT(json_rejects("[1] 2", 4), "Trailing content reported at its offset");
+    TEST_ASSERT(json_rejects("{\"a\" 1}", (size_t)-1), "Missing colon rejected");
+    TEST_ASSERT(json_rejects("{1: 2}", (size_t)-1), "Non-string key rejected");
+    TEST_ASSERT(json_rejects("", (size_t)-1), "Empty input rejected");
+    TEST_ASSERT(json_accepts(" \t\r\n\"scalar\" "), "Top-level scalar accepted");
+    
+    printf("   JSON parser working correctly\n");
+}
+
+// Test the pooled random source and the tokens built on it
+static bool in_alphabet(const char* text, const char* alphabet) {
+    return text[strspn(text, alphabet)] == '\0';
+}
+
+static void test_random(void) {
+    printf("\n🎲 Testing Random Source...\n");
+    
+    static const char BASE62[] = "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789";
+    static const char BASE64URL[] = "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789-_";
+    enum { RANDOM_BATCH = 64 };
+    
+    unsigned char bytes[RANDOM_BATCH][16];
+    bool filled = true;
+    for (int i = 0; i < RANDOM_BATCH; i++) {
+        filled &= torchlight_random_bytes(bytes[i], sizeof(bytes[i])) == 0;
+    }
+    bool unique = true;
+    for (int i = 0; i < RANDOM_BATCH; i++) {
+        for (int j = i + 1; j < RANDOM_BATCH; j++) {
+            unique &= memcmp(bytes[i], bytes[j], sizeof(bytes[i])) != 0;
+        }
+    }
+    TEST_ASSERT(filled && unique, "Random bytes unique over a batch");
+    static unsigned char large[8192];
+    TEST_ASSERT(torchlight_random_bytes(large, sizeof(large)) == 0 &&
+                memcmp(large, large + 4096, 4096) != 0, "Large request bypasses the pool");
+    
+    static char ids[RANDOM_BATCH][64];
+    bool shaped = true;
+    for (int i = 0; i < RANDOM_BATCH; i++) {
+        memset(ids[i], 'x', sizeof(ids[i]));
+        shaped &= torchlight_random_base62(ids[i], 63) == 0 && ids[i][63] == '\0' &&
+                  strlen(ids[i]) == 63 && in_alphabet(ids[i], BASE62);
+    }
+    unique = true;
+    for (int i = 0; i < RANDOM_BATCH; i++) {
+        for (int j = i + 1; j < RANDOM_BATCH; j++) {
+            unique &= strcmp(ids[i], ids[j]) != 0;
+        }
+    }
+    TEST_ASSERT(shaped, "Base62 strings have the right length, alphabet and terminator");
+    TEST_ASSERT(unique, "Base62 strings unique over a batch");
+    char empty[4] = "xyz";
+    TEST_ASSERT(torchlight_random_base62(empty, 0) == 0 && empty[0] == '\0', "Empty base62 string terminated");
+    
+    static char tokens[RANDOM_BATCH][64];
+    shaped = true;
+    for (int i = 0; i < RANDOM_BATCH; i++) {
+        shaped &= torchlight_generate_csrf_token(tokens[i], sizeof(tokens[i])) == 0 &&
+                  strlen(tokens[i]) == 43 && in_alphabet(tokens[i], BASE64URL);
+    }
+    unique = true;
+    for (int i = 0; i < RANDOM_BATCH; i++) {
+        for (int j = i + 1; j < RANDOM_BATCH; j++) {
+            unique &= strcmp(tokens[i], tokens[j]) != 0;
+        }
+    }
+    TEST_ASSERT(shaped, "CSRF tokens are 43 base64url characters");
+    TEST_ASSERT(unique, "CSRF tokens unique over a batch");
+    char small[16];
+    TEST_ASSERT(torchlight_generate_csrf_token(small, sizeof(small)) != 0, "CSRF token refuses a short buffer");
+    
+    // The child must not replay the bytes left in the parent's pool
+    unsigned char primed[1];
+    torchlight_random_bytes(primed, sizeof(primed));
+    int fds[2];
+    unsigned char parent[32], child[32];
+    bool forked = false;
+    if (pipe(fds) == 0) {
+        pid_t pid = fork();
+        if (pid == 0) {
+            close(fds[0]);
+            bool ok = torchlight_random_bytes(child, sizeof(child)) == 0 &&
+                      write(fds[1], child, sizeof(child)) == (ssize_t)sizeof(child);
+            _exit(ok ? 0 : 1);
+        }
+        close(fds[1]);
+        if (pid > 0) {
+            int status = 0;
+            forked = read(fds[0], child, sizeof(child)) == (ssize_t)sizeof(child);
+            waitpid(pid, &status, 0);
+            forked &= WIFEXITED(status) && WEXITSTATUS(status) == 0;
+        }
+        close(fds[0]);
+    }
+    TEST_ASSERT(forked && torchlight_random_bytes(parent, sizeof(parent)) == 0 &&
+                memcmp(parent, child, sizeof(parent)) != 0, "Child process draws from a fresh pool");
+    
+    printf("   Random source working correctly\n");
+}
+
+// Test CSRF tokens
+static void test_csrf(void) {
+    printf("\n🔐 Testing CSRF Tokens...\n");
+    
+    static const unsigned char secret[] = "test secret of enough bytes";
+    TEST_ASSERT(torchlight_set_csrf_secret(secret, sizeof(secret) - 1) == 0, "Set CSRF secret");
+    
+    http_request_t request = {0};
+    strcpy(request.session_id, "session-one");
+    request.has_session = true;
+    
+    char token[64];
+    TEST_ASSERT(torchlight_csrf_token(&request, NULL, token, sizeof(token)) == 0, "Issue session token");
+    
+    strcpy(request.headers[0].name, "X-CSRF-Token");
+    strcpy(request.headers[0].value, token);
+    request.header_count = 1;
+    TEST_ASSERT(torchlight_validate_csrf_token(&request, NULL), "Session token validates");
+    
+    http_request_t other = request;
+    strcpy(other.session_id, "session-two");
+    TEST_ASSERT(!torchlight_validate_csrf_token(&other, NULL), "Token bound to its session");
+    
+    other = request;
+    other.headers[0].value[5] = other.headers[0].value[5] == 'A' ? 'B' : 'A';
+    TEST_ASSERT(!torchlight_validate_csrf_token(&other, NULL), "Tampered token rejected");
+    
+    other = request;
+    other.header_count = 0;
+    TEST_ASSERT(!torchlight_validate_csrf_token(&other, NULL), "Missing token rejected");
+    
+    // Double-submit cookie for requests without a session
+    http_request_t anonymous = {0};
+    http_response_t response = {0};
+    TEST_ASSERT(torchlight_csrf_token(&anonymous, &response, token, sizeof(token)) == 0,
+                "Issue double-submit token");
+    TEST_ASSERT(response.header_count == 1 && strstr(response.headers[0].value, token) != NULL,
+                "Double-submit cookie set");
+    
+    strcpy(anonymous.headers[0].name, "Cookie");
+    snprintf(anonymous.headers[0].value, sizeof(anonymous.headers[0].value), "theme=dark; csrf_token=%s", token);
+    strcpy(anonymous.headers[1].name, "Content-Type");
+    strcpy(anonymous.headers[1].value, "application/x-www-form-urlencoded");
+    anonymous.header_count = 2;
+    char body[128];
+    snprintf(body, sizeof(body), "name=x&csrf_token=%s", token);
+    anonymous.body = body;
+    TEST_ASSERT(torchlight_validate_csrf_token(&anonymous, NULL), "Form field matches cookie");
+    
+    snprintf(body, sizeof(body), "name=x&csrf_token=%s", "forged");
+    TEST_ASSERT(!torchlight_validate_csrf_token(&anonymous, NULL), "Mismatched form field rejected");
+    
+    printf("   CSRF tokens working correctly\n");
+}
+
+// Test the session table
+typedef struct {
+    session_t* session;
+    volatile bool stop;
+} attr_writer_t;
+
+// Alternate between two sizes so every set moves the records after it
+static void* attr_writer(void* arg) {
+    attr_writer_t* writer = arg;
+    for (int i = 0; !writer->stop; i++) {
+        torchlight_session_set_string(writer->session, "a", i % 2 ? "short" : "a much longer value");
+        torchlight_session_set_blob(writer->session, "b", "0123456789abcdef", i % 2 ? 4 : 16);
+    }
+    return NULL;
+}
+
+static bool session_attrs_race(session_t* session) {
+    torchlight_session_set_string(session, "a", "short");
+    torchlight_session_set_string(session, "z", "after");
+    
+    attr_writer_t writer = { session, false };
+    pthread_t thread;
+    pthread_create(&thread, NULL, attr_writer, &writer);
+    
+    bool intact = true;
+    for (int i = 0; i < 20000 && intact; i++) {
+        char value[32];
+        if (torchlight_session_get_string(session, "a", value, sizeof(value)) < 0) continue;
+        intact = strcmp(value, "short") == 0 || strcmp(value, "a much longer value") == 0;
+        intact &= torchlight_session_get_string(session, "z", value, sizeof(value)) == 5 &&
+                  strcmp(value, "after") == 0;
+    }
+    
+    writer.stop = true;
+    pthread_join(thread, NULL);
+    torchlight_session_remove_attr(session, "a");
+    torchlight_session_remove_attr(session, "b");
+    torchlight_session_remove_attr(session, "z");
+    return intact;
+}
+
+static void test_sessions(void) {
+    printf("\n🗝️  Testing Session Table...\n");
+    
+    enum { SESSION_TEST_COUNT = 200 };
+    static char ids[SESSION_TEST_COUNT][64];
+    int base = torchlight_session_count();
+    
+    bool created = true;
+    for (int i = 0; i < SESSION_TEST_COUNT; i++) {
+        char user[16];
+        snprintf(user, sizeof(user), "user%d", i);
+        created &= torchlight_create_session(user, ids[i]) == 0;
+    }
+    TEST_ASSERT(created, "Create sessions");
+    TEST_ASSERT(torchlight_session_count() == base + SESSION_TEST_COUNT, "Session count after create");
+    
+    session_t* session = torchlight_acquire_session(ids[7]);
+    TEST_ASSERT(session && strcmp(session->user_id, "user7") == 0, "Acquire session by id");
+    TEST_ASSERT(session && torchlight_session_set_string(session, "theme", "dark") == 0 &&
+                torchlight_session_set_int(session, "visits", 3) == 0, "Set session attributes");
+    char theme[16];
+    int64_t visits = 0;
+    TEST_ASSERT(session && torchlight_session_get_string(session, "theme", theme, sizeof(theme)) == 4 &&
+                strcmp(theme, "dark") == 0 &&
+                torchlight_session_get_int(session, "visits", &visits) == 0 && visits == 3,
+                "Read session attributes");
+    TEST_ASSERT(session && torchlight_session_get_string(session, "theme", theme, 3) == 4 &&
+                strcmp(theme, "da") == 0, "Truncated string read reports full length");
+    TEST_ASSERT(session && torchlight_session_get_string(session, "visits", theme, sizeof(theme)) == -1,
+                "Attribute of another type not returned");
+    TEST_ASSERT(session && torchlight_session_remove_attr(session, "theme") == 0 &&
+                torchlight_session_get_string(session, "theme", theme, sizeof(theme)) == -1,
+                "Remove session attribute");
+    if (session) {
+        TEST_ASSERT(session_attrs_race(session), "Reads never see a value torn by a concurrent set");
+        torchlight_release_session(session);
+    }
+    
+    // Deleting every other entry backward-shifts the rest; all must stay reachable
+    bool destroyed = true;
+    for (int i = 0; i < SESSION_TEST_COUNT; i += 2) {
+        destroyed &= torchlight_destroy_session(ids[i]) == 0;
+    }
+    TEST_ASSERT(destroyed, "Destroy every other session");
+    TEST_ASSERT(torchlight_session_count() == base + SESSION_TEST_COUNT / 2, "Session count after destroy");
+    
+    bool reachable = true;
+    for (int i = 0; i < SESSION_TEST_COUNT; i++) {
+        session = torchlight_acquire_session(ids[i]);
+        if ((session != NULL) != (i % 2 == 1)) reachable = false;
+        if (session) torchlight_release_session(session);
+    }
+    TEST_ASSERT(reachable, "Remaining sessions found, destroyed ones gone");
+    TEST_ASSERT(torchlight_destroy_session(ids[0]) != 0, "Destroying twice fails");
+    
+    for (int i = 1; i < SESSION_TEST_COUNT; i += 2) {
+        torchlight_destroy_session(ids[i]);
+    }
+    TEST_ASSERT(torchlight_session_count() == base, "Session count restored");
+    
+    printf("   Session table working correctly\n");
+}
+
+// Test session expiry on the timing wheel, driven by the session clock
+static void test_session_expiry(void) {
+    printf("\n⏳ Testing Session Expiry...\n");
+    
+    torchlight_cleanup_sessions();
+    int base = torchlight_session_count();
+    char stale[64], touched[64], idle[64];
+    TEST_ASSERT(torchlight_create_session("stale", stale) == 0 &&
+                torchlight_create_session("touched", touched) == 0 &&
+                torchlight_create_session("idle", idle) == 0, "Create sessions");
+    
+    // Backdated, but still scheduled in its original bucket
+    session_t* session = torchlight_acquire_session(stale);
+    if (session) session->last_access_time -= 1000;
+    torchlight_release_session(session);
+    
+    // The bucket comes round on an earlier lap of the 1024 s wheel
+    tl_session_clock_advance(600);
+    torchlight_cleanup_sessions();
+    TEST_ASSERT(torchlight_session_count() == base + 3, "Sessions not yet due relinked for a later lap");
+    
+    session = torchlight_acquire_session(touched);
+    torchlight_release_session(session);
+    
+    tl_session_clock_advance(2100);
+    torchlight_cleanup_sessions();
+    TEST_ASSERT(torchlight_session_count() == base + 2, "Backdated session expired");
+    
+    tl_session_clock_advance(1000);
+    torchlight_cleanup_sessions();
+    TEST_ASSERT(torchlight_session_count() == base + 1, "Idle session expired");
+    session = torchlight_acquire_session(touched);
+    TEST_ASSERT(session && strcmp(session->user_id, "touched") == 0, "Touched session survives");
+    torchlight_release_session(session);
+    
+    // A pause longer than the wheel visits every bucket once
+    bool created = true;
+    for (int i = 0; i < 50; i++) {
+        char id[64];
+        created &= torchlight_create_session("paused", id) == 0;
+    }
+    tl_session_clock_advance(5000);
+    torchlight_cleanup_sessions();
+    TEST_ASSERT(created && torchlight_session_count() == base, "Long pause expires everything due in one pass");
+    
+    printf("   Session expiry working correctly\n");
+}
+
+// Test that leases outlive the table's reference
+enum { LEASE_TEST_COUNT = 256 };
+
+typedef struct {
+    char (*ids)[64];
+    volatile bool* stop;
+    unsigned seed;
+    bool intact;
+    int leased;
+} lease_reader_t;
+
+static void* lease_reader(void* arg) {
+    lease_reader_t* reader = arg;
+    while (!*reader->stop) {
+        int i = rand_r(&reader->seed) % LEASE_TEST_COUNT;
+        session_t* session = torchlight_acquire_session(reader->ids[i]);
+        if (!session) continue;
+        
+        char user[16], value[16];
+        snprintf(user, sizeof(user), "lease%d", i);
+        reader->intact &= strcmp(session->user_id, user) == 0;
+        reader->intact &= torchlight_session_set_string(session, "owner", user) == 0 &&
+                          torchlight_session_get_string(session, "owner", value, sizeof(value)) >= 0;
+        reader->leased++;
+        torchlight_release_session(session);
+    }
+    return NULL;
+}
+
+static void test_session_leases(void) {
+    printf("\n🔖 Testing Session Leases...\n");
+    
+    torchlight_cleanup_sessions();
+    int base = torchlight_session_count();
+    char id[64];
+    
+    TEST_ASSERT(torchlight_create_session("destroyed", id) == 0, "Create session");
+    session_t* session = torchlight_acquire_session(id);
+    TEST_ASSERT(session && torchlight_session_set_string(session, "cart", "3 items") == 0, "Lease session");
+    TEST_ASSERT(torchlight_destroy_session(id) == 0 && torchlight_acquire_session(id) == NULL,
+                "Destroyed session no longer found");
+    char cart[16];
+    TEST_ASSERT(session && strcmp(session->user_id, "destroyed") == 0 &&
+                torchlight_session_get_string(session, "cart", cart, sizeof(cart)) == 7 &&
+                strcmp(cart, "3 items") == 0, "Lease readable after destroy");
+    torchlight_release_session(session);
+    
+    TEST_ASSERT(torchlight_create_session("expired", id) == 0, "Create session");
+    session = torchlight_acquire_session(id);
+    tl_session_clock_advance(5000);
+    torchlight_cleanup_sessions();
+    TEST_ASSERT(torchlight_acquire_session(id) == NULL, "Expired session no longer found");
+    TEST_ASSERT(session && strcmp(session->user_id, "expired") == 0 &&
+                torchlight_session_set_int(session, "visits", 4) == 0, "Lease usable after expiry");
+    torchlight_release_session(session);
+    TEST_ASSERT(torchlight_session_count() == base, "Released leases not reinserted");
+    
+    // Readers lease random sessions on every shard while they are destroyed
+    static char ids[LEASE_TEST_COUNT][64];
+    bool created = true;
+    for (int i = 0; i < LEASE_TEST_COUNT; i++) {
+        char user[16];
+        snprintf(user, sizeof(user), "lease%d", i);
+        created &= torchlight_create_session(user, ids[i]) == 0;
+    }
+    TEST_ASSERT(created, "Create sessions across shards");
+    
+    volatile bool stop = false;
+    lease_reader_t readers[4];
+    pthread_t threads[4];
+    for (int t = 0; t < 4; t++) {
+        readers[t] = (lease_reader_t){ ids, &stop, (unsigned)t + 1, true, 0 };
+        pthread_create(&threads[t], NULL, lease_reader, &readers[t]);
+    }
+    
+    bool destroyed = true;
+    for (int i = 0; i < LEASE_TEST_COUNT; i++) {
+        destroyed &= torchlight_destroy_session(ids[i]) == 0;
+        if (i % 16 == 0) usleep(1000);
+    }
+    stop = true;
+    
+    bool intact = true;
+    int leased = 0;
+    for (int t = 0; t < 4; t++) {
+        pthread_join(threads[t], NULL);
+        intact &= readers[t].intact;
+        leased += readers[t].leased;
+    }
+    TEST_ASSERT(destroyed, "Destroy sessions while leased");
+    TEST_ASSERT(intact && leased > 0, "Concurrent leases see intact sessions");
+    TEST_ASSERT(torchlight_session_count() == base, "Session count restored");
+    
+    printf("   Session leases working correctly\n");
+}
+
+// Test the mmap-backed session store
+static bool store_file(char* path, const void* data, size_t length) {
+    strcpy(path, "/tmp/torchlight-store-XXXXXX");
+    int fd = mkstemp(path);
+    if (fd < 0) return false;
+    bool written = write(fd, data, length) == (ssize_t)length;
+    close(fd);
+    return written;
+}
+
+static void test_session_store(void) {
+    printf("\n💾 Testing Persistent Session Store...\n");
+    
+    char path[64];
+    static char foreign[4096];
+    memset(foreign, 'x', sizeof(foreign));
+    TEST_ASSERT(store_file(path, foreign, sizeof(foreign)) &&
+                torchlight_open_session_store(path, 64) != 0, "Foreign file refused");
+    FILE* file = fopen(path, "rb");
+    TEST_ASSERT(file && fgetc(file) == 'x', "Foreign file left untouched");
+    if (file) fclose(file);
+    unlink(path);
+    
+    // A zero header is an attach that died before publishing; a big one
+    // used to be truncated to nothing and then written through the map
+    static char zeroes[1 << 16];
+    TEST_ASSERT(store_file(path, zeroes, sizeof(zeroes)) &&
+                torchlight_open_session_store(path, 64) == 0, "Unfinished store reinitialized");
+    
+    char session_id[64];
+    TEST_ASSERT(torchlight_create_session("stored-user", session_id) == 0, "Create stored session");
+    torchlight_close_session_store();
+    
+    session_t* session = torchlight_acquire_session(session_id);
+    TEST_ASSERT(session == NULL, "Stored session not in the memory table");
+    if (session) torchlight_release_session(session);
+    
+    TEST_ASSERT(torchlight_open_session_store(path, 64) == 0, "Reopen store");
+    session = torchlight_acquire_session(session_id);
+    TEST_ASSERT(session && strcmp(session->user_id, "stored-user") == 0, "Session survives reopening");
+    if (session) torchlight_release_session(session);
+    
+    // Two overlapping leases each merge only the keys they wrote
+    session_t* first = torchlight_acquire_session(session_id);
+    session_t* second = torchlight_acquire_session(session_id);
+    TEST_ASSERT(first && second && first != second &&
+                torchlight_session_set_string(first, "theme", "dark") == 0 &&
+                torchlight_session_set_string(second, "lang", "en") == 0, "Write through two leases");
+    TEST_ASSERT(torchlight_release_session(first) == 0 && torchlight_release_session(second) == 0,
+                "Release both leases");
+    char value[16];
+    session = torchlight_acquire_session(session_id);
+    TEST_ASSERT(session && torchlight_session_get_string(session, "theme", value, sizeof(value)) == 4 &&
+                torchlight_session_get_string(session, "lang", value, sizeof(value)) == 2,
+                "Both leases merged");
+    if (session) torchlight_release_session(session);
+    
+    // Each blob fits alone but not next to the other; the second merge fails
+    static char blob[600];
+    first = torchlight_acquire_session(session_id);
+    second = torchlight_acquire_session(session_id);
+    TEST_ASSERT(first && second && torchlight_session_set_blob(first, "a", blob, sizeof(blob)) == 0 &&
+                torchlight_session_set_blob(second, "b", blob, sizeof(blob)) == 0 &&
+                torchlight_session_set_string(second, "lang", "fr") == 0, "Write blobs through two leases");
+    TEST_ASSERT(torchlight_release_session(first) == 0, "First blob merged");
+    TEST_ASSERT(torchlight_release_session(second) == -1, "Merge that no longer fits reported");
+    session = torchlight_acquire_session(session_id);
+    TEST_ASSERT(session && torchlight_session_get_blob(session, "a", blob, sizeof(blob)) == sizeof(blob) &&
+                torchlight_session_get_blob(session, "b", blob, sizeof(blob)) == -1 &&
+                torchlight_session_get_string(session, "lang", value, sizeof(value)) == 2 &&
+                strcmp(value, "en") == 0, "Failed merge left the stored session unchanged");
+    if (session) torchlight_release_session(session);
+    TEST_ASSERT(torchlight_destroy_session(session_id) == 0 && torchlight_session_count() == 0,
+                "Destroy stored session");
+    
+    torchlight_close_session_store();
+    unlink(path);
+    printf("   Persistent session store working correctly\n");
+}
+
+// Test signed and encrypted cookie sessions
+static void test_cookie_sessions(void) {
+    printf("\n🍪 Testing Cookie Sessions...\n");
+    
+    static const unsigned char first_secret[] = "first cookie secret, 32 bytes..";
+    static const unsigned char second_secret[] = "second cookie secret, 32 bytes.";
+    TEST_ASSERT(torchlight_set_session_cookie_key(1, first_secret, 8) != 0, "Short cookie secret rejected");
+    TEST_ASSERT(torchlight_set_session_cookie_key(1, first_secret, sizeof(first_secret) - 1) == 0,
+                "Install cookie key");
+    
+    session_t session = {0};
+    strcpy(session.user_id, "cookie-user");
+    session.authenticated = true;
+    session.created_time = time(NULL);
+    session.last_access_time = session.created_time;
+    
+    char signed_cookie[512];
+    char sealed_cookie[512];
+    session_t decoded;
+    int signed_length = torchlight_encode_session_cookie(&session, false, signed_cookie, sizeof(signed_cookie));
+    TEST_ASSERT(signed_length > 0 &&
+                torchlight_decode_session_cookie(signed_cookie, (size_t)signed_length, &decoded) == 0 &&
+                strcmp(decoded.user_id, "cookie-user") == 0 && decoded.authenticated,
+                "Signed cookie round-trips");
+    int sealed_length = torchlight_encode_session_cookie(&session, true, sealed_cookie, sizeof(sealed_cookie));
+    TEST_ASSERT(sealed_length > 0 &&
+                torchlight_decode_session_cookie(sealed_cookie, (size_t)sealed_length, &decoded) == 0 &&
+                strcmp(decoded.user_id, "cookie-user") == 0, "Encrypted cookie round-trips");
+    
+    char tampered[512];
+    strcpy(tampered, signed_cookie);
+    tampered[20] = tampered[20] == 'A' ? 'B' : 'A';
+    TEST_ASSERT(torchlight_decode_session_cookie(tampered, (size_t)signed_length, &decoded) != 0,
+                "Tampered signed cookie rejected");
+    strcpy(tampered, sealed_cookie);
+    tampered[30] = tampered[30] == 'A' ? 'B' : 'A';
+    TEST_ASSERT(torchlight_decode_session_cookie(tampered, (size_t)sealed_length, &decoded) != 0,
+                "Tampered encrypted cookie rejected");
+    
+    session_t stale = session;
+    stale.last_access_time -= TORCHLIGHT_SESSION_TIMEOUT + 10;
+    char stale_cookie[512];
+    int stale_length = torchlight_encode_session_cookie(&stale, false, stale_cookie, sizeof(stale_cookie));
+    TEST_ASSERT(stale_length > 0 &&
+                torchlight_decode_session_cookie(stale_cookie, (size_t)stale_length, &decoded) != 0,
+                "Expired cookie rejected");
+    
+    // Rotation: the old key verifies until it is retired
+    TEST_ASSERT(torchlight_set_session_cookie_key(2, second_secret, sizeof(second_secret) - 1) == 0,
+                "Rotate to a new key");
+    TEST_ASSERT(torchlight_decode_session_cookie(signed_cookie, (size_t)signed_length, &decoded) == 0,
+                "Old key still verifies");
+    TEST_ASSERT(torchlight_retire_session_cookie_key(2) != 0, "Primary key cannot be retired");
+    TEST_ASSERT(torchlight_retire_session_cookie_key(1) == 0 &&
+                torchlight_decode_session_cookie(signed_cookie, (size_t)signed_length, &decoded) != 0,
+                "Retired key no longer verifies");
+    
+    http_response_t response = {0};
+    TEST_ASSERT(torchlight_store_cookie_session(&response, &session, true) == 0 && response.header_count == 1,
+                "Cookie session attached to response");
+    
+    http_request_t request = {0};
+    strcpy(request.headers[0].name, "Cookie");
+    snprintf(request.headers[0].value, sizeof(request.headers[0].value), "theme=dark; %.*s",
+             (int)strcspn(response.headers[0].value, ";"), response.headers[0].value);
+    request.header_count = 1;
+    TEST_ASSERT(torchlight_load_cookie_session(&request, &decoded) == 0 &&
+                strcmp(decoded.user_id, "cookie-user") == 0, "Cookie session loaded from request");
+    
+    printf("   Cookie sessions working correctly\n");
+}
+
+// Test GCRA rate limiting
+static void test_rate_limiting(void) {
+    printf("\n🚦 Testing Rate Limiting...\n");
+    
+    TEST_ASSERT(torchlight_set_rate_limit(0, 0) != 0, "Reject zero rate");
+    TEST_ASSERT(torchlight_set_rate_limit(60, 3) == 0, "Configure 60/minute, burst 3");
+    
+    bool burst = torchlight_check_rate_limit("client-a") &&
+                 torchlight_check_rate_limit("client-a") &&
+                 torchlight_check_rate_limit("client-a");
+    TEST_ASSERT(burst, "Burst admitted");
+    TEST_ASSERT(!torchlight_check_rate_limit("client-a"), "Request beyond burst denied");
+    TEST_ASSERT(!torchlight_check_rate_limit("client-a"), "Denied request does not earn credit");
+    TEST_ASSERT(torchlight_check_rate_limit("client-b"), "Other client unaffected");
+    
+    TEST_ASSERT(torchlight_set_rate_limit(60000, 1) == 0, "Configure 1000/second, burst 1");
+    TEST_ASSERT(torchlight_check_rate_limit("client-a"), "Reconfiguring resets clients");
+    TEST_ASSERT(!torchlight_check_rate_limit("client-a"), "Second immediate request denied");
+    usleep(2000);
+    TEST_ASSERT(torchlight_check_rate_limit("client-a"), "Admitted again after one interval");
+    
+    printf("   Rate limiting working correctly\n");
+}
+
+// Test PROXY protocol headers
+static void test_proxy_protocol(void) {
+    printf("\n🧅 Testing PROXY Protocol...\n");
+    
+    torchlight_set_proxy_protocol(true);
+    http_request_t request;
+    
+    static const char v1[] = "PROXY TCP4 192.0.2.7 192.0.2.1 40000 80\r\nGET /v1 HTTP/1.1\r\nHost: x\r\n\r\n";
+    TEST_ASSERT(parse_split(v1, sizeof(v1) - 1, 0, &request) == 0 &&
+                strcmp(request.client_id, "192.0.2.7") == 0 && strcmp(request.path, "/v1") == 0,
+                "PROXY v1 TCP4 source used as client");
+    TEST_ASSERT(parse_split(v1, sizeof(v1) - 1, 9, &request) == 0 &&
+                strcmp(request.client_id, "192.0.2.7") == 0, "PROXY v1 split across reads");
+    
+    static const char v1_tor[] = "PROXY TCP6 fc00:dead:beef:4dad::0:1234 ::1 40000 80\r\nGET / HTTP/1.1\r\n\r\n";
+    TEST_ASSERT(parse_split(v1_tor, sizeof(v1_tor) - 1, 0, &request) == 0 &&
+                request.has_circuit_id && request.circuit_id == 0x1234 &&
+                strcmp(request.client_id, "circuit:4660") == 0, "PROXY v1 Tor circuit id");
+    
+    static const char v1_bad[] = "PROXY TCP9 x y 1 2\r\nGET / HTTP/1.1\r\n\r\n";
+    TEST_ASSERT(parse_split(v1_bad, sizeof(v1_bad) - 1, 0, &request) != 0, "PROXY v1 bad protocol rejected");
+    
+    static const char missing[] = "GET / HTTP/1.1\r\n\r\n";
+    TEST_ASSERT(parse_split(missing, sizeof(missing) - 1, 0, &request) != 0, "Missing PROXY header rejected");
+    
+    // Version 2: signature, PROXY command over TCP/IPv6, then addresses and ports
+    unsigned char v2[16 + 36 + 64];
+    static const unsigned char v2_signature[12] = {
+        0x0D, 0x0A, 0x0D, 0x0A, 0x00, 0x0D, 0x0A, 0x51, 0x55, 0x49, 0x54, 0x0A
+    };
+    static const unsigned char tor_source[16] = {
+        0xfc, 0x00, 0xde, 0xad, 0xbe, 0xef, 0x4d, 0xad, 0, 0, 0, 0, 0x00, 0x01, 0x00, 0x02
+    };
+    memcpy(v2, v2_signature, 12);
+    v2[12] = 0x21;
+    v2[13] = 0x21;
+    v2[14] = 0;
+    v2[15] = 36;
+    memset(v2 + 16, 0, 36);
+    memcpy(v2 + 16, tor_source, 16);
+    static const char v2_request[] = "GET /v2 HTTP/1.1\r\nHost: x\r\n\r\n";
+    memcpy(v2 + 16 + 36, v2_request, sizeof(v2_request) - 1);
+    size_t v2_length = 16 + 36 + sizeof(v2_request) - 1;
+    
+    TEST_ASSERT(parse_split((const char*)v2, v2_length, 0, &request) == 0 &&
+                request.has_circuit_id && request.circuit_id == 0x10002 && strcmp(request.path, "/v2") == 0,
+                "PROXY v2 Tor circuit id");
+    TEST_ASSERT(parse_split((const char*)v2, v2_length, 5, &request) == 0 &&
+                request.circuit_id == 0x10002, "PROXY v2 short read inside the signature");
+    TEST_ASSERT(parse_split((const char*)v2, v2_length, 14, &request) == 0 &&
+                request.circuit_id == 0x10002, "PROXY v2 short read inside the preamble");
+    
+    v2[12] = 0x20;  // LOCAL keeps the socket peer
+    TEST_ASSERT(parse_split((const char*)v2, v2_length, 0, &request) == 0 &&
+                !request.has_circuit_id && strcmp(request.client_id, "local") == 0,
+                "PROXY v2 LOCAL keeps the peer address");
+    
+    v2[12] = 0x22;
+    TEST_ASSERT(parse_split((const char*)v2, v2_length, 0, &request) != 0, "PROXY v2 unknown command rejected");
+    v2[12] = 0x11;
+    TEST_ASSERT(parse_split((const char*)v2, v2_length, 0, &request) != 0, "PROXY v2 bad version rejected");
+    
+    torchlight_set_proxy_protocol(false);
+    printf("   PROXY protocol working correctly\n");
+}
+
+// Drive torchlight_handle_request() over a socketpair. Returns the
+// client end; the server end is closed here unless the request was queued,
+// in which case its handler thread closes it.
+static int serve_request(const char* raw, int* result_out) {
+    int fds[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0) return -1;
+    
+    struct timeval timeout = { 1, 0 };
+    setsockopt(fds[0], SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(fds[1], SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    
+    if (write(fds[1], raw, strlen(raw)) < 0) {
+        close(fds[0]);
+        close(fds[1]);
+        return -1;
+    }
+    
+    int result = torchlight_handle_request(fds[0]);
+    if (result != 1) close(fds[0]);
+    if (result_out) *result_out = result;
+    return fds[1];
+}
+
+// Read the reply to EOF, so the server is done writing, and return its
+// status code
+static int reply_status(int fd) {
+    char reply[256] = "";
+    size_t length = 0;
+    char discard[4096];
+    ssize_t got;
+    
+    while ((got = read(fd, discard, sizeof(discard))) > 0) {
+        size_t keep = (size_t)got < sizeof(reply) - 1 - length ? (size_t)got : sizeof(reply) - 1 - length;
+        memcpy(reply + length, discard, keep);
+        length += keep;
+    }
+    close(fd);
+    
+    int status = 0;
+    sscanf(reply, "HTTP/1.1 %d", &status);
+    return status;
+}
+
+static uint64_t test_now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000;
+}
+
+// Restart the server with a test configuration
+static void restart_server(torchlight_config_t* config) {
+    torchlight_shutdown();
+    config->max_connections = config->max_connections ? config->max_connections : 100;
+    torchlight_init(config);
+    torchlight_start();
+}
+
+// A handler that holds its thread until the gate opens, logging the
+// client of every request it serves
+static pthread_mutex_t g_gate_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t g_gate_changed = PTHREAD_COND_INITIALIZER;
+static bool g_gate_open = true;
+static int g_gate_waiting = 0;
+static char g_served[16][64];
+static int g_served_count = 0;
+
+static int gated_handler(const http_request_t* request, http_response_t* response) {
+    pthread_mutex_lock(&g_gate_lock);
+    g_gate_waiting++;
+    pthread_cond_broadcast(&g_gate_changed);
+    while (!g_gate_open) pthread_cond_wait(&g_gate_changed, &g_gate_lock);
+    g_gate_waiting--;
+    if (g_served_count < 16) strcpy(g_served[g_served_count++], request->client_id);
+    pthread_mutex_unlock(&g_gate_lock);
+    return torchlight_response_html(response, "ok");
+}
+
+static void gate_close(void) {
+    pthread_mutex_lock(&g_gate_lock);
+    g_gate_open = false;
+    g_served_count = 0;
+    pthread_mutex_unlock(&g_gate_lock);
+}
+
+static void gate_open(void) {
+    pthread_mutex_lock(&g_gate_lock);
+    g_gate_open = true;
+    pthread_cond_broadcast(&g_gate_changed);
+    pthread_mutex_unlock(&g_gate_lock);
+}
+
+// Wait until `count` handlers are parked at the gate
+static bool gate_wait(int count) {
+    struct timespec until;
+    clock_gettime(CLOCK_REALTIME, &until);
+    until.tv_sec += 2;
+    
+    pthread_mutex_lock(&g_gate_lock);
+    int rc = 0;
+    while (g_gate_waiting < count && rc == 0) {
+        rc = pthread_cond_timedwait(&g_gate_changed, &g_gate_lock, &until);
+    }
+    bool reached = g_gate_waiting >= count;
+    pthread_mutex_unlock(&g_gate_lock);
+    return reached;
+}
+
+// Test the fair request scheduler
+static void test_scheduler(void) {
+    printf("\n⚖️  Testing Fair Scheduler...\n");
+    
+    torchlight_config_t config = {0};
+    config.handler_threads = 1;
+    config.max_queued_per_client = 4;
+    config.accept_proxy_protocol = true;
+    restart_server(&config);
+    torchlight_add_route(HTTP_METHOD_GET, "/gated", gated_handler, "Gated");
+    
+    // Park the only handler thread, then queue a backlog from one client
+    // ahead of a single request from another
+    gate_close();
+    int clients[8];
+    int queued = 0;
+    int result = 0;
+    clients[0] = serve_request("PROXY TCP4 192.0.2.9 192.0.2.1 1 80\r\nGET /gated HTTP/1.1\r\n\r\n", &result);
+    queued += result == 1;
+    TEST_ASSERT(gate_wait(1), "Handler thread busy");
+    
+    for (int i = 1; i <= 5; i++) {
+        clients[i] = serve_request("PROXY TCP4 192.0.2.10 192.0.2.1 1 80\r\nGET /gated HTTP/1.1\r\n\r\n",
+                                   &result);
+        queued += result == 1;
+    }
+    TEST_ASSERT(queued == 5 && reply_status(clients[5]) == 429, "Per-client queue cap enforced");
+    
+    clients[6] = serve_request("PROXY TCP4 192.0.2.11 192.0.2.1 1 80\r\nGET /gated HTTP/1.1\r\n\r\n", &result);
+    TEST_ASSERT(result == 1, "Second client queued");
+    
+    gate_open();
+    bool served = true;
+    for (int i = 0; i <= 6; i++) {
+        if (i != 5) served &= reply_status(clients[i]) == 200;
+    }
+    TEST_ASSERT(served, "Queued requests served");
+    
+    int position = -1;
+    for (int i = 0; i < g_served_count; i++) {
+        if (strcmp(g_served[i], "192.0.2.11") == 0) position = i;
+    }
+    TEST_ASSERT(g_served_count == 6 && position >= 1 && position <= 2,
+                "New client served within one round of the backlog");
+    
+    printf("   Fair scheduler working correctly\n");
+}
+
+// Test early load shedding
+static void test_load_shedding(void) {
+    printf("\n🪫 Testing Load Shedding...\n");
+    
+    torchlight_config_t config = {0};
+    config.handler_threads = 1;
+    config.enable_load_shedding = true;
+    config.max_connections = 1;  // Caps the adaptive limit at one in flight
+    restart_server(&config);
+    torchlight_add_route(HTTP_METHOD_GET, "/gated", gated_handler, "Gated");
+    torchlight_add_route(HTTP_METHOD_POST, "/gated", gated_handler, "Gated");
+    
+    gate_close();
+    int result = 0;
+    int busy = serve_request("GET /gated HTTP/1.1\r\n\r\n", &result);
+    TEST_ASSERT(result == 1 && gate_wait(1), "First request admitted");
+    
+    // The body never arrives; shedding must not wait for it
+    uint64_t started = test_now_ms();
+    int shed = serve_request("POST /gated HTTP/1.1\r\nContent-Length: 100000\r\n\r\n", &result);
+    uint64_t elapsed = test_now_ms() - started;
+    TEST_ASSERT(result == 0 && reply_status(shed) == 503, "Request over the limit shed with 503");
+    TEST_ASSERT(elapsed < 500, "Shed after the headers, before reading the body");
+    
+    gate_open();
+    TEST_ASSERT(reply_status(busy) == 200, "Admitted request completes");
+    
+    // The slot comes back once the response is sent
+    usleep(20000);
+    gate_close();
+    busy = serve_request("GET /gated HTTP/1.1\r\n\r\n", &result);
+    TEST_ASSERT(result == 1 && gate_wait(1), "Admitted again after completion");
+    gate_open();
+    reply_status(busy);
+    
+    printf("   Load shedding working correctly\n");
+}
+
+// Test route bulkheads and deadlines
+static int deadline_handler(const http_request_t* request, http_response_t* response) {
+    while (!torchlight_request_cancelled(request)) usleep(1000);
+    (void)response;
+    return -1;
+}
+
+static void test_bulkheads(void) {
+    printf("\n🚧 Testing Route Bulkheads...\n");
+    
+    torchlight_config_t config = {0};
+    config.handler_threads = 2;
+    config.max_queued_per_client = 8;
+    restart_server(&config);
+    torchlight_add_route(HTTP_METHOD_GET, "/gated", gated_handler, "Gated");
+    torchlight_add_route(HTTP_METHOD_GET, "/hello", test_hello_handler, "Hello");
+    torchlight_add_route(HTTP_METHOD_GET, "/slow", deadline_handler, "Deadline");
+    TEST_ASSERT(torchlight_set_route_limits(HTTP_METHOD_GET, "/gated", 1, 0) == 0 &&
+                torchlight_set_route_limits(HTTP_METHOD_GET, "/slow", 0, 20) == 0,
+                "Set route limits");
+    TEST_ASSERT(torchlight_set_route_limits(HTTP_METHOD_GET, "/missing", 1, 0) != 0,
+                "Limits for an unknown route rejected");
+    
+    gate_close();
+    int busy = serve_request("GET /gated HTTP/1.1\r\n\r\n", NULL);
+    TEST_ASSERT(gate_wait(1), "Route slot taken");
+    
+    // The second handler thread refuses at once instead of waiting
+    uint64_t started = test_now_ms();
+    int refused = serve_request("GET /gated HTTP/1.1\r\n\r\n", NULL);
+    TEST_ASSERT(reply_status(refused) == 503 && test_now_ms() - started < 500,
+                "Route at capacity refused with 503 at once");
+    TEST_ASSERT(reply_status(serve_request("GET /hello HTTP/1.1\r\n\r\n", NULL)) == 200,
+                "Other routes keep being served");
+    
+    gate_open();
+    TEST_ASSERT(reply_status(busy) == 200, "Slot holder completes");
+    usleep(20000);
+    TEST_ASSERT(reply_status(serve_request("GET /gated HTTP/1.1\r\n\r\n", NULL)) == 200,
+                "Slot released after completion");
+    
+    started = test_now_ms();
+    TEST_ASSERT(reply_status(serve_request("GET /slow HTTP/1.1\r\n\r\n", NULL)) == 503 &&
+                test_now_ms() - started < 500, "Handler past its deadline answered with 503");
+    
+    printf("   Route bulkheads working correctly\n");
+}
+
+// Test the header-phase cap on slow clients
+static void* slow_reader(void* arg) {
+    torchlight_handle_request(*(int*)arg);
+    return NULL;
+}
+
+static void test_slow_clients(void) {
+    printf("\n🐌 Testing Slow-Client Protection...\n");
+    
+    // A floor of 1 B/s, which the trickling client stays above
+    torchlight_config_t config = {0};
+    config.min_header_rate_bps = 1;
+    config.max_header_phase_connections = 1;
+    restart_server(&config);
+    torchlight_add_route(HTTP_METHOD_GET, "/hello", test_hello_handler, "Hello");
+    
+    int fds[2];
+    TEST_ASSERT(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0, "Open slow connection");
+    const char* partial = "GET /hello HTTP/1.1\r\nHost: example.onion\r\n";
+    TEST_ASSERT(write(fds[1], partial, strlen(partial)) > 0, "Send partial headers");
+    pthread_t reader;
+    pthread_create(&reader, NULL, slow_reader, &fds[0]);
+    usleep(50000);
+    
+    // The only header-phase connection is still in its grace period
+    int result = 0;
+    int refused = serve_request("GET /hello HTTP/1.1\r\n\r\n", &result);
+    TEST_ASSERT(result == 0 && reply_status(refused) == 503, "New connection refused at the cap");
+    
+    // Past grace, the trickler is evicted even though it beats the floor
+    sleep(2);
+    int served = serve_request("GET /hello HTTP/1.1\r\n\r\n", &result);
+    TEST_ASSERT(result == 0 && reply_status(served) == 200, "Slowest connection evicted to make room");
+    pthread_join(reader, NULL);
+    close(fds[0]);
+    close(fds[1]);
+    
+    printf("   Slow-client protection working correctly\n");
+}
+
+// Test the compiled template cache
+static char g_template_dir[64];
+
+static bool template_dir_create(void) {
+    strcpy(g_template_dir, "/tmp/torchlight-templates-XXXXXX");
+    return mkdtemp(g_template_dir) != NULL;
+}
+
+// Write `content` to `name` under the template directory; the full path
+// goes to `path`
+static bool write_template(char* path, size_t size, const char* name, const char* content) {
+    snprintf(path, size, "%s/%s", g_template_dir, name);
+    FILE* file = fopen(path, "wb");
+    if (!file) return false;
+    bool written = fputs(content, file) >= 0;
+    return fclose(file) == 0 && written;
+}
+
+static bool renders_to(const torchlight_template_t* tpl, const char* variables, const char* expected) {
+    char* output = NULL;
+    bool match = tpl && torchlight_render_compiled(tpl, variables, &output, NULL) == 0 &&
+                 strcmp(output, expected) == 0;
+    if (!match && output) printf("   got: %s\n", output);
+    free(output);
+    return match;
+}
+
+static void test_template_cache(void) {
+    printf("\n🗃️  Testing Template Cache...\n");
+    
+    char path[128];
+    TEST_ASSERT(template_dir_create() && write_template(path, sizeof(path), "page.html", "<p>{{name}}</p>"),
+                "Write template file");
+    torchlight_set_template_cache(true);
+    
+    torchlight_template_t* first = torchlight_load_template(path);
+    torchlight_template_t* again = torchlight_load_template(path);
+    TEST_ASSERT(first && first == again, "Second load served from the cache");
+    TEST_ASSERT(renders_to(first, "{\"name\": \"Ann\"}", "<p>Ann</p>"), "Cached template renders");
+    
+    char spelled[160];
+    snprintf(spelled, sizeof(spelled), "%s/./page.html", g_template_dir);
+    torchlight_template_t* respelled = torchlight_load_template(spelled);
+    TEST_ASSERT(respelled == first, "Equivalent spellings share an entry");
+    torchlight_release_template(respelled);
+    
+    // Same size, so only the mtime tells the versions apart
+    TEST_ASSERT(write_template(path, sizeof(path), "page.html", "<b>{{name}}</b>"), "Rewrite template file");
+    struct timespec times[2] = { { 0, UTIME_OMIT }, { time(NULL) + 10, 0 } };
+    TEST_ASSERT(utimensat(AT_FDCWD, path, times, 0) == 0, "Move mtime forward");
+    
+    torchlight_template_t* edited = torchlight_load_template(path);
+    TEST_ASSERT(edited && edited != first, "Changed mtime recompiles");
+    TEST_ASSERT(renders_to(edited, "{\"name\": \"Ann\"}", "<b>Ann</b>"), "New version renders");
+    TEST_ASSERT(renders_to(first, "{\"name\": \"Ann\"}", "<p>Ann</p>"), "Old version still held by its users");
+    
+    char* output = NULL;
+    TEST_ASSERT(torchlight_render_template(path, "{\"name\": \"Bo\"}", &output, NULL) == 0 &&
+                strcmp(output, "<b>Bo</b>") == 0, "Render by path uses the new version");
+    free(output);
+    
+    torchlight_release_template(first);
+    torchlight_release_template(again);
+    torchlight_release_template(edited);
+    torchlight_clear_template_cache();
+    torchlight_set_template_cache(false);
+    TEST_ASSERT(torchlight_load_template("/nonexistent/page.html") == NULL, "Missing template rejected");
+    
+    unlink(path);
+    rmdir(g_template_dir);
+    printf("   Template cache working correctly\n");
+}
+
+// Test rendering from values bound to slots
+static int fill_from_names(void* context, size_t slot, const char* name, torchlight_value_t* value) {
+    (void)slot;
+    if (strcmp(name, (const char*)context) == 0) return -1;  // Abort on request
+    value->ptr = name;
+    value->len = strlen(name);
+    return 0;
+}
+
+static void test_template_slots(void) {
+    printf("\n🎰 Testing Slot-Bound Rendering...\n");
+    
+    const char* source = "{{greeting}}, {{name}}! {{greeting}} again.";
+    torchlight_template_t* tpl = torchlight_compile_template(source, strlen(source));
+    TEST_ASSERT(tpl && torchlight_template_slot_count(tpl) == 2, "Repeated variable shares a slot");
+    TEST_ASSERT(torchlight_template_slot(tpl, "greeting") == 0 &&
+                torchlight_template_slot(tpl, "name") == 1 &&
+                torchlight_template_slot(tpl, "missing") == -1, "Slots indexed by first use");
+    TEST_ASSERT(strcmp(torchlight_template_slot_name(tpl, 1), "name") == 0 &&
+                torchlight_template_slot_name(tpl, 2) == NULL, "Slot names");
+    
+    // Lengths bound the values; they need not be NUL-terminated
+    torchlight_value_t values[2] = { { "Hello there", 5 }, { "Ann", 3 } };
+    char* output = NULL;
+    size_t output_size = 0;
+    TEST_ASSERT(torchlight_render_slots(tpl, values, 2, &output, &output_size) == 0 &&
+                strcmp(output, "Hello, Ann! Hello again.") == 0 && output_size == strlen(output),
+                "Render from slot values");
+    free(output);
+    
+    values[1].ptr = NULL;
+    TEST_ASSERT(torchlight_render_slots(tpl, values, 1, &output, NULL) == 0 &&
+                strcmp(output, "Hello, ! Hello again.") == 0, "Unbound slots render empty");
+    free(output);
+    
+    // One pass into a buffer presized from earlier renders; a bigger one grows it
+    static char long_name[4096];
+    memset(long_name, 'n', sizeof(long_name) - 1);
+    values[1] = (torchlight_value_t){ long_name, sizeof(long_name) - 1 };
+    TEST_ASSERT(torchlight_render_slots(tpl, values, 2, &output, &output_size) == 0 &&
+                output_size == strlen("Hello, ! Hello again.") + sizeof(long_name) - 1 &&
+                output_size == strlen(output) && memcmp(output + 7, long_name, 32) == 0,
+                "Output larger than the estimate grows the buffer");
+    free(output);
+    
+    TEST_ASSERT(torchlight_render_fill(tpl, fill_from_names, "", &output, NULL) == 0 &&
+                strcmp(output, "greeting, name! greeting again.") == 0, "Render through a fill callback");
+    free(output);
+    output = NULL;
+    TEST_ASSERT(torchlight_render_fill(tpl, fill_from_names, "name", &output, NULL) != 0 && output == NULL,
+                "Fill callback aborts the render");
+    
+    torchlight_release_template(tpl);
+    printf("   Slot-bound rendering working correctly\n");
+}
+
+// Test scatter/gather rendering
+static int g_iov_releases = 0;
+
+static void count_iov_release(void* context) {
+    (void)context;
+    g_iov_releases++;
+}
+
+static void test_template_iov(void) {
+    printf("\n🧩 Testing Scatter/Gather Rendering...\n");
+    
+    const char* source = "<h1>{{title}}</h1>{{body}}";
+    torchlight_template_t* tpl = torchlight_compile_template(source, strlen(source));
+    static char body[8192];
+    memset(body, 'x', sizeof(body));
+    torchlight_value_t values[2] = { { "News", 4 }, { body, sizeof(body) } };
+    
+    http_response_t response = {0};
+    response.status = HTTP_STATUS_OK;
+    response.content_type = CONTENT_TYPE_TEXT_HTML;
+    TEST_ASSERT(tpl && torchlight_render_iov(tpl, values, 2, &response, count_iov_release, NULL) == 0,
+                "Render into an iovec list");
+    torchlight_release_template(tpl);  // The response holds its own reference
+    
+    bool points_at_value = false;
+    size_t total = 0;
+    for (int i = 0; i < response.body_iov_count; i++) {
+        points_at_value |= response.body_iov[i].iov_base == body;
+        total += response.body_iov[i].iov_len;
+    }
+    TEST_ASSERT(points_at_value, "Large value not copied");
+    TEST_ASSERT(total == response.body_length && total == 4 + 4 + 5 + sizeof(body), "Spans add up to the body");
+    
+    int fds[2];
+    TEST_ASSERT(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0 &&
+                torchlight_send_response(fds[0], &response) == 0, "Send iovec body");
+    close(fds[0]);
+    static char reply[sizeof(body) + 1024];
+    size_t length = 0;
+    ssize_t got;
+    while (length < sizeof(reply) - 1 && (got = read(fds[1], reply + length, sizeof(reply) - 1 - length)) > 0) {
+        length += (size_t)got;
+    }
+    close(fds[1]);
+    reply[length] = '\0';
+    const char* page = strstr(reply, "\r\n\r\n");
+    TEST_ASSERT(page && strncmp(page + 4, "<h1>News</h1>xxx", 16) == 0 &&
+                strlen(page + 4) == total, "Page arrives intact");
+    
+    TEST_ASSERT(g_iov_releases == 0, "Values held until the response is released");
+    torchlight_release_response(&response);
+    TEST_ASSERT(g_iov_releases == 1 && response.body_iov == NULL, "Release callback runs once");
+    
+    // From a file and JSON, which the response copies
+    char path[128];
+    TEST_ASSERT(template_dir_create() && write_template(path, sizeof(path), "item.html", "<li>{{item}}</li>"),
+                "Write template file");
+    char* variables = strdup("{\"item\": \"tea\"}");
+    TEST_ASSERT(torchlight_render_template_iov(path, variables, &response) == 0, "Render file into an iovec list");
+    memset(variables, 0, strlen(variables));
+    free(variables);
+    char joined[64] = "";
+    for (int i = 0; i < response.body_iov_count; i++) {
+        strncat(joined, response.body_iov[i].iov_base, response.body_iov[i].iov_len);
+    }
+    TEST_ASSERT(strcmp(joined, "<li>tea</li>") == 0, "Values outlive the caller's JSON");
+    torchlight_release_response(&response);
+    
+    unlink(path);
+    rmdir(g_template_dir);
+    printf("   Scatter/gather rendering working correctly\n");
+}
+
+// Test sections, partials and dotted paths
+static bool compiled_renders_to(const char* source, const char* variables, const char* expected) {
+    torchlight_template_t* tpl = torchlight_compile_template(source, strlen(source));
+    bool match = renders_to(tpl, variables, expected);
+    torchlight_release_template(tpl);
+    return match;
+}
+
+static void test_template_sections(void) {
+    printf("\n🔁 Testing Template Sections...\n");
+    
+    const char* list = "{\"title\": \"Menu\", \"items\": [{\"name\": \"tea\"}, {\"name\": \"cake\"}], "
+                       "\"empty\": [], \"user\": {\"profile\": {\"name\": \"Ann\"}}, \"admin\": false}";
+    
+    // Only top-level keys are indexed, never nested ones or text inside strings
+    TEST_ASSERT(compiled_renders_to("{{name}}", "{\"a\":{\"name\":\"inner\"},\"b\":\"\\\"name\\\": x\",\"name\":\"outer\"}",
+                                    "outer"), "Top-level key found past nested and quoted names");
+    TEST_ASSERT(compiled_renders_to("<ul>{{#items}}<li>{{name}}</li>{{/items}}</ul>", list,
+                                    "<ul><li>tea</li><li>cake</li></ul>"), "Section repeats per element");
+    TEST_ASSERT(compiled_renders_to("{{#items}}{{title}}:{{name}} {{/items}}", list, "Menu:tea Menu:cake "),
+                "Outer names visible inside a section");
+    TEST_ASSERT(compiled_renders_to("[{{#empty}}x{{/empty}}{{^empty}}none{{/empty}}]", list, "[none]"),
+                "Inverted section for an empty list");
+    TEST_ASSERT(compiled_renders_to("{{#admin}}root{{/admin}}{{^admin}}guest{{/admin}}", list, "guest"),
+                "Conditional on a boolean");
+    TEST_ASSERT(compiled_renders_to("{{#user}}{{profile.name}}{{/user}} {{user.profile.name}}", list, "Ann Ann"),
+                "Dotted paths into nested objects");
+    TEST_ASSERT(compiled_renders_to("a{{! ignored }}b{{missing.path}}c", list, "abc"),
+                "Comments and missing paths render nothing");
+    TEST_ASSERT(torchlight_compile_template("{{#items}}open", 14) == NULL &&
+                torchlight_compile_template("{{#a}}{{/b}}", 12) == NULL, "Unbalanced sections rejected");
+    
+    char path[128];
+    TEST_ASSERT(template_dir_create() &&
+                write_template(path, sizeof(path), "item.html", "<li>{{name}}</li>"), "Write partial");
+    torchlight_set_template_directory(g_template_dir);
+    TEST_ASSERT(compiled_renders_to("{{#items}}{{>item.html}}{{/items}}", list, "<li>tea</li><li>cake</li>"),
+                "Partial rendered in the section's context");
+    torchlight_set_template_directory("");
+    
+    unlink(path);
+    rmdir(g_template_dir);
+    printf("   Template sections working correctly\n");
+}
+
+// Compile a template from memory and return its rendering
+static char* render_source(const char* source, const char* variables) {
+    torchlight_template_t* tpl = torchlight_compile_template(source, strlen(source));
+    if (!tpl) return NULL;
+    
+    char* output = NULL;
+    size_t output_size = 0;
+    if (torchlight_render_compiled(tpl, variables, &output, &output_size) != 0) output = NULL;
+    torchlight_release_template(tpl);
+    return output;
+}
+
+// Test context-aware escaping
+static void test_context_escaping(void) {
+    printf("\n🛡️  Testing Context-Aware Escaping...\n");
+    
+    const char* markup = "{\"v\": \"<b a='1'>&\\\"\"}";
+    TEST_ASSERT(compiled_renders_to("<p>{{v}}</p>", markup, "<p>&lt;b a=&#39;1&#39;&gt;&amp;&quot;</p>"),
+                "Element text is HTML-escaped");
+    TEST_ASSERT(compiled_renders_to("<p>{{&v}}</p>", markup, "<p><b a='1'>&\"</p>"),
+                "Raw variables are not escaped");
+    TEST_ASSERT(compiled_renders_to("<a title=\"{{v}}\">", markup, "<a title=\"&lt;b a&#61;&#39;1&#39;&gt;&amp;&quot;\">"),
+                "Attribute values are escaped");
+    TEST_ASSERT(compiled_renders_to("<a href=\"{{u}}\">", "{\"u\": \"javascript:alert(1)\"}", "<a href=\"#\">"),
+                "javascript: URL replaced");
+    TEST_ASSERT(compiled_renders_to("<a href=\" {{u}}\">", "{\"u\": \"javascript:alert(1)\"}", "<a href=\" #\">"),
+                "javascript: URL after leading space replaced");
+    TEST_ASSERT(compiled_renders_to("<a href=\"{{a}}{{u}}\">", "{\"a\": \"\", \"u\": \"javascript:alert(1)\"}",
+                                    "<a href=\"#\">"), "javascript: URL after an empty value replaced");
+    TEST_ASSERT(compiled_renders_to("<a href=\"/{{p}}\">", "{\"p\": \"a:b\"}", "<a href=\"/a:b\">"),
+                "Values after the scheme are not scheme-checked");
+    TEST_ASSERT(compiled_renders_to("<a href=\"/s?q={{q}}\">", "{\"q\": \"a b&c\"}", "<a href=\"/s?q=a%20b%26c\">"),
+                "Query values are percent-encoded");
+    
+    // JavaScript: inside a string the value is escaped, in code it becomes a string
+    const char* payload = "{\"id\": \"1);alert(document.cookie);(\"}";
+    TEST_ASSERT(compiled_renders_to("<script>var id = {{id}};</script>", payload,
+                           "<script>var id = \"1);alert(document.cookie);(\";</script>"),
+                "Script value in code is quoted");
+    TEST_ASSERT(compiled_renders_to("<button onclick=\"load({{id}})\">", payload,
+                           "<button onclick=\"load(&#34;1);alert(document.cookie);(&#34;)\">"),
+                "Event handler value in code is quoted");
+    TEST_ASSERT(compiled_renders_to("<script>var id = {{id}};</script>", "{}",
+                           "<script>var id = \"\";</script>"),
+                "Missing script value renders an empty string");
+    
+    char* output = render_source("<script>var s = '{{v}}';</script>", "{\"v\": \"'</script><x>\"}");
+    TEST_ASSERT(output && !strstr(output, "</script><x>") && !strstr(output, "''"),
+                "Script string value cannot close the string or the element");
+    free(output);
+    
+    output = render_source("<script>if (a) /x{{v}}/.test(b);</script>", "{\"v\": \"/;alert(1)//\"}");
+    TEST_ASSERT(output && !strstr(output, "/;alert"), "Regex literal value is escaped");
+    free(output);
+    
+    output = render_source("<script>var s = \"a\\\"\" + {{v}};</script>", "{\"v\": \"x\"}");
+    TEST_ASSERT(output && strstr(output, "+ \"x\";") != NULL, "Escaped quote does not end the string");
+    free(output);
+    
+    output = render_source("<script>// {{v}}\nvar x = {{v}};</script>", "{\"v\": \"1\"}");
+    TEST_ASSERT(output && strstr(output, "var x = \"1\";") != NULL, "Line comment ends at newline");
+    free(output);
+    
+    TEST_ASSERT(torchlight_compile_template("<script>`${x}{{v}}`</script>", 28) == NULL,
+                "Variable in template literal fails to compile");
+    
+    // Only '<' followed by a name, '/', '!' or '?' starts a tag
+    TEST_ASSERT(compiled_renders_to("1 < 2 <script>var x = {{v}};</script>", "{\"v\": \"alert(1)\"}",
+                                    "1 < 2 <script>var x = \"alert(1)\";</script>"),
+                "Bare '<' in text does not hide the next script");
+    
+    // Raw text elements: markup inside is text up to the matching end tag
+    TEST_ASSERT(compiled_renders_to("<textarea>{{v}}</textarea>", "{\"v\": \"</textarea><script>\"}",
+                                    "<textarea>&lt;/textarea&gt;&lt;script&gt;</textarea>"),
+                "Textarea value is HTML-escaped");
+    TEST_ASSERT(compiled_renders_to("<title><a href=\"{{u}}\"></TITLE><a href=\"{{u}}\">",
+                                    "{\"u\": \"javascript:alert(1)\"}",
+                                    "<title><a href=\"javascript:alert(1)\"></TITLE><a href=\"#\">"),
+                "Title content is text, not tags");
+    TEST_ASSERT(torchlight_compile_template("<style>p { color: {{c}} }</style>", 33) == NULL,
+                "Variable in a style element fails to compile");
+    TEST_ASSERT(compiled_renders_to("<style>p::before { content: \"<p>\" }</style ><p>{{v}}</p>",
+                                    "{\"v\": \"<\"}",
+                                    "<style>p::before { content: \"<p>\" }</style ><p>&lt;</p>"),
+                "Style element ends at its end tag");
+    
+    // Direct escaper
+    char buffer[64];
+    size_t needed = torchlight_escape(TORCHLIGHT_ESCAPE_JS_VALUE, "a\"b", 3, buffer, sizeof(buffer));
+    TEST_ASSERT(needed == strlen(buffer) && buffer[0] == '"' && buffer[needed - 1] == '"' &&
+                strchr(buffer + 1, '"') == buffer + needed - 1,
+                "JS value escape is a single quoted string");
+    needed = torchlight_escape(TORCHLIGHT_ESCAPE_HTML, "<<<<", 4, buffer, 8);
+    TEST_ASSERT(needed == 16 && strlen(buffer) < 8 && buffer[strlen(buffer) - 1] == ';',
+                "Truncated escape reports full length without a partial sequence");
+    
+    printf("   Context escaping working correctly\n");
+}
+
+// Test serving embedded static assets
+static void static_request(http_request_t* request, http_method_t method, const char* path,
+                           const char* accept_encoding, const char* if_none_match) {
+    memset(request, 0, sizeof(*request));
+    request->method = method;
+    snprintf(request->path, sizeof(request->path), "%s", path);
+    if (accept_encoding) {
+        strcpy(request->headers[request->header_count].name, "Accept-Encoding");
+        snprintf(request->headers[request->header_count++].value, sizeof(request->headers[0].value),
+                 "%s", accept_encoding);
+    }
+    if (if_none_match) {
+        strcpy(request->headers[request->header_count].name, "If-None-Match");
+        snprintf(request->headers[request->header_count++].value, sizeof(request->headers[0].value),
+                 "%s", if_none_match);
+    }
+}
+
+static const char* response_header(const http_response_t* response, const char* name) {
+    for (int i = 0; i < response->header_count; i++) {
+        if (strcasecmp(response->headers[i].name, name) == 0) return response->headers[i].value;
+    }
+    return NULL;
+}
+
+static void test_embedded_assets(void) {
+    printf("\n📦 Testing Embedded Assets...\n");
+    
+    // A one-asset bundle: every key lands in slot 0 and strcmp decides
+    static const unsigned char css[] = "body{color:red}";
+    static const unsigned char css_gzip[] = "gzipped";
+    static const torchlight_embedded_asset_t assets[] = {
+        { "/site.css", css, sizeof(css) - 1, css_gzip, sizeof(css_gzip) - 1, "\"5e7f\"", CONTENT_TYPE_TEXT_CSS,
+          NULL, 0, NULL, 0, 0 }
+    };
+    static const uint32_t displacements[] = { 0 };
+    static const uint32_t slots[] = { 0 };
+    static const torchlight_embedded_bundle_t bundle = { assets, 1, displacements, 1, slots, 1 };
+    TEST_ASSERT(torchlight_register_embedded_assets(&bundle) == 0, "Register bundle");
+    TEST_ASSERT(torchlight_find_embedded_asset("/site.css") == &assets[0] &&
+                torchlight_find_embedded_asset("/other.css") == NULL, "Find asset by path");
+    
+    http_request_t request;
+    http_response_t response = {0};
+    static_request(&request, HTTP_METHOD_GET, "/site.css", NULL, NULL);
+    TEST_ASSERT(torchlight_serve_static(&request, &response) == 0 && response.status == HTTP_STATUS_OK &&
+                response.body_iov && response.body_iov[0].iov_base == (void*)css, "Identity body served in place");
+    TEST_ASSERT(strcmp(response_header(&response, "ETag"), "\"5e7f\"") == 0 &&
+                response_header(&response, "Content-Encoding") == NULL &&
+                response_header(&response, "Vary") != NULL, "Identity ETag");
+    torchlight_release_response(&response);
+    
+    // The gzip variant is another representation with its own validator
+    response = (http_response_t){0};
+    static_request(&request, HTTP_METHOD_GET, "/site.css", "br, gzip;q=0.8", NULL);
+    TEST_ASSERT(torchlight_serve_static(&request, &response) == 0 &&
+                response.body_length == sizeof(css_gzip) - 1 &&
+                strcmp(response_header(&response, "Content-Encoding"), "gzip") == 0, "Gzip variant negotiated");
+    TEST_ASSERT(strcmp(response_header(&response, "ETag"), "\"5e7f-gz\"") == 0, "Gzip variant has a distinct ETag");
+    torchlight_release_response(&response);
+    
+    response = (http_response_t){0};
+    static_request(&request, HTTP_METHOD_GET, "/site.css", "gzip;q=0", NULL);
+    TEST_ASSERT(torchlight_serve_static(&request, &response) == 0 &&
+                response_header(&response, "Content-Encoding") == NULL, "gzip;q=0 gets the identity body");
+    torchlight_release_response(&response);
+    
+    // An explicit gzip entry overrides the wildcard
+    const char* encodings[][2] = {
+        { "gzip;q=0, *", NULL }, { "*, gzip;q=0", NULL }, { "*", "gzip" }, { "*;q=0, gzip", "gzip" }
+    };
+    bool negotiated = true;
+    for (size_t i = 0; i < sizeof(encodings) / sizeof(encodings[0]); i++) {
+        response = (http_response_t){0};
+        static_request(&request, HTTP_METHOD_GET, "/site.css", encodings[i][0], NULL);
+        const char* encoding = torchlight_serve_static(&request, &response) == 0 ?
+                               response_header(&response, "Content-Encoding") : "failed";
+        negotiated &= encodings[i][1] ? encoding && strcmp(encoding, encodings[i][1]) == 0 : encoding == NULL;
+        torchlight_release_response(&response);
+    }
+    TEST_ASSERT(negotiated, "Explicit gzip preference overrides the wildcard");
+    
+    // Either validator shows the client has this version
+    const char* validators[][2] = {
+        { NULL, "\"5e7f\"" }, { "gzip", "\"5e7f-gz\"" }, { "gzip", "\"5e7f\"" }, { NULL, "W/\"5e7f-gz\"" }
+    };
+    bool revalidated = true;
+    for (size_t i = 0; i < sizeof(validators) / sizeof(validators[0]); i++) {
+        response = (http_response_t){0};
+        static_request(&request, HTTP_METHOD_GET, "/site.css", validators[i][0], validators[i][1]);
+        revalidated &= torchlight_serve_static(&request, &response) == 0 &&
+                       response.status == HTTP_STATUS_NOT_MODIFIED && response.body_length == 0;
+        torchlight_release_response(&response);
+    }
+    TEST_ASSERT(revalidated, "If-None-Match accepts either ETag");
+    
+    response = (http_response_t){0};
+    static_request(&request, HTTP_METHOD_GET, "/site.css", NULL, "\"other\"");
+    TEST_ASSERT(torchlight_serve_static(&request, &response) == 0 && response.status == HTTP_STATUS_OK,
+                "Stale ETag gets the body");
+    torchlight_release_response(&response);
+    
+    response = (http_response_t){0};
+    static_request(&request, HTTP_METHOD_HEAD, "/site.css", NULL, NULL);
+    TEST_ASSERT(torchlight_serve_static(&request, &response) == 0 && response.body_length == sizeof(css) - 1 &&
+                response.body_iov == NULL, "HEAD gets the length without a body");
+    
+    response = (http_response_t){0};
+    static_request(&request, HTTP_METHOD_GET, "/missing.css", NULL, NULL);
+    TEST_ASSERT(torchlight_serve_static(&request, &response) == -1 && response.header_count == 0,
+                "Unknown path left to the caller");
+    
+    printf("   Embedded assets working correctly\n");
+}
+
+// Test {{%cache}} fragment caching
+static void test_fragment_cache(void) {
+    printf("\n🧊 Testing Fragment Cache...\n");
+    
+    torchlight_invalidate_fragments(NULL);
+    const char* source = "{{%cache box 60}}<b>{{n}}</b>{{/cache}} {{n}}";
+    torchlight_template_t* tpl = torchlight_compile_template(source, strlen(source));
+    TEST_ASSERT(renders_to(tpl, "{\"n\": \"1\"}", "<b>1</b> 1"), "Block rendered on a miss");
+    TEST_ASSERT(renders_to(tpl, "{\"n\": \"2\"}", "<b>1</b> 2"), "Block served from the cache on a hit");
+    torchlight_invalidate_fragments("other");
+    TEST_ASSERT(renders_to(tpl, "{\"n\": \"3\"}", "<b>1</b> 3"), "Invalidating another name keeps it");
+    torchlight_invalidate_fragments("box");
+    TEST_ASSERT(renders_to(tpl, "{\"n\": \"4\"}", "<b>4</b> 4"), "Invalidated by name");
+    torchlight_release_template(tpl);
+    
+    // The variable's value is part of the key
+    source = "{{%cache user id 60}}{{name}}{{/cache}}";
+    tpl = torchlight_compile_template(source, strlen(source));
+    TEST_ASSERT(renders_to(tpl, "{\"id\": \"a\", \"name\": \"Ann\"}", "Ann") &&
+                renders_to(tpl, "{\"id\": \"b\", \"name\": \"Bo\"}", "Bo") &&
+                renders_to(tpl, "{\"id\": \"a\", \"name\": \"changed\"}", "Ann"), "Fragments keyed by variable");
+    
+    // A held fragment outlives its entry
+    torchlight_value_t values[2] = { { "b", 1 }, { "unused", 6 } };
+    http_response_t response = {0};
+    TEST_ASSERT(torchlight_render_iov(tpl, values, 2, &response, NULL, NULL) == 0, "Render cached block to iov");
+    torchlight_invalidate_fragments(NULL);
+    char joined[32] = "";
+    for (int i = 0; i < response.body_iov_count; i++) {
+        strncat(joined, response.body_iov[i].iov_base, response.body_iov[i].iov_len);
+    }
+    TEST_ASSERT(strcmp(joined, "Bo") == 0, "Spliced fragment survives invalidation");
+    torchlight_release_response(&response);
+    torchlight_release_template(tpl);
+    
+    // A name reused in another template or another context is another fragment
+    const char* payload = "{\"v\": \"alert(1)\"}";
+    TEST_ASSERT(compiled_renders_to("<p>{{%cache greeting 60}}{{v}}{{/cache}}</p>", payload,
+                                    "<p>alert(1)</p>") &&
+                compiled_renders_to("<script>var x = {{%cache greeting 60}}{{v}}{{/cache}};</script>", payload,
+                                    "<script>var x = \"alert(1)\";</script>"),
+                "Fragment rendered in text not reused in script");
+    TEST_ASSERT(compiled_renders_to("<i>{{%cache greeting 60}}{{v}}{{/cache}}</i>", "{\"v\": \"other\"}",
+                                    "<i>other</i>"), "Fragment not shared between templates");
+    torchlight_invalidate_fragments("greeting");
+    
+    source = "{{%cache live 0}}{{n}}{{/cache}}";
+    tpl = torchlight_compile_template(source, strlen(source));
+    TEST_ASSERT(renders_to(tpl, "{\"n\": \"1\"}", "1") && renders_to(tpl, "{\"n\": \"2\"}", "2"),
+                "Zero TTL is never cached");
+    torchlight_release_template(tpl);
+    
+    TEST_ASSERT(torchlight_compile_template("{{%cache box}}x{{/cache}}", 25) == NULL &&
+                torchlight_compile_template("{{%cache box 60}}x", 18) == NULL, "Malformed cache blocks rejected");
+    
+    printf("   Fragment cache working correctly\n");
+}
+
+// Test hot reload through the template watcher
+static bool loads_as(const char* path, const char* expected) {
+    torchlight_template_t* tpl = torchlight_load_template(path);
+    char* output = NULL;
+    bool match = tpl && torchlight_render_compiled(tpl, "{}", &output, NULL) == 0 && strcmp(output, expected) == 0;
+    free(output);
+    torchlight_release_template(tpl);
+    return match;
+}
+
+// The watcher polls every 250 ms
+static bool reloads_as(const char* path, const char* expected) {
+    for (int i = 0; i < 100; i++) {
+        if (expected ? loads_as(path, expected) : torchlight_load_template(path) == NULL) return true;
+        usleep(20000);
+    }
+    return false;
+}
+
+static void test_template_reload(void) {
+    printf("\n🔥 Testing Template Hot Reload...\n");
+    
+    char page[128], item[128], moved[128], sub[128], renamed[128], link[128];
+    char outside[] = "/tmp/torchlight-outside-XXXXXX";
+    int outside_fd = mkstemp(outside);
+    TEST_ASSERT(template_dir_create() && outside_fd >= 0 && write(outside_fd, "out1", 4) == 4,
+                "Create template tree");
+    close(outside_fd);
+    snprintf(sub, sizeof(sub), "%s/sub", g_template_dir);
+    snprintf(renamed, sizeof(renamed), "%s/renamed", g_template_dir);
+    snprintf(link, sizeof(link), "%s/link.html", g_template_dir);
+    TEST_ASSERT(mkdir(sub, 0700) == 0 && symlink(outside, link) == 0 &&
+                write_template(page, sizeof(page), "page.html", "v1") &&
+                write_template(item, sizeof(item), "sub/item.html", "item1"), "Write templates");
+    
+    torchlight_config_t config = {0};
+    config.enable_cache = true;
+    snprintf(config.template_directory, sizeof(config.template_directory), "%s", g_template_dir);
+    restart_server(&config);
+    
+    TEST_ASSERT(loads_as(page, "v1"), "Watched template cached");
+    TEST_ASSERT(write_template(page, sizeof(page), "page.html", "v2") && reloads_as(page, "v2"),
+                "Rewritten template reloaded");
+    
+    // Events from a renamed directory must name its new path
+    TEST_ASSERT(rename(sub, renamed) == 0, "Rename watched directory");
+    snprintf(moved, sizeof(moved), "%s/renamed/item.html", g_template_dir);
+    TEST_ASSERT(reloads_as(moved, "item1"), "Template under the new name loads");
+    TEST_ASSERT(write_template(moved, sizeof(moved), "renamed/item.html", "item2") && reloads_as(moved, "item2"),
+                "Change under a renamed directory reloaded");
+    
+    // inotify never reports a change to the link's target
+    TEST_ASSERT(loads_as(link, "out1"), "Symlinked template loads");
+    FILE* file = fopen(outside, "wb");
+    TEST_ASSERT(file && fputs("out-2", file) >= 0 && fclose(file) == 0, "Rewrite symlink target");
+    TEST_ASSERT(loads_as(link, "out-2"), "Symlinked template checked with stat()");
+    
+    TEST_ASSERT(unlink(page) == 0 && reloads_as(page, NULL), "Removed template dropped");
+    
+    torchlight_config_t defaults = {0};
+    restart_server(&defaults);
+    unlink(moved);
+    unlink(link);
+    unlink(outside);
+    rmdir(renamed);
+    rmdir(g_template_dir);
+    printf("   Template hot reload working correctly\n");
+}
+
+// Test pooled buffers and size estimates
+static size_t g_first_capacity = 0;
+
+static int chunked_handler(const http_request_t* request, http_response_t* response) {
+    (void)request;
+    char chunk[100];
+    memset(chunk, 'c', sizeof(chunk));
+    
+    response->status = HTTP_STATUS_OK;
+    torchlight_response_append(response, chunk, sizeof(chunk));
+    g_first_capacity = response->body_capacity;
+    for (int i = 1; i < 30; i++) torchlight_response_append(response, chunk, sizeof(chunk));
+    return 0;
+}
+
+static void test_buffer_pool(void) {
+    printf("\n♻️  Testing Buffer Pool...\n");
+    
+    size_t capacity = 0;
+    char* buffer = torchlight_buffer_alloc(10, &capacity);
+    TEST_ASSERT(buffer && capacity == 256, "Smallest class is 256 bytes");
+    torchlight_buffer_free(buffer, capacity);
+    
+    buffer = torchlight_buffer_alloc(300, &capacity);
+    TEST_ASSERT(buffer && capacity == 512, "Sizes round up to a power of two");
+    memcpy(buffer, "kept", 5);
+    char* grown = torchlight_buffer_grow(buffer, &capacity, 1500);
+    TEST_ASSERT(grown && capacity == 2048 && strcmp(grown, "kept") == 0, "Grow keeps the contents");
+    torchlight_buffer_free(grown, capacity);
+    size_t reused_capacity = 0;
+    char* reused = torchlight_buffer_alloc(1100, &reused_capacity);
+    TEST_ASSERT(reused == grown && reused_capacity == 2048, "Freed buffer reused by the same class");
+    free(reused);  // Plain malloc blocks
+    
+    torchlight_size_estimate_t estimate = {0};
+    TEST_ASSERT(torchlight_size_estimate_reserve(&estimate) == 0, "No history reserves nothing");
+    for (int i = 0; i < 50; i++) torchlight_size_estimate_record(&estimate, i % 2 ? 900 : 1100);
+    size_t reserve = torchlight_size_estimate_reserve(&estimate);
+    TEST_ASSERT(reserve >= 1100 && reserve < 2000, "Reserve covers a steady source");
+    
+    // Appends are presized from the route's recent bodies
+    torchlight_config_t config = {0};
+    restart_server(&config);
+    torchlight_add_route(HTTP_METHOD_GET, "/chunked", chunked_handler, "Chunked");
+    TEST_ASSERT(reply_status(serve_request("GET /chunked HTTP/1.1\r\n\r\n", NULL)) == 200 &&
+                g_first_capacity < 3000, "First response grows as it goes");
+    TEST_ASSERT(reply_status(serve_request("GET /chunked HTTP/1.1\r\n\r\n", NULL)) == 200 &&
+                g_first_capacity >= 3001, "Later responses reserve their usual size up front");
+    
+    printf("   Buffer pool working correctly\n");
+}
+
+// Test that CSRF is only enforced on requests that reach a route
+static void test_csrf_routing(void) {
+    printf("\n🧭 Testing CSRF Routing...\n");
+    
+    torchlight_config_t config = {0};
+    config.enable_csrf_protection = true;
+    restart_server(&config);
+    torchlight_add_route(HTTP_METHOD_POST, "/form", gated_handler, "Form");
+    
+    TEST_ASSERT(reply_status(serve_request("POST /nowhere HTTP/1.1\r\nContent-Length: 0\r\n\r\n", NULL)) == 404,
+                "Unmatched path is a 404 without a token");
+    TEST_ASSERT(reply_status(serve_request("POST /form HTTP/1.1\r\nContent-Length: 0\r\n\r\n", NULL)) == 403,
+                "Matched route without a token refused");
+    TEST_ASSERT(reply_status(serve_request("POST /form HTTP/1.1\r\nCookie: csrf_token=abc\r\n"
+                                           "X-CSRF-Token: abc\r\nContent-Length: 0\r\n\r\n", NULL)) == 200,
+                "Matched route with a token served");
+    
+    torchlight_config_t defaults = {0};
+    restart_server(&defaults);
+    printf("   CSRF routing working correctly\n");
+}
+
+int main() {
+    printf("🚀 TorchLight Dynamic HTTP Server Test Suite\n");
+    printf("================================================\n");
+    
+    // Run all tests
+    test_initialization();
+    test_routing();
+    test_request_parsing();
+    test_response_generation();
+    test_json_api();
+    test_template_engine();
+    test_utilities();
+    test_route_finding();
+    test_default_routes();
+    test_json_parser();
+    test_random();
+    test_csrf();
+    test_sessions();
+    test_session_expiry();
+    test_session_leases();
+    test_session_store();
+    test_cookie_sessions();
+    test_rate_limiting();
+    test_proxy_protocol();
+    test_scheduler();
+    test_load_shedding();
+    test_bulkheads();
+    test_slow_clients();
+    test_template_cache();
+    test_template_slots();
+    test_template_iov();
+    test_template_sections();
+    test_context_escaping();
+    test_embedded_assets();
+    test_fragment_cache();
+    test_template_reload();
+    test_buffer_pool();
+    test_csrf_routing();
+    
+    // Final cleanup
+    printf("\n🧹 Cleaning up...\n");
+    torchlight_shutdown();
+    printf("✅ TorchLight shutdown complete\n");
+    
+    // Summary
+    printf("\n📊 Test Results Summary:\n");
+    printf("   Tests Run: %d\n", tests_run);
+    printf("   Tests Passed: %d\n", tests_passed);
+    printf("   Success Rate: %.1f%%\n", (float)tests_passed / tests_run * 100);
+    
+    if (tests_passed == tests_run) {
+        printf("\n🎉 All TorchLight tests passed!\n");
+        printf("✅ TorchLight is ready for production use\n");
+    } else {
+        printf("\n⚠️  Some tests failed - check implementation\n");
+    }
+    
+    printf("\n💡 TorchLight Features Verified:\n");
+    printf("   🔥 HTTP/1.1 server initialization\n");
+    printf("   🗭 Flexible routing system\n");
+    printf("   📋 Request parsing and validation\n");
+    printf("   📤 Response generation (HTML, JSON, errors)\n");
+    printf("   📊 JSON API framework\n");
+    printf("   🎨 Template engine with variable substitution\n");
+    printf("   🔧 Utility functions and content type detection\n");
+    printf("   🔍 Route finding and parameter extraction\n");
+    printf("   🏠 Default API endpoints (status, stats)\n");
+    printf("   🧾 Strict JSON parsing and navigation\n");
+    printf("   🎲 Pooled random bytes, IDs and tokens (fork-safe)\n");
+    printf("   🔐 CSRF tokens (session-bound and double-submit)\n");
+    printf("   🗝️  Session table and attributes\n");
+    printf("   ⏳ Session expiry on a timing wheel\n");
+    printf("   🔖 Leases that outlive destroy and expiry\n");
+    printf("   💾 Persistent mmap session store\n");
+    printf("   🍪 Signed and encrypted cookie sessions\n");
+    printf("   🚦 GCRA rate limiting\n");
+    printf("   🧅 PROXY protocol v1/v2\n");
+    printf("   ⚖️  Fair scheduling across clients\n");
+    printf("   🪫 Adaptive load shedding\n");
+    printf("   🚧 Route bulkheads and deadlines\n");
+    printf("   🐌 Slow-client eviction under a header-phase cap\n");
+    printf("   🗃️  Compiled template cache with mtime invalidation\n");
+    printf("   🎰 Slot-bound rendering without JSON\n");
+    printf("   🧩 Scatter/gather rendering into writev\n");
+    printf("   🔁 Sections, partials and dotted paths\n");
+    printf("   🛡️  Context-aware escaping\n");
+    printf("   📦 Embedded static assets with per-encoding ETags\n");
+    printf("   🧊 Fragment caching\n");
+    printf("   🔥 Template hot reload through inotify\n");
+    printf("   ♻️  Pooled buffers presized from recent output\n");
+    printf("   🧭 CSRF checked only on matched routes\n");
+    
+    printf("\n🚀 Ready to illuminate the web through Tor!\n");
+    
+    return (tests_passed == tests_run) ? 0 : 1;
+}
\ No newline at end of file
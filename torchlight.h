@@ -32,6 +32,7 @@
 #include <stdint.h>
 #include <stdbool.h>
 #include <time.h>
+#include <sys/uio.h>
 
 #ifdef __cplusplus
 extern "C" {
@@ -44,7 +45,6 @@ extern "C" {
 #define TORCHLIGHT_VERSION "1.0.0"
 #define TORCHLIGHT_MAX_ROUTES 256
 #define TORCHLIGHT_MAX_HEADERS 32
-#define TORCHLIGHT_MAX_SESSIONS 1024
 #define TORCHLIGHT_BUFFER_SIZE 16384
 #define TORCHLIGHT_MAX_REQUEST_SIZE (10 * 1024 * 1024)  // 10MB
 #define TORCHLIGHT_SESSION_TIMEOUT 3600  // 1 hour
@@ -78,6 +78,7 @@ typedef enum {
     HTTP_STATUS_NOT_FOUND = 404,
     HTTP_STATUS_METHOD_NOT_ALLOWED = 405,
     HTTP_STATUS_CONFLICT = 409,
+    HTTP_STATUS_TOO_MANY_REQUESTS = 429,
     HTTP_STATUS_INTERNAL_SERVER_ERROR = 500,
     HTTP_STATUS_NOT_IMPLEMENTED = 501,
     HTTP_STATUS_SERVICE_UNAVAILABLE = 503
@@ -105,6 +106,9 @@ typedef struct {
     char value[512];
 } http_header_t;
 
+// Parsed JSON document (opaque, see torchlight_json_parse)
+typedef struct torchlight_json torchlight_json_t;
+
 // HTTP Request
 typedef struct {
     http_method_t method;
@@ -117,6 +121,7 @@ typedef struct {
     
     char* body;
     size_t body_length;
+    torchlight_json_t* json;    // Parsed body (torchlight_request_json), freed with the request
     
     // Parsed query parameters
     char query_params[32][2][256];  // [param][name/value][string]
@@ -128,6 +133,11 @@ typedef struct {
     
     // Connection info
     int socket_fd;
+    char client_id[64];         // Peer address or "circuit:<id>", used as the rate limit key
+    uint32_t circuit_id;        // Tor circuit, from a PROXY protocol header
+    bool has_circuit_id;
+    uint64_t admitted_us;       // Monotonic admission time (load shedding)
+    uint64_t deadline_us;       // Monotonic handler deadline (0 = none)
     time_t received_time;
 } http_request_t;
 
@@ -141,6 +151,14 @@ typedef struct {
     
     char* body;
     size_t body_length;
+    size_t body_capacity;       // body is a pool buffer of this size (0 = plain malloc)
+    
+    // Scatter/gather body, sent with one sendmsg() instead of `body`;
+    // body_length is the total. body_release runs once the response is done.
+    struct iovec* body_iov;
+    int body_iov_count;
+    void (*body_release)(void* context);
+    void* body_release_context;
     
     bool keep_alive;
     bool chunked_encoding;
@@ -149,6 +167,13 @@ typedef struct {
 // Route Handler Function Type
 typedef int (*route_handler_func_t)(const http_request_t* request, http_response_t* response);
 
+// Moving estimate of an output size: mean and mean deviation of recent
+// samples, smoothed the way TCP smooths round-trip times
+typedef struct {
+    size_t mean;
+    size_t deviation;
+} torchlight_size_estimate_t;
+
 // Route Definition
 typedef struct {
     http_method_t method;
@@ -157,6 +182,10 @@ typedef struct {
     const char* description;
     bool requires_auth;
     char* allowed_origins;       // CORS support
+    
+    // Bulkhead: see torchlight_set_route_limits()
+    int max_in_flight;           // 0 = unlimited
+    int deadline_ms;             // Handler budget (0 = none)
 } route_t;
 
 // Session Data
@@ -165,7 +194,9 @@ typedef struct {
     char user_id[64];
     time_t created_time;
     time_t last_access_time;
-    char data[1024];            // JSON string for session data
+    char data[1024];            // Attribute arena, see torchlight_session_set_*()
+    uint16_t data_length;       // Bytes of the arena in use
+    uint32_t dirty_fields;      // One bit per attribute changed since load
     bool authenticated;
 } session_t;
 
@@ -176,6 +207,8 @@ typedef struct {
     char static_directory[512];
     
     bool enable_sessions;
+    char session_store_path[512];   // Optional mmap-backed persistent sessions
+    int session_store_slots;        // Slot count for a new store (0 = default)
     bool enable_websockets;
     bool enable_cors;
     bool enable_gzip;
@@ -184,11 +217,31 @@ typedef struct {
     int max_connections;
     int timeout_seconds;
     
+    // Handler threads fed by the fair scheduler (0 = handle inline)
+    int handler_threads;
+    int max_queued_per_client;
+    
+    // Adaptive in-flight limit; excess requests get an immediate 503
+    // (max_connections caps the limit)
+    bool enable_load_shedding;
+    
+    // Slow-client protection: minimum bytes/s while reading headers and
+    // body (checked after a 2 s grace period), and a cap on connections
+    // still sending headers (the slowest past the grace period is evicted,
+    // otherwise the new connection gets a 503). 0 disables each.
+    int min_header_rate_bps;
+    int min_body_rate_bps;
+    int max_header_phase_connections;
+    
     // Security settings
     bool enable_csrf_protection;
     bool enable_rate_limiting;
     int rate_limit_requests_per_minute;
     
+    // Require a PROXY protocol v1/v2 header on every connection (for Tor
+    // onion services with HiddenServiceExportCircuitID haproxy)
+    bool accept_proxy_protocol;
+    
     // Custom error pages
     char error_404_page[256];
     char error_500_page[256];
@@ -202,8 +255,7 @@ typedef struct {
     route_t routes[TORCHLIGHT_MAX_ROUTES];
     int route_count;
     
-    session_t sessions[TORCHLIGHT_MAX_SESSIONS];
-    int session_count;
+    int session_count;          // Snapshot of the session store size
     
     // Statistics
     uint64_t requests_served;
@@ -228,7 +280,9 @@ int torchlight_init(const torchlight_config_t* config);
 // Start serving HTTP requests (non-blocking)
 int torchlight_start(void);
 
-// Process a single HTTP request
+// Process a single HTTP request. Returns 1 if the request was queued for a
+// handler thread, which then owns (and closes) socket_fd; otherwise the
+// caller still owns it.
 int torchlight_handle_request(int socket_fd);
 
 // Stop the server gracefully
@@ -240,6 +294,9 @@ void torchlight_shutdown(void);
 // Get server statistics
 void torchlight_get_stats(torchlight_server_t* stats_out);
 
+// Register the built-in index, /api/status and /api/stats routes
+int torchlight_register_default_routes(void);
+
 // ============================================================================
 // Routing API
 // ============================================================================
@@ -257,6 +314,16 @@ int torchlight_remove_route(http_method_t method, const char* path_pattern);
 // Find matching route for request
 const route_t* torchlight_find_route(const http_request_t* request);
 
+// Isolate a route: at most max_in_flight concurrent handlers (excess
+// requests get an immediate 503), and a deadline after which
+// torchlight_request_cancelled() reports true. 0 disables each.
+int torchlight_set_route_limits(http_method_t method, const char* path_pattern,
+                                int max_in_flight, int deadline_ms);
+
+// True once the request has passed its route deadline; long-running
+// handlers should poll this and give up
+bool torchlight_request_cancelled(const http_request_t* request);
+
 // ============================================================================
 // Request/Response Utilities
 // ============================================================================
@@ -267,6 +334,13 @@ int torchlight_parse_request(int socket_fd, http_request_t* request);
 // Send HTTP response to socket
 int torchlight_send_response(int socket_fd, const http_response_t* response);
 
+// Free the response body (malloc'd, pooled or scatter/gather) and reset it
+void torchlight_release_response(http_response_t* response);
+
+// Append to the body, which is started in a pool buffer sized from the
+// route's recent responses
+int torchlight_response_append(http_response_t* response, const char* data, size_t length);
+
 // Create response with JSON content
 int torchlight_response_json(http_response_t* response, const char* json_data);
 
@@ -283,6 +357,12 @@ int torchlight_response_error(http_response_t* response, http_status_t status, c
 // Header and Parameter Utilities
 // ============================================================================
 
+// Expect a PROXY protocol header before each request (set from config)
+void torchlight_set_proxy_protocol(bool enabled);
+
+// Read-rate floors and header-phase cap for incoming requests (set from config)
+void torchlight_set_slow_client_limits(int min_header_bps, int min_body_bps, int max_header_connections);
+
 // Get header value from request
 const char* torchlight_get_header(const http_request_t* request, const char* name);
 
@@ -303,30 +383,245 @@ int torchlight_get_path_param(const http_request_t* request, const route_t* rout
 // Create new session
 int torchlight_create_session(const char* user_id, char* session_id_out);
 
-// Get session by ID
+// Get session by ID (unleased: the pointer is only valid until the session
+// is destroyed or expires; prefer torchlight_acquire_session()). With a
+// persistent session store this returns a per-thread copy that the next
+// call overwrites; treat it as read-only, since writes to it are lost.
+// Use torchlight_acquire_session() to change a session.
 session_t* torchlight_get_session(const char* session_id);
 
-// Update session data
+// Lease a session by ID; the session stays valid until released
+session_t* torchlight_acquire_session(const char* session_id);
+
+// Return a lease obtained from torchlight_acquire_session(); -1 if the
+// lease's changes could not be merged back into a persistent session
+int torchlight_release_session(session_t* session);
+
+// Update session data (stored as the "data" string attribute)
 int torchlight_update_session(const char* session_id, const char* data);
 
 // Destroy session
 int torchlight_destroy_session(const char* session_id);
 
-// Cleanup expired sessions
+// Cleanup expired sessions (cost scales with the number that expired)
 int torchlight_cleanup_sessions(void);
 
+// Run torchlight_cleanup_sessions() once a second on a background thread
+int torchlight_start_session_reaper(void);
+void torchlight_stop_session_reaper(void);
+
+// Number of live sessions in the store
+int torchlight_session_count(void);
+
+// Typed session attributes, packed into session->data. Setters update in
+// place under a per-session lock and mark the attribute dirty. Getters copy
+// the value into the caller's buffer under the same lock and return its
+// full length (strings without the NUL), or -1 if the attribute is missing
+// or of another type; a result >= buffer_size means the copy was truncated
+// (strings are always terminated). With a persistent store, releasing a
+// lease merges only the attributes it changed into the stored session.
+int torchlight_session_set_string(session_t* session, const char* key, const char* value);
+int torchlight_session_set_int(session_t* session, const char* key, int64_t value);
+int torchlight_session_set_blob(session_t* session, const char* key, const void* value, size_t length);
+int torchlight_session_get_string(const session_t* session, const char* key, char* buffer, size_t buffer_size);
+int torchlight_session_get_int(const session_t* session, const char* key, int64_t* value_out);
+int torchlight_session_get_blob(const session_t* session, const char* key, void* buffer, size_t buffer_size);
+int torchlight_session_remove_attr(session_t* session, const char* key);
+
+// Set in dirty_fields after editing user_id/authenticated on a leased
+// persistent-store session so the change is written back on release
+#define TORCHLIGHT_SESSION_DIRTY_CORE (1u << 31)
+
+// Keep sessions in a memory-mapped file that survives restarts and is
+// shared by every process that opens it (e.g. prefork workers). Writes
+// survive a process crash; a host crash may lose those not yet flushed.
+int torchlight_open_session_store(const char* path, size_t slot_count);
+void torchlight_close_session_store(void);
+
+// ============================================================================
+// Cookie Sessions
+// ============================================================================
+
+// Install a signing key (secret of at least 16 bytes); the newest key signs
+// new cookies while earlier keys keep verifying until retired
+int torchlight_set_session_cookie_key(uint8_t key_id, const unsigned char* secret, size_t secret_len);
+int torchlight_retire_session_cookie_key(uint8_t key_id);
+
+// Serialize a session into an authenticated (optionally encrypted) cookie
+// value; returns the encoded length or -1 if the session does not fit
+int torchlight_encode_session_cookie(const session_t* session, bool encrypt,
+                                     char* cookie_out, size_t cookie_size);
+
+// Verify a cookie value and restore the session it carries
+int torchlight_decode_session_cookie(const char* cookie, size_t cookie_length, session_t* session_out);
+
+// Read the session cookie from a request / attach it to a response
+int torchlight_load_cookie_session(const http_request_t* request, session_t* session_out);
+int torchlight_store_cookie_session(http_response_t* response, const session_t* session, bool encrypt);
+
 // ============================================================================
 // Template Engine
 // ============================================================================
 
-// Render template with variables
+// Output contexts for escaping
+typedef enum {
+    TORCHLIGHT_ESCAPE_NONE = 0,         // Raw output
+    TORCHLIGHT_ESCAPE_HTML,             // Element text
+    TORCHLIGHT_ESCAPE_ATTRIBUTE,        // Attribute value
+    TORCHLIGHT_ESCAPE_URL,              // Part of a URL query (percent-encoded)
+    TORCHLIGHT_ESCAPE_URL_ATTRIBUTE,    // href/src URL before its scheme: scheme checked, then attribute-escaped
+    TORCHLIGHT_ESCAPE_JS,               // Inside a JavaScript string, regex or comment
+    TORCHLIGHT_ESCAPE_JS_VALUE,         // JavaScript code: emitted as a quoted, escaped string
+    TORCHLIGHT_ESCAPE_JS_VALUE_ATTRIBUTE // The same in an on* attribute (quotes as &#34;)
+} torchlight_escape_t;
+
+// Compiled template (opaque, reference counted)
+typedef struct torchlight_template torchlight_template_t;
+
+// Render template with variables (compiled once and cached by path when
+// config.enable_cache is set)
 int torchlight_render_template(const char* template_path, const char* variables_json, 
                               char** output, size_t* output_size);
 
+// Templates support {{name}} and dotted {{a.b.c}} variables, sections
+// {{#list}}...{{/list}} (repeated per element, or once for a truthy value),
+// inverted sections {{^name}}...{{/name}}, partials {{>file}},
+// comments {{! ... }} and cached fragments
+// {{%cache name [variable] ttl}}...{{/cache}}.
+
+// Compile a template from memory; free with torchlight_release_template()
+torchlight_template_t* torchlight_compile_template(const char* source, size_t length);
+
+// Load a template file through the cache (recompiled when its mtime changes)
+torchlight_template_t* torchlight_load_template(const char* path);
+
+// Drop a reference from compile/load
+void torchlight_release_template(torchlight_template_t* tpl);
+
+// Render a compiled template; output is malloc'd and NUL-terminated
+int torchlight_render_compiled(const torchlight_template_t* tpl, const char* variables_json,
+                               char** output, size_t* output_size);
+
+// Value bound to a template slot; it is not copied, and a NULL ptr renders
+// as an empty string
+typedef struct {
+    const char* ptr;
+    size_t len;
+} torchlight_value_t;
+
+// Supplies the value for one slot; return -1 to abort the render
+typedef int (*torchlight_slot_fill_t)(void* context, size_t slot, const char* name,
+                                      torchlight_value_t* value);
+
+// Slots are the template's distinct variable names, in order of first use
+int torchlight_template_slot(const torchlight_template_t* tpl, const char* name);
+size_t torchlight_template_slot_count(const torchlight_template_t* tpl);
+const char* torchlight_template_slot_name(const torchlight_template_t* tpl, size_t slot);
+
+// Render from values indexed by slot, without any JSON, in one pass into a
+// buffer presized from the template's recent output
+int torchlight_render_slots(const torchlight_template_t* tpl, const torchlight_value_t* values,
+                            size_t value_count, char** output, size_t* output_size);
+int torchlight_render_fill(const torchlight_template_t* tpl, torchlight_slot_fill_t fill,
+                           void* context, char** output, size_t* output_size);
+
+// Render into response->body, in a pool buffer presized from the
+// template's recent output; status and content type are left to the caller
+int torchlight_render_response(const torchlight_template_t* tpl, const char* variables_json,
+                               http_response_t* response);
+
+// Render into response->body_iov without building the page: literal spans
+// point into the compiled template (held until the response is released)
+// and value spans point at the caller's data, which must stay valid until
+// then; `release(context)` runs at that point. On failure nothing is
+// attached and release is not called. Status and content type are left to
+// the caller.
+int torchlight_render_iov(const torchlight_template_t* tpl, const torchlight_value_t* values,
+                          size_t value_count, http_response_t* response,
+                          void (*release)(void* context), void* context);
+
+// Same, from a template file and variables JSON (the JSON is copied)
+int torchlight_render_template_iov(const char* template_path, const char* variables_json,
+                                   http_response_t* response);
+
+// Enable or disable the template cache (set from config.enable_cache)
+void torchlight_set_template_cache(bool enabled);
+
+// Directory that {{>partial}} names are relative to (set from
+// config.template_directory)
+void torchlight_set_template_directory(const char* directory);
+void torchlight_clear_template_cache(void);
+
+// Drop cached {{%cache}} fragments called `name` (all of them if NULL)
+void torchlight_invalidate_fragments(const char* name);
+
 // Simple variable substitution
 int torchlight_substitute_variables(const char* template_str, const char* variables_json,
                                    char** output, size_t* output_size);
 
+// ============================================================================
+// Embedded Assets
+// ============================================================================
+
+// Bundles are generated at build time by torchlight_embed (see the
+// torchlight_embed() CMake function). Templates are keyed by their path
+// under the template directory ("pages/index.html"), static assets by URL
+// path ("/css/site.css"). The layout below is what generated code fills in.
+
+// Precompiled template op (mirrors the engine's bytecode)
+typedef struct {
+    uint32_t type;
+    uint32_t offset;
+    uint32_t length;
+    uint32_t slot;
+    uint32_t jump;
+    uint32_t escape;
+} torchlight_embedded_op_t;
+
+typedef struct {
+    const char* path;
+    const unsigned char* data;
+    size_t length;
+    const unsigned char* gzip_data;         // NULL when compression does not pay
+    size_t gzip_length;
+    const char* etag;                       // Quoted, from SHA-256 of data
+    content_type_t content_type;
+
+    // Templates only
+    const torchlight_embedded_op_t* ops;
+    uint32_t op_count;
+    const char* const* slot_names;
+    uint32_t slot_count;
+    size_t literal_bytes;
+} torchlight_embedded_asset_t;
+
+// Perfect hash over asset paths: FNV-1a picks a bucket, the bucket's
+// displacement picks the slot, and one strcmp confirms the match.
+typedef struct {
+    const torchlight_embedded_asset_t* assets;
+    uint32_t asset_count;
+    const uint32_t* displacements;          // One per bucket
+    uint32_t bucket_count;
+    const uint32_t* slots;                  // Asset index, or UINT32_MAX
+    uint32_t slot_count;                    // Power of two
+} torchlight_embedded_bundle_t;
+
+// Register a generated bundle (safe while serving; bundles registered
+// later take precedence). torchlight_load_template() and partials then
+// resolve embedded templates without touching the filesystem.
+int torchlight_register_embedded_assets(const torchlight_embedded_bundle_t* bundle);
+
+// Find an embedded asset by key, or NULL
+const torchlight_embedded_asset_t* torchlight_find_embedded_asset(const char* path);
+
+// Serve the embedded static asset for request->path: 304 when
+// If-None-Match holds either variant's ETag, the gzip variant (ETag with
+// a "-gz" suffix) when the client accepts it. The body points at the
+// embedded data. Returns -1 (response untouched) if there
+// is no such asset. A HEAD request gets the headers and Content-Length
+// only.
+int torchlight_serve_static(const http_request_t* request, http_response_t* response);
+
 // ============================================================================
 // JSON API Helpers
 // ============================================================================
@@ -334,6 +629,55 @@ int torchlight_substitute_variables(const char* template_str, const char* variab
 // Parse JSON from request body
 int torchlight_parse_json(const http_request_t* request, char** json_out);
 
+// JSON value types; INVALID is a missing value (absent key, wrong type)
+typedef enum {
+    TORCHLIGHT_JSON_INVALID = 0,
+    TORCHLIGHT_JSON_NULL,
+    TORCHLIGHT_JSON_FALSE,
+    TORCHLIGHT_JSON_TRUE,
+    TORCHLIGHT_JSON_NUMBER,
+    TORCHLIGHT_JSON_STRING,
+    TORCHLIGHT_JSON_ARRAY,
+    TORCHLIGHT_JSON_OBJECT
+} torchlight_json_type_t;
+
+// A value in a parsed document; valid while the document is
+typedef struct {
+    const torchlight_json_t* doc;
+    uint32_t index;
+} torchlight_json_value_t;
+
+// Validating RFC 8259 parser (SIMD structural indexing, one allocation per
+// document). Returns NULL on invalid JSON, with the byte offset of the
+// error in error_offset if given. Free with torchlight_json_free().
+torchlight_json_t* torchlight_json_parse(const char* json, size_t length, size_t* error_offset);
+void torchlight_json_free(torchlight_json_t* doc);
+
+// The request body parsed once and kept until the request is done; NULL
+// if the body is missing, not application/json or invalid
+const torchlight_json_t* torchlight_request_json(const http_request_t* request);
+
+// Navigation: object member by name, array element by position, and
+// iteration (first/next walk array elements or object member values;
+// torchlight_json_key names the member). A missing value propagates, so
+// lookups can be chained and checked once.
+torchlight_json_value_t torchlight_json_root(const torchlight_json_t* doc);
+torchlight_json_type_t torchlight_json_type(torchlight_json_value_t value);
+torchlight_json_value_t torchlight_json_get(torchlight_json_value_t object, const char* key);
+torchlight_json_value_t torchlight_json_at(torchlight_json_value_t array, size_t position);
+size_t torchlight_json_count(torchlight_json_value_t container);
+torchlight_json_value_t torchlight_json_first(torchlight_json_value_t container);
+torchlight_json_value_t torchlight_json_next(torchlight_json_value_t value);
+const char* torchlight_json_key(torchlight_json_value_t value, size_t* length);
+
+// Typed getters; strings are decoded and NUL-terminated. The others
+// return -1 if the value is missing or of another type (int also if the
+// number is not an integer that fits).
+const char* torchlight_json_string(torchlight_json_value_t value, size_t* length);
+int torchlight_json_int(torchlight_json_value_t value, int64_t* out);
+int torchlight_json_double(torchlight_json_value_t value, double* out);
+int torchlight_json_bool(torchlight_json_value_t value, bool* out);
+
 // Create JSON response with status
 int torchlight_json_response(http_response_t* response, const char* data, const char* message);
 
@@ -360,13 +704,29 @@ int torchlight_websocket_receive(int socket_fd, char* buffer, size_t buffer_size
 // Security Helpers
 // ============================================================================
 
-// Generate CSRF token
+// Generate CSRF token (43 base64url characters; token_size >= 44)
 int torchlight_generate_csrf_token(char* token_out, size_t token_size);
 
-// Validate CSRF token
+// Generate a stateless token bound to a session (HMAC of id and issue time)
+int torchlight_generate_session_csrf_token(const char* session_id, char* token_out, size_t token_size);
+
+// Token to embed in a form or header for this request: session-bound when
+// the request has a session, otherwise the csrf_token double-submit cookie
+// (issued on the response if the client has none)
+int torchlight_csrf_token(const http_request_t* request, http_response_t* response,
+                          char* token_out, size_t token_size);
+
+// Key for session-bound tokens (at least 16 bytes; random per process if unset)
+int torchlight_set_csrf_secret(const unsigned char* secret, size_t secret_len);
+
+// Validate the token sent in the X-CSRF-Token header or csrf_token form
+// field, against expected_token or, when NULL, statelessly
 bool torchlight_validate_csrf_token(const http_request_t* request, const char* expected_token);
 
-// Check rate limiting
+// Configure the per-client limit (burst 0 = one minute's worth)
+int torchlight_set_rate_limit(int requests_per_minute, int burst);
+
+// Check rate limiting (true = allowed); lock-free, fixed memory
 bool torchlight_check_rate_limit(const char* client_id);
 
 // Add security headers to response
@@ -380,7 +740,38 @@ int torchlight_add_security_headers(http_response_t* response);
 int torchlight_url_encode(const char* input, char* output, size_t output_size);
 int torchlight_url_decode(const char* input, char* output, size_t output_size);
 
-// HTML escape
+// Base64url encode/decode without padding; return output length or -1
+int torchlight_base64url_encode(const unsigned char* input, size_t input_length,
+                                char* output, size_t output_size);
+int torchlight_base64url_decode(const char* input, size_t input_length,
+                                unsigned char* output, size_t output_size);
+
+// Cryptographically secure random bytes from a per-thread buffered pool
+int torchlight_random_bytes(void* output, size_t length);
+
+// Random base62 string of `length` characters (output holds length + 1)
+int torchlight_random_base62(char* output, size_t length);
+
+// Output buffers in power-of-two size classes (256 B to 64 KB), recycled
+// through a per-thread free list. They are plain malloc blocks, so free()
+// is always safe; torchlight_buffer_free() lets the next render reuse one.
+char* torchlight_buffer_alloc(size_t size, size_t* capacity);
+char* torchlight_buffer_grow(char* buffer, size_t* capacity, size_t size);
+void torchlight_buffer_free(char* buffer, size_t capacity);
+
+// Record an output size / capacity to reserve for the next one (0 = no
+// history). Updates from concurrent threads may race; it is only a hint.
+void torchlight_size_estimate_record(torchlight_size_estimate_t* estimate, size_t size);
+size_t torchlight_size_estimate_reserve(const torchlight_size_estimate_t* estimate);
+
+// Escape `length` bytes for an output context. Output is NUL-terminated
+// and never ends in a partial escape sequence; like snprintf, the return
+// value is the full escaped length, so output was complete if it is below
+// output_size (output may be NULL to measure).
+size_t torchlight_escape(torchlight_escape_t context, const char* input, size_t length,
+                         char* output, size_t output_size);
+
+// HTML escape; returns the escaped length like snprintf, or -1
 int torchlight_html_escape(const char* input, char* output, size_t output_size);
 
 // MIME type detection
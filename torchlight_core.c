@@ -14,26 +14,38 @@
 #include <time.h>
 #include <pthread.h>
 #include "torchlight.h"
+#include "torchlight_internal.h"
 
 // Global server state
-static torchlight_server_t g_server = {0};
+torchlight_server_t g_server = {0};
 static pthread_mutex_t g_server_mutex = PTHREAD_MUTEX_INITIALIZER;
 
+static void dispatch_request(http_request_t* request);
+
 // Default configuration
 static const torchlight_config_t DEFAULT_CONFIG = {
     .document_root = "./www",
     .template_directory = "./templates",
     .static_directory = "./static",
     .enable_sessions = true,
+    .session_store_path = "",
+    .session_store_slots = 0,
     .enable_websockets = true,
     .enable_cors = false,
     .enable_gzip = false,
     .enable_cache = true,
     .max_connections = 100,
     .timeout_seconds = 30,
+    .handler_threads = 0,
+    .max_queued_per_client = 16,
+    .enable_load_shedding = false,
+    .min_header_rate_bps = 0,
+    .min_body_rate_bps = 0,
+    .max_header_phase_connections = 0,
     .enable_csrf_protection = false,
     .enable_rate_limiting = false,
     .rate_limit_requests_per_minute = 60,
+    .accept_proxy_protocol = false,
     .error_404_page = "",
     .error_500_page = ""
 };
@@ -58,9 +70,8 @@ int torchlight_init(const torchlight_config_t* config) {
         g_server.config = DEFAULT_CONFIG;
     }
     
-    // Initialize route and session arrays
+    // Initialize route table
     g_server.route_count = 0;
-    g_server.session_count = 0;
     
     // Initialize statistics
     g_server.requests_served = 0;
@@ -69,6 +80,32 @@ int torchlight_init(const torchlight_config_t* config) {
     g_server.active_connections = 0;
     g_server.error_count = 0;
     
+    torchlight_set_proxy_protocol(g_server.config.accept_proxy_protocol);
+    torchlight_set_template_cache(g_server.config.enable_cache);
+    torchlight_set_template_directory(g_server.config.template_directory);
+    torchlight_set_slow_client_limits(g_server.config.min_header_rate_bps,
+                                      g_server.config.min_body_rate_bps,
+                                      g_server.config.max_header_phase_connections);
+    
+    if (g_server.config.enable_load_shedding) {
+        tl_concurrency_limiter_configure(g_server.config.max_connections);
+    }
+    
+    if (g_server.config.enable_rate_limiting &&
+        torchlight_set_rate_limit(g_server.config.rate_limit_requests_per_minute, 0) != 0) {
+        pthread_mutex_unlock(&g_server_mutex);
+        return -1;
+    }
+    
+    // Attach the persistent session store if one is configured
+    if (g_server.config.enable_sessions && g_server.config.session_store_path[0]) {
+        if (torchlight_open_session_store(g_server.config.session_store_path,
+                                          (size_t)g_server.config.session_store_slots) != 0) {
+            pthread_mutex_unlock(&g_server_mutex);
+            return -1;
+        }
+    }
+    
     g_server.initialized = true;
     
     printf("✅ TorchLight initialized successfully\n");
@@ -88,74 +125,92 @@ int torchlight_start(void) {
         return -1;
     }
     
-    printf("🚀 TorchLight HTTP server ready for requests\n");
-    printf("   Max connections: %d\n", g_server.config.max_connections);
-    printf("   Request timeout: %d seconds\n", g_server.config.timeout_seconds);
-    
-    return 0;
-}
-
-int torchlight_handle_request(int socket_fd) {
-    if (!g_server.initialized) {
+    // Expire idle sessions in the background
+    if (g_server.config.enable_sessions && torchlight_start_session_reaper() != 0) {
+        printf("❌ Failed to start session reaper\n");
         return -1;
     }
     
-    pthread_mutex_lock(&g_server_mutex);
-    g_server.active_connections++;
-    pthread_mutex_unlock(&g_server_mutex);
-    
-    printf("🌐 Processing HTTP request on socket %d\n", socket_fd);
+    // Watchdog for slow clients (no-op unless limits are configured)
+    if (tl_connection_monitor_start() != 0) {
+        printf("❌ Failed to start connection monitor\n");
+        return -1;
+    }
     
-    // Parse the request
-    http_request_t request = {0};
-    request.socket_fd = socket_fd;
-    request.received_time = time(NULL);
+    // Hot reload for cached templates (falls back to stat() per render)
+    if (g_server.config.enable_cache) {
+        tl_template_watcher_start(g_server.config.template_directory);
+    }
     
-    int parse_result = torchlight_parse_request(socket_fd, &request);
-    if (parse_result != 0) {
-        printf("❌ Failed to parse HTTP request\n");
-        
-        // Send error response
-        http_response_t error_response = {0};
-        torchlight_response_error(&error_response, HTTP_STATUS_BAD_REQUEST, "Invalid HTTP request");
-        torchlight_send_response(socket_fd, &error_response);
-        
-        pthread_mutex_lock(&g_server_mutex);
-        g_server.active_connections--;
-        g_server.error_count++;
-        pthread_mutex_unlock(&g_server_mutex);
-        
+    // Fair-queued handler threads
+    if (g_server.config.handler_threads > 0 &&
+        tl_scheduler_start(g_server.config.handler_threads,
+                           g_server.config.max_queued_per_client, dispatch_request) != 0) {
+        printf("❌ Failed to start request scheduler\n");
         return -1;
     }
     
-    printf("   Method: %d, Path: %s\n", request.method, request.path);
+    printf("🚀 TorchLight HTTP server ready for requests\n");
+    printf("   Max connections: %d\n", g_server.config.max_connections);
+    printf("   Request timeout: %d seconds\n", g_server.config.timeout_seconds);
     
+    return 0;
+}
+
+// Route a parsed request, send the response and release the request
+static void dispatch_request(http_request_t* request) {
     // Update statistics
     pthread_mutex_lock(&g_server_mutex);
     g_server.requests_served++;
-    g_server.bytes_received += request.body_length;
+    g_server.bytes_received += request->body_length;
     pthread_mutex_unlock(&g_server_mutex);
     
     // Find matching route
-    const route_t* route = torchlight_find_route(&request);
+    const route_t* route = torchlight_find_route(request);
     
     http_response_t response = {0};
     
-    if (route) {
+    // CSRF check for state-changing methods on a matched route; an unknown
+    // path is a 404 whatever the token
+    bool csrf_rejected = route && g_server.config.enable_csrf_protection &&
+                         request->method != HTTP_METHOD_GET &&
+                         request->method != HTTP_METHOD_HEAD &&
+                         request->method != HTTP_METHOD_OPTIONS &&
+                         !torchlight_validate_csrf_token(request, NULL);
+    
+    if (csrf_rejected) {
+        printf("   🛡️  CSRF token missing or invalid\n");
+        torchlight_response_error(&response, HTTP_STATUS_FORBIDDEN, "CSRF token missing or invalid");
+    } else if (route && !tl_route_acquire_slot(route, request)) {
+        printf("   🚧 Route at capacity: %s\n", route->path_pattern);
+        torchlight_response_error(&response, HTTP_STATUS_SERVICE_UNAVAILABLE, "Route at capacity");
+        torchlight_add_header(&response, "Retry-After", "1");
+    } else if (route) {
         printf("   ✅ Route found: %s\n", route->description ? route->description : "No description");
         
         // Call the route handler
-        int handler_result = route->handler(&request, &response);
+        int handler_result = route->handler(request, &response);
+        tl_route_release_slot(route);
         
-        if (handler_result != 0) {
+        if (handler_result != 0 && torchlight_request_cancelled(request)) {
+            printf("   ⏱️  Route handler passed its deadline\n");
+            torchlight_release_response(&response);
+            torchlight_response_error(&response, HTTP_STATUS_SERVICE_UNAVAILABLE, "Deadline exceeded");
+        } else if (handler_result != 0) {
             printf("   ❌ Route handler failed\n");
+            torchlight_release_response(&response);
             torchlight_response_error(&response, HTTP_STATUS_INTERNAL_SERVER_ERROR, "Handler error");
+        } else if (!response.body_iov) {
+            tl_route_record_response(route, &response);
         }
+    } else if ((request->method == HTTP_METHOD_GET || request->method == HTTP_METHOD_HEAD) &&
+               torchlight_serve_static(request, &response) == 0) {
+        printf("   📦 Embedded asset: %s\n", request->path);
     } else {
         printf("   ❌ No route found for %s %s\n", 
-               request.method == HTTP_METHOD_GET ? "GET" : 
-               request.method == HTTP_METHOD_POST ? "POST" : "OTHER", 
-               request.path);
+               request->method == HTTP_METHOD_GET ? "GET" : 
+               request->method == HTTP_METHOD_POST ? "POST" : "OTHER", 
+               request->path);
         
         torchlight_response_error(&response, HTTP_STATUS_NOT_FOUND, "Page not found");
     }
@@ -166,7 +221,13 @@ int torchlight_handle_request(int socket_fd) {
     }
     
     // Send response
-    int send_result = torchlight_send_response(socket_fd, &response);
+    int send_result = torchlight_send_response(request->socket_fd, &response);
+    
+    // Feed the observed latency back to the concurrency limiter
+    if (request->admitted_us) {
+        uint64_t latency = tl_concurrency_limiter_now_us() - request->admitted_us;
+        tl_concurrency_limiter_release(latency ? latency : 1);
+    }
     
     // Update statistics
     pthread_mutex_lock(&g_server_mutex);
@@ -179,28 +240,124 @@ int torchlight_handle_request(int socket_fd) {
     pthread_mutex_unlock(&g_server_mutex);
     
     // Cleanup
-    if (request.body) {
-        free(request.body);
-    }
-    if (response.body) {
-        free(response.body);
+    if (request->body) {
+        free(request->body);
     }
+    torchlight_json_free(request->json);
     
     // Call callback if set
     if (g_server.on_response_sent) {
         g_server.on_response_sent(&response);
     }
     
+    torchlight_release_response(&response);
+    
     printf("   ✅ Request completed\n");
+}
+
+// Called by the parser once the request line and headers are in, so a
+// request we are going to refuse never has its body read. Sends the
+// rejection itself.
+static bool admit_request(http_request_t* request) {
+    // Per-client rate limiting, before any routing work
+    if (g_server.config.enable_rate_limiting && !torchlight_check_rate_limit(request->client_id)) {
+        printf("   🚦 Rate limited: %s\n", request->client_id);
+        tl_rate_limiter_send_rejection(request->socket_fd);
+        return false;
+    }
+    
+    // Shed load beyond the adaptive concurrency limit
+    if (g_server.config.enable_load_shedding) {
+        if (!tl_concurrency_limiter_acquire()) {
+            printf("   🪫 Overloaded, shedding request\n");
+            tl_concurrency_limiter_send_rejection(request->socket_fd);
+            return false;
+        }
+        request->admitted_us = tl_concurrency_limiter_now_us();
+    }
+    
+    return true;
+}
+
+int torchlight_handle_request(int socket_fd) {
+    if (!g_server.initialized) {
+        return -1;
+    }
+    
+    pthread_mutex_lock(&g_server_mutex);
+    g_server.active_connections++;
+    pthread_mutex_unlock(&g_server_mutex);
+    
+    printf("🌐 Processing HTTP request on socket %d\n", socket_fd);
+    
+    // Parse the request
+    http_request_t request = {0};
+    request.socket_fd = socket_fd;
+    request.received_time = time(NULL);
+    
+    int parse_result = tl_parse_request(socket_fd, &request, admit_request);
+    if (parse_result > 0) {
+        // Refused after its headers; the body was never read
+        pthread_mutex_lock(&g_server_mutex);
+        g_server.active_connections--;
+        g_server.error_count++;
+        pthread_mutex_unlock(&g_server_mutex);
+        
+        return 0;
+    }
+    if (parse_result != 0) {
+        printf("❌ Failed to parse HTTP request\n");
+        
+        // Send error response
+        http_response_t error_response = {0};
+        torchlight_response_error(&error_response, HTTP_STATUS_BAD_REQUEST, "Invalid HTTP request");
+        torchlight_send_response(socket_fd, &error_response);
+        
+        pthread_mutex_lock(&g_server_mutex);
+        g_server.active_connections--;
+        g_server.error_count++;
+        pthread_mutex_unlock(&g_server_mutex);
+        
+        return -1;
+    }
+    
+    printf("   Method: %d, Path: %s, Client: %s\n", request.method, request.path, request.client_id);
+    
+    // Run now, or hand the request to the fair scheduler
+    if (tl_scheduler_active()) {
+        if (tl_scheduler_submit(&request) != 0) {
+            printf("   ⚖️  Queue full for %s\n", request.client_id);
+            tl_rate_limiter_send_rejection(socket_fd);
+            if (request.admitted_us) tl_concurrency_limiter_release(0);
+            
+            pthread_mutex_lock(&g_server_mutex);
+            g_server.active_connections--;
+            g_server.error_count++;
+            pthread_mutex_unlock(&g_server_mutex);
+            
+            free(request.body);
+            return 0;
+        }
+        return 1;
+    }
+    
+    dispatch_request(&request);
     return 0;
 }
 
 int torchlight_stop(void) {
     printf("🛑 Stopping TorchLight HTTP server...\n");
+    tl_scheduler_stop();
+    tl_connection_monitor_stop();
+    tl_template_watcher_stop();
+    torchlight_stop_session_reaper();
     return 0;
 }
 
 void torchlight_shutdown(void) {
+    // Handler threads take the server mutex, so join them before locking
+    tl_scheduler_stop();
+    
     pthread_mutex_lock(&g_server_mutex);
     
     if (!g_server.initialized) {
@@ -210,8 +367,16 @@ void torchlight_shutdown(void) {
     
     printf("🔄 Shutting down TorchLight HTTP server...\n");
     
+    tl_connection_monitor_stop();
+    tl_template_watcher_stop();
+    torchlight_stop_session_reaper();
+    
     // Cleanup sessions
     torchlight_cleanup_sessions();
+    torchlight_close_session_store();
+    
+    // Drop compiled templates
+    torchlight_clear_template_cache();
     
     // Reset state
     memset(&g_server, 0, sizeof(g_server));
@@ -227,6 +392,8 @@ void torchlight_get_stats(torchlight_server_t* stats_out) {
     pthread_mutex_lock(&g_server_mutex);
     *stats_out = g_server;
     pthread_mutex_unlock(&g_server_mutex);
+    
+    stats_out->session_count = torchlight_session_count();
 }
 
 // Built-in route handlers
@@ -292,7 +459,10 @@ static int api_stats_handler(const http_request_t* request, http_response_t* res
         "  \"active_connections\": %u,\n"
         "  \"error_count\": %u,\n"
         "  \"route_count\": %d,\n"
-        "  \"session_count\": %d\n"
+        "  \"session_count\": %d,\n"
+        "  \"concurrency_limit\": %d,\n"
+        "  \"requests_shed\": %lu,\n"
+        "  \"slow_connections_dropped\": %lu\n"
         "}\n",
         g_server.requests_served,
         g_server.bytes_sent, 
@@ -300,7 +470,10 @@ static int api_stats_handler(const http_request_t* request, http_response_t* res
         g_server.active_connections,
         g_server.error_count,
         g_server.route_count,
-        g_server.session_count);
+        torchlight_session_count(),
+        tl_concurrency_limiter_limit(),
+        tl_concurrency_limiter_shed_count(),
+        tl_connection_monitor_dropped());
     
     return torchlight_response_json(response, stats_json);
 }
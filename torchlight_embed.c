@@ -0,0 +1,532 @@
+/*
+ * TorchLight Asset Embedder
+ * Build-time generator for embedded template and static asset bundles
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <openssl/evp.h>
+#ifdef TORCHLIGHT_EMBED_GZIP
+#include <zlib.h>
+#endif
+#include "torchlight.h"
+#include "torchlight_internal.h"
+
+// Usage: torchlight_embed <name> <output-base> [--templates DIR] [--static DIR]
+//
+// Writes <output-base>.c defining `const torchlight_embedded_bundle_t
+// <name>` and <output-base>.h declaring it. Templates are compiled here,
+// so a template error fails the build, and are keyed by their path under
+// DIR; static files are keyed by URL path ("/" + path under DIR). Output
+// is deterministic: files are sorted by key.
+
+#define EMBED_MAX_DISPLACEMENT (1u << 24)
+
+typedef struct {
+    char* key;
+    char* file;
+    bool is_template;
+    unsigned char* data;
+    size_t length;
+    unsigned char* gzip_data;
+    size_t gzip_length;
+    char etag[36];
+    content_type_t content_type;
+
+    torchlight_embedded_op_t* ops;
+    size_t op_count;
+    size_t literal_bytes;
+    char** slot_names;
+    size_t slot_count;
+
+    uint64_t hash;
+} embed_asset_t;
+
+typedef struct {
+    embed_asset_t* assets;
+    size_t count;
+    size_t capacity;
+} embed_list_t;
+
+static int embed_add(embed_list_t* list, const char* key, const char* file, bool is_template) {
+    if (list->count == list->capacity) {
+        size_t capacity = list->capacity ? list->capacity * 2 : 64;
+        embed_asset_t* assets = realloc(list->assets, capacity * sizeof(embed_asset_t));
+        if (!assets) return -1;
+        list->assets = assets;
+        list->capacity = capacity;
+    }
+
+    embed_asset_t* asset = &list->assets[list->count];
+    memset(asset, 0, sizeof(*asset));
+    asset->key = strdup(key);
+    asset->file = strdup(file);
+    asset->is_template = is_template;
+    if (!asset->key || !asset->file) return -1;
+
+    list->count++;
+    return 0;
+}
+
+// Collect regular files under `directory`, skipping dotfiles
+static int embed_scan(embed_list_t* list, const char* directory, const char* relative,
+                      bool is_template) {
+    char path[1024];
+    snprintf(path, sizeof(path), "%s%s%s", directory, relative[0] ? "/" : "", relative);
+
+    DIR* dir = opendir(path);
+    if (!dir) {
+        fprintf(stderr, "torchlight_embed: cannot open %s\n", path);
+        return -1;
+    }
+
+    struct dirent* entry;
+    int result = 0;
+
+    while (result == 0 && (entry = readdir(dir)) != NULL) {
+        if (entry->d_name[0] == '.') continue;
+
+        char child[1024];
+        char file[1024];
+        int written = snprintf(child, sizeof(child), "%s%s%s", relative, relative[0] ? "/" : "",
+                               entry->d_name);
+        if (written < 0 || (size_t)written >= sizeof(child) ||
+            snprintf(file, sizeof(file), "%s/%s", directory, child) >= (int)sizeof(file)) {
+            fprintf(stderr, "torchlight_embed: path too long under %s\n", path);
+            result = -1;
+            break;
+        }
+
+        struct stat st;
+        if (stat(file, &st) != 0) continue;
+
+        if (S_ISDIR(st.st_mode)) {
+            result = embed_scan(list, directory, child, is_template);
+        } else if (S_ISREG(st.st_mode)) {
+            char key[sizeof(child) + 1];
+            snprintf(key, sizeof(key), "%s%s", is_template ? "" : "/", child);
+            result = embed_add(list, key, file, is_template);
+        }
+    }
+
+    closedir(dir);
+    return result;
+}
+
+static int embed_compare(const void* a, const void* b) {
+    return strcmp(((const embed_asset_t*)a)->key, ((const embed_asset_t*)b)->key);
+}
+
+static bool embed_compressible(content_type_t type) {
+    return type != CONTENT_TYPE_IMAGE_PNG && type != CONTENT_TYPE_IMAGE_JPEG;
+}
+
+#ifdef TORCHLIGHT_EMBED_GZIP
+// Keep a gzip variant only when it saves at least a tenth
+static int embed_gzip(embed_asset_t* asset) {
+    if (asset->length < 256 || !embed_compressible(asset->content_type)) return 0;
+
+    z_stream stream = {0};
+    if (deflateInit2(&stream, Z_BEST_COMPRESSION, Z_DEFLATED, 15 + 16, 9, Z_DEFAULT_STRATEGY) != Z_OK) {
+        return -1;
+    }
+
+    uLong bound = deflateBound(&stream, (uLong)asset->length);
+    unsigned char* output = malloc(bound);
+    if (!output) {
+        deflateEnd(&stream);
+        return -1;
+    }
+
+    stream.next_in = asset->data;
+    stream.avail_in = (uInt)asset->length;
+    stream.next_out = output;
+    stream.avail_out = (uInt)bound;
+
+    int status = deflate(&stream, Z_FINISH);
+    size_t length = stream.total_out;
+    deflateEnd(&stream);
+
+    if (status != Z_STREAM_END || length >= asset->length - asset->length / 10) {
+        free(output);
+        return 0;
+    }
+
+    asset->gzip_data = output;
+    asset->gzip_length = length;
+    return 0;
+}
+#endif
+
+// Whole file, NUL-terminated (empty files are fine here)
+static char* embed_read(const char* path, size_t* length) {
+    FILE* file = fopen(path, "rb");
+    if (!file) return NULL;
+
+    char* content = NULL;
+    size_t size = 0;
+    size_t capacity = 0;
+    bool failed = false;
+
+    for (;;) {
+        if (size == capacity) {
+            capacity = capacity ? capacity * 2 : 65536;
+            char* grown = realloc(content, capacity + 1);
+            if (!grown) {
+                failed = true;
+                break;
+            }
+            content = grown;
+        }
+        size_t read = fread(content + size, 1, capacity - size, file);
+        size += read;
+        if (read == 0) {
+            failed = ferror(file) != 0;
+            break;
+        }
+    }
+
+    fclose(file);
+    if (failed) {
+        free(content);
+        return NULL;
+    }
+
+    content[size] = '\0';
+    *length = size;
+    return content;
+}
+
+static int embed_load(embed_asset_t* asset) {
+    char* content = embed_read(asset->file, &asset->length);
+    if (!content) {
+        fprintf(stderr, "torchlight_embed: cannot read %s\n", asset->file);
+        return -1;
+    }
+    asset->data = (unsigned char*)content;
+    asset->content_type = torchlight_detect_content_type(asset->file);
+    asset->hash = tl_embedded_hash(asset->key);
+
+    // ETag: first 128 bits of the SHA-256, hex
+    unsigned char digest[EVP_MAX_MD_SIZE];
+    unsigned int digest_length = 0;
+    if (EVP_Digest(asset->data, asset->length, digest, &digest_length, EVP_sha256(), NULL) != 1) {
+        return -1;
+    }
+    asset->etag[0] = '"';
+    for (int i = 0; i < 16; i++) {
+        snprintf(asset->etag + 1 + i * 2, 3, "%02x", digest[i]);
+    }
+    asset->etag[33] = '"';
+    asset->etag[34] = '\0';
+
+    if (asset->is_template) {
+        torchlight_template_t* tpl = torchlight_compile_template(content, asset->length);
+        if (!tpl) {
+            fprintf(stderr, "torchlight_embed: template %s does not compile\n", asset->file);
+            return -1;
+        }
+
+        asset->ops = tl_template_export(tpl, &asset->op_count, &asset->literal_bytes);
+        asset->slot_count = torchlight_template_slot_count(tpl);
+        asset->slot_names = calloc(asset->slot_count ? asset->slot_count : 1, sizeof(char*));
+
+        bool ok = asset->ops && asset->slot_names;
+        for (size_t i = 0; ok && i < asset->slot_count; i++) {
+            asset->slot_names[i] = strdup(torchlight_template_slot_name(tpl, i));
+            ok = asset->slot_names[i] != NULL;
+        }
+
+        torchlight_release_template(tpl);
+        return ok ? 0 : -1;
+    }
+
+#ifdef TORCHLIGHT_EMBED_GZIP
+    return embed_gzip(asset);
+#else
+    return 0;
+#endif
+}
+
+// Perfect hash: place the biggest buckets first, trying displacements
+// until every key in the bucket lands in a free slot
+typedef struct {
+    uint32_t bucket;
+    uint32_t size;
+} embed_bucket_t;
+
+static int embed_bucket_compare(const void* a, const void* b) {
+    const embed_bucket_t* x = a;
+    const embed_bucket_t* y = b;
+    if (x->size != y->size) return x->size > y->size ? -1 : 1;
+    return x->bucket < y->bucket ? -1 : x->bucket > y->bucket;
+}
+
+static int embed_build_index(const embed_list_t* list, uint32_t** displacements_out,
+                             uint32_t* bucket_count_out, uint32_t** slots_out,
+                             uint32_t* slot_count_out) {
+    uint32_t count = (uint32_t)list->count;
+    uint32_t bucket_count = count / 2 + 1;
+    uint32_t slot_count = 1;
+    while (slot_count < count + count / 4) slot_count <<= 1;
+
+    uint32_t* displacements = calloc(bucket_count, sizeof(uint32_t));
+    uint32_t* slots = malloc(slot_count * sizeof(uint32_t));
+    embed_bucket_t* buckets = calloc(bucket_count, sizeof(embed_bucket_t));
+    uint32_t* members = malloc((count ? count : 1) * sizeof(uint32_t));
+    uint32_t* placed = malloc((count ? count : 1) * sizeof(uint32_t));
+
+    if (!displacements || !slots || !buckets || !members || !placed) goto fail;
+
+    for (uint32_t i = 0; i < slot_count; i++) slots[i] = UINT32_MAX;
+    for (uint32_t b = 0; b < bucket_count; b++) buckets[b].bucket = b;
+    for (uint32_t i = 0; i < count; i++) {
+        buckets[tl_embedded_bucket(list->assets[i].hash, bucket_count)].size++;
+    }
+    qsort(buckets, bucket_count, sizeof(embed_bucket_t), embed_bucket_compare);
+
+    for (uint32_t b = 0; b < bucket_count && buckets[b].size > 0; b++) {
+        uint32_t size = 0;
+        for (uint32_t i = 0; i < count; i++) {
+            if (tl_embedded_bucket(list->assets[i].hash, bucket_count) == buckets[b].bucket) {
+                members[size++] = i;
+            }
+        }
+
+        uint32_t displacement = 0;
+        for (; displacement < EMBED_MAX_DISPLACEMENT; displacement++) {
+            uint32_t j = 0;
+            for (; j < size; j++) {
+                uint32_t slot = tl_embedded_slot(list->assets[members[j]].hash, displacement, slot_count);
+                if (slots[slot] != UINT32_MAX) break;
+
+                uint32_t k = 0;
+                while (k < j && placed[k] != slot) k++;
+                if (k < j) break;
+                placed[j] = slot;
+            }
+            if (j == size) break;
+        }
+
+        if (displacement == EMBED_MAX_DISPLACEMENT) {
+            fprintf(stderr, "torchlight_embed: no perfect hash found (colliding paths?)\n");
+            goto fail;
+        }
+
+        displacements[buckets[b].bucket] = displacement;
+        for (uint32_t j = 0; j < size; j++) slots[placed[j]] = members[j];
+    }
+
+    free(buckets);
+    free(members);
+    free(placed);
+
+    *displacements_out = displacements;
+    *bucket_count_out = bucket_count;
+    *slots_out = slots;
+    *slot_count_out = slot_count;
+    return 0;
+
+fail:
+    free(displacements);
+    free(slots);
+    free(buckets);
+    free(members);
+    free(placed);
+    return -1;
+}
+
+// Output
+
+static void embed_write_bytes(FILE* out, const char* symbol, const unsigned char* data, size_t length) {
+    // Trailing NUL so embedded text can be used as a C string
+    fprintf(out, "static const unsigned char %s[%zu] = {", symbol, length + 1);
+    for (size_t i = 0; i < length; i++) {
+        fprintf(out, "%s0x%02x,", i % 16 == 0 ? "\n    " : "", data[i]);
+    }
+    fprintf(out, "%s0x00\n};\n\n", length % 16 == 0 ? "\n    " : "");
+}
+
+static void embed_write_string(FILE* out, const char* value) {
+    fputc('"', out);
+    for (const unsigned char* p = (const unsigned char*)value; *p; p++) {
+        if (*p == '"' || *p == '\\') {
+            fprintf(out, "\\%c", *p);
+        } else if (*p < 0x20 || *p >= 0x7f) {
+            fprintf(out, "\\%03o", *p);
+        } else {
+            fputc(*p, out);
+        }
+    }
+    fputc('"', out);
+}
+
+static int embed_write(const embed_list_t* list, const char* name, const char* base,
+                       const uint32_t* displacements, uint32_t bucket_count,
+                       const uint32_t* slots, uint32_t slot_count) {
+    char path[1024];
+
+    snprintf(path, sizeof(path), "%s.h", base);
+    FILE* header = fopen(path, "w");
+    if (!header) {
+        fprintf(stderr, "torchlight_embed: cannot write %s\n", path);
+        return -1;
+    }
+    char guard[128];
+    size_t guard_length = 0;
+    for (const char* p = name; *p && guard_length + 1 < sizeof(guard); p++) {
+        guard[guard_length++] = isalnum((unsigned char)*p) ? (char)toupper((unsigned char)*p) : '_';
+    }
+    guard[guard_length] = '\0';
+
+    fprintf(header,
+            "// Generated by torchlight_embed; do not edit\n"
+            "#ifndef %s_EMBEDDED_H\n"
+            "#define %s_EMBEDDED_H\n\n"
+            "#include \"torchlight.h\"\n\n"
+            "extern const torchlight_embedded_bundle_t %s;\n\n"
+            "#endif\n", guard, guard, name);
+    fclose(header);
+
+    snprintf(path, sizeof(path), "%s.c", base);
+    FILE* out = fopen(path, "w");
+    if (!out) {
+        fprintf(stderr, "torchlight_embed: cannot write %s\n", path);
+        return -1;
+    }
+
+    fprintf(out, "// Generated by torchlight_embed; do not edit\n\n#include \"torchlight.h\"\n\n");
+
+    for (size_t i = 0; i < list->count; i++) {
+        const embed_asset_t* asset = &list->assets[i];
+        char symbol[64];
+
+        fprintf(out, "// %s\n", asset->key);
+        snprintf(symbol, sizeof(symbol), "asset_%zu_data", i);
+        embed_write_bytes(out, symbol, asset->data, asset->length);
+
+        if (asset->gzip_data) {
+            snprintf(symbol, sizeof(symbol), "asset_%zu_gzip", i);
+            embed_write_bytes(out, symbol, asset->gzip_data, asset->gzip_length);
+        }
+
+        if (asset->is_template) {
+            // Always at least one element: a non-NULL ops marks a template
+            fprintf(out, "static const torchlight_embedded_op_t asset_%zu_ops[%zu] = {\n",
+                    i, asset->op_count ? asset->op_count : 1);
+            for (size_t j = 0; j < asset->op_count; j++) {
+                const torchlight_embedded_op_t* op = &asset->ops[j];
+                fprintf(out, "    { %u, %u, %u, %u, %u, %u },\n",
+                        op->type, op->offset, op->length, op->slot, op->jump, op->escape);
+            }
+            if (asset->op_count == 0) fprintf(out, "    { 0, 0, 0, 0, 0, 0 },\n");
+            fprintf(out, "};\n\n");
+
+            fprintf(out, "static const char* const asset_%zu_slots[%zu] = {\n",
+                    i, asset->slot_count ? asset->slot_count : 1);
+            for (size_t j = 0; j < asset->slot_count; j++) {
+                fprintf(out, "    ");
+                embed_write_string(out, asset->slot_names[j]);
+                fprintf(out, ",\n");
+            }
+            if (asset->slot_count == 0) fprintf(out, "    0,\n");
+            fprintf(out, "};\n\n");
+        }
+    }
+
+    fprintf(out, "static const torchlight_embedded_asset_t assets[%zu] = {\n",
+            list->count ? list->count : 1);
+    for (size_t i = 0; i < list->count; i++) {
+        const embed_asset_t* asset = &list->assets[i];
+
+        fprintf(out, "    { ");
+        embed_write_string(out, asset->key);
+        fprintf(out, ", asset_%zu_data, %zu, ", i, asset->length);
+        if (asset->gzip_data) {
+            fprintf(out, "asset_%zu_gzip, %zu, ", i, asset->gzip_length);
+        } else {
+            fprintf(out, "0, 0, ");
+        }
+        embed_write_string(out, asset->etag);
+        fprintf(out, ", (content_type_t)%d,\n      ", (int)asset->content_type);
+        if (asset->is_template) {
+            fprintf(out, "asset_%zu_ops, %zu, asset_%zu_slots, %zu, %zu },\n",
+                    i, asset->op_count, i, asset->slot_count, asset->literal_bytes);
+        } else {
+            fprintf(out, "0, 0, 0, 0, 0 },\n");
+        }
+    }
+    if (list->count == 0) fprintf(out, "    { 0 },\n");
+    fprintf(out, "};\n\n");
+
+    fprintf(out, "static const uint32_t displacements[%u] = {", bucket_count);
+    for (uint32_t i = 0; i < bucket_count; i++) {
+        fprintf(out, "%s%u,", i % 12 == 0 ? "\n    " : " ", displacements[i]);
+    }
+    fprintf(out, "\n};\n\n");
+
+    fprintf(out, "static const uint32_t slots[%u] = {", slot_count);
+    for (uint32_t i = 0; i < slot_count; i++) {
+        fprintf(out, "%s%uu,", i % 8 == 0 ? "\n    " : " ", slots[i]);
+    }
+    fprintf(out, "\n};\n\n");
+
+    fprintf(out,
+            "const torchlight_embedded_bundle_t %s = {\n"
+            "    assets, %zu, displacements, %u, slots, %u\n"
+            "};\n", name, list->count, bucket_count, slot_count);
+
+    bool failed = ferror(out);
+    if (fclose(out) != 0 || failed) {
+        fprintf(stderr, "torchlight_embed: error writing %s\n", path);
+        return -1;
+    }
+    return 0;
+}
+
+static void embed_usage(void) {
+    fprintf(stderr, "Usage: torchlight_embed <name> <output-base> [--templates DIR] [--static DIR]\n");
+}
+
+int main(int argc, char** argv) {
+    if (argc < 3) {
+        embed_usage();
+        return 2;
+    }
+
+    const char* name = argv[1];
+    const char* base = argv[2];
+    embed_list_t list = {0};
+
+    for (int i = 3; i < argc; i++) {
+        bool is_template = strcmp(argv[i], "--templates") == 0;
+        if ((!is_template && strcmp(argv[i], "--static") != 0) || i + 1 >= argc) {
+            embed_usage();
+            return 2;
+        }
+        if (embed_scan(&list, argv[++i], "", is_template) != 0) return 1;
+    }
+
+    qsort(list.assets, list.count, sizeof(embed_asset_t), embed_compare);
+
+    size_t total = 0;
+    for (size_t i = 0; i < list.count; i++) {
+        if (embed_load(&list.assets[i]) != 0) return 1;
+        total += list.assets[i].length;
+    }
+
+    uint32_t* displacements = NULL;
+    uint32_t* slots = NULL;
+    uint32_t bucket_count = 0;
+    uint32_t slot_count = 0;
+
+    if (embed_build_index(&list, &displacements, &bucket_count, &slots, &slot_count) != 0) return 1;
+    if (embed_write(&list, name, base, displacements, bucket_count, slots, slot_count) != 0) return 1;
+
+    printf("📦 Embedded %zu files (%zu bytes) into %s\n", list.count, total, name);
+    return 0;
+}
@@ -0,0 +1,97 @@
+/*
+ * TorchLight - Internal Interfaces
+ *
+ * Functions shared between TorchLight's own translation units. Not part
+ * of the public API and not installed: every declaration here has hidden
+ * visibility, so none of them is exported from the shared library.
+ */
+
+#pragma once
+
+#include "torchlight.h"
+
+#pragma GCC visibility push(hidden)
+
+// Server state (torchlight_core.c)
+extern torchlight_server_t g_server;
+
+// Request parsing (http_parser.c)
+int tl_parse_request(int socket_fd, http_request_t* request, bool (*admit)(http_request_t* request));
+
+// Route bulkheads (route_handler.c)
+bool tl_route_acquire_slot(const route_t* route, http_request_t* request);
+void tl_route_release_slot(const route_t* route);
+void tl_route_record_response(const route_t* route, const http_response_t* response);
+
+// Rate limiter (rate_limiter.c)
+int tl_rate_limiter_send_rejection(int socket_fd);
+
+// Concurrency limiter (concurrency_limiter.c)
+void tl_concurrency_limiter_configure(int max_limit);
+bool tl_concurrency_limiter_acquire(void);
+void tl_concurrency_limiter_release(uint64_t latency_us);
+uint64_t tl_concurrency_limiter_now_us(void);
+int tl_concurrency_limiter_send_rejection(int socket_fd);
+int tl_concurrency_limiter_limit(void);
+uint64_t tl_concurrency_limiter_shed_count(void);
+
+// Slow-client accounting (connection_monitor.c); begin() returns
+// TL_CONNECTION_REFUSED when the header-phase cap or the registry is full
+#define TL_CONNECTION_REFUSED (-2)
+int tl_connection_monitor_start(void);
+void tl_connection_monitor_stop(void);
+uint64_t tl_connection_monitor_dropped(void);
+int tl_connection_monitor_begin(int socket_fd);
+void tl_connection_monitor_progress(int slot, size_t bytes);
+void tl_connection_monitor_body_phase(int slot);
+bool tl_connection_monitor_end(int slot);
+
+// Request scheduler (scheduler.c)
+int tl_scheduler_start(int thread_count, int max_per_client, void (*dispatch)(http_request_t* request));
+bool tl_scheduler_active(void);
+int tl_scheduler_submit(const http_request_t* request);
+void tl_scheduler_stop(void);
+
+// Session clock (session_manager.c): time(NULL) plus an offset that
+// tests advance to drive expiry
+time_t tl_session_now(void);
+void tl_session_clock_advance(time_t seconds);
+
+// Persistent session backend (session_store.c)
+bool tl_session_store_active(void);
+int tl_session_store_lookup(const char* session_id, uint64_t hash, session_t* out, bool touch);
+int tl_session_store_insert(const session_t* session, uint64_t hash);
+int tl_session_store_update(const char* session_id, uint64_t hash,
+                            int (*merge)(session_t* stored, void* context), void* context);
+int tl_session_store_remove(const char* session_id, uint64_t hash);
+int tl_session_store_expire(time_t now, int timeout);
+int tl_session_store_count(void);
+
+// Template engine (template_engine.c)
+torchlight_template_t* tl_template_import(const torchlight_embedded_asset_t* asset);
+torchlight_embedded_op_t* tl_template_export(const torchlight_template_t* tpl, size_t* op_count,
+                                             size_t* literal_bytes);
+void tl_template_cache_watch(const char* directory);
+void tl_template_cache_reload(const char* path, bool removed);
+
+// Template hot reload (template_watcher.c)
+int tl_template_watcher_start(const char* directory);
+void tl_template_watcher_stop(void);
+
+// Embedded assets (embedded_assets.c)
+torchlight_template_t* tl_embedded_template(const char* key);
+uint64_t tl_embedded_hash(const char* key);
+uint32_t tl_embedded_bucket(uint64_t hash, uint32_t bucket_count);
+uint32_t tl_embedded_slot(uint64_t hash, uint32_t displacement, uint32_t slot_count);
+
+// Context escaping (utils.c); a sequence is at most 8 bytes
+size_t tl_escape_scan(torchlight_escape_t context, const char* data, size_t length);
+size_t tl_escape_sequence(torchlight_escape_t context, const char* data, size_t length,
+                          char* out, size_t* consumed);
+bool tl_escape_url_safe(const char* data, size_t length);
+
+// Value of "name=" at the start of a pair in a separated list (utils.c)
+const char* tl_find_pair_value(const char* list, const char* name,
+                               const char* separators, size_t* length_out);
+
+#pragma GCC visibility pop
@@ -6,11 +6,19 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
+#include <limits.h>
 #include <sys/stat.h>
 #include <ctype.h>
 #include <time.h>
 #include <pthread.h>
+#include <sys/random.h>
+#include <openssl/rand.h>
+#include <openssl/hmac.h>
+#include <openssl/evp.h>
+#include <openssl/crypto.h>
 #include "torchlight.h"
+#include "torchlight_internal.h"
 
 // String utility functions
 
@@ -140,48 +148,659 @@ int torchlight_url_encode(const char* input, char* output, size_t output_size) {
     return 0;
 }
 
-// HTML escaping
+// Base64url encoding/decoding (RFC 4648 section 5, no padding)
+
+static const char BASE64URL_ALPHABET[] =
+    "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789-_";
+
+int torchlight_base64url_encode(const unsigned char* input, size_t input_length,
+                                char* output, size_t output_size) {
+    if (!input || !output) return -1;
+
+    size_t needed = (input_length / 3) * 4 + ((input_length % 3) ? (input_length % 3) + 1 : 0);
+    if (needed + 1 > output_size) return -1;
 
-int torchlight_html_escape(const char* input, char* output, size_t output_size) {
-    if (!input || !output || output_size == 0) return -1;
-    
-    const char* src = input;
     char* dst = output;
-    size_t dst_remaining = output_size - 1;
-    
-    while (*src && dst_remaining > 6) {  // Longest escape is &quot; (6 chars)
-        const char* escape = NULL;
-        
-        switch (*src) {
-            case '<': escape = "&lt;"; break;
-            case '>': escape = "&gt;"; break;
-            case '&': escape = "&amp;"; break;
-            case '"': escape = "&quot;"; break;
-            case '\'': escape = "&#39;"; break;
-            default:
-                *dst++ = *src;
-                dst_remaining--;
-                break;
+    size_t i = 0;
+
+    for (; i + 3 <= input_length; i += 3) {
+        uint32_t v = ((uint32_t)input[i] << 16) | ((uint32_t)input[i + 1] << 8) | input[i + 2];
+        *dst++ = BASE64URL_ALPHABET[(v >> 18) & 0x3F];
+        *dst++ = BASE64URL_ALPHABET[(v >> 12) & 0x3F];
+        *dst++ = BASE64URL_ALPHABET[(v >> 6) & 0x3F];
+        *dst++ = BASE64URL_ALPHABET[v & 0x3F];
+    }
+
+    if (input_length - i == 1) {
+        uint32_t v = (uint32_t)input[i] << 16;
+        *dst++ = BASE64URL_ALPHABET[(v >> 18) & 0x3F];
+        *dst++ = BASE64URL_ALPHABET[(v >> 12) & 0x3F];
+    } else if (input_length - i == 2) {
+        uint32_t v = ((uint32_t)input[i] << 16) | ((uint32_t)input[i + 1] << 8);
+        *dst++ = BASE64URL_ALPHABET[(v >> 18) & 0x3F];
+        *dst++ = BASE64URL_ALPHABET[(v >> 12) & 0x3F];
+        *dst++ = BASE64URL_ALPHABET[(v >> 6) & 0x3F];
+    }
+
+    *dst = '\0';
+    return (int)(dst - output);
+}
+
+static int base64url_value(unsigned char c) {
+    if (c >= 'A' && c <= 'Z') return c - 'A';
+    if (c >= 'a' && c <= 'z') return c - 'a' + 26;
+    if (c >= '0' && c <= '9') return c - '0' + 52;
+    if (c == '-') return 62;
+    if (c == '_') return 63;
+    return -1;
+}
+
+int torchlight_base64url_decode(const char* input, size_t input_length,
+                                unsigned char* output, size_t output_size) {
+    if (!input || !output) return -1;
+    if (input_length % 4 == 1) return -1;  // Not a valid encoding length
+
+    size_t needed = (input_length / 4) * 3 + ((input_length % 4) ? (input_length % 4) - 1 : 0);
+    if (needed > output_size) return -1;
+
+    unsigned char* dst = output;
+    uint32_t acc = 0;
+    int bits = 0;
+
+    for (size_t i = 0; i < input_length; i++) {
+        int v = base64url_value((unsigned char)input[i]);
+        if (v < 0) return -1;
+
+        acc = (acc << 6) | (uint32_t)v;
+        bits += 6;
+        if (bits >= 8) {
+            bits -= 8;
+            *dst++ = (unsigned char)(acc >> bits);
         }
-        
-        if (escape) {
-            size_t escape_len = strlen(escape);
-            if (escape_len <= dst_remaining) {
-                strcpy(dst, escape);
-                dst += escape_len;
-                dst_remaining -= escape_len;
-            } else {
-                break;  // Not enough space
+    }
+
+    return (int)(dst - output);
+}
+
+// Escaping
+//
+// Each output context has a set of bytes that must be rewritten. The scan
+// looks for the next such byte 16 bytes at a time with SSE2 (32 with AVX2
+// for the HTML sets, picked at runtime), so clean text is found at close
+// to memory bandwidth and copied in one piece. Only the bytes that need it
+// go through the per-byte path.
+
+#if defined(__x86_64__) || (defined(__i386__) && defined(__SSE2__))
+#define TORCHLIGHT_ESCAPE_SIMD 1
+#include <immintrin.h>
+#endif
+
+#define ESCAPE_SEQUENCE_MAX 8
+
+static const char ESCAPE_HEX[] = "0123456789ABCDEF";
+
+static bool escape_byte_needed(torchlight_escape_t context, unsigned char c) {
+    switch (context) {
+        case TORCHLIGHT_ESCAPE_HTML:
+            return c == '&' || c == '<' || c == '>' || c == '"' || c == '\'';
+        case TORCHLIGHT_ESCAPE_ATTRIBUTE:
+        case TORCHLIGHT_ESCAPE_URL_ATTRIBUTE:
+            return c == '&' || c == '<' || c == '>' || c == '"' || c == '\'' || c == '`' || c == '=';
+        case TORCHLIGHT_ESCAPE_URL:
+            return !((c >= '0' && c <= '9') || (c >= 'A' && c <= 'Z') || (c >= 'a' && c <= 'z') ||
+                     c == '-' || c == '.' || c == '_' || c == '~');
+        case TORCHLIGHT_ESCAPE_JS:
+            // 0xE2 starts U+2028/U+2029, which end a line in JavaScript. '`'
+            // and '=' matter in template literals and unquoted attributes.
+            return c < 0x20 || c == '\\' || c == '\'' || c == '"' || c == '<' || c == '>' ||
+                   c == '&' || c == '/' || c == '`' || c == '=' || c == 0xE2;
+        default:
+            return false;
+    }
+}
+
+// Per-context byte classes for short values and block tails
+static unsigned char g_escape_table[TORCHLIGHT_ESCAPE_JS + 1][256];
+
+__attribute__((constructor))
+static void escape_build_tables(void) {
+    for (int context = 0; context <= TORCHLIGHT_ESCAPE_JS; context++) {
+        for (int c = 0; c < 256; c++) {
+            g_escape_table[context][c] = escape_byte_needed((torchlight_escape_t)context, (unsigned char)c);
+        }
+    }
+}
+
+#ifdef TORCHLIGHT_ESCAPE_SIMD
+
+#define ESCAPE_EQ(v, c) _mm_cmpeq_epi8((v), _mm_set1_epi8((char)(c)))
+
+static inline __m128i escape_mask_html(__m128i v) {
+    return _mm_or_si128(_mm_or_si128(ESCAPE_EQ(v, '&'), ESCAPE_EQ(v, '<')),
+                        _mm_or_si128(_mm_or_si128(ESCAPE_EQ(v, '>'), ESCAPE_EQ(v, '"')),
+                                     ESCAPE_EQ(v, '\'')));
+}
+
+static inline __m128i escape_mask_attribute(__m128i v) {
+    return _mm_or_si128(escape_mask_html(v), _mm_or_si128(ESCAPE_EQ(v, '`'), ESCAPE_EQ(v, '=')));
+}
+
+// Unsigned lo <= v <= hi per byte
+static inline __m128i escape_in_range(__m128i v, char lo, char hi) {
+    __m128i offset = _mm_sub_epi8(v, _mm_set1_epi8(lo));
+    return _mm_cmpeq_epi8(_mm_min_epu8(offset, _mm_set1_epi8((char)(hi - lo))), offset);
+}
+
+static inline __m128i escape_mask_url(__m128i v) {
+    __m128i ok = _mm_or_si128(escape_in_range(v, '0', '9'),
+                              escape_in_range(_mm_or_si128(v, _mm_set1_epi8(0x20)), 'a', 'z'));
+    ok = _mm_or_si128(ok, _mm_or_si128(_mm_or_si128(ESCAPE_EQ(v, '-'), ESCAPE_EQ(v, '.')),
+                                       _mm_or_si128(ESCAPE_EQ(v, '_'), ESCAPE_EQ(v, '~'))));
+    return _mm_xor_si128(ok, _mm_set1_epi8((char)0xFF));
+}
+
+static inline __m128i escape_mask_js(__m128i v) {
+    __m128i control = _mm_cmpeq_epi8(_mm_max_epu8(v, _mm_set1_epi8(0x1F)), _mm_set1_epi8(0x1F));
+    __m128i quote = _mm_or_si128(_mm_or_si128(ESCAPE_EQ(v, '\\'), ESCAPE_EQ(v, '\'')),
+                                 _mm_or_si128(ESCAPE_EQ(v, '"'), ESCAPE_EQ(v, '/')));
+    __m128i markup = _mm_or_si128(_mm_or_si128(ESCAPE_EQ(v, '<'), ESCAPE_EQ(v, '>')),
+                                  _mm_or_si128(ESCAPE_EQ(v, '&'), ESCAPE_EQ(v, 0xE2)));
+    __m128i syntax = _mm_or_si128(ESCAPE_EQ(v, '`'), ESCAPE_EQ(v, '='));
+    return _mm_or_si128(_mm_or_si128(control, syntax), _mm_or_si128(quote, markup));
+}
+
+#define ESCAPE_SCAN_SSE2(mask_fn)                                              \
+    for (; i + 16 <= length; i += 16) {                                        \
+        __m128i v = _mm_loadu_si128((const __m128i*)(data + i));              \
+        int mask = _mm_movemask_epi8(mask_fn(v));                              \
+        if (mask) return i + (size_t)__builtin_ctz((unsigned)mask);            \
+    }
+
+// HTML and attribute sets, 32 bytes at a time. Returns where the SSE2
+// loop should continue (the first block that may need escaping).
+__attribute__((target("avx2")))
+static size_t escape_scan_avx2(const char* data, size_t length, bool attribute) {
+    size_t i = 0;
+
+    for (; i + 32 <= length; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i*)(data + i));
+        __m256i m = _mm256_or_si256(
+            _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('&')),
+                            _mm256_cmpeq_epi8(v, _mm256_set1_epi8('<'))),
+            _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('>')),
+                                            _mm256_cmpeq_epi8(v, _mm256_set1_epi8('"'))),
+                            _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\''))));
+        if (attribute) {
+            m = _mm256_or_si256(m, _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('`')),
+                                                   _mm256_cmpeq_epi8(v, _mm256_set1_epi8('='))));
+        }
+        if (_mm256_movemask_epi8(m)) break;
+    }
+
+    return i;
+}
+
+static bool escape_has_avx2(void) {
+    static int supported = -1;
+
+    int value = __atomic_load_n(&supported, __ATOMIC_RELAXED);
+    if (value < 0) {
+        __builtin_cpu_init();
+        value = __builtin_cpu_supports("avx2") ? 1 : 0;
+        __atomic_store_n(&supported, value, __ATOMIC_RELAXED);
+    }
+    return value == 1;
+}
+
+#endif
+
+// Index of the first byte that needs escaping, or length if none does
+size_t tl_escape_scan(torchlight_escape_t context, const char* data, size_t length) {
+    size_t i = 0;
+    if (context > TORCHLIGHT_ESCAPE_JS) return length;
+
+#ifdef TORCHLIGHT_ESCAPE_SIMD
+    if (length < 16) goto tail;
+
+    switch (context) {
+        case TORCHLIGHT_ESCAPE_HTML:
+            if (length >= 64 && escape_has_avx2()) i = escape_scan_avx2(data, length, false);
+            ESCAPE_SCAN_SSE2(escape_mask_html)
+            break;
+        case TORCHLIGHT_ESCAPE_ATTRIBUTE:
+        case TORCHLIGHT_ESCAPE_URL_ATTRIBUTE:
+            if (length >= 64 && escape_has_avx2()) i = escape_scan_avx2(data, length, true);
+            ESCAPE_SCAN_SSE2(escape_mask_attribute)
+            break;
+        case TORCHLIGHT_ESCAPE_URL:
+            ESCAPE_SCAN_SSE2(escape_mask_url)
+            break;
+        case TORCHLIGHT_ESCAPE_JS:
+            ESCAPE_SCAN_SSE2(escape_mask_js)
+            break;
+        default:
+            return length;
+    }
+
+tail:
+#endif
+    {
+        const unsigned char* table = g_escape_table[context];
+        for (; i < length; i++) {
+            if (table[(unsigned char)data[i]]) return i;
+        }
+    }
+    return length;
+}
+
+// Replacement for the byte(s) at data (which need escaping). Writes at
+// most ESCAPE_SEQUENCE_MAX bytes and returns their count.
+size_t tl_escape_sequence(torchlight_escape_t context, const char* data, size_t length,
+                          char* out, size_t* consumed) {
+    unsigned char c = (unsigned char)data[0];
+    *consumed = 1;
+
+    if (context == TORCHLIGHT_ESCAPE_URL) {
+        out[0] = '%';
+        out[1] = ESCAPE_HEX[c >> 4];
+        out[2] = ESCAPE_HEX[c & 0x0F];
+        return 3;
+    }
+
+    if (context == TORCHLIGHT_ESCAPE_JS) {
+        if (c == 0xE2) {
+            if (length >= 3 && (unsigned char)data[1] == 0x80 &&
+                ((unsigned char)data[2] == 0xA8 || (unsigned char)data[2] == 0xA9)) {
+                memcpy(out, (unsigned char)data[2] == 0xA8 ? "\\u2028" : "\\u2029", 6);
+                *consumed = 3;
+                return 6;
             }
+            out[0] = (char)c;
+            return 1;
         }
-        
-        src++;
+        memcpy(out, "\\u00", 4);
+        out[4] = ESCAPE_HEX[c >> 4];
+        out[5] = ESCAPE_HEX[c & 0x0F];
+        return 6;
     }
-    
-    *dst = '\0';
+
+    const char* entity;
+    switch (c) {
+        case '&': entity = "&amp;"; break;
+        case '<': entity = "&lt;"; break;
+        case '>': entity = "&gt;"; break;
+        case '"': entity = "&quot;"; break;
+        case '\'': entity = "&#39;"; break;
+        case '`': entity = "&#96;"; break;
+        case '=': entity = "&#61;"; break;
+        default:
+            out[0] = (char)c;
+            return 1;
+    }
+
+    size_t entity_length = strlen(entity);
+    memcpy(out, entity, entity_length);
+    return entity_length;
+}
+
+// A URL is safe to place in href/src if it is relative or uses a scheme
+// we allow; anything else (javascript:, data:, ...) is rejected
+bool tl_escape_url_safe(const char* data, size_t length) {
+    static const char* const allowed[] = { "http", "https", "mailto" };
+
+    for (size_t i = 0; i < length; i++) {
+        char c = data[i];
+        if (c == '/' || c == '?' || c == '#') return true;
+        if (c != ':') continue;
+
+        for (size_t j = 0; j < sizeof(allowed) / sizeof(allowed[0]); j++) {
+            if (strlen(allowed[j]) == i && strncasecmp(data, allowed[j], i) == 0) return true;
+        }
+        return false;
+    }
+    return true;
+}
+
+size_t torchlight_escape(torchlight_escape_t context, const char* input, size_t length,
+                         char* output, size_t output_size) {
+    if (!input) length = 0;
+
+    if (context == TORCHLIGHT_ESCAPE_JS_VALUE || context == TORCHLIGHT_ESCAPE_JS_VALUE_ATTRIBUTE) {
+        const char* quote = context == TORCHLIGHT_ESCAPE_JS_VALUE ? "\"" : "&#34;";
+        size_t quote_length = strlen(quote);
+        size_t limit = output && output_size > 0 ? output_size - 1 : 0;
+
+        if (output && output_size > 0) output[0] = '\0';
+        if (quote_length > limit) {
+            return 2 * quote_length + torchlight_escape(TORCHLIGHT_ESCAPE_JS, input, length, NULL, 0);
+        }
+
+        memcpy(output, quote, quote_length);
+        size_t inner = torchlight_escape(TORCHLIGHT_ESCAPE_JS, input, length,
+                                         output + quote_length, output_size - quote_length);
+        size_t written = quote_length + inner;
+        if (written + quote_length <= limit) {
+            memcpy(output + written, quote, quote_length);
+            output[written + quote_length] = '\0';
+        }
+        return written + quote_length;
+    }
+
+    if (context == TORCHLIGHT_ESCAPE_URL_ATTRIBUTE) {
+        if (!tl_escape_url_safe(input, length)) {
+            input = "#";
+            length = 1;
+        }
+        context = TORCHLIGHT_ESCAPE_ATTRIBUTE;
+    }
+
+    size_t limit = output && output_size > 0 ? output_size - 1 : 0;
+    size_t needed = 0;
+    size_t written = 0;
+    size_t pos = 0;
+
+    // Output stops at the first piece that does not fit, so an escape
+    // sequence is never cut in half
+    while (pos < length) {
+        size_t clean = context == TORCHLIGHT_ESCAPE_NONE
+                     ? length - pos
+                     : tl_escape_scan(context, input + pos, length - pos);
+
+        if (written == needed && output) {
+            size_t room = limit - written;
+            size_t copy = clean < room ? clean : room;
+            memcpy(output + written, input + pos, copy);
+            written += copy;
+        }
+        needed += clean;
+        pos += clean;
+        if (pos == length) break;
+
+        char sequence[ESCAPE_SEQUENCE_MAX];
+        size_t consumed;
+        size_t sequence_length = tl_escape_sequence(context, input + pos, length - pos, sequence, &consumed);
+
+        if (written == needed && output && sequence_length <= limit - written) {
+            memcpy(output + written, sequence, sequence_length);
+            written += sequence_length;
+        }
+        needed += sequence_length;
+        pos += consumed;
+    }
+
+    if (output && output_size > 0) output[written] = '\0';
+    return needed;
+}
+
+int torchlight_html_escape(const char* input, char* output, size_t output_size) {
+    if (!input) return -1;
+
+    size_t needed = torchlight_escape(TORCHLIGHT_ESCAPE_HTML, input, strlen(input), output, output_size);
+    return needed > INT_MAX ? -1 : (int)needed;
+}
+
+// Random number utilities
+//
+// Each thread draws from its own pool, refilled from getrandom() (falling
+// back to the OpenSSL DRBG) 4 KB at a time. Minting a session ID or token
+// is then a copy out of the pool, with no syscall or lock. A fork
+// generation counter bumped by pthread_atfork() makes a child discard
+// the pool it inherited, so parent and child never share random bytes.
+
+#define RANDOM_POOL_SIZE 4096
+
+typedef struct {
+    unsigned char bytes[RANDOM_POOL_SIZE];
+    size_t available;           // Unused bytes at the end of the pool
+    unsigned int generation;
+} random_pool_t;
+
+static __thread random_pool_t g_random_pool;
+static unsigned int g_fork_generation = 1;
+static pthread_once_t g_random_once = PTHREAD_ONCE_INIT;
+
+static void random_after_fork(void) {
+    __atomic_add_fetch(&g_fork_generation, 1, __ATOMIC_RELAXED);
+}
+
+static void random_register_fork_handler(void) {
+    pthread_atfork(NULL, NULL, random_after_fork);
+}
+
+static int random_fill(unsigned char* buffer, size_t length) {
+    size_t filled = 0;
+
+    while (filled < length) {
+        ssize_t got = getrandom(buffer + filled, length - filled, 0);
+        if (got <= 0) {
+            // No getrandom() (old kernel, seccomp): use the OpenSSL DRBG
+            return RAND_bytes(buffer + filled, (int)(length - filled)) == 1 ? 0 : -1;
+        }
+        filled += (size_t)got;
+    }
+
+    return 0;
+}
+
+int torchlight_random_bytes(void* output, size_t length) {
+    if (!output) return -1;
+
+    random_pool_t* pool = &g_random_pool;
+    unsigned char* dst = output;
+
+    pthread_once(&g_random_once, random_register_fork_handler);
+
+    unsigned int generation = __atomic_load_n(&g_fork_generation, __ATOMIC_RELAXED);
+    if (pool->generation != generation) {
+        pool->available = 0;
+        pool->generation = generation;
+    }
+
+    // Large requests bypass the pool
+    if (length >= RANDOM_POOL_SIZE) {
+        return random_fill(dst, length);
+    }
+
+    while (length > 0) {
+        if (pool->available == 0) {
+            if (random_fill(pool->bytes, RANDOM_POOL_SIZE) != 0) return -1;
+            pool->available = RANDOM_POOL_SIZE;
+        }
+
+        size_t take = length < pool->available ? length : pool->available;
+        unsigned char* src = pool->bytes + pool->available - take;
+
+        memcpy(dst, src, take);
+        memset(src, 0, take);  // Never hand out the same bytes twice
+
+        pool->available -= take;
+        dst += take;
+        length -= take;
+    }
+
     return 0;
 }
 
+int torchlight_random_base62(char* output, size_t length) {
+    static const char BASE62_ALPHABET[] =
+        "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789";
+
+    if (!output) return -1;
+
+    unsigned char bytes[64];
+    size_t written = 0;
+
+    while (written < length) {
+        size_t batch = length - written;
+        if (batch > sizeof(bytes)) batch = sizeof(bytes);
+
+        if (torchlight_random_bytes(bytes, batch) != 0) return -1;
+
+        // Keep 6 bits per byte and reject 62 and 63, so every symbol is
+        // equally likely (about 3% of bytes are rejected)
+        for (size_t i = 0; i < batch && written < length; i++) {
+            unsigned char v = bytes[i] & 0x3F;
+            if (v < 62) {
+                output[written++] = BASE62_ALPHABET[v];
+            }
+        }
+    }
+
+    output[length] = '\0';
+    return 0;
+}
+
+// Output buffer pool
+//
+// Response bodies and rendered pages are short-lived and, per route or
+// template, come in much the same size each time. Buffers are rounded up
+// to a power of two from 256 B to 64 KB; a released one goes on its size
+// class's free list for the thread (at most BUFFER_POOL_DEPTH deep), and
+// the next buffer of that class is popped off it without calling malloc.
+// Larger buffers are allocated exactly and freed right away. A thread's
+// lists are freed when it exits.
+
+#define BUFFER_CLASS_MIN_SHIFT 8        // 256 B
+#define BUFFER_CLASS_MAX_SHIFT 16       // 64 KB
+#define BUFFER_CLASS_COUNT (BUFFER_CLASS_MAX_SHIFT - BUFFER_CLASS_MIN_SHIFT + 1)
+#define BUFFER_POOL_DEPTH 4
+
+typedef struct buffer_free {
+    struct buffer_free* next;
+} buffer_free_t;
+
+typedef struct {
+    buffer_free_t* lists[BUFFER_CLASS_COUNT];
+    int depth[BUFFER_CLASS_COUNT];
+    bool registered;            // Exit destructor installed for this thread
+} buffer_pool_t;
+
+static __thread buffer_pool_t g_buffer_pool;
+static pthread_key_t g_buffer_pool_key;
+static pthread_once_t g_buffer_pool_once = PTHREAD_ONCE_INIT;
+
+static void buffer_pool_drain(void* arg) {
+    buffer_pool_t* pool = arg;
+
+    for (int i = 0; i < BUFFER_CLASS_COUNT; i++) {
+        while (pool->lists[i]) {
+            buffer_free_t* next = pool->lists[i]->next;
+            free(pool->lists[i]);
+            pool->lists[i] = next;
+        }
+        pool->depth[i] = 0;
+    }
+}
+
+static void buffer_pool_create_key(void) {
+    pthread_key_create(&g_buffer_pool_key, buffer_pool_drain);
+}
+
+// Capacity to allocate for `size` bytes
+static size_t buffer_round(size_t size) {
+    if (size <= ((size_t)1 << BUFFER_CLASS_MIN_SHIFT)) return (size_t)1 << BUFFER_CLASS_MIN_SHIFT;
+    if (size > ((size_t)1 << BUFFER_CLASS_MAX_SHIFT)) return size;
+    return (size_t)1 << (64 - __builtin_clzll((unsigned long long)size - 1));
+}
+
+// Size class of a capacity, or -1 if it is not one
+static int buffer_class(size_t capacity) {
+    if (capacity < ((size_t)1 << BUFFER_CLASS_MIN_SHIFT) ||
+        capacity > ((size_t)1 << BUFFER_CLASS_MAX_SHIFT) ||
+        (capacity & (capacity - 1)) != 0) {
+        return -1;
+    }
+    return __builtin_ctzll((unsigned long long)capacity) - BUFFER_CLASS_MIN_SHIFT;
+}
+
+char* torchlight_buffer_alloc(size_t size, size_t* capacity) {
+    if (!capacity) return NULL;
+
+    size_t rounded = buffer_round(size);
+    int size_class = buffer_class(rounded);
+    buffer_pool_t* pool = &g_buffer_pool;
+
+    char* buffer;
+    if (size_class >= 0 && pool->lists[size_class]) {
+        buffer_free_t* entry = pool->lists[size_class];
+        pool->lists[size_class] = entry->next;
+        pool->depth[size_class]--;
+        buffer = (char*)entry;
+    } else {
+        buffer = malloc(rounded);
+        if (!buffer) return NULL;
+    }
+
+    *capacity = rounded;
+    return buffer;
+}
+
+// On failure the buffer is left as it was and NULL is returned
+char* torchlight_buffer_grow(char* buffer, size_t* capacity, size_t size) {
+    if (!capacity) return NULL;
+    if (!buffer) return torchlight_buffer_alloc(size, capacity);
+    if (size <= *capacity) return buffer;
+
+    size_t rounded = buffer_round(size > *capacity * 2 ? size : *capacity * 2);
+    char* grown = realloc(buffer, rounded);
+    if (!grown) return NULL;
+
+    *capacity = rounded;
+    return grown;
+}
+
+void torchlight_buffer_free(char* buffer, size_t capacity) {
+    if (!buffer) return;
+
+    int size_class = buffer_class(capacity);
+    buffer_pool_t* pool = &g_buffer_pool;
+
+    if (size_class < 0 || pool->depth[size_class] >= BUFFER_POOL_DEPTH) {
+        free(buffer);
+        return;
+    }
+
+    if (!pool->registered) {
+        pthread_once(&g_buffer_pool_once, buffer_pool_create_key);
+        pthread_setspecific(g_buffer_pool_key, pool);
+        pool->registered = true;
+    }
+
+    buffer_free_t* entry = (buffer_free_t*)buffer;
+    entry->next = pool->lists[size_class];
+    pool->lists[size_class] = entry;
+    pool->depth[size_class]++;
+}
+
+// Gains of 1/8 for the mean and 1/4 for the deviation; reserving the mean
+// plus twice the deviation covers nearly every sample of a steady source
+void torchlight_size_estimate_record(torchlight_size_estimate_t* estimate, size_t size) {
+    if (!estimate) return;
+
+    size_t mean = __atomic_load_n(&estimate->mean, __ATOMIC_RELAXED);
+    size_t deviation = __atomic_load_n(&estimate->deviation, __ATOMIC_RELAXED);
+
+    if (mean == 0) {
+        mean = size;
+        deviation = size / 8;       // Power-of-two classes add headroom of their own
+    } else {
+        size_t error = size > mean ? size - mean : mean - size;
+        mean = mean - mean / 8 + size / 8;
+        deviation = deviation - deviation / 4 + error / 4;
+    }
+
+    __atomic_store_n(&estimate->mean, mean, __ATOMIC_RELAXED);
+    __atomic_store_n(&estimate->deviation, deviation, __ATOMIC_RELAXED);
+}
+
+size_t torchlight_size_estimate_reserve(const torchlight_size_estimate_t* estimate) {
+    if (!estimate) return 0;
+
+    size_t mean = __atomic_load_n(&estimate->mean, __ATOMIC_RELAXED);
+    if (mean == 0) return 0;
+    return mean + 2 * __atomic_load_n(&estimate->deviation, __ATOMIC_RELAXED);
+}
+
 // File utility functions
 
 bool torchlight_file_exists(const char* path) {
@@ -230,88 +849,214 @@ int torchlight_read_file(const char* path, char** content, size_t* size) {
     return 0;
 }
 
-// Session management utilities
+// Security functions
+//
+// CSRF tokens need no server-side storage. A request with a session gets
+// a token of base64url(issued_at[8] || HMAC-SHA256(key, session_id ||
+// issued_at)[16]), which is checked by recomputing the MAC. A request
+// without a session uses double-submit: a random token is kept in the
+// csrf_token cookie and the submitted copy has to match it. Every
+// comparison is constant time.
 
-static session_t g_sessions[TORCHLIGHT_MAX_SESSIONS] = {0};
-static int g_session_count = 0;
-static pthread_mutex_t g_session_mutex = PTHREAD_MUTEX_INITIALIZER;
+#define CSRF_COOKIE_NAME "csrf_token"
+#define CSRF_FIELD_NAME "csrf_token"
+#define CSRF_HEADER_NAME "X-CSRF-Token"
+#define CSRF_TOKEN_LIFETIME (12 * 3600)     // 12 hours
+#define CSRF_CLOCK_SKEW 60
+#define CSRF_MAC_SIZE 16
+#define CSRF_SIGNED_RAW (8 + CSRF_MAC_SIZE)
 
-// Generate random session ID
-static void generate_session_id(char* session_id_out) {
-    const char* chars = "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789";
-    
-    for (int i = 0; i < 63; i++) {
-        session_id_out[i] = chars[rand() % 62];
-    }
-    session_id_out[63] = '\0';
+static unsigned char g_csrf_key[32];
+static bool g_csrf_key_set = false;
+static pthread_rwlock_t g_csrf_key_lock = PTHREAD_RWLOCK_INITIALIZER;
+
+int torchlight_set_csrf_secret(const unsigned char* secret, size_t secret_len) {
+    if (!secret || secret_len < 16) return -1;
+
+    static const char label[] = "torchlight csrf";
+    unsigned int key_len = sizeof(g_csrf_key);
+
+    pthread_rwlock_wrlock(&g_csrf_key_lock);
+    HMAC(EVP_sha256(), secret, (int)secret_len,
+         (const unsigned char*)label, sizeof(label) - 1, g_csrf_key, &key_len);
+    g_csrf_key_set = true;
+    pthread_rwlock_unlock(&g_csrf_key_lock);
+
+    return 0;
 }
 
-int torchlight_create_session(const char* user_id, char* session_id_out) {
-    pthread_mutex_lock(&g_session_mutex);
-    
-    if (g_session_count >= TORCHLIGHT_MAX_SESSIONS) {
-        pthread_mutex_unlock(&g_session_mutex);
-        return -1;  // Too many sessions
+// Without a configured secret, tokens are signed with a per-process random
+// key (they stop validating after a restart)
+static int csrf_mac(const char* session_id, uint64_t issued_at, unsigned char mac_out[CSRF_MAC_SIZE]) {
+    unsigned char message[64 + 8];
+    size_t id_len = strnlen(session_id, 63);
+    unsigned char digest[32];
+    unsigned int digest_len = sizeof(digest);
+
+    memcpy(message, session_id, id_len);
+    for (int i = 0; i < 8; i++) {
+        message[id_len + i] = (unsigned char)(issued_at >> (56 - 8 * i));
     }
-    
-    session_t* session = &g_sessions[g_session_count];
-    
-    generate_session_id(session->session_id);
-    if (user_id) {
-        strncpy(session->user_id, user_id, sizeof(session->user_id) - 1);
+
+    pthread_rwlock_rdlock(&g_csrf_key_lock);
+    if (!g_csrf_key_set) {
+        pthread_rwlock_unlock(&g_csrf_key_lock);
+        pthread_rwlock_wrlock(&g_csrf_key_lock);
+        if (!g_csrf_key_set) {
+            if (torchlight_random_bytes(g_csrf_key, sizeof(g_csrf_key)) != 0) {
+                pthread_rwlock_unlock(&g_csrf_key_lock);
+                return -1;
+            }
+            g_csrf_key_set = true;
+        }
     }
-    
-    session->created_time = time(NULL);
-    session->last_access_time = session->created_time;
-    session->authenticated = (user_id != NULL);
-    session->data[0] = '\0';
-    
-    strcpy(session_id_out, session->session_id);
-    g_session_count++;
-    
-    pthread_mutex_unlock(&g_session_mutex);
+    HMAC(EVP_sha256(), g_csrf_key, sizeof(g_csrf_key),
+         message, id_len + 8, digest, &digest_len);
+    pthread_rwlock_unlock(&g_csrf_key_lock);
+
+    memcpy(mac_out, digest, CSRF_MAC_SIZE);
     return 0;
 }
 
-session_t* torchlight_get_session(const char* session_id) {
-    if (!session_id) return NULL;
-    
-    pthread_mutex_lock(&g_session_mutex);
-    
-    for (int i = 0; i < g_session_count; i++) {
-        if (strcmp(g_sessions[i].session_id, session_id) == 0) {
-            g_sessions[i].last_access_time = time(NULL);
-            pthread_mutex_unlock(&g_session_mutex);
-            return &g_sessions[i];
+int torchlight_generate_csrf_token(char* token_out, size_t token_size) {
+    if (!token_out) return -1;
+
+    unsigned char bytes[32];
+    if (torchlight_random_bytes(bytes, sizeof(bytes)) != 0) return -1;
+
+    return torchlight_base64url_encode(bytes, sizeof(bytes), token_out, token_size) < 0 ? -1 : 0;
+}
+
+int torchlight_generate_session_csrf_token(const char* session_id, char* token_out, size_t token_size) {
+    if (!session_id || !token_out) return -1;
+
+    unsigned char raw[CSRF_SIGNED_RAW];
+    uint64_t issued_at = (uint64_t)time(NULL);
+
+    for (int i = 0; i < 8; i++) {
+        raw[i] = (unsigned char)(issued_at >> (56 - 8 * i));
+    }
+    if (csrf_mac(session_id, issued_at, raw + 8) != 0) return -1;
+
+    return torchlight_base64url_encode(raw, sizeof(raw), token_out, token_size) < 0 ? -1 : 0;
+}
+
+static bool csrf_equal(const char* a, size_t a_len, const char* b, size_t b_len) {
+    if (a_len == 0 || a_len != b_len) return false;
+    return CRYPTO_memcmp(a, b, a_len) == 0;
+}
+
+// Find "name=" at the start of a pair in a "; " or "&" separated list
+const char* tl_find_pair_value(const char* list, const char* name,
+                               const char* separators, size_t* length_out) {
+    size_t name_len = strlen(name);
+    const char* p = list;
+
+    while ((p = strstr(p, name)) != NULL) {
+        bool at_start = (p == list || strchr(separators, p[-1]) != NULL);
+        if (at_start && p[name_len] == '=') {
+            const char* value = p + name_len + 1;
+            *length_out = strcspn(value, separators);
+            return value;
         }
+        p += name_len;
     }
-    
-    pthread_mutex_unlock(&g_session_mutex);
+
     return NULL;
 }
 
-int torchlight_cleanup_sessions(void) {
-    time_t now = time(NULL);
-    int cleaned = 0;
-    
-    pthread_mutex_lock(&g_session_mutex);
-    
-    for (int i = g_session_count - 1; i >= 0; i--) {
-        if (now - g_sessions[i].last_access_time > TORCHLIGHT_SESSION_TIMEOUT) {
-            // Remove expired session
-            for (int j = i; j < g_session_count - 1; j++) {
-                g_sessions[j] = g_sessions[j + 1];
-            }
-            g_session_count--;
-            cleaned++;
-        }
+// Submitted token: request header first, then a urlencoded form field
+static const char* csrf_submitted_token(const http_request_t* request, size_t* length_out) {
+    const char* header = torchlight_get_header(request, CSRF_HEADER_NAME);
+    if (header) {
+        *length_out = strlen(header);
+        return header;
     }
-    
-    pthread_mutex_unlock(&g_session_mutex);
-    return cleaned;
+
+    const char* content_type = torchlight_get_header(request, "Content-Type");
+    if (request->body && content_type &&
+        strncasecmp(content_type, "application/x-www-form-urlencoded", 33) == 0) {
+        return tl_find_pair_value(request->body, CSRF_FIELD_NAME, "&", length_out);
+    }
+
+    return NULL;
 }
 
-// Security functions
+static bool csrf_check_signed(const char* session_id, const char* token, size_t token_len) {
+    unsigned char raw[CSRF_SIGNED_RAW];
+    unsigned char expected_mac[CSRF_MAC_SIZE];
+
+    if (torchlight_base64url_decode(token, token_len, raw, sizeof(raw)) != CSRF_SIGNED_RAW) {
+        return false;
+    }
+
+    uint64_t issued_at = 0;
+    for (int i = 0; i < 8; i++) {
+        issued_at = (issued_at << 8) | raw[i];
+    }
+
+    uint64_t now = (uint64_t)time(NULL);
+    if (issued_at > now + CSRF_CLOCK_SKEW || now - issued_at > CSRF_TOKEN_LIFETIME) {
+        return false;
+    }
+
+    if (csrf_mac(session_id, issued_at, expected_mac) != 0) return false;
+    return CRYPTO_memcmp(raw + 8, expected_mac, CSRF_MAC_SIZE) == 0;
+}
+
+bool torchlight_validate_csrf_token(const http_request_t* request, const char* expected_token) {
+    if (!request) return false;
+
+    size_t token_len = 0;
+    const char* token = csrf_submitted_token(request, &token_len);
+    if (!token) return false;
+
+    if (expected_token) {
+        return csrf_equal(token, token_len, expected_token, strlen(expected_token));
+    }
+
+    if (request->has_session) {
+        return csrf_check_signed(request->session_id, token, token_len);
+    }
+
+    // Double-submit: the cookie and the submitted copy must match
+    const char* cookie_header = torchlight_get_header(request, "Cookie");
+    if (!cookie_header) return false;
+
+    size_t cookie_len = 0;
+    const char* cookie = tl_find_pair_value(cookie_header, CSRF_COOKIE_NAME, "; ", &cookie_len);
+    return cookie && csrf_equal(token, token_len, cookie, cookie_len);
+}
+
+int torchlight_csrf_token(const http_request_t* request, http_response_t* response,
+                          char* token_out, size_t token_size) {
+    if (!request || !token_out) return -1;
+
+    if (request->has_session) {
+        return torchlight_generate_session_csrf_token(request->session_id, token_out, token_size);
+    }
+
+    // Reuse the double-submit cookie if the client already has one
+    const char* cookie_header = torchlight_get_header(request, "Cookie");
+    size_t cookie_len = 0;
+    const char* cookie = cookie_header ?
+        tl_find_pair_value(cookie_header, CSRF_COOKIE_NAME, "; ", &cookie_len) : NULL;
+
+    if (cookie && cookie_len > 0) {
+        if (cookie_len >= token_size) return -1;
+        memcpy(token_out, cookie, cookie_len);
+        token_out[cookie_len] = '\0';
+        return 0;
+    }
+
+    if (!response) return -1;
+    if (torchlight_generate_csrf_token(token_out, token_size) != 0) return -1;
+
+    char header_value[128];
+    snprintf(header_value, sizeof(header_value),
+             CSRF_COOKIE_NAME "=%s; Path=/; SameSite=Strict", token_out);
+    return torchlight_add_header(response, "Set-Cookie", header_value);
+}
 
 int torchlight_add_security_headers(http_response_t* response) {
     if (!response) return -1;